@@ -0,0 +1,315 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file benchmark.h
+ * @brief Timing harness of the benchmark suite and synthetic particle
+ *        distributions.
+ *
+ * Every benchmark is run once untimed, then param::bench_repetitions times.
+ * The time of a repetition is the maximum over the ranks, the suite reports
+ * the min/mean/max over the repetitions and the mean imbalance max/mean over
+ * the ranks. The results are written in JSON, one benchmark per line, and
+ * compared by name with the results of a previous run.
+ */
+
+#ifndef _benchmark_h_
+#define _benchmark_h_
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <mpi.h>
+#include <omp.h>
+
+#include "body.h"
+#include "kernels.h"
+#include "params.h"
+#include "timers.h"
+
+namespace benchmark {
+
+/**
+ * @brief Keep the compiler from removing the computation of value
+ */
+inline void
+do_not_optimize(const double value) {
+  static volatile double sink;
+  sink = value;
+}
+
+/**
+ * @brief Time of F on this rank, the ranks start together
+ */
+template<typename F>
+double
+time(F && f) {
+  MPI_Barrier(MPI_COMM_WORLD);
+  const double start = omp_get_wtime();
+  f();
+  return omp_get_wtime() - start;
+}
+
+/**
+ * @brief Time accumulated in the region path of the timers registry
+ */
+inline double
+region_time(const std::string & path) {
+  for(auto & r : timers::registry().regions())
+    if(r.path == path)
+      return r.time;
+  return 0.;
+}
+
+struct result_t {
+  std::string name;
+  int64_t n; // number of items processed per repetition
+  double min, mean, max, imbalance;
+  double baseline = 0.; // min of the baseline, 0 if not in the baseline
+}; // struct result_t
+
+class suite_t
+{
+public:
+  suite_t() {
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank_);
+    MPI_Comm_size(MPI_COMM_WORLD, &size_);
+  }
+
+  bool enabled(const std::string & name) const {
+    return name.find(param::bench_filter) != std::string::npos;
+  }
+
+  /**
+   * @brief Run the benchmark name. F performs the untimed setup of a
+   * repetition and returns the time of the measured part on this rank,
+   * usually with benchmark::time. Collective.
+   */
+  template<typename F>
+  void run(const std::string & name, const int64_t n, F && f) {
+    if(!enabled(name))
+      return;
+    f();
+    const int reps = std::max(param::bench_repetitions, 1);
+    result_t res{name, n, 0., 0., 0., 0.};
+    for(int r = 0; r < reps; ++r) {
+      const double t = f();
+      double tmax, tsum;
+      MPI_Allreduce(&t, &tmax, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+      MPI_Allreduce(&t, &tsum, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+      res.min = r == 0 ? tmax : std::min(res.min, tmax);
+      res.max = std::max(res.max, tmax);
+      res.mean += tmax / reps;
+      res.imbalance += (tsum > 0. ? tmax * size_ / tsum : 1.) / reps;
+    } // for
+    results_.push_back(res);
+    if(rank_ == 0)
+      printf("%-40s %12.4e s %10.3e ns/item\n", name.c_str(), res.min,
+        res.min * 1e9 / std::max(n, (int64_t)1));
+  }
+
+  /**
+   * @brief Read the results of a previous run and report the benchmarks
+   * slower than their baseline by more than param::bench_tolerance.
+   * Returns the number of regressions.
+   */
+  int compare(const char * filename) {
+    std::map<std::string, double> baseline;
+    std::ifstream file(filename);
+    if(!file.is_open()) {
+      if(rank_ == 0)
+        fprintf(stderr, "Cannot open the baseline %s\n", filename);
+      return 0;
+    }
+    std::string line;
+    while(std::getline(file, line)) {
+      size_t name = line.find("\"name\": \"");
+      size_t min = line.find("\"min\": ");
+      if(name == std::string::npos || min == std::string::npos)
+        continue;
+      name += 9;
+      baseline[line.substr(name, line.find('"', name) - name)] =
+        atof(line.c_str() + min + 7);
+    } // while
+
+    int regressions = 0;
+    if(rank_ == 0)
+      printf("\n%-40s %12s %12s %8s\n", "benchmark", "baseline", "current",
+        "ratio");
+    for(auto & res : results_) {
+      auto it = baseline.find(res.name);
+      if(it == baseline.end() || it->second <= 0.)
+        continue;
+      res.baseline = it->second;
+      const double ratio = res.min / res.baseline;
+      const bool slower = ratio > 1. + param::bench_tolerance;
+      regressions += slower;
+      if(rank_ == 0)
+        printf("%-40s %12.4e %12.4e %8.3f%s\n", res.name.c_str(),
+          res.baseline, res.min, ratio, slower ? "  REGRESSION" : "");
+    } // for
+    return regressions;
+  }
+
+  /**
+   * @brief Write the results on rank 0
+   */
+  void write(const char * filename) const {
+    if(rank_ != 0)
+      return;
+    FILE * file = fopen(filename, "w");
+    if(file == nullptr) {
+      fprintf(stderr, "Cannot open %s\n", filename);
+      return;
+    }
+    fprintf(file, "{\n");
+    fprintf(file, "  \"ranks\": %d,\n", size_);
+    fprintf(file, "  \"threads\": %d,\n", omp_get_max_threads());
+    fprintf(file, "  \"dimension\": %d,\n", (int)gdimension);
+    fprintf(file, "  \"nparticles\": %ld,\n", (long)param::nparticles);
+    fprintf(file, "  \"repetitions\": %d,\n", param::bench_repetitions);
+    fprintf(file, "  \"benchmarks\": [\n");
+    for(size_t i = 0; i < results_.size(); ++i) {
+      const result_t & r = results_[i];
+      fprintf(file,
+        "    {\"name\": \"%s\", \"n\": %ld, \"min\": %.6e, \"mean\": %.6e, "
+        "\"max\": %.6e, \"imbalance\": %.4f",
+        r.name.c_str(), (long)r.n, r.min, r.mean, r.max, r.imbalance);
+      if(r.baseline > 0.)
+        fprintf(file, ", \"baseline\": %.6e, \"ratio\": %.4f", r.baseline,
+          r.min / r.baseline);
+      fprintf(file, "}%s\n", i + 1 < results_.size() ? "," : "");
+    } // for
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+  }
+
+private:
+  int rank_, size_;
+  std::vector<result_t> results_;
+}; // class suite_t
+
+enum distribution_t { uniform, clustered, plummer };
+const char * distribution_name[] = {"uniform", "clustered", "plummer"};
+
+/**
+ * @brief Generate the share of this rank of nparticles particles of unit total
+ * mass. The smoothing length follows the analytic density of the
+ * distribution, as in physics::compute_smoothinglength:
+ * - uniform: unit box;
+ * - clustered: 8 gaussian clumps of width 0.05 holding 80% of the mass, the
+ *   rest is uniform in the unit box;
+ * - plummer: Plummer sphere of scale radius 0.1 centered in the box,
+ *   generalized to gdimension, truncated at 10 scale radii.
+ */
+inline void
+generate(const distribution_t dist,
+  const int64_t nparticles,
+  std::vector<body> & bodies) {
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  const int64_t first = nparticles * rank / size;
+  const int64_t last = nparticles * (rank + 1) / size;
+  const double mass = 1. / nparticles;
+  const double D = gdimension;
+
+  // Same clumps on all the ranks
+  const int nclumps = 8;
+  const double sigma = 0.05, background = 0.2;
+  std::vector<point_t> clumps(nclumps);
+  std::mt19937_64 g_clumps(12345);
+  std::uniform_real_distribution<double> u(0., 1.);
+  for(auto & c : clumps)
+    for(size_t d = 0; d < gdimension; ++d)
+      c[d] = 0.2 + 0.6 * u(g_clumps);
+
+  const double a = 0.1;
+  const double surface[3] = {2., 2. * M_PI, 4. * M_PI};
+
+  std::mt19937_64 g(1000 * (dist + 1) + rank);
+  std::normal_distribution<double> normal(0., 1.);
+  bodies.resize(last - first);
+  for(int64_t i = 0; i < last - first; ++i) {
+    point_t x;
+    double rho = 1.;
+    if(dist == uniform) {
+      for(size_t d = 0; d < gdimension; ++d)
+        x[d] = u(g);
+    }
+    else if(dist == clustered) {
+      if(u(g) < background)
+        for(size_t d = 0; d < gdimension; ++d)
+          x[d] = u(g);
+      else {
+        const point_t & c = clumps[g() % nclumps];
+        for(size_t d = 0; d < gdimension; ++d)
+          x[d] = c[d] + sigma * normal(g);
+      } // if
+      rho = background;
+      for(auto & c : clumps)
+        rho += (1. - background) / nclumps *
+               exp(-0.5 * flecsi::distance(x, c) * flecsi::distance(x, c) /
+                   (sigma * sigma)) /
+               pow(2. * M_PI * sigma * sigma, D / 2.);
+    }
+    else {
+      // M(<r) = (r^2 / (a^2 + r^2))^(D/2)
+      double r;
+      do {
+        r = a / sqrt(pow(u(g), -2. / D) - 1.);
+      } while(!(r < 10. * a));
+      point_t dir;
+      double norm = 0.;
+      do {
+        for(size_t d = 0; d < gdimension; ++d)
+          dir[d] = normal(g);
+        norm = flecsi::magnitude(dir);
+      } while(norm == 0.);
+      for(size_t d = 0; d < gdimension; ++d)
+        x[d] = 0.5 + r * dir[d] / norm;
+      rho = D * a * a / (surface[gdimension - 1] * pow(a * a + r * r, D / 2. + 1.));
+    } // if
+
+    body & b = bodies[i];
+    point_t v = 0.;
+    b.set_coordinates(x);
+    b.set_mass(mass);
+    b.set_radius(
+      pow(mass / rho, 1. / D) * param::sph_eta * kernels::kernel_width);
+    b.set_id(first + i);
+    b.setType(NORMAL);
+    b.setVelocity(v);
+    b.setVelocityhalf(v);
+    b.setInternalenergy(1.);
+    b.setTotalenergy(1.);
+    b.setAlpha(1.);
+  } // for
+}
+
+} // namespace benchmark
+
+#endif // _benchmark_h_
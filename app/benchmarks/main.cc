@@ -0,0 +1,326 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file main.cc
+ * @brief Benchmark suite: SPH kernels, EOS, keys, tree construction, sorts,
+ *        traversals and output on synthetic particle distributions.
+ */
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "bodies_system.h"
+#include "default_physics.h"
+#include "params.h"
+
+#include "benchmark.h"
+
+void
+print_usage() {
+  log_one(warn) << "Benchmark suite in " << gdimension << "D" << std::endl
+                << "Usage: ./bench_" << gdimension
+                << "d [parameter-file.par]" << std::endl;
+}
+
+/**
+ * @brief Kernel and kernel gradient evaluations at h = 1 in the support of
+ * the kernel, r in [0, 1), analytic then tabulated
+ */
+template<param::sph_kernel_keyword K>
+void
+bench_kernel(benchmark::suite_t & suite, const char * name) {
+  const int64_t n = param::bench_kernel_samples;
+  std::vector<double> r(n);
+  std::vector<point_t> x(n);
+  std::mt19937_64 g(K);
+  std::uniform_real_distribution<double> u(-1., 1.);
+  for(int64_t i = 0; i < n; ++i) {
+    for(size_t d = 0; d < gdimension; ++d)
+      x[i][d] = u(g);
+    x[i] *= fabs(u(g)) / std::max(flecsi::magnitude(x[i]), 1e-12);
+    r[i] = flecsi::magnitude(x[i]);
+  } // for
+
+  suite.run(std::string("kernel/") + name, n, [&]() {
+    return benchmark::time([&]() {
+      double sum = 0.;
+      for(int64_t i = 0; i < n; ++i)
+        sum += kernels::kernel<K, gdimension>(r[i], 1.);
+      benchmark::do_not_optimize(sum);
+    });
+  });
+  suite.run(std::string("kernel_gradient/") + name, n, [&]() {
+    return benchmark::time([&]() {
+      point_t sum = 0.;
+      for(int64_t i = 0; i < n; ++i)
+        sum += kernels::kernel_gradient<K, gdimension>(x[i], 1.);
+      benchmark::do_not_optimize(sum[0]);
+    });
+  });
+
+  kernels::tabulate(kernels::kernel<K, gdimension>,
+    kernels::kernel_gradient<K, gdimension>, param::sph_kernel_table_size);
+  suite.run(std::string("kernel_tabulated/") + name, n, [&]() {
+    return benchmark::time([&]() {
+      double sum = 0.;
+      for(int64_t i = 0; i < n; ++i)
+        sum += kernels::tabulated_kernel(r[i], 1.);
+      benchmark::do_not_optimize(sum);
+    });
+  });
+  suite.run(std::string("kernel_gradient_tabulated/") + name, n, [&]() {
+    return benchmark::time([&]() {
+      point_t sum = 0.;
+      for(int64_t i = 0; i < n; ++i)
+        sum += kernels::tabulated_kernel_gradient(x[i], 1.);
+      benchmark::do_not_optimize(sum[0]);
+    });
+  });
+}
+
+void
+bench_kernels(benchmark::suite_t & suite) {
+  using namespace param;
+  kernels::set_sinc_kernel_normalization(sph_sinc_index);
+  bench_kernel<cubic_spline>(suite, "cubic_spline");
+  bench_kernel<quintic_spline>(suite, "quintic_spline");
+  bench_kernel<wendland_c2>(suite, "wendland_c2");
+  bench_kernel<wendland_c4>(suite, "wendland_c4");
+  bench_kernel<wendland_c6>(suite, "wendland_c6");
+  bench_kernel<gaussian>(suite, "gaussian");
+  bench_kernel<super_gaussian>(suite, "super_gaussian");
+  bench_kernel<sinc_ker>(suite, "sinc");
+  // Table of the selected kernel for the following benchmarks
+  kernels::select();
+}
+
+/**
+ * @brief Pressure and sound speed of the analytic EOS E on particles with
+ * log-uniform density and internal energy in [lo, hi], then of its table,
+ * per particle and over spans of particles. The particles are reused to stay
+ * in cache, as in the density pass where the EOS is called.
+ */
+template<param::eos_type_keyword E>
+void
+bench_eos(benchmark::suite_t & suite,
+  const char * name,
+  const double lo[3],
+  const double hi[3]) {
+  const int64_t m = 4096;
+  const int64_t n = (param::bench_kernel_samples + m - 1) / m * m;
+  std::vector<body> particles(m);
+  std::mt19937_64 g(E);
+  std::uniform_real_distribution<double> u(0., 1.);
+  for(auto & p : particles) {
+    p.setDensity(lo[0] * pow(hi[0] / lo[0], u(g)));
+    p.setInternalenergy(lo[1] * pow(hi[1] / lo[1], u(g)));
+    p.setElectronfraction(lo[2] + (hi[2] - lo[2]) * u(g));
+  } // for
+
+  suite.run(std::string("eos/") + name, n, [&]() {
+    return benchmark::time([&]() {
+      for(int64_t i = 0; i < n; ++i)
+        eos::pressure_soundspeed<E>(particles[i % m]);
+    });
+  });
+
+  const int ppd = param::eos_tab_points_per_decade;
+  const int np[3] = {int(ceil(log10(hi[0] / lo[0]) * ppd)) + 1,
+    int(ceil(log10(hi[1] / lo[1]) * ppd)) + 1, 1};
+  eos::tabulate(eos::pressure_soundspeed<E>, lo, hi, np);
+  suite.run(std::string("eos_tabulated/") + name, n, [&]() {
+    return benchmark::time([&]() {
+      for(int64_t i = 0; i < n; ++i)
+        eos::pressure_soundspeed<param::eos_tabulated>(particles[i % m]);
+    });
+  });
+  eos::use_table = true;
+  suite.run(std::string("eos_tabulated_span/") + name, n, [&]() {
+    return benchmark::time([&]() {
+      for(int64_t i = 0; i < n; i += m)
+        eos::compute_pressure_soundspeed_span(particles.data(), m);
+    });
+  });
+}
+
+void
+bench_eoses(benchmark::suite_t & suite) {
+  using namespace param;
+  // Code units for the ideal fluid, CGS for the white dwarf
+  const double ideal_lo[3] = {1e-2, 1e-2, 0.5}, ideal_hi[3] = {1e2, 1e2, 0.5};
+  const double wd_lo[3] = {1e2, 1e14, 0.5}, wd_hi[3] = {1e10, 1e19, 0.5};
+  bench_eos<eos_ideal>(suite, "ideal", ideal_lo, ideal_hi);
+  bench_eos<eos_wd>(suite, "wd", wd_lo, wd_hi);
+  // EOS and table of the parameters for the following benchmarks
+  eos::select();
+}
+
+/**
+ * @brief Keys, sorts, tree construction, traversals and output of one
+ * particle distribution
+ */
+void
+bench_distribution(benchmark::suite_t & suite,
+  const benchmark::distribution_t dist) {
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  const std::string suffix =
+    std::string("/") + benchmark::distribution_name[dist];
+  const int64_t n = param::nparticles;
+
+  std::vector<body> initial;
+  benchmark::generate(dist, n, initial);
+
+  body_system<double, gdimension> bs;
+  bs.setMacangle(param::fmm_macangle);
+  auto & tree = *bs.tree();
+
+  // Unsorted particles with their keys, as before the sort of update_iteration
+  auto reset = [&]() {
+    bs.setLocalbodies(initial);
+    tree.set_range(bs.getRange());
+    tree.compute_keys();
+  };
+  auto key_comp = [](const body & left, const body & right) {
+    if(left.key() < right.key())
+      return true;
+    if(left.key() == right.key())
+      return left.id() < right.id();
+    return false;
+  };
+
+  suite.run("compute_keys" + suffix, n, [&]() {
+    reset();
+    return benchmark::time([&]() { tree.compute_keys(); });
+  });
+
+  suite.run("psort" + suffix, n, [&]() {
+    reset();
+    std::vector<int> dist(size);
+    dist[rank] = bs.getLocalbodies().size();
+    MPI_Allgather(
+      MPI_IN_PLACE, 1, MPI_INT, dist.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    return benchmark::time(
+      [&]() { psort::psort(bs.getLocalbodies(), key_comp, dist.data()); });
+  });
+
+  suite.run("key_sort" + suffix, n, [&]() {
+    reset();
+    std::vector<int64_t> dist(size);
+    dist[rank] = bs.getLocalbodies().size();
+    MPI_Allgather(MPI_IN_PLACE, 1, MPI_INT64_T, dist.data(), 1, MPI_INT64_T,
+      MPI_COMM_WORLD);
+    return benchmark::time(
+      [&]() { psort::key_sort(bs.getLocalbodies(), dist.data()); });
+  });
+
+  // The bodies are now sorted and distributed, the tree can be rebuilt
+  bs.setLocalbodies(initial);
+  bs.update_iteration();
+
+  suite.run("build_tree" + suffix, n, [&]() {
+    tree.clean();
+    return benchmark::time([&]() { tree.build_tree(physics::compute_cofm); });
+  });
+
+  // share_nodes_ is timed by the registry during build_tree
+  suite.run("share_nodes" + suffix, n, [&]() {
+    tree.clean();
+    const double start = benchmark::region_time("build_tree/share_nodes");
+    tree.build_tree(physics::compute_cofm);
+    return benchmark::region_time("build_tree/share_nodes") - start;
+  });
+
+  // The ghosts are requested during the traversal: a new tree every time
+  bs.apply_all(eos::init);
+  suite.run("traversal_sph" + suffix, n, [&]() {
+    bs.update_iteration();
+    return benchmark::time([&]() {
+      bs.apply_in_smoothinglength(
+        physics::pipeline.density_pressure_soundspeed);
+    });
+  });
+
+  if constexpr(gdimension == 3) {
+    suite.run("traversal_fmm" + suffix, n, [&]() {
+      bs.update_iteration();
+      return benchmark::time([&]() { bs.gravitation_fmm(); });
+    });
+  }
+
+  const std::string prefix = "bench_io_" + std::string(suffix, 1);
+  int64_t step = 0;
+  suite.run("outputDataHDF5" + suffix, n, [&]() {
+    const double t = benchmark::time([&]() {
+      bs.write_bodies(prefix.c_str(), step, 0.);
+      io::finalizeOutput();
+    });
+    ++step;
+    return t;
+  });
+  MPI_Barrier(MPI_COMM_WORLD);
+  if(rank == 0)
+    remove((prefix + ".h5part").c_str());
+}
+
+int
+main(int argc, char * argv[]) {
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  log_set_output_rank(0);
+
+  if(argc > 2) {
+    print_usage();
+    MPI_Finalize();
+    exit(0);
+  }
+  if(argc == 2)
+    param::mpi_read_params(argv[1]);
+
+  kernels::select();
+  viscosity::select();
+  eos::select();
+  external_force::select(param::external_force_type);
+  physics::select_pipeline();
+
+  if(rank == 0)
+    printf("Benchmarks: %d ranks, %d threads, %ld particles, %dD\n", size,
+      omp_get_max_threads(), (long)param::nparticles, (int)gdimension);
+
+  benchmark::suite_t suite;
+  bench_kernels(suite);
+  bench_eoses(suite);
+  for(auto dist :
+    {benchmark::uniform, benchmark::clustered, benchmark::plummer})
+    bench_distribution(suite, dist);
+
+  int regressions = 0;
+  if(strlen(param::bench_baseline) > 0)
+    regressions = suite.compare(param::bench_baseline);
+  suite.write(param::bench_output);
+
+  MPI_Finalize();
+  return regressions > 0;
+}
@@ -71,6 +71,13 @@ set_derived_params() {
 
   // set external force
   external_force::select(external_force_type);
+
+  // hydro passes for this kernel, viscosity and EOS
+  physics::select_pipeline();
+
+  if(block_timestep_levels > 1 && !adaptive_timestep)
+    log_one(warn) << "block_timestep_levels requires adaptive_timestep, "
+                  << "using a global timestep" << std::endl;
 }
 
 namespace flecsi {
@@ -93,6 +100,31 @@ mpi_init_task(const char * parameter_file) {
   body_system<double, gdimension> bs;
   bs.read_bodies(initial_data_prefix, output_h5data_prefix, initial_iteration);
 
+  // fields of the ghosts to update after the density pass
+  unsigned density_ghosts = GHOST_DENSITY | GHOST_PRESSURE | GHOST_SOUNDSPEED;
+  if(sph_viscosity != visc_constant)
+    density_ghosts |= GHOST_ALPHA;
+
+  // particles with their own power-of-two timesteps
+  const bool block_timesteps = integration::block_timesteps_enabled();
+
+  // fields of the ghosts read by the physics in the traversals
+  unsigned traversal_ghosts =
+    density_ghosts | GHOST_VELOCITY | GHOST_VELOCITYHALF;
+  if(sph_viscosity == visc_cullen)
+    traversal_ghosts |= GHOST_DIVERGENCEV;
+  if(block_timesteps)
+    traversal_ghosts |= GHOST_TIMEBIN;
+  bs.set_ghost_fields(traversal_ghosts);
+
+  // fields of the bodies read by the acceleration with sph_soa_kernels
+  const unsigned acceleration_fields = GHOST_DENSITY | GHOST_PRESSURE |
+    GHOST_SOUNDSPEED | GHOST_ALPHA | GHOST_VELOCITY | GHOST_VELOCITYHALF;
+
+  // the total energy of the particles is restored with the checkpoint
+  const bool restart =
+    restart_from_checkpoint && initial_iteration > 0;
+
   MPI_Barrier(MPI_COMM_WORLD);
 
   do {
@@ -105,7 +137,7 @@ mpi_init_task(const char * parameter_file) {
       bs.update_iteration();
       bs.apply_all(eos::init);
 
-      if(thermokinetic_formulation) {
+      if(thermokinetic_formulation && !restart) {
         // compute total energy for every particle
         bs.apply_all(physics::set_total_energy);
       }
@@ -115,7 +147,11 @@ mpi_init_task(const char * parameter_file) {
       }
 
       log_one(trace) << "compute density pressure cs"<<std::endl;
-      bs.apply_in_smoothinglength(physics::compute_density_pressure_soundspeed);
+      if(sph_soa_kernels)
+        bs.apply_in_smoothinglength_soa(GHOST_VELOCITY,
+          physics::pipeline.density_pressure_soundspeed_soa);
+      else
+        bs.apply_in_smoothinglength(physics::pipeline.density_pressure_soundspeed);
       bs.apply_all(integration::save_velocityhalf);
 
       if (sph_viscosity != visc_constant) {
@@ -125,8 +161,12 @@ mpi_init_task(const char * parameter_file) {
 
       // compute acceleration
       log_one(trace) << "compute rhs of evolution equations" << std::endl;
-      bs.reset_ghosts();
-      bs.apply_in_smoothinglength(physics::compute_acceleration);
+      bs.update_ghosts(density_ghosts | GHOST_VELOCITYHALF);
+      if(sph_soa_kernels)
+        bs.apply_in_smoothinglength_soa(acceleration_fields,
+          physics::pipeline.acceleration_soa);
+      else
+        bs.apply_in_smoothinglength(physics::pipeline.acceleration);
       if (physics::iteration < relaxation_steps) {
         log_one(trace) << "add relaxation terms" << std::endl;
         bs.apply_all(physics::add_drag_acceleration);
@@ -134,8 +174,9 @@ mpi_init_task(const char * parameter_file) {
         log_one(trace) << "relaxation terms: done" << std::endl;
       }
 
-      if (adaptive_timestep) {
-        // Update timestep in the very beginning
+      if (adaptive_timestep && !block_timesteps) {
+        // Update timestep in the very beginning, the block timesteps are set
+        // at the end of the iteration
         log_one(trace) << "compute adaptive timestep" << std::endl;
         bs.apply_all(physics::compute_dt);
         bs.get_all(physics::set_adaptive_timestep);
@@ -147,25 +188,27 @@ mpi_init_task(const char * parameter_file) {
           // compute de/dt 
           for (int m=1; m<=pressure_updates_number;++m) { // 1 or 2 passes
             log_one(trace) << "compute dedt: pass " << m  << std::endl;
-            bs.apply_in_smoothinglength(physics::compute_dedt);
+            bs.apply_in_smoothinglength(physics::pipeline.dedt);
             if (physics::iteration < relaxation_steps)
               bs.apply_all(physics::add_drag_dedt);
 
             bs.apply_all(physics::recompute_pressure_soundspeed_thermokinetic);
-            if (m < pressure_updates_number) 
-              bs.reset_ghosts(); // skip syncing with the last pass
+            // skip syncing with the last pass
+            if (m < pressure_updates_number)
+              bs.update_ghosts(GHOST_PRESSURE | GHOST_SOUNDSPEED);
           }
         }
         else { 
           // or compute du/dt
           for (int m=1; m<=pressure_updates_number;++m) { // 1 or 2 passes
             log_one(trace) << "compute dudt: pass " << m  << std::endl;
-            bs.apply_in_smoothinglength(physics::compute_dudt);
+            bs.apply_in_smoothinglength(physics::pipeline.dudt);
             if (physics::iteration < relaxation_steps)
               bs.apply_all(physics::add_drag_dudt);
             bs.apply_all(physics::recompute_pressure_soundspeed);
-            if (m < pressure_updates_number) 
-              bs.reset_ghosts(); // skip syncing with the last pass
+            // skip syncing with the last pass
+            if (m < pressure_updates_number)
+              bs.update_ghosts(GHOST_PRESSURE | GHOST_SOUNDSPEED);
           }
         }
       } // if evolve_internal_energy
@@ -175,22 +218,36 @@ mpi_init_task(const char * parameter_file) {
       log_one(trace) << "leapfrog: kick one" << std::endl;
       if (evolve_internal_energy) {
         if (thermokinetic_formulation)
-          bs.apply_all(integration::leapfrog_kick_e);
+          bs.apply_all(block_timesteps ? integration::block_kick_one_e
+                                       : integration::leapfrog_kick_e);
         else
-          bs.apply_all(integration::leapfrog_kick_u);
+          bs.apply_all(block_timesteps ? integration::block_kick_one_u
+                                       : integration::leapfrog_kick_u);
+      }
+      if (block_timesteps)
+        bs.apply_all(integration::block_kick_one_v);
+      else {
+        bs.apply_all(integration::leapfrog_kick_v);
+        bs.apply_all(integration::save_velocityhalf);
       }
-      bs.apply_all(integration::leapfrog_kick_v);
-      bs.apply_all(integration::save_velocityhalf);
       log_one(trace) << "kick one: done" << std::endl;
 
       log_one(trace) << "leapfrog: drift" << std::endl;
-      bs.apply_all(integration::leapfrog_drift);
+      bs.apply_all(block_timesteps ? integration::block_drift
+                                   : integration::leapfrog_drift);
       log_one(trace) << "drift: done" << std::endl;
 
       // sync velocities
       bs.update_iteration();
+      // forces of the particles ending their step only
+      if (block_timesteps)
+        bs.set_active_sinks(integration::is_active);
       log_one(trace) << "compute density pressure cs" << std::endl;
-      bs.apply_in_smoothinglength(physics::compute_density_pressure_soundspeed);
+      if(sph_soa_kernels)
+        bs.apply_in_smoothinglength_soa(GHOST_VELOCITY,
+          physics::pipeline.density_pressure_soundspeed_soa);
+      else
+        bs.apply_in_smoothinglength(physics::pipeline.density_pressure_soundspeed);
 
       if (sph_viscosity != visc_constant) {
         log_one(trace) << "compute adaptive viscosity" << std::endl;
@@ -199,46 +256,55 @@ mpi_init_task(const char * parameter_file) {
 
       // compute acceleration
       log_one(trace) << "leapfrog: kick two (velocity)" << std::endl;
-      bs.reset_ghosts();
-      bs.apply_in_smoothinglength(physics::compute_acceleration);
+      bs.update_ghosts(density_ghosts);
+      if(sph_soa_kernels)
+        bs.apply_in_smoothinglength_soa(acceleration_fields,
+          physics::pipeline.acceleration_soa);
+      else
+        bs.apply_in_smoothinglength(physics::pipeline.acceleration);
       if(physics::iteration < relaxation_steps) {
         bs.apply_all(physics::add_drag_acceleration);
         bs.apply_in_smoothinglength(physics::add_short_range_repulsion);
       }
-      bs.apply_all(integration::leapfrog_kick_v);
+      bs.apply_all(block_timesteps ? integration::block_kick_two_v
+                                   : integration::leapfrog_kick_v);
       log_one(trace) << "kick two (velocity): done" << std::endl;
 
       // sync velocities: needed for de/dt
-      bs.reset_ghosts();
+      bs.update_ghosts(GHOST_VELOCITY);
 
       if (evolve_internal_energy) {
         log_one(trace) << "leapfrog: kick two (energy)" << std::endl;
         if (thermokinetic_formulation) {
           for (int m=1; m<=pressure_updates_number;++m) { // 1 or 2 passes
             log_one(trace) << "compute dedt: pass " << m  << std::endl;
-            bs.apply_in_smoothinglength(physics::compute_dedt);
+            bs.apply_in_smoothinglength(physics::pipeline.dedt);
             if (physics::iteration < relaxation_steps)
               bs.apply_all(physics::add_drag_dedt);
 
             bs.apply_all(physics::recompute_pressure_soundspeed_thermokinetic);
+            // skip syncing with the last pass
             if (m < pressure_updates_number)
-              bs.reset_ghosts(); // skip syncing with the last pass
+              bs.update_ghosts(GHOST_PRESSURE | GHOST_SOUNDSPEED);
           }
 
-          bs.apply_all(integration::leapfrog_kick_e);
+          bs.apply_all(block_timesteps ? integration::block_kick_two_e
+                                       : integration::leapfrog_kick_e);
         }
         else {
           for (int m=1; m<=pressure_updates_number;++m) { // 1 or 2 passes
             log_one(trace) << "compute dudt: pass " << m  << std::endl;
-            bs.apply_in_smoothinglength(physics::compute_dudt);
+            bs.apply_in_smoothinglength(physics::pipeline.dudt);
             if (physics::iteration < relaxation_steps)
               bs.apply_all(physics::add_drag_dudt);
 
             bs.apply_all(physics::recompute_pressure_soundspeed);
-            if (m < pressure_updates_number) 
-              bs.reset_ghosts(); // skip syncing with the last pass
+            // skip syncing with the last pass
+            if (m < pressure_updates_number)
+              bs.update_ghosts(GHOST_PRESSURE | GHOST_SOUNDSPEED);
           }
-          bs.apply_all(integration::leapfrog_kick_u);
+          bs.apply_all(block_timesteps ? integration::block_kick_two_u
+                                       : integration::leapfrog_kick_u);
         }
         log_one(trace) << "kick two (energy): done" << std::endl;
       } // evolve internal energy
@@ -246,7 +312,7 @@ mpi_init_task(const char * parameter_file) {
 
     if(sph_variable_h){
       log_one(trace) << "updating smoothing length" << std::endl;
-      bs.get_all(physics::compute_smoothinglength);
+      bs.update_smoothinglength();
       log_one(trace) << ".done" << std::endl;
     }else if(sph_update_uniform_h){
       // The particles moved, compute new smoothing length
@@ -254,10 +320,15 @@ mpi_init_task(const char * parameter_file) {
       bs.get_all(physics::compute_average_smoothinglength,bs.getNBodies());
       log_one(trace) << ".done" << std::endl;
     }
+    // back to all the particles, h was only updated for the active ones
+    if (block_timesteps)
+      bs.set_active_sinks(nullptr);
 
     // Compute and output scalar reductions and diagnostic
     analysis::scalar_output(bs,rank);
     analysis::h5data_output(bs, rank);
+    analysis::checkpoint_output(bs, rank);
+    analysis::timers_output(rank);
     diagnostic::output(bs,rank);
 
     // Check for nans
@@ -268,7 +339,12 @@ mpi_init_task(const char * parameter_file) {
       // Update timestep
       log_one(trace) << "compute adaptive timestep" << std::endl;
       bs.apply_all(physics::compute_dt);
-      bs.get_all(physics::set_adaptive_timestep);
+      if(block_timesteps) {
+        bs.get_all(physics::set_block_timesteps);
+        bs.limit_timebins();
+        bs.get_all(physics::set_block_step);
+      } else
+        bs.get_all(physics::set_adaptive_timestep);
       log_one(trace) << ".done" << std::endl;
     }
 
@@ -292,6 +368,16 @@ check_conservation(const std::vector<analysis::e_conservation> & check) {
   return analysis::check_conservation(check);
 }
 
+double
+energy_drift() {
+  return analysis::energy_drift;
+}
+
+std::vector<int64_t>
+timebin_histogram() {
+  return analysis::timebin_histogram;
+}
+
 void
 specialization_tlt_init(int argc, char * argv[]) {
 
@@ -39,6 +39,9 @@ using type_t = double;
 // fix sph_kernel at compile time
 // #define sph_kernel wendland_c4
 
+// interpolate the kernel in a table, with inlined calls for any sph_kernel
+// #define sph_kernel_tabulated true
+
 // fix sph_viscosity at compile time
 // #define sph_viscosity visc_constant
 
@@ -11,6 +11,7 @@
 #include "io.h"
 #include "kernels.h"
 #include "lattice.h"
+#include "lattice_stream.h"
 #include "params.h"
 #include "sodtube.h"
 #include "user.h"
@@ -257,75 +258,33 @@ main(int argc, char * argv[]) {
   log_one(info) << "Number of particles: " << nparticles << std::endl;
   log_one(info) << "Initial data file: " << initial_data_file << std::endl;
 
-  // allocate arrays
-  // Position
-  double * x = new double[nparticles]();
-  double * y = new double[nparticles]();
-  double * z = new double[nparticles]();
-  // Velocity
-  double * vx = new double[nparticles]();
-  double * vy = new double[nparticles]();
-  double * vz = new double[nparticles]();
-  // Acceleration
-  double * ax = new double[nparticles]();
-  double * ay = new double[nparticles]();
-  double * az = new double[nparticles]();
-  // Smoothing length
-  double * h = new double[nparticles]();
-  // Density
-  double * rho = new double[nparticles]();
-  // Internal Energy
-  double * u = new double[nparticles]();
-  // Pressure
-  double * P = new double[nparticles]();
-  // Mass
-  double * m = new double[nparticles]();
-  // Id
-  int64_t * id = new int64_t[nparticles]();
-  // Timestep
-  double * dt = new double[nparticles]();
-
-  // generate the lattice
-  auto && [_npm, _npt, _npb] =
-    std::make_tuple(particle_lattice::generate(lattice_type, domain_type,
-                      mbox_min, mbox_max, sph_separation, 0, x, y, z),
-      particle_lattice::generate(lattice_type, domain_type,
-        tbox_min, tbox_max, sph_sep_t, np_middle, x, y, z),
-      particle_lattice::generate(lattice_type, domain_type,
-        bbox_min, bbox_max, sph_sep_t, nparticles - np_bottom, x, y, z));
-  assert(np_middle == _npm && np_top == _npt && np_bottom == _npb);
+  // first particle of the bottom block, which sets the stretch of the blocks
+  double y_first = 0., z_first = 0.;
+  particle_lattice::stream(lattice_type, domain_type, bbox_min, bbox_max,
+    sph_sep_t, np_middle + np_top,
+    [&](int64_t, double x_p, double y_p, double z_p) {
+      y_first = y_p;
+      z_first = z_p;
+      return false;
+    });
 
   // stretch top and bottom blocks to align with the width
-  double yx_stretch = floor(box_length / dx_t + 0.1) * dx_t / box_length;
-  double yz_stretch = h_t / h_m;
-  for(int i = np_middle; i < nparticles; ++i) {
-    double y0 = w_m / 2. + gap;
-    if(y[i] > 0) {
-      y[i] = y0 + yx_stretch * yz_stretch * (y[i] - y0);
-    }
-    else {
-      y[i] = -y0 + yx_stretch * yz_stretch * (y[i] + y0);
-    }
-    x[i] /= yx_stretch;
-  }
-  if constexpr(gdimension == 3) {
-    double yz_stretch = h_t / h_m;
-    for(int i = np_middle; i < nparticles; ++i) {
-      z[i] /= yz_stretch;
-    }
-  }
+  const double yx_stretch =
+    floor(box_length / dx_t + 0.1) * dx_t / box_length;
+  const double yz_stretch = h_t / h_m;
+  const double y0 = w_m / 2. + gap;
+  if(y_first > 0)
+    y_first = y0 + yx_stretch * yz_stretch * (y_first - y0);
+  else
+    y_first = -y0 + yx_stretch * yz_stretch * (y_first + y0);
+  z_first /= yz_stretch;
 
   // stretch top and bottom blocks to align with the width
-  double y_stretch = .5 * box_width / std::abs(y[np_middle + np_top]);
-  for(int i = 0; i < nparticles; ++i) {
-    y[i] *= y_stretch;
-  }
+  const double y_stretch = .5 * box_width / std::abs(y_first);
   pmass *= y_stretch;
+  double z_stretch = 1.;
   if constexpr(gdimension == 3) {
-    double z_stretch = .5 * box_height / std::abs(z[np_middle + np_top]);
-    for(int i = 0; i < nparticles; ++i) {
-      z[i] *= z_stretch;
-    }
+    z_stretch = .5 * box_height / std::abs(z_first);
     pmass *= z_stretch;
   }
 
@@ -337,45 +296,10 @@ main(int argc, char * argv[]) {
   double timestep =
     timestep_cfl_factor * sph_separation / std::max(cs, flow_velocity);
 
-  // particle id number
-  int64_t posid = 0;
-  //double wmid2 = -y[0] + .1 * dy_m;
-  for(int64_t part = 0; part < nparticles; ++part) {
-    id[part] = posid++;
-    // if (std::abs(y[part]) < wmid2) {
-    if(part < np_middle) {
-      P[part] = pressure_m;
-      rho[part] = rho_m;
-      vx[part] = vx_m;
-      m[part] = pmass;
-    }
-    else {
-      P[part] = pressure_t;
-      rho[part] = rho_t;
-      vx[part] = vx_t;
-      m[part] = pmass_t;
-    }
-
-    vy[part] = 0.;
-
-    // Add velocity perturbation a-la Price (2008)
-    if(y[part] < 0.25 and y[part] > 0.25 - 0.025)
-      vy[part] = KH_A * sin(-2 * M_PI * (x[part] + .5) / KH_lambda);
-    if(y[part] > -0.25 and y[part] < -0.25 + 0.025)
-      vy[part] = KH_A * sin(2 * M_PI * (x[part] + .5) / KH_lambda);
-
-    // compute internal energy using gamma-law eos
-    u[part] = P[part] / (poly_gamma - 1.) / rho[part];
-
-    // particle masses and smoothing length
-    m[part] = pmass;
-    h[part] = sph_eta * kernels::kernel_width *
-              pow(m[part] / rho[part], 1. / gdimension);
-
-  } // for part=0..nparticles
-
   // delete the output file if exists
-  remove(initial_data_file.c_str());
+  if(rank == 0)
+    remove(initial_data_file.c_str());
+  MPI_Barrier(MPI_COMM_WORLD);
 
   hid_t dataFile = H5P_openFile(initial_data_file.c_str(), H5F_ACC_RDWR);
 
@@ -387,41 +311,67 @@ main(int argc, char * argv[]) {
   H5P_writeAttribute(dataFile, "dimension", &dim);
   H5P_writeAttribute(dataFile, "use_fixed_timestep", &use_fixed_timestep);
 
-  H5P_setNumParticles(nparticles);
-  H5P_setStep(dataFile, 0);
-
-  // H5PartSetNumParticles(dataFile,nparticles);
-  H5P_writeDataset(dataFile, "x", x, nparticles);
-  H5P_writeDataset(dataFile, "y", y, nparticles);
-  H5P_writeDataset(dataFile, "z", z, nparticles);
-  H5P_writeDataset(dataFile, "vx", vx, nparticles);
-  H5P_writeDataset(dataFile, "vy", vy, nparticles);
-  H5P_writeDataset(dataFile, "h", h, nparticles);
-  H5P_writeDataset(dataFile, "rho", rho, nparticles);
-  H5P_writeDataset(dataFile, "u", u, nparticles);
-  H5P_writeDataset(dataFile, "P", P, nparticles);
-  H5P_writeDataset(dataFile, "m", m, nparticles);
-  H5P_writeDataset(dataFile, "id", id, nparticles);
+  // each rank generates and writes its range of particles chunk by chunk
+  lattice_stream_t stream(dataFile, nparticles,
+    {"vx", "vy", "h", "rho", "u", "P", "m"}, [&](lattice_chunk_t & chunk) {
+      double *x = chunk.x.data(), *y = chunk.y.data(), *z = chunk.z.data();
+      double *vx = chunk["vx"], *vy = chunk["vy"], *h = chunk["h"],
+             *rho = chunk["rho"], *u = chunk["u"], *P = chunk["P"],
+             *m = chunk["m"];
+      for(int64_t part = 0; part < chunk.size; ++part) {
+        const bool middle = chunk.id[part] < np_middle;
+
+        // stretch the blocks
+        if(!middle) {
+          if(y[part] > 0)
+            y[part] = y0 + yx_stretch * yz_stretch * (y[part] - y0);
+          else
+            y[part] = -y0 + yx_stretch * yz_stretch * (y[part] + y0);
+          x[part] /= yx_stretch;
+          if constexpr(gdimension == 3)
+            z[part] /= yz_stretch;
+        }
+        y[part] *= y_stretch;
+        if constexpr(gdimension == 3)
+          z[part] *= z_stretch;
+
+        if(middle) {
+          P[part] = pressure_m;
+          rho[part] = rho_m;
+          vx[part] = vx_m;
+        }
+        else {
+          P[part] = pressure_t;
+          rho[part] = rho_t;
+          vx[part] = vx_t;
+        }
+
+        vy[part] = 0.;
+
+        // Add velocity perturbation a-la Price (2008)
+        if(y[part] < 0.25 and y[part] > 0.25 - 0.025)
+          vy[part] = KH_A * sin(-2 * M_PI * (x[part] + .5) / KH_lambda);
+        if(y[part] > -0.25 and y[part] < -0.25 + 0.025)
+          vy[part] = KH_A * sin(2 * M_PI * (x[part] + .5) / KH_lambda);
+
+        // compute internal energy using gamma-law eos
+        u[part] = P[part] / (poly_gamma - 1.) / rho[part];
+
+        // particle masses and smoothing length
+        m[part] = pmass;
+        h[part] = sph_eta * kernels::kernel_width *
+                  pow(m[part] / rho[part], 1. / gdimension);
+      } // for part=0..chunk.size
+    });
+  stream.add(lattice_type, domain_type, mbox_min, mbox_max, sph_separation, 0);
+  stream.add(
+    lattice_type, domain_type, tbox_min, tbox_max, sph_sep_t, np_middle);
+  stream.add(lattice_type, domain_type, bbox_min, bbox_max, sph_sep_t,
+    nparticles - np_bottom);
+  stream.close();
 
   H5P_closeFile(dataFile);
 
-  delete[]  x; 
-  delete[]  y;
-  delete[]  z;
-  delete[]  vx;
-  delete[]  vy;
-  delete[]  vz;
-  delete[]  ax;
-  delete[]  ay;
-  delete[]  az;
-  delete[]  h;
-  delete[]  rho;
-  delete[]  u;
-  delete[]  P;
-  delete[]  m;
-  delete[]  id;
-  delete[]  dt;
-
   MPI_Finalize();
   return 0;
 }
@@ -11,6 +11,7 @@
 #include "io.h"
 #include "kernels.h"
 #include "lattice.h"
+#include "lattice_stream.h"
 #include "params.h"
 #include "sodtube.h"
 #include "user.h"
@@ -253,42 +254,6 @@ main(int argc, char * argv[]) {
   log_one(info) << "Number of particles: " << nparticles << std::endl;
   log_one(info) << "Initial data file: " << initial_data_file << std::endl;
 
-  // allocate arrays
-  // Position
-  double * x = new double[nparticles]();
-  double * y = new double[nparticles]();
-  double * z = new double[nparticles]();
-  // Velocity
-  double * vx = new double[nparticles]();
-  double * vy = new double[nparticles]();
-  double * vz = new double[nparticles]();
-  // Acceleration
-  double * ax = new double[nparticles]();
-  double * ay = new double[nparticles]();
-  double * az = new double[nparticles]();
-  // Smoothing length
-  double * h = new double[nparticles]();
-  // Density
-  double * rho = new double[nparticles]();
-  // Internal Energy
-  double * u = new double[nparticles]();
-  // Pressure
-  double * P = new double[nparticles]();
-  // Mass
-  double * m = new double[nparticles]();
-  // Id
-  int64_t * id = new int64_t[nparticles]();
-  // Timestep
-  double * dt = new double[nparticles]();
-
-  // generate the lattice
-  auto && [_npb, _npt] =
-    std::make_tuple(particle_lattice::generate(lattice_type, domain_type,
-                      bbox_min, bbox_max, sph_separation, 0, x, y, z),
-      particle_lattice::generate(lattice_type, domain_type, 
-        tbox_min, tbox_max, sph_sep_t, np_bottom, x, y, z));
-
-  assert(np_bottom == _npb && np_top == _npt);
   // max. value for the speed of sound
   double cs =
     sqrt(poly_gamma * std::max(pressure_1 / rho_1, pressure_2 / rho_2));
@@ -297,54 +262,10 @@ main(int argc, char * argv[]) {
   double timestep =
     timestep_cfl_factor * sph_separation / std::max(cs, flow_velocity);
 
-  // particle id number
-  int64_t posid = 0;
-  for(int64_t part = 0; part < nparticles; ++part) {
-    id[part] = posid++;
-    if(particle_lattice::in_domain_1d(
-         y[part], bbox_min[1], bbox_max[1], domain_type)) {
-      rho[part] = rho_1;
-      m[part] = pmass;
-      P[part] =
-        pressure_0 + gravity_acceleration_constant *
-                       (rho_2 * (tbox_max[1] - tbox_min[1]) - rho_1 * y[part]);
-    }
-    else {
-      rho[part] = rho_2;
-      m[part] = pmass;
-      P[part] = pressure_0 +
-                gravity_acceleration_constant * rho_2 * (tbox_max[1] - y[part]);
-    }
-    u[part] = u_from_eos(rho[part], P[part]);
-
-    vx[part] = 0.;
-    vy[part] = 0.;
-
-    // Add velocity perturbation a-la Price (2008)
-    if(fabs(y[part]) < .5 * rt_perturbation_stripe_width) {
-      if constexpr(gdimension == 2)
-        vy[part] =
-          -rt_perturbation_amplitude *
-          (1 + cos(2 * M_PI * x[part] / box_length * rt_perturbation_mode)) *
-          cos(M_PI * y[part] / rt_perturbation_stripe_width);
-
-      if constexpr(gdimension == 3)
-        vy[part] =
-          -rt_perturbation_amplitude *
-          (1 + cos(2 * M_PI * x[part] / box_length * rt_perturbation_mode)) *
-          (1 + cos(2 * M_PI * z[part] / box_length * rt_perturbation_mode)) *
-          cos(M_PI * y[part] / rt_perturbation_stripe_width);
-    }
-
-    // particle masses and smoothing length
-    m[part] = pmass;
-    h[part] = sph_eta * kernels::kernel_width *
-              pow(m[part] / rho[part], 1. / gdimension);
-
-  } // for part=0..nparticles
-
   // delete the output file if exists
-  remove(initial_data_file.c_str());
+  if(rank == 0)
+    remove(initial_data_file.c_str());
+  MPI_Barrier(MPI_COMM_WORLD);
 
   hid_t dataFile = H5P_openFile(initial_data_file.c_str(), H5F_ACC_RDWR);
 
@@ -356,40 +277,63 @@ main(int argc, char * argv[]) {
   H5P_writeAttribute(dataFile, "dimension", &dim);
   H5P_writeAttribute(dataFile, "use_fixed_timestep", &use_fixed_timestep);
 
-  H5P_setNumParticles(nparticles);
-  H5P_setStep(dataFile, 0);
-
-  // H5PartSetNumParticles(dataFile,nparticles);
-  H5P_writeDataset(dataFile, "x", x, nparticles);
-  H5P_writeDataset(dataFile, "y", y, nparticles);
-  H5P_writeDataset(dataFile, "z", z, nparticles);
-  H5P_writeDataset(dataFile, "vx", vx, nparticles);
-  H5P_writeDataset(dataFile, "vy", vy, nparticles);
-  H5P_writeDataset(dataFile, "h", h, nparticles);
-  H5P_writeDataset(dataFile, "rho", rho, nparticles);
-  H5P_writeDataset(dataFile, "u", u, nparticles);
-  H5P_writeDataset(dataFile, "P", P, nparticles);
-  H5P_writeDataset(dataFile, "m", m, nparticles);
-  H5P_writeDataset(dataFile, "id", id, nparticles);
+  // each rank generates and writes its range of particles chunk by chunk
+  lattice_stream_t stream(dataFile, nparticles,
+    {"vx", "vy", "h", "rho", "u", "P", "m"}, [&](lattice_chunk_t & chunk) {
+      double *x = chunk.x.data(), *y = chunk.y.data(), *z = chunk.z.data();
+      double *vx = chunk["vx"], *vy = chunk["vy"], *h = chunk["h"],
+             *rho = chunk["rho"], *u = chunk["u"], *P = chunk["P"],
+             *m = chunk["m"];
+      for(int64_t part = 0; part < chunk.size; ++part) {
+        if(particle_lattice::in_domain_1d(
+             y[part], bbox_min[1], bbox_max[1], domain_type)) {
+          rho[part] = rho_1;
+          m[part] = pmass;
+          P[part] = pressure_0 +
+                    gravity_acceleration_constant *
+                      (rho_2 * (tbox_max[1] - tbox_min[1]) - rho_1 * y[part]);
+        }
+        else {
+          rho[part] = rho_2;
+          m[part] = pmass;
+          P[part] = pressure_0 + gravity_acceleration_constant * rho_2 *
+                                   (tbox_max[1] - y[part]);
+        }
+        u[part] = u_from_eos(rho[part], P[part]);
+
+        vx[part] = 0.;
+        vy[part] = 0.;
+
+        // Add velocity perturbation a-la Price (2008)
+        if(fabs(y[part]) < .5 * rt_perturbation_stripe_width) {
+          if constexpr(gdimension == 2)
+            vy[part] = -rt_perturbation_amplitude *
+                       (1 + cos(2 * M_PI * x[part] / box_length *
+                              rt_perturbation_mode)) *
+                       cos(M_PI * y[part] / rt_perturbation_stripe_width);
+
+          if constexpr(gdimension == 3)
+            vy[part] = -rt_perturbation_amplitude *
+                       (1 + cos(2 * M_PI * x[part] / box_length *
+                              rt_perturbation_mode)) *
+                       (1 + cos(2 * M_PI * z[part] / box_length *
+                              rt_perturbation_mode)) *
+                       cos(M_PI * y[part] / rt_perturbation_stripe_width);
+        }
+
+        // particle masses and smoothing length
+        m[part] = pmass;
+        h[part] = sph_eta * kernels::kernel_width *
+                  pow(m[part] / rho[part], 1. / gdimension);
+      } // for part=0..chunk.size
+    });
+  stream.add(lattice_type, domain_type, bbox_min, bbox_max, sph_separation, 0);
+  stream.add(
+    lattice_type, domain_type, tbox_min, tbox_max, sph_sep_t, np_bottom);
+  stream.close();
 
   H5P_closeFile(dataFile);
 
-  delete[]  x; 
-  delete[]  y;
-  delete[]  z;
-  delete[]  vx;
-  delete[]  vy;
-  delete[]  vz;
-  delete[]  ax;
-  delete[]  ay;
-  delete[]  az;
-  delete[]  h;
-  delete[]  rho;
-  delete[]  u;
-  delete[]  P;
-  delete[]  m;
-  delete[]  id;
-  delete[]  dt;
   MPI_Finalize();
   return 0;
 }
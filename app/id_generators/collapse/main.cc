@@ -209,17 +209,17 @@ main(int argc, char * argv[]) {
   H5P_setStep(dataFile, 0);
 
   // H5PartSetNumParticles(dataFile,nparticles);
-  H5P_writeDataset(dataFile, "x", x, nparticles);
-  H5P_writeDataset(dataFile, "y", y, nparticles);
-  H5P_writeDataset(dataFile, "z", z, nparticles);
-  H5P_writeDataset(dataFile, "vx", vx, nparticles);
-  H5P_writeDataset(dataFile, "vy", vy, nparticles);
-  H5P_writeDataset(dataFile, "h", h, nparticles);
-  H5P_writeDataset(dataFile, "rho", rho, nparticles);
-  H5P_writeDataset(dataFile, "u", u, nparticles);
-  H5P_writeDataset(dataFile, "P", P, nparticles);
-  H5P_writeDataset(dataFile, "m", m, nparticles);
-  H5P_writeDataset(dataFile, "id", id, nparticles);
+  H5P_writeDataset(dataFile, "x", x);
+  H5P_writeDataset(dataFile, "y", y);
+  H5P_writeDataset(dataFile, "z", z);
+  H5P_writeDataset(dataFile, "vx", vx);
+  H5P_writeDataset(dataFile, "vy", vy);
+  H5P_writeDataset(dataFile, "h", h);
+  H5P_writeDataset(dataFile, "rho", rho);
+  H5P_writeDataset(dataFile, "u", u);
+  H5P_writeDataset(dataFile, "P", P);
+  H5P_writeDataset(dataFile, "m", m);
+  H5P_writeDataset(dataFile, "id", id);
 
   H5P_closeFile(dataFile);
 
@@ -0,0 +1,256 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file lattice_stream.h
+ * @brief Parallel, chunked generation of lattice initial data.
+ *
+ * The particles [0, nparticles) are split evenly between the ranks. Each rank
+ * only generates its own range of the lattice, in chunks of at most
+ * param::lattice_stream_chunk particles, and writes every chunk straight into
+ * its hyperslab of the h5part file. The memory footprint of a generator is
+ * therefore bounded by the chunk size instead of the total particle number.
+ *
+ * Random perturbations of the lattice are drawn per particle id with
+ * lattice_perturbation(), so they do not depend on the number of ranks.
+ */
+
+#ifndef _lattice_stream_h_
+#define _lattice_stream_h_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "io.h"
+#include "lattice.h"
+#include "params.h"
+
+/**
+ * @brief Position of a lattice particle from its coordinate arrays
+ */
+inline point_t
+lattice_point(const double x, const double y, const double z) {
+  point_t pos;
+  pos[0] = x;
+  if constexpr(gdimension > 1)
+    pos[1] = y;
+  if constexpr(gdimension > 2)
+    pos[2] = z;
+  return pos;
+}
+
+/**
+ * @brief Consecutive particles generated by one rank
+ */
+struct lattice_chunk_t {
+  int64_t first = 0; // id of the first particle of the chunk
+  int64_t size = 0; // number of particles in the chunk
+  std::vector<double> x, y, z;
+  std::vector<int64_t> id;
+  std::map<std::string, std::vector<double>> fields;
+
+  double * operator[](const std::string & name) {
+    return fields.at(name).data();
+  }
+
+  point_t position(const int64_t i) const {
+    return lattice_point(x[i], y[i], z[i]);
+  }
+
+  void set_position(const int64_t i, const point_t & pos) {
+    x[i] = pos[0];
+    if constexpr(gdimension > 1)
+      y[i] = pos[1];
+    if constexpr(gdimension > 2)
+      z[i] = pos[2];
+  }
+}; // struct lattice_chunk_t
+
+/**
+ * @brief Counter-based random number: a hash of the seed and the counter,
+ * uniform in [0,1). Draws for different counters are independent.
+ */
+inline double
+lattice_uniform(const uint64_t seed, const uint64_t counter) {
+  // splitmix64 finalizer
+  auto mix = [](uint64_t z) {
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  };
+  return (mix(mix(seed) ^ counter) >> 11) * 0x1.0p-53;
+}
+
+/**
+ * @brief Add a normal perturbation of standard deviation sigma to the
+ * position of the particle id. The draws only depend on the id and on
+ * particle_lattice::random_seed: any rank can perturb any particle, in any
+ * order, and gets the same result.
+ */
+inline void
+lattice_perturbation(point_t & pos, const int64_t id, const double sigma) {
+  const uint64_t seed = particle_lattice::random_seed;
+  for(unsigned short k = 0; k < gdimension; ++k) {
+    // Box-Muller, two draws per component
+    const uint64_t counter = 2 * (uint64_t(id) * gdimension + k);
+    const double u1 = 1. - lattice_uniform(seed, counter);
+    const double u2 = lattice_uniform(seed, counter + 1);
+    pos[k] += sigma * std::sqrt(-2. * std::log(u1)) * std::cos(2. * M_PI * u2);
+  }
+}
+
+class lattice_stream_t
+{
+public:
+  // computes the fields of a chunk; the positions can be modified as well
+  using fill_t = std::function<void(lattice_chunk_t &)>;
+
+  /**
+   * @brief Open the step 0 of the file and create the datasets x, y, z, id
+   * and the fields. Collective.
+   */
+  lattice_stream_t(hid_t & file_id,
+    const int64_t nparticles,
+    const std::vector<std::string> & fields,
+    fill_t fill,
+    const int64_t chunk = param::lattice_stream_chunk)
+    : names_(fields), fill_(fill), chunk_size_(std::max(chunk, (int64_t)1)) {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    first_ = nparticles * rank / size;
+    last_ = nparticles * (rank + 1) / size;
+
+    // every rank performs the same number of collective writes
+    int64_t nchunks = (last_ - first_ + chunk_size_ - 1) / chunk_size_;
+    MPI_Allreduce(
+      &nchunks, &nchunks_, 1, MPI_INT64_T, MPI_MAX, MPI_COMM_WORLD);
+
+    chunk_.x.resize(chunk_size_);
+    chunk_.y.resize(chunk_size_);
+    chunk_.z.resize(chunk_size_);
+    chunk_.id.resize(chunk_size_);
+    for(auto & name : names_)
+      chunk_.fields[name].resize(chunk_size_);
+    chunk_.first = first_;
+    reset_();
+
+    io::H5P_setNumParticles(last_ - first_);
+    io::H5P_setStep(file_id, 0);
+    dset_.push_back(io::H5P_createDataset("x", chunk_.x.data()));
+    dset_.push_back(io::H5P_createDataset("y", chunk_.y.data()));
+    dset_.push_back(io::H5P_createDataset("z", chunk_.z.data()));
+    dset_.push_back(io::H5P_createDataset("id", chunk_.id.data()));
+    for(auto & name : names_)
+      dset_.push_back(io::H5P_createDataset(name.c_str(), chunk_[name]));
+  }
+
+  /**
+   * @brief Generate the lattice in a box, numbering its particles from posid.
+   * Only the particles of this rank are kept.
+   */
+  void add(const int lattice_type,
+    const int domain_type,
+    const point_t & bbox_min,
+    const point_t & bbox_max,
+    const double sph_sep,
+    const int64_t posid) {
+    if(posid >= last_)
+      return;
+    particle_lattice::stream(lattice_type, domain_type, bbox_min, bbox_max,
+      sph_sep, posid, [this](int64_t id, double x, double y, double z) {
+        if(id < first_)
+          return true;
+        if(id >= last_)
+          return false;
+        const int64_t i = chunk_.size++;
+        chunk_.x[i] = x;
+        chunk_.y[i] = y;
+        chunk_.z[i] = z;
+        chunk_.id[i] = id;
+        if(chunk_.size == chunk_size_)
+          flush_();
+        return true;
+      });
+  }
+
+  /**
+   * @brief Write the last chunk and close the datasets. Collective.
+   */
+  void close() {
+    if(chunk_.size > 0)
+      flush_();
+    // ranks with fewer chunks still take part in the collective writes
+    while(written_chunks_ < nchunks_)
+      flush_();
+    assert(chunk_.first == last_);
+    for(auto & d : dset_)
+      H5Dclose(d);
+    dset_.clear();
+  }
+
+  int64_t first() const {
+    return first_;
+  }
+
+  int64_t last() const {
+    return last_;
+  }
+
+private:
+  void reset_() {
+    chunk_.size = 0;
+    std::fill(chunk_.x.begin(), chunk_.x.end(), 0.);
+    std::fill(chunk_.y.begin(), chunk_.y.end(), 0.);
+    std::fill(chunk_.z.begin(), chunk_.z.end(), 0.);
+    for(auto & f : chunk_.fields)
+      std::fill(f.second.begin(), f.second.end(), 0.);
+  }
+
+  void flush_() {
+    if(chunk_.size > 0)
+      fill_(chunk_);
+    const hsize_t offset = chunk_.first;
+    const hsize_t count = chunk_.size;
+    io::H5P_writeDatasetSlab(dset_[0], chunk_.x.data(), offset, count);
+    io::H5P_writeDatasetSlab(dset_[1], chunk_.y.data(), offset, count);
+    io::H5P_writeDatasetSlab(dset_[2], chunk_.z.data(), offset, count);
+    io::H5P_writeDatasetSlab(dset_[3], chunk_.id.data(), offset, count);
+    for(size_t i = 0; i < names_.size(); ++i)
+      io::H5P_writeDatasetSlab(dset_[4 + i], chunk_[names_[i]], offset, count);
+    chunk_.first += chunk_.size;
+    ++written_chunks_;
+    reset_();
+  }
+
+  std::vector<std::string> names_;
+  fill_t fill_;
+  int64_t chunk_size_;
+  int64_t first_ = 0, last_ = 0;
+  int64_t nchunks_ = 0, written_chunks_ = 0;
+  lattice_chunk_t chunk_;
+  std::vector<hid_t> dset_;
+}; // class lattice_stream_t
+
+#endif // _lattice_stream_h_
@@ -7,12 +7,12 @@
 #include <cassert>
 #include <iostream>
 #include <math.h>
-#include <random>
 
 #include "density_profiles.h"
 #include "io.h"
 #include "kernels.h"
 #include "lattice.h"
+#include "lattice_stream.h"
 #include "params.h"
 #include "sedov.h"
 #include "user.h"
@@ -158,153 +158,140 @@ main(int argc, char * argv[]) {
   MPI_Init(&argc, &argv);
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
   MPI_Comm_size(MPI_COMM_WORLD, &size);
-  assert(size == 1); // parallel ID generator not implemented yet
   log_set_output_rank(0);
 
   // set simulation parameters
   param::mpi_read_params(argv[1]);
   set_derived_params();
-  body_system<double, gdimension> bs;
-  if(modify_initial_data) {
-    bs.read_bodies(initial_data_prefix, "", initial_iteration);
-    SET_PARAM(nparticles, bs.getNBodies());
-  }
-  else {
-    bs.getLocalbodies().clear();
-    bs.getLocalbodies().resize(nparticles);
-  }
-  auto & bodies = bs.getLocalbodies();
-
-  // Declare coordinate arrays
-  double * x = new double[nparticles]();
-  double * y = new double[nparticles]();
-  double * z = new double[nparticles]();
-
-  if(not modify_initial_data) {
-    // Generate the lattice
-    auto _np = particle_lattice::generate(lattice_type, domain_type, bbox_min,
-      bbox_max, sph_separation, 0, x, y, z);
-    assert(nparticles == _np);
-
-    for(int64_t a = 0L; a < nparticles; ++a) {
-      body & particle = bodies[a];
-      if constexpr(gdimension == 1) {
-        point_t pos = {x[a]};
-        particle.set_coordinates(pos);
-      }
-
-      if constexpr(gdimension == 2) {
-        point_t pos = {x[a], y[a]};
-        particle.set_coordinates(pos);
-      }
-
-      if constexpr(gdimension == 3) {
-        point_t pos = {x[a], y[a], z[a]};
-        particle.set_coordinates(pos);
-      }
-    }
-  }
 
   // Assign density, pressure and specific internal energy to particles
   const double rho0 = density_profiles::spherical_density_profile(0);
   const double K0 = pressure_initial // polytropic constant
                     / pow(rho_initial, poly_gamma);
-  std::default_random_engine generator;
 
-  /*
-    double rmax = 0.0;
-    for(int64_t a=0; a<nparticles; ++a){
-      body& particle = bodies[a];
+  // particle velocity (inward), from the perturbed position rp and the
+  // radial distance r of the lattice point
+  auto infall_velocity = [](const point_t & rp, const double r) {
+    point_t vp = 0;
+    if(r > 0) {
+      vp = rp * (-1.0 * noh_infall_velocity) / r;
+    }
+    return vp;
+  };
+
+  if(modify_initial_data) {
+    // every rank modifies its part of the existing data
+    body_system<double, gdimension> bs;
+    bs.read_bodies(initial_data_prefix, "", initial_iteration);
+    SET_PARAM(nparticles, bs.getNBodies());
+    auto & bodies = bs.getLocalbodies();
+
+    for(auto & particle : bodies) {
+      // zero acceleration for this test
+      point_t zero = 0;
+      particle.setAcceleration(zero);
+
+      // radial distance from the origin
       point_t rp(particle.coordinates());
       double r = magnitude(rp);
-      if (r > rmax) {
-        rmax = r;
-      }
-    }
-    double tmass = rho_initial * rmax;
-    double pmass = tmass/nparticles;
-
-    std::cout << "rmax" << " " << rmax << std::endl;
-    std::cout << "tmass" << " " << tmass << std::endl;
-    std::cout << "nparticles" << " " << nparticles << std::endl;
-  */
-
-  for(int64_t a = 0; a < nparticles; ++a) {
-    body & particle = bodies[a];
-
-    // zero acceleration for this test
-    point_t zero = 0;
-    particle.setAcceleration(zero);
-
-    // radial distance from the origin
-    point_t rp(particle.coordinates());
-    double r = magnitude(rp);
-
-    // set density, particle mass, smoothing length and id
-    double rho_a, m_a, h_a;
-    if(modify_initial_data) {
-      rho_a = particle.getDensity();
-      m_a = particle.mass();
-      h_a = particle.radius();
-    }
-    else {
-      rho_a = rho_initial / rho0 // renormalize density profile
-              * density_profiles::spherical_density_profile(r / sphere_radius);
-      m_a = mass_particle;
-      h_a = sph_eta * kernels::kernel_width *
-            pow(mass_particle / rho_a, 1. / gdimension);
-      //      m_a = pmass;
-      //      h_a = sph_eta * kernels::kernel_width
-      //          * pow(pmass/1.0,1./gdimension);
-
-      particle.setDensity(rho_a);
-      particle.setDensity(rho_initial);
-      particle.set_mass(m_a);
-      particle.set_radius(h_a);
-      particle.set_id(a);
-    }
 
-    if(lattice_perturbation_amplitude > 0.0) {
-      // add lattice perturbation
-      std::normal_distribution<double> distribution(
-        0., h_a * lattice_perturbation_amplitude);
-      for(unsigned short k = 0; k < gdimension; ++k) {
-        rp[k] += distribution(generator);
+      // keep density, particle mass and smoothing length
+      double rho_a = particle.getDensity();
+      double h_a = particle.radius();
+
+      if(lattice_perturbation_amplitude > 0.0) {
+        // add lattice perturbation
+        lattice_perturbation(
+          rp, particle.id(), h_a * lattice_perturbation_amplitude);
+        particle.set_coordinates(rp);
       }
-      particle.set_coordinates(rp);
-    }
+      particle.setVelocity(infall_velocity(rp, r));
 
-    // set particle velocity (inward)
-    point_t vp = 0;
-    double infall_velocity = noh_infall_velocity;
-    if(r > 0) {
-      vp = rp * (-1.0 * infall_velocity) / r;
-    }
-    particle.setVelocity(vp);
+      // set internal energy
+      double u_a = K0 * pow(rho_a, poly_gamma - 1) / (poly_gamma - 1);
+      particle.setInternalenergy(u_a);
 
-    // set internal energy
-    double u_a = K0 * pow(rho_a, poly_gamma - 1) / (poly_gamma - 1);
-    particle.setInternalenergy(u_a);
+      // set pressure (a function of density and internal energy)
+      double P_a = rho_a * u_a * (poly_gamma - 1);
+      particle.setPressure(P_a);
 
-    // set pressure (a function of density and internal energy)
-    double P_a = rho_a * u_a * (poly_gamma - 1);
-    particle.setPressure(P_a);
+      // set timestep
+      particle.setDt(initial_dt);
+    }
 
-    // set timestep
-    particle.setDt(initial_dt);
+    // remove the previous file
+    if(rank == 0)
+      remove(initial_data_file);
+
+    // write the file; iteration for initial data MUST BE zero!!
+    bs.write_bodies(initial_data_prefix, 0, 0.0);
+  }
+  else {
+    // delete the output file if exists
+    if(rank == 0)
+      remove(initial_data_file);
+    MPI_Barrier(MPI_COMM_WORLD);
+    hid_t dataFile = H5P_openFile(initial_data_file, H5F_ACC_RDWR);
+    int dim = gdimension;
+    H5P_writeAttribute(dataFile, "dimension", &dim);
+
+    // each rank generates and writes its range of particles chunk by chunk
+    lattice_stream_t stream(dataFile, nparticles,
+      {"vx", "vy", "vz", "h", "rho", "u", "P", "m", "dt"},
+      [&](lattice_chunk_t & chunk) {
+        double *vx = chunk["vx"], *vy = chunk["vy"], *vz = chunk["vz"],
+               *h = chunk["h"], *rho = chunk["rho"], *u = chunk["u"],
+               *P = chunk["P"], *m = chunk["m"], *dt = chunk["dt"];
+        for(int64_t a = 0; a < chunk.size; ++a) {
+          // radial distance from the origin
+          point_t rp = chunk.position(a);
+          double r = magnitude(rp);
+
+          // set density, particle mass and smoothing length; the smoothing
+          // length follows the density profile, the density is uniform
+          double rho_a = rho_initial / rho0 // renormalize density profile
+                         * density_profiles::spherical_density_profile(
+                             r / sphere_radius);
+          double h_a = sph_eta * kernels::kernel_width *
+                       pow(mass_particle / rho_a, 1. / gdimension);
+          rho[a] = rho_initial;
+          m[a] = mass_particle;
+          h[a] = h_a;
+
+          if(lattice_perturbation_amplitude > 0.0) {
+            // add lattice perturbation
+            lattice_perturbation(
+              rp, chunk.id[a], h_a * lattice_perturbation_amplitude);
+            chunk.set_position(a, rp);
+          }
+          point_t vp = infall_velocity(rp, r);
+          vx[a] = vp[0];
+          if constexpr(gdimension > 1)
+            vy[a] = vp[1];
+          if constexpr(gdimension > 2)
+            vz[a] = vp[2];
+
+          // set internal energy and pressure
+          u[a] = K0 * pow(rho_a, poly_gamma - 1) / (poly_gamma - 1);
+          P[a] = rho_a * u[a] * (poly_gamma - 1);
+          dt[a] = initial_dt;
+        } // for a=0..chunk.size
+      });
+    double time = 0.;
+    int64_t iteration = 0;
+    H5P_writeAttributeStep(dataFile, "time", &time);
+    H5P_writeAttributeStep(dataFile, "iteration", &iteration);
+    H5P_writeAttributeStep(dataFile, "timestep", &timestep);
+
+    stream.add(
+      lattice_type, domain_type, bbox_min, bbox_max, sph_separation, 0);
+    stream.close();
+    H5P_closeFile(dataFile);
   }
 
   log_one(info) << "Number of particles: " << nparticles << std::endl;
   log_one(info) << "Mass of a single particle: " << mass_particle << std::endl;
 
-  // remove the previous file
-  remove(initial_data_file);
-  delete[] x;
-  delete[] y;
-  delete[] z;
-
-  // write the file; iteration for initial data MUST BE zero!!
-  bs.write_bodies(initial_data_prefix, 0, 0.0);
   MPI_Finalize();
   return 0;
 }
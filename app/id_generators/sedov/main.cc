@@ -7,12 +7,12 @@
 #include <cassert>
 #include <iostream>
 #include <math.h>
-#include <random>
 
 #include "density_profiles.h"
 #include "io.h"
 #include "kernels.h"
 #include "lattice.h"
+#include "lattice_stream.h"
 #include "params.h"
 #include "sedov.h"
 #include "user.h"
@@ -179,136 +179,167 @@ main(int argc, char * argv[]) {
   MPI_Init(&argc, &argv);
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
   MPI_Comm_size(MPI_COMM_WORLD, &size);
-  assert(size == 1); // parallel ID generator not implemented yet
   log_set_output_rank(0);
 
   // set simulation parameters
   param::mpi_read_params(argv[1]);
   set_derived_params();
-  body_system<double, gdimension> bs;
-  if(modify_initial_data) {
-    bs.read_bodies(initial_data_prefix, "", initial_iteration);
-    SET_PARAM(nparticles, bs.getNBodies());
-  }
-  else {
-    bs.getLocalbodies().clear();
-    bs.getLocalbodies().resize(nparticles);
-  }
-  auto & bodies = bs.getLocalbodies();
-
-  // Declare coordinate arrays
-  double * x = new double[nparticles]();
-  double * y = new double[nparticles]();
-  double * z = new double[nparticles]();
-
-  if(not modify_initial_data) {
-    // Generate the lattice
-    auto _np = particle_lattice::generate(lattice_type, domain_type, bbox_min,
-      bbox_max, sph_separation, 0, x, y, z);
-    assert(nparticles == _np);
-
-    for(int64_t a = 0L; a < nparticles; ++a) {
-      body & particle = bodies[a];
-      if constexpr(gdimension == 1) {
-        point_t pos = {x[a]};
-        particle.set_coordinates(pos);
-      }
-
-      if constexpr(gdimension == 2) {
-        point_t pos = {x[a], y[a]};
-        particle.set_coordinates(pos);
-      }
 
-      if constexpr(gdimension == 3) {
-        point_t pos = {x[a], y[a], z[a]};
-        particle.set_coordinates(pos);
-      }
-    }
-  }
-
-  // Number of particles in the blast zone
+  // Number of particles in the blast zone, over all ranks
   int64_t particles_blast = 0;
 
   // Total mass of particles in the blast zone
   double mass_blast = 0;
 
-  // Count the number of particles and mass in the blast zone
-  // The blast is centered at the origin ({0,0} or {0,0,0})
-  for(int64_t a = 0L; a < nparticles; ++a) {
-    body & particle = bodies[a];
-    double r = magnitude(particle.coordinates());
-    if(r < sedov_blast_radius) {
-      particles_blast++;
-      mass_blast += mass_particle;
-    }
-  }
-
   // Assign density, pressure and specific internal energy to particles,
   // including the particles in the blast zone
   const double rho0 = density_profiles::spherical_density_profile(0);
   const double K0 = pressure_initial // polytropic constant
                     / pow(rho_initial, poly_gamma);
-  std::default_random_engine generator;
-  for(int64_t a = 0; a < nparticles; ++a) {
-    body & particle = bodies[a];
-
-    // zero velocity for this test
-    point_t zero = 0;
-    particle.setVelocity(zero);
-    particle.setAcceleration(zero);
-
-    // radial distance from the origin
-    point_t rp(particle.coordinates());
-    double r = magnitude(rp);
-
-    // set density, particle mass, smoothing length and id
-    double rho_a, m_a, h_a;
-    if(modify_initial_data) {
-      rho_a = particle.getDensity();
-      m_a = particle.mass();
-      // h_a   = particle.radius();
-      h_a = sph_eta * kernels::kernel_width * pow(m_a / rho_a, 1. / gdimension);
-    }
-    else {
-      rho_a = rho_initial / rho0 // renormalize density profile
-              * density_profiles::spherical_density_profile(r / sphere_radius);
-      m_a = mass_particle;
-      h_a = sph_eta * kernels::kernel_width *
-            pow(mass_particle / rho_a, 1. / gdimension);
-      particle.setDensity(rho_a);
-      particle.set_mass(m_a);
-      particle.set_radius(h_a);
-      particle.set_id(a);
-    }
-
-    if(lattice_perturbation_amplitude > 0.0) {
-      // add lattice perturbation
-      std::normal_distribution<double> distribution(
-        0., h_a * lattice_perturbation_amplitude);
-      for(unsigned short k = 0; k < gdimension; ++k) {
-        rp[k] += distribution(generator);
-      }
-      particle.set_coordinates(rp);
-    }
-
+  auto internal_energy = [&](const double rho_a, const double r) {
     // Blast energy in input file is given as total energy.
     // FleCSPH uses specific internal energy.
     // Convert blast energy in specific internal energy:
     double u_blast = sedov_blast_energy / mass_blast;
 
-    // set internal energy
     double u_a = K0 * pow(rho_a, poly_gamma - 1) / (poly_gamma - 1);
     if(r < sedov_blast_radius)
       u_a += u_blast;
-    // u_a += sedov_blast_energy/particles_blast;
-    particle.setInternalenergy(u_a);
+    return u_a;
+  };
+
+  if(modify_initial_data) {
+    // every rank modifies its part of the existing data
+    body_system<double, gdimension> bs;
+    bs.read_bodies(initial_data_prefix, "", initial_iteration);
+    SET_PARAM(nparticles, bs.getNBodies());
+    auto & bodies = bs.getLocalbodies();
+
+    // Count the number of particles and mass in the blast zone
+    // The blast is centered at the origin ({0,0} or {0,0,0})
+    for(auto & particle : bodies) {
+      double r = magnitude(particle.coordinates());
+      if(r < sedov_blast_radius) {
+        particles_blast++;
+        mass_blast += mass_particle;
+      }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &particles_blast, 1, MPI_INT64_T, MPI_SUM,
+      MPI_COMM_WORLD);
+    MPI_Allreduce(
+      MPI_IN_PLACE, &mass_blast, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+    for(auto & particle : bodies) {
+      // zero velocity for this test
+      point_t zero = 0;
+      particle.setVelocity(zero);
+      particle.setAcceleration(zero);
+
+      // radial distance from the origin
+      point_t rp(particle.coordinates());
+      double r = magnitude(rp);
+
+      // keep density and particle mass, reset the smoothing length
+      double rho_a = particle.getDensity();
+      double m_a = particle.mass();
+      double h_a =
+        sph_eta * kernels::kernel_width * pow(m_a / rho_a, 1. / gdimension);
+
+      if(lattice_perturbation_amplitude > 0.0) {
+        // add lattice perturbation
+        lattice_perturbation(
+          rp, particle.id(), h_a * lattice_perturbation_amplitude);
+        particle.set_coordinates(rp);
+      }
+
+      // set internal energy
+      double u_a = internal_energy(rho_a, r);
+      particle.setInternalenergy(u_a);
 
-    // set pressure (a function of density and internal energy)
-    double P_a = rho_a * u_a * (poly_gamma - 1);
-    particle.setPressure(P_a);
+      // set pressure (a function of density and internal energy)
+      double P_a = rho_a * u_a * (poly_gamma - 1);
+      particle.setPressure(P_a);
+
+      // set timestep
+      particle.setDt(initial_dt);
+    }
 
-    // set timestep
-    particle.setDt(initial_dt);
+    // remove the previous file
+    if(rank == 0)
+      remove(initial_data_file);
+
+    // write the file; iteration for initial data MUST BE zero!!
+    bs.write_bodies(initial_data_prefix, 0, 0.0);
+  }
+  else {
+    // delete the output file if exists
+    if(rank == 0)
+      remove(initial_data_file);
+    MPI_Barrier(MPI_COMM_WORLD);
+    hid_t dataFile = H5P_openFile(initial_data_file, H5F_ACC_RDWR);
+    int dim = gdimension;
+    H5P_writeAttribute(dataFile, "dimension", &dim);
+
+    // each rank generates and writes its range of particles chunk by chunk
+    lattice_stream_t stream(dataFile, nparticles,
+      {"vx", "vy", "vz", "h", "rho", "u", "P", "m", "dt"},
+      [&](lattice_chunk_t & chunk) {
+        double *h = chunk["h"], *rho = chunk["rho"], *u = chunk["u"],
+               *P = chunk["P"], *m = chunk["m"], *dt = chunk["dt"];
+        for(int64_t a = 0; a < chunk.size; ++a) {
+          // radial distance from the origin
+          point_t rp = chunk.position(a);
+          double r = magnitude(rp);
+
+          // set density, particle mass and smoothing length
+          double rho_a = rho_initial / rho0 // renormalize density profile
+                         * density_profiles::spherical_density_profile(
+                             r / sphere_radius);
+          double h_a = sph_eta * kernels::kernel_width *
+                       pow(mass_particle / rho_a, 1. / gdimension);
+          rho[a] = rho_a;
+          m[a] = mass_particle;
+          h[a] = h_a;
+
+          if(lattice_perturbation_amplitude > 0.0) {
+            // add lattice perturbation
+            lattice_perturbation(
+              rp, chunk.id[a], h_a * lattice_perturbation_amplitude);
+            chunk.set_position(a, rp);
+          }
+
+          // set internal energy and pressure; zero velocity for this test
+          u[a] = internal_energy(rho_a, r);
+          P[a] = rho_a * u[a] * (poly_gamma - 1);
+          dt[a] = initial_dt;
+        } // for a=0..chunk.size
+      });
+    double time = 0.;
+    int64_t iteration = 0;
+    H5P_writeAttributeStep(dataFile, "time", &time);
+    H5P_writeAttributeStep(dataFile, "iteration", &iteration);
+    H5P_writeAttributeStep(dataFile, "timestep", &timestep);
+
+    // Count the number of particles in the blast zone, in the range of
+    // particles of this rank
+    particle_lattice::stream(lattice_type, domain_type, bbox_min, bbox_max,
+      sph_separation, 0, [&](int64_t id, double x, double y, double z) {
+        if(id < stream.first())
+          return true;
+        if(id >= stream.last())
+          return false;
+        if(magnitude(lattice_point(x, y, z)) < sedov_blast_radius)
+          particles_blast++;
+        return true;
+      });
+    MPI_Allreduce(MPI_IN_PLACE, &particles_blast, 1, MPI_INT64_T, MPI_SUM,
+      MPI_COMM_WORLD);
+    mass_blast = particles_blast * mass_particle;
+
+    stream.add(
+      lattice_type, domain_type, bbox_min, bbox_max, sph_separation, 0);
+    stream.close();
+    H5P_closeFile(dataFile);
   }
 
   log_one(info) << "Number of particles: " << nparticles << std::endl;
@@ -318,14 +349,6 @@ main(int argc, char * argv[]) {
                 << std::endl;
   log_one(info) << "Total blast energy: " << sedov_blast_energy << std::endl;
 
-  // remove the previous file
-  remove(initial_data_file);
-  delete[] x;
-  delete[] y;
-  delete[] z;
-
-  // write the file; iteration for initial data MUST BE zero!!
-  bs.write_bodies(initial_data_prefix, 0, 0.0);
   MPI_Finalize();
   return 0;
 }
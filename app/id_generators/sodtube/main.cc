@@ -20,6 +20,7 @@
 #include "io.h"
 #include "kernels.h"
 #include "lattice.h"
+#include "lattice_stream.h"
 #include "params.h"
 #include "sodtube.h"
 #include "user.h"
@@ -435,53 +436,12 @@ main(int argc, char * argv[]) {
       lbox_min, lbox_max, lr_sph_sep, tparticles);
   } // equal mass
 
-  // Initialize the arrays to be filled later
-  // Position
-  double * x = new double[tparticles]();
-  double * y = new double[tparticles]();
-  double * z = new double[tparticles]();
-  // Velocity
-  double * vx = new double[tparticles]();
-  double * vy = new double[tparticles]();
-  double * vz = new double[tparticles]();
-  // Acceleration
-  double * ax = new double[tparticles]();
-  double * ay = new double[tparticles]();
-  double * az = new double[tparticles]();
-  // Smoothing length
-  double * h = new double[tparticles]();
-  // Density
-  double * rho = new double[tparticles]();
-  // Internal Energy
-  double * u = new double[tparticles]();
-  // Pressure
-  double * P = new double[tparticles]();
-  // Mass
-  double * m = new double[tparticles]();
-  // Id
-  int64_t * id = new int64_t[tparticles]();
-  // Timestep
-  double * dt = new double[tparticles]();
-
-  if(equal_separation) {
-    tparticles = particle_lattice::generate(lattice_type, domain_type, 
-      cbox_min, cbox_max, sph_separation, 0, x, y, z);
-    tparticles += particle_lattice::generate(lattice_type, domain_type,
-      rbox_min, rbox_max, sph_separation, tparticles, x, y, z);
-    tparticles += particle_lattice::generate(lattice_type, domain_type,
-      lbox_min, lbox_max, sph_separation, tparticles, x, y, z);
-  }
-  if(equal_mass) {
-    tparticles = particle_lattice::generate(lattice_type, domain_type,
-      cbox_min, cbox_max, sph_separation, 0, x, y, z);
-    tparticles += particle_lattice::generate(lattice_type, domain_type,
-      rbox_min, rbox_max, lr_sph_sep, tparticles, x, y, z);
-    tparticles += particle_lattice::generate(lattice_type, domain_type,
-      lbox_min, lbox_max, lr_sph_sep, tparticles, x, y, z);
-  }
-
-  // particle id number
-  int64_t posid = 0;
+  // box sizes and lattice spacings, in the order of the particle ids
+  const double lr_sep = equal_mass ? lr_sph_sep : sph_separation;
+  const int64_t np_c = particle_lattice::count(
+    lattice_type, domain_type, cbox_min, cbox_max, sph_separation, 0);
+  const int64_t np_r = particle_lattice::count(
+    lattice_type, domain_type, rbox_min, rbox_max, lr_sep, np_c);
 
   // max. value for the speed of sound
   double cs =
@@ -490,60 +450,12 @@ main(int argc, char * argv[]) {
   // The value for constant timestep
   double timestep = 0.5 * sph_separation / cs;
 
-  if(equal_separation) {
-    for(int64_t part = 0; part < tparticles; ++part) {
-      id[part] = posid++;
-      if(particle_lattice::in_domain_1d(
-           x[part], cbox_min[0], cbox_max[0], domain_type)) {
-        P[part] = pressure_1;
-        rho[part] = rho_1;
-        vx[part] = vx_1;
-        m[part] = rho[part] / (double)parts_mid;
-      }
-      else {
-        P[part] = pressure_2;
-        rho[part] = rho_2;
-        vx[part] = vx_2;
-        m[part] = rho[part] / (double)parts_lr;
-      }
-
-      // compute internal energy using gamma-law eos
-      u[part] = P[part] / (poly_gamma - 1.) / rho[part];
-
-      // particle smoothing length
-      h[part] = sph_eta * kernels::kernel_width *
-                pow(m[part] / rho[part], 1. / gdimension);
-    } // for part=0..nparticles
-  }
-  if(equal_mass) {
-    for(int64_t part = 0; part < tparticles; ++part) {
-      id[part] = posid++;
-      if(particle_lattice::in_domain_1d(
-           x[part], cbox_min[0], cbox_max[0], domain_type)) {
-        P[part] = pressure_1;
-        rho[part] = rho_1;
-        vx[part] = vx_1;
-      }
-      else {
-        P[part] = pressure_2;
-        rho[part] = rho_2;
-        vx[part] = vx_2;
-      }
-
-      // compute internal energy using gamma-law eos
-      u[part] = P[part] / (poly_gamma - 1.) / rho[part];
-
-      // particle masses and smoothing length
-      m[part] = mass;
-      h[part] = sph_eta * kernels::kernel_width *
-                pow(m[part] / rho[part], 1. / gdimension);
-
-    } // for part=0..nparticles
-  }
   log_one(info) << "Actual number of particles: " << tparticles << std::endl
                 << std::flush;
   // delete the output file if exists
-  remove(initial_data_file.c_str());
+  if(rank == 0)
+    remove(initial_data_file.c_str());
+  MPI_Barrier(MPI_COMM_WORLD);
   hid_t dataFile = H5P_openFile(initial_data_file.c_str(), H5F_ACC_RDWR);
 
   int use_fixed_timestep = 1;
@@ -554,40 +466,43 @@ main(int argc, char * argv[]) {
   H5P_writeAttribute(dataFile, "dimension", &dim);
   H5P_writeAttribute(dataFile, "use_fixed_timestep", &use_fixed_timestep);
 
-  H5P_setNumParticles(tparticles);
-  H5P_setStep(dataFile, 0);
-
-  // H5PartSetNumParticles(dataFile,nparticles);
-  H5P_writeDataset(dataFile, "x", x, tparticles);
-  H5P_writeDataset(dataFile, "y", y, tparticles);
-  H5P_writeDataset(dataFile, "z", z, tparticles);
-  H5P_writeDataset(dataFile, "vx", vx, tparticles);
-  H5P_writeDataset(dataFile, "vy", vy, tparticles);
-  H5P_writeDataset(dataFile, "h", h, tparticles);
-  H5P_writeDataset(dataFile, "rho", rho, tparticles);
-  H5P_writeDataset(dataFile, "u", u, tparticles);
-  H5P_writeDataset(dataFile, "P", P, tparticles);
-  H5P_writeDataset(dataFile, "m", m, tparticles);
-  H5P_writeDataset(dataFile, "id", id, tparticles);
+  // each rank generates and writes its range of particles chunk by chunk
+  lattice_stream_t stream(dataFile, tparticles,
+    {"vx", "vy", "h", "rho", "u", "P", "m"}, [&](lattice_chunk_t & chunk) {
+      double *x = chunk.x.data(), *vx = chunk["vx"], *h = chunk["h"],
+             *rho = chunk["rho"], *u = chunk["u"], *P = chunk["P"],
+             *m = chunk["m"];
+      for(int64_t part = 0; part < chunk.size; ++part) {
+        if(particle_lattice::in_domain_1d(
+             x[part], cbox_min[0], cbox_max[0], domain_type)) {
+          P[part] = pressure_1;
+          rho[part] = rho_1;
+          vx[part] = vx_1;
+          m[part] = equal_mass ? mass : rho[part] / (double)parts_mid;
+        }
+        else {
+          P[part] = pressure_2;
+          rho[part] = rho_2;
+          vx[part] = vx_2;
+          m[part] = equal_mass ? mass : rho[part] / (double)parts_lr;
+        }
+
+        // compute internal energy using gamma-law eos
+        u[part] = P[part] / (poly_gamma - 1.) / rho[part];
+
+        // particle smoothing length
+        h[part] = sph_eta * kernels::kernel_width *
+                  pow(m[part] / rho[part], 1. / gdimension);
+      } // for part=0..chunk.size
+    });
+  stream.add(lattice_type, domain_type, cbox_min, cbox_max, sph_separation, 0);
+  stream.add(lattice_type, domain_type, rbox_min, rbox_max, lr_sep, np_c);
+  stream.add(
+    lattice_type, domain_type, lbox_min, lbox_max, lr_sep, np_c + np_r);
+  stream.close();
 
   H5P_closeFile(dataFile);
 
-  delete[]  x; 
-  delete[]  y;
-  delete[]  z;
-  delete[]  vx;
-  delete[]  vy;
-  delete[]  vz;
-  delete[]  ax;
-  delete[]  ay;
-  delete[]  az;
-  delete[]  h;
-  delete[]  rho;
-  delete[]  u;
-  delete[]  P;
-  delete[]  m;
-  delete[]  id;
-  delete[]  dt;
   MPI_Finalize();
   return 0;
 }
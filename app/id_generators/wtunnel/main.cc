@@ -10,6 +10,7 @@
 
 #include "io.h"
 #include "lattice.h"
+#include "lattice_stream.h"
 #include "params.h"
 #include "sodtube.h"
 #include "user.h"
@@ -124,112 +125,53 @@ main(int argc, char * argv[]) {
                 << " - generated initial data file: " << initial_data_file
                 << endl;
 
-  // allocate arrays
-  int64_t tparticles = 0;
-  tparticles = particle_lattice::count(
+  // count the particles
+  int64_t tparticles = particle_lattice::count(
     lattice_type, 0, cbox_min, cbox_max, sph_separation, 0);
 
-  // Initialize the arrays to be filled later
-  // Position
-  double * x = new double[tparticles]();
-  double * y = new double[tparticles]();
-  double * z = new double[tparticles]();
-  // Velocity
-  double * vx = new double[tparticles]();
-  double * vy = new double[tparticles]();
-  double * vz = new double[tparticles]();
-  // Acceleration
-  double * ax = new double[tparticles]();
-  double * ay = new double[tparticles]();
-  double * az = new double[tparticles]();
-  // Smoothing length
-  double * h = new double[tparticles]();
-  // Density
-  double * rho = new double[tparticles]();
-  // Internal Energy
-  double * u = new double[tparticles]();
-  // Pressure
-  double * P = new double[tparticles]();
-  // Mass
-  double * m = new double[tparticles]();
-  // Id
-  int64_t * id = new int64_t[tparticles]();
-  // Timestep
-  double * dt = new double[tparticles]();
-
-  tparticles = particle_lattice::generate(
-    lattice_type, 0, cbox_min, cbox_max, sph_separation, 0, x, y, z);
-
-  // particle id number
-  int64_t posid = 0;
-
   // max. value for the speed of sound
   double cs = sqrt(poly_gamma * pressure_initial / rho_initial);
 
   // The value for constant timestep
   double timestep = 0.5 * sph_separation / cs;
 
-  for(int64_t part = 0; part < tparticles; ++part) {
-    id[part] = posid++;
-    P[part] = pressure_initial;
-    rho[part] = rho_initial;
-    vx[part] = -flow_velocity;
-    m[part] = rho_initial / (double)tparticles;
-
-    // compute internal energy using gamma-law eos
-    u[part] = pressure_initial / (poly_gamma - 1.) / rho_initial;
-
-    // particle smoothing length
-    h[part] = sph_smoothing_length;
-
-  } // for part=0..nparticles
-
   log_one(info) << "Actual number of particles: " << tparticles << std::endl;
   // delete the output file if exists
-  remove(initial_data_file.c_str());
+  if(rank == 0)
+    remove(initial_data_file.c_str());
+  MPI_Barrier(MPI_COMM_WORLD);
   hid_t dataFile = H5P_openFile(initial_data_file.c_str(), H5F_ACC_RDWR);
 
   int use_fixed_timestep = 1;
   // add the global attributes
-  H5P_writeAttribute(dataFile, "nparticles", &nparticles);
+  H5P_writeAttribute(dataFile, "nparticles", &tparticles);
   H5P_writeAttribute(dataFile, "timestep", &timestep);
   int dim = gdimension;
   H5P_writeAttribute(dataFile, "dimension", &dim);
   H5P_writeAttribute(dataFile, "use_fixed_timestep", &use_fixed_timestep);
 
-  H5P_setNumParticles(nparticles);
-  H5P_setStep(dataFile, 0);
-
-  // H5PartSetNumParticles(dataFile,nparticles);
-  H5P_writeDataset(dataFile, "x", x, nparticles);
-  H5P_writeDataset(dataFile, "y", y, nparticles);
-  H5P_writeDataset(dataFile, "z", z, nparticles);
-  H5P_writeDataset(dataFile, "vx", vx, nparticles);
-  H5P_writeDataset(dataFile, "vy", vy, nparticles);
-  H5P_writeDataset(dataFile, "h", h, nparticles);
-  H5P_writeDataset(dataFile, "rho", rho, nparticles);
-  H5P_writeDataset(dataFile, "u", u, nparticles);
-  H5P_writeDataset(dataFile, "P", P, nparticles);
-  H5P_writeDataset(dataFile, "m", m, nparticles);
-  H5P_writeDataset(dataFile, "id", id, nparticles);
+  // each rank generates and writes its range of particles chunk by chunk
+  lattice_stream_t stream(dataFile, tparticles,
+    {"vx", "vy", "h", "rho", "u", "P", "m"}, [&](lattice_chunk_t & chunk) {
+      double *vx = chunk["vx"], *h = chunk["h"], *rho = chunk["rho"],
+             *u = chunk["u"], *P = chunk["P"], *m = chunk["m"];
+      for(int64_t part = 0; part < chunk.size; ++part) {
+        P[part] = pressure_initial;
+        rho[part] = rho_initial;
+        vx[part] = -flow_velocity;
+        m[part] = rho_initial / (double)tparticles;
+
+        // compute internal energy using gamma-law eos
+        u[part] = pressure_initial / (poly_gamma - 1.) / rho_initial;
+
+        // particle smoothing length
+        h[part] = sph_smoothing_length;
+      } // for part=0..chunk.size
+    });
+  stream.add(lattice_type, 0, cbox_min, cbox_max, sph_separation, 0);
+  stream.close();
 
   H5P_closeFile(dataFile);
-  delete[]  x; 
-  delete[]  y;
-  delete[]  z;
-  delete[]  vx;
-  delete[]  vy;
-  delete[]  vz;
-  delete[]  ax;
-  delete[]  ay;
-  delete[]  az;
-  delete[]  h;
-  delete[]  rho;
-  delete[]  u;
-  delete[]  P;
-  delete[]  m;
-  delete[]  id;
-  delete[]  dt;
   MPI_Finalize();
   return 0;
 }
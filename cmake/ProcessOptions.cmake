@@ -15,6 +15,12 @@ include(CMakeDependentOption)
 option(ENABLE_UNIT_TESTS "Enable unit tests" ON)
 # enables debug messages from tree
 option(ENABLE_DEBUG_TREE "Enable debug tree" OFF)
+# instantiates the hydro passes for the common kernel/viscosity/EOS choices
+option(ENABLE_PHYSICS_PIPELINES "Enable compile-time specialized hydro passes" OFF)
+# builds the benchmark suite, run with 'ctest -L benchmark'
+option(ENABLE_BENCHMARKS "Enable benchmark suite" OFF)
+# numbers of ranks of the benchmark runs, powers of two
+set(BENCHMARK_RANKS "1;4" CACHE STRING "Numbers of MPI ranks of the benchmark runs")
 # TODO: get rid of this
 #option(ENABLE_DEBUG "Compile in DEBUG mode" OFF)
 # sets integrated log level (0 - none, X - ?)
@@ -22,6 +28,12 @@ set(LOG_STRIP_LEVEL 0 CACHE STRING "LOG Strip level")
 # integer width for keys
 set(KEY_INTEGER_TYPE "uint64_t" CACHE STRING "Type of integer used to generate keys")
 set_property(CACHE KEY_INTEGER_TYPE PROPERTY STRINGS "uint32_t" "uint64_t" "uint128_t")
+# space filling curve used to generate keys
+set(KEY_CURVE "morton" CACHE STRING "Space filling curve used to generate keys")
+set_property(CACHE KEY_CURVE PROPERTY STRINGS "morton" "hilbert")
+# order of the FMM multipole and Taylor expansions
+set(FMM_ORDER "1" CACHE STRING "Order of the FMM expansions")
+set_property(CACHE FMM_ORDER PROPERTY STRINGS "1" "2" "3")
 
 # tentative; color output at building
 option(ENABLE_FORCE_COMPILE_COLORED "Forces build to use colorized output" ON)
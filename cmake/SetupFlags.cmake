@@ -8,6 +8,8 @@
 # more readable generator expressions
 #------------------------------------------------
 set(debug_tree "$<BOOL:${ENABLE_DEBUG_TREE}>")
+set(hilbert_keys "$<STREQUAL:${KEY_CURVE},hilbert>")
+set(physics_pipelines "$<BOOL:${ENABLE_PHYSICS_PIPELINES}>")
 set(build_debug "$<CONFIG:Debug>")
 set(build_release "$<CONFIG:Release>")
 set(unit_tests "$<BOOL:${ENABLE_UNIT_TESTS}>")
@@ -27,9 +29,16 @@ target_compile_definitions(flecsph::flags
     INTERFACE
         "LOG_STRIP_LEVEL=${LOG_STRIP_LEVEL}"
         "PARALLEL_IO"
+        "FMM_ORDER=${FMM_ORDER}"
         $<${debug_tree}:
           "ENABLE_DEBUG_TREE"
         >
+        $<${hilbert_keys}:
+          "HILBERT_KEYS"
+        >
+        $<${physics_pipelines}:
+          "ENABLE_PHYSICS_PIPELINES"
+        >
 )
 
 # compiler-specific flags
@@ -40,14 +40,19 @@
  *  posid        - enter the particle ID number from which the function is
  * called it is important for when the function is assigning position
  *                 coordinates to the particles
- *  count_only   - boolean for determing particle number (returned for
- * allocating proper arrays) or writing positions to those arrays x,y,z[]      -
- * the arrays to be filled for the positions of each particle
+ *  emit         - functor called as emit(posid,x,y,z) for every particle, in
+ *                 increasing posid order; returning false stops the lattice
+ *                 walk early (used to generate only a range of particles)
  */
 
+#ifndef _lattice_h_
+#define _lattice_h_
+
 #include "density_profiles.h"
 #include "tree.h"
 #include "user.h"
+#include <chrono>
+#include <functional>
 #include <math.h>
 #include <random>
 #include <stdlib.h>
@@ -133,13 +138,13 @@ in_domain_3d(const double x,
 }
 
 /**
- * @brief      Generate lattice will run through the supplied domain, and--
- *             depending on the count_only switch--count total number of
- * particles or assign the positions to the position arrays Returns int64_t:
- * total particle number
+ * @brief      Generate lattice will run through the supplied domain and pass
+ *             the position of every particle to the emit functor.
+ *             Returns int64_t: total particle number
  *
  * @param      Refer to inputs section in introduction
  */
+template<class EMIT>
 int64_t
 generator_lattice_1d(const int lattice_type,
   const int domain_type,
@@ -147,10 +152,7 @@ generator_lattice_1d(const int lattice_type,
   const point_t & bbox_max,
   const double sph_sep,
   int64_t posid,
-  bool count_only = true,
-  double x[] = NULL,
-  double y[] = NULL,
-  double z[] = NULL) {
+  EMIT && emit) {
   // Central coordinates: in most cases this should be centered at 0
   double x_c = (bbox_max[0] + bbox_min[0]) / 2.;
 
@@ -161,17 +163,14 @@ generator_lattice_1d(const int lattice_type,
   double xmin = bbox_min[0], xmax = bbox_max[0];
   for(double x_p = xmin; x_p < xmax; x_p += sph_sep) {
     if(in_domain_1d(x_p, xmin, xmax, domain_type)) {
-      if(!count_only) {
-        x[posid] = x_p;
-        y[posid] = 0.0;
-        z[posid] = 0.0;
-      }
-      posid++;
+      if(!emit(posid++, x_p, 0.0, 0.0))
+        return (posid - posid_starting);
     }
   }
   return (posid - posid_starting);
 }
 
+template<class EMIT>
 int64_t
 generator_lattice_2d(const int lattice_type,
   const int domain_type,
@@ -179,10 +178,7 @@ generator_lattice_2d(const int lattice_type,
   const point_t & bbox_max,
   const double sph_sep,
   int64_t posid,
-  bool count_only = true,
-  double x[] = NULL,
-  double y[] = NULL,
-  double z[] = NULL) {
+  EMIT && emit) {
   // Coordinate extents
   double xmin = bbox_min[0], xmax = bbox_max[0];
   double ymin = bbox_min[1], ymax = bbox_max[1];
@@ -198,29 +194,22 @@ generator_lattice_2d(const int lattice_type,
     for(double y_p = ymin; y_p < ymax; y_p += dx)
       for(double x_p = xmin; x_p < xmax; x_p += dx)
         if(in_domain_2d(x_p, y_p, bbox_min, bbox_max, domain_type)) {
-          if(!count_only) {
-            x[posid] = x_p;
-            y[posid] = y_p;
-            z[posid] = 0.0;
-          }
-          posid++;
+          if(!emit(posid++, x_p, y_p, 0.0))
+            return (posid - posid_starting);
         } // if in domain
   }
   else { // triangular lattice
     for(double y_p = ymin, yo = 0; y_p < ymax; y_p += dy, yo = 1 - yo)
       for(double x_p = xmin + yo * dx / 2; x_p < xmax; x_p += dx)
         if(in_domain_2d(x_p, y_p, bbox_min, bbox_max, domain_type)) {
-          if(!count_only) {
-            x[posid] = x_p;
-            y[posid] = y_p;
-            z[posid] = 0.0;
-          }
-          posid++;
+          if(!emit(posid++, x_p, y_p, 0.0))
+            return (posid - posid_starting);
         } // if in domain
   } // lattice
   return (posid - posid_starting);
 }
 
+template<class EMIT>
 int64_t
 generator_lattice_3d(const int lattice_type,
   const int domain_type,
@@ -228,10 +217,7 @@ generator_lattice_3d(const int lattice_type,
   const point_t & bbox_max,
   const double sph_sep,
   int64_t posid,
-  bool count_only = true,
-  double x[] = NULL,
-  double y[] = NULL,
-  double z[] = NULL) {
+  EMIT && emit) {
   // Save the starting position id
   const int64_t posid_starting = posid;
 
@@ -251,12 +237,8 @@ generator_lattice_3d(const int lattice_type,
       for(double y_p = ymin; y_p < ymax; y_p += dx)
         for(double x_p = xmin; x_p < xmax; x_p += dx)
           if(in_domain_3d(x_p, y_p, z_p, bbox_min, bbox_max, domain_type)) {
-            if(!count_only) {
-              x[posid] = x_p;
-              y[posid] = y_p;
-              z[posid] = z_p;
-            }
-            posid++;
+            if(!emit(posid++, x_p, y_p, z_p))
+              return (posid - posid_starting);
           } // if in domain
   }
   else if(lattice_type == 1) { // hcp lattice in 3D
@@ -265,12 +247,8 @@ generator_lattice_3d(const int lattice_type,
           y_p += dy, yo = 1 - yo)
         for(double x_p = xmin + (yo - zo) * dx / 2.; x_p < xmax; x_p += dx)
           if(in_domain_3d(x_p, y_p, z_p, bbox_min, bbox_max, domain_type)) {
-            if(!count_only) {
-              x[posid] = x_p;
-              y[posid] = y_p;
-              z[posid] = z_p;
-            }
-            posid++;
+            if(!emit(posid++, x_p, y_p, z_p))
+              return (posid - posid_starting);
           } // if in domain
   }
   else if(lattice_type == 2) { // fcc lattice in 3D
@@ -280,12 +258,8 @@ generator_lattice_3d(const int lattice_type,
           y_p += dy, yo = 1 - yo)
         for(double x_p = xmin + (yo - zl) * dx / 2.; x_p < xmax; x_p += dx)
           if(in_domain_3d(x_p, y_p, z_p, bbox_min, bbox_max, domain_type)) {
-            if(!count_only) {
-              x[posid] = x_p;
-              y[posid] = y_p;
-              z[posid] = z_p;
-            }
-            posid++;
+            if(!emit(posid++, x_p, y_p, z_p))
+              return (posid - posid_starting);
           } // if in domain
   } // lattice_type
 
@@ -319,13 +293,13 @@ npart_icosahedral_sphere(const int k) {
 /**
  * @brief      Generates a spherical icosahedral lattice by placing particles in
  *             concentric shells, centered at the origin.
- *             Depending on the count_only switch--count total number of
- * particles or assign the positions to the position arrays Uses current
- * spherical density profile from density_profiles.h Returns int64_t: total
- * particle number.
+ *             Passes the position of every particle to the emit functor.
+ *             Uses current spherical density profile from density_profiles.h
+ *             Returns int64_t: total particle number.
  *
  * @param      Refer to inputs section in introduction
  */
+template<class EMIT>
 int64_t
 generator_icosahedral_lattice(const int lattice_type,
   const int domain_type,
@@ -333,10 +307,7 @@ generator_icosahedral_lattice(const int lattice_type,
   const point_t & bbox_max,
   const double sph_sep,
   int64_t posid,
-  bool count_only = true,
-  double x[] = NULL,
-  double y[] = NULL,
-  double z[] = NULL) {
+  EMIT && emit) {
   // sanity check
   assert(lattice_type == 3 and gdimension == 3);
 
@@ -422,23 +393,15 @@ generator_icosahedral_lattice(const int lattice_type,
         y_p = y_c + ico_vtx[i][1];
         z_p = z_c + ico_vtx[i][2];
         if(in_domain_3d(x_p, y_p, z_p, bbox_min, bbox_max, domain_type)) {
-          if(!count_only) {
-            x[posid] = x_p;
-            y[posid] = y_p;
-            z[posid] = z_p;
-          }
-          posid++;
+          if(!emit(posid++, x_p, y_p, z_p))
+            return (posid - posid_starting);
         } // if in domain
       } // for i from 0 to 12
     }
     else {
       // single point at the origin
-      if(!count_only) {
-        x[posid] = x_c;
-        y[posid] = y_c;
-        z[posid] = z_c;
-      }
-      posid++;
+      if(!emit(posid++, x_c, y_c, z_c))
+        return (posid - posid_starting);
     } // if NN>0
 
     //
@@ -476,12 +439,8 @@ generator_icosahedral_lattice(const int lattice_type,
         y_p = y_c + y_p / r;
         z_p = z_c + z_p / r;
         if(in_domain_3d(x_p, y_p, z_p, bbox_min, bbox_max, domain_type)) {
-          if(!count_only) {
-            x[posid] = x_p;
-            y[posid] = y_p;
-            z[posid] = z_p;
-          }
-          posid++;
+          if(!emit(posid++, x_p, y_p, z_p))
+            return (posid - posid_starting);
         } // if in domain
       } // for k from 1 to NN-1
     } // for i from 0 to 30
@@ -541,12 +500,8 @@ generator_icosahedral_lattice(const int lattice_type,
           y_p = y_c + y_p / r;
           z_p = z_c + z_p / r;
           if(in_domain_3d(x_p, y_p, z_p, bbox_min, bbox_max, domain_type)) {
-            if(!count_only) {
-              x[posid] = x_p;
-              y[posid] = y_p;
-              z[posid] = z_p;
-            }
-            posid++;
+            if(!emit(posid++, x_p, y_p, z_p))
+              return (posid - posid_starting);
           } // if in domain
 
         } // for n
@@ -591,15 +546,19 @@ generator_icosahedral_lattice(const int lattice_type,
   return (posid - posid_starting);
 }
 
+// seed of the random lattice, identical on all ranks (see select())
+unsigned random_seed = 0;
+
 /**
  * @brief      Generates a spherical random particle distribution
- *             Depending on the count_only switch--count total number of
- * particles or assign the positions to the position arrays Uses current
- * spherical density profile from density_profiles.h Returns int64_t: total
- * particle number.
+ *             Passes the position of every particle to the emit functor.
+ *             The sequence only depends on random_seed.
+ *             Uses current spherical density profile from density_profiles.h
+ *             Returns int64_t: total particle number.
  *
  * @param      Refer to inputs section in introduction
  */
+template<class EMIT>
 int64_t
 generator_random_lattice(const int lattice_type,
   const int domain_type,
@@ -607,15 +566,12 @@ generator_random_lattice(const int lattice_type,
   const point_t & bbox_max,
   const double sph_sep,
   int64_t posid,
-  bool count_only = true,
-  double x[] = NULL,
-  double y[] = NULL,
-  double z[] = NULL) {
+  EMIT && emit) {
   // sanity check
   assert(lattice_type == 4 and gdimension == 3);
 
   std::default_random_engine generator;
-  generator.seed(std::chrono::system_clock::now().time_since_epoch().count());
+  generator.seed(random_seed);
 
   // save the starting position id
   const int64_t posid_starting = posid;
@@ -650,20 +606,41 @@ generator_random_lattice(const int lattice_type,
 
       if(random <= exact &&
          in_domain_3d(x_p, y_p, z_p, bbox_min, bbox_max, domain_type)) {
-        if(!count_only) {
-          x[posid] = x_p;
-          y[posid] = y_p;
-          z[posid] = z_p;
-        }
         rejected = false;
-        posid++;
+        if(!emit(posid++, x_p, y_p, z_p))
+          return (posid - posid_starting);
       } // if in domain
     }
   }
   return (posid - posid_starting);
 }
 
-// wrappers (because function pointers don't accept default parameters)
+/**
+ * @brief  Stores the positions in the x, y, z arrays
+ */
+struct store_positions {
+  double *x, *y, *z;
+  bool operator()(int64_t posid, double x_p, double y_p, double z_p) const {
+    x[posid] = x_p;
+    y[posid] = y_p;
+    z[posid] = z_p;
+    return true;
+  }
+};
+
+/**
+ * @brief  Only counts the particles
+ */
+struct count_positions {
+  bool operator()(int64_t, double, double, double) const {
+    return true;
+  }
+};
+
+// functor type for the streaming generation
+typedef std::function<bool(int64_t, double, double, double)> lattice_emit_t;
+
+// wrappers (because function pointers don't accept templates)
 int64_t
 generate_lattice_1d(const int lattice_type,
   const int domain_type,
@@ -675,7 +652,7 @@ generate_lattice_1d(const int lattice_type,
   double * y,
   double * z) {
   return generator_lattice_1d(lattice_type, domain_type, bbox_min, bbox_max,
-    sph_sep, posid, false, x, y, z);
+    sph_sep, posid, store_positions{x, y, z});
 }
 int64_t
 count_lattice_1d(const int lattice_type,
@@ -684,8 +661,19 @@ count_lattice_1d(const int lattice_type,
   const point_t & bbox_max,
   const double sph_sep,
   int64_t posid) {
+  return generator_lattice_1d(lattice_type, domain_type, bbox_min, bbox_max,
+    sph_sep, posid, count_positions());
+}
+int64_t
+stream_lattice_1d(const int lattice_type,
+  const int domain_type,
+  const point_t & bbox_min,
+  const point_t & bbox_max,
+  const double sph_sep,
+  int64_t posid,
+  const lattice_emit_t & emit) {
   return generator_lattice_1d(
-    lattice_type, domain_type, bbox_min, bbox_max, sph_sep, posid);
+    lattice_type, domain_type, bbox_min, bbox_max, sph_sep, posid, emit);
 }
 
 int64_t
@@ -699,7 +687,7 @@ generate_lattice_2d(const int lattice_type,
   double * y,
   double * z) {
   return generator_lattice_2d(lattice_type, domain_type, bbox_min, bbox_max,
-    sph_sep, posid, false, x, y, z);
+    sph_sep, posid, store_positions{x, y, z});
 }
 int64_t
 count_lattice_2d(const int lattice_type,
@@ -708,8 +696,19 @@ count_lattice_2d(const int lattice_type,
   const point_t & bbox_max,
   const double sph_sep,
   int64_t posid) {
+  return generator_lattice_2d(lattice_type, domain_type, bbox_min, bbox_max,
+    sph_sep, posid, count_positions());
+}
+int64_t
+stream_lattice_2d(const int lattice_type,
+  const int domain_type,
+  const point_t & bbox_min,
+  const point_t & bbox_max,
+  const double sph_sep,
+  int64_t posid,
+  const lattice_emit_t & emit) {
   return generator_lattice_2d(
-    lattice_type, domain_type, bbox_min, bbox_max, sph_sep, posid);
+    lattice_type, domain_type, bbox_min, bbox_max, sph_sep, posid, emit);
 }
 
 int64_t
@@ -723,7 +722,7 @@ generate_lattice_3d(const int lattice_type,
   double * y,
   double * z) {
   return generator_lattice_3d(lattice_type, domain_type, bbox_min, bbox_max,
-    sph_sep, posid, false, x, y, z);
+    sph_sep, posid, store_positions{x, y, z});
 }
 int64_t
 count_lattice_3d(const int lattice_type,
@@ -732,8 +731,19 @@ count_lattice_3d(const int lattice_type,
   const point_t & bbox_max,
   const double sph_sep,
   int64_t posid) {
+  return generator_lattice_3d(lattice_type, domain_type, bbox_min, bbox_max,
+    sph_sep, posid, count_positions());
+}
+int64_t
+stream_lattice_3d(const int lattice_type,
+  const int domain_type,
+  const point_t & bbox_min,
+  const point_t & bbox_max,
+  const double sph_sep,
+  int64_t posid,
+  const lattice_emit_t & emit) {
   return generator_lattice_3d(
-    lattice_type, domain_type, bbox_min, bbox_max, sph_sep, posid);
+    lattice_type, domain_type, bbox_min, bbox_max, sph_sep, posid, emit);
 }
 
 int64_t
@@ -747,7 +757,7 @@ generate_icosahedral_lattice(const int lattice_type,
   double * y,
   double * z) {
   return generator_icosahedral_lattice(lattice_type, domain_type, bbox_min,
-    bbox_max, sph_sep, posid, false, x, y, z);
+    bbox_max, sph_sep, posid, store_positions{x, y, z});
 }
 int64_t
 count_icosahedral_lattice(const int lattice_type,
@@ -756,8 +766,19 @@ count_icosahedral_lattice(const int lattice_type,
   const point_t & bbox_max,
   const double sph_sep,
   int64_t posid) {
+  return generator_icosahedral_lattice(lattice_type, domain_type, bbox_min,
+    bbox_max, sph_sep, posid, count_positions());
+}
+int64_t
+stream_icosahedral_lattice(const int lattice_type,
+  const int domain_type,
+  const point_t & bbox_min,
+  const point_t & bbox_max,
+  const double sph_sep,
+  int64_t posid,
+  const lattice_emit_t & emit) {
   return generator_icosahedral_lattice(
-    lattice_type, domain_type, bbox_min, bbox_max, sph_sep, posid);
+    lattice_type, domain_type, bbox_min, bbox_max, sph_sep, posid, emit);
 }
 
 int64_t
@@ -771,7 +792,7 @@ generate_random_lattice(const int lattice_type,
   double * y,
   double * z) {
   return generator_random_lattice(lattice_type, domain_type, bbox_min, bbox_max,
-    sph_sep, posid, false, x, y, z);
+    sph_sep, posid, store_positions{x, y, z});
 }
 int64_t
 count_random_lattice(const int lattice_type,
@@ -780,8 +801,19 @@ count_random_lattice(const int lattice_type,
   const point_t & bbox_max,
   const double sph_sep,
   int64_t posid) {
+  return generator_random_lattice(lattice_type, domain_type, bbox_min, bbox_max,
+    sph_sep, posid, count_positions());
+}
+int64_t
+stream_random_lattice(const int lattice_type,
+  const int domain_type,
+  const point_t & bbox_min,
+  const point_t & bbox_max,
+  const double sph_sep,
+  int64_t posid,
+  const lattice_emit_t & emit) {
   return generator_random_lattice(
-    lattice_type, domain_type, bbox_min, bbox_max, sph_sep, posid);
+    lattice_type, domain_type, bbox_min, bbox_max, sph_sep, posid, emit);
 }
 
 // pointer types
@@ -800,11 +832,21 @@ typedef int64_t (*particle_count_function_t)(const int,
   const point_t &,
   const double,
   int64_t);
+typedef int64_t (*lattice_stream_function_t)(const int,
+  const int,
+  const point_t &,
+  const point_t &,
+  const double,
+  int64_t,
+  const lattice_emit_t &);
 lattice_generate_function_t generate;
 particle_count_function_t count;
+lattice_stream_function_t stream;
 
 /**
- * @brief  Installs the 'generate' and 'count' function pointers
+ * @brief  Installs the 'generate', 'count' and 'stream' function pointers
+ *         Collective for the random lattice: the seed is shared by all ranks
+ *         so that each of them can stream a part of the same lattice.
  */
 void
 select() {
@@ -812,10 +854,12 @@ select() {
     case 1:
       generate = generate_lattice_1d;
       count = count_lattice_1d;
+      stream = stream_lattice_1d;
       break;
     case 2:
       generate = generate_lattice_2d;
       count = count_lattice_2d;
+      stream = stream_lattice_2d;
       break;
     case 3:
       switch(param::lattice_type) {
@@ -824,14 +868,20 @@ select() {
         case 2:
           generate = generate_lattice_3d;
           count = count_lattice_3d;
+          stream = stream_lattice_3d;
           break;
         case 3:
           generate = generate_icosahedral_lattice;
           count = count_icosahedral_lattice;
+          stream = stream_icosahedral_lattice;
           break;
         case 4:
           generate = generate_random_lattice;
           count = count_random_lattice;
+          stream = stream_random_lattice;
+          random_seed =
+            std::chrono::system_clock::now().time_since_epoch().count();
+          MPI_Bcast(&random_seed, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
           break;
         default:
           std::cerr << "ERROR: lattice_type not implemented" << std::endl;
@@ -848,3 +898,5 @@ select() {
 
 #undef SQ
 #undef CU
+
+#endif // _lattice_h_
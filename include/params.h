@@ -141,7 +141,8 @@ typedef enum eos_type_keyword_enum{
   eos_polytropic,
   eos_wd,
   eos_ppt,
-  eos_no_eos
+  eos_no_eos,
+  eos_tabulated
 } eos_type_keyword;
 
 
@@ -151,6 +152,12 @@ typedef enum sph_viscosity_keyword_enum {
   visc_cullen
 } sph_viscosity_keyword;
 
+// sort_engine keywords
+typedef enum sort_engine_keyword_enum {
+  sort_psort,
+  sort_keys
+} sort_engine_keyword;
+
 //////////////////////////////////////////////////////////////////////
 //
 // Parameters controlling timestepping and iterations
@@ -188,6 +195,21 @@ DECLARE_PARAM(double, timestep_cfl_factor, 0.25)
 DECLARE_PARAM(bool, adaptive_timestep, false)
 #endif
 
+//- number of power-of-two levels of the block timesteps: the particles
+//  advance with their own step dt*2^k, k < block_timestep_levels, dt being
+//  the smallest step of a cycle. 0 or 1: all the particles share the global timestep.
+//  Requires adaptive_timestep.
+#ifndef block_timestep_levels
+DECLARE_PARAM(int64_t, block_timestep_levels, 0)
+#endif
+
+//- block timesteps: maximum number of levels between the timebins of
+//  neighbor particles, the larger ones are demoted (2: steps within a
+//  factor 4 of the neighbors)
+#ifndef block_timestep_neighbor_levels
+DECLARE_PARAM(int64_t, block_timestep_neighbor_levels, 2)
+#endif
+
 //- number of passes when computing du/dt or de/dt 
 //  to accurately update the pressure (1 or 2)
 #ifndef pressure_updates_number
@@ -232,6 +254,17 @@ DECLARE_KEYWORD_PARAM(sph_kernel, wendland_c4)
 DECLARE_PARAM(double, sph_sinc_index, 4.0)
 #endif
 
+//- if true, the kernel and its gradient are interpolated in a table of the
+//  selected kernel, see kernels::tabulate
+#ifndef sph_kernel_tabulated
+DECLARE_PARAM(bool, sph_kernel_tabulated, false)
+#endif
+
+//- number of intervals of the kernel table
+#ifndef sph_kernel_table_size
+DECLARE_PARAM(int32_t, sph_kernel_table_size, 4096)
+#endif
+
 //- if true, recompute (uniform) smoothing length every timestep
 //  h = average { sph_eta (m/rho)^1/D } (Rosswog'09, eq.51)
 #ifndef sph_update_uniform_h
@@ -244,6 +277,80 @@ DECLARE_PARAM(bool, sph_update_uniform_h, false)
 DECLARE_PARAM(bool, sph_variable_h, false)
 #endif
 
+//- variable smoothing length: relative tolerance on h of the Newton-Raphson
+//  solve of h = sph_eta * kernel_width * (m/rho(h))^1/D
+#ifndef sph_h_tolerance
+DECLARE_PARAM(double, sph_h_tolerance, 1e-4)
+#endif
+
+//- maximum number of Newton-Raphson iterations per particle, and of tree
+//  walks for the particles whose h grows beyond their search radius
+#ifndef sph_h_max_iterations
+DECLARE_PARAM(int32_t, sph_h_max_iterations, 20)
+#endif
+
+//- search radius of the particles walked again, in units of their h
+#ifndef sph_h_search_factor
+DECLARE_PARAM(double, sph_h_search_factor, 1.2)
+#endif
+
+//- if true, the leaf groups of the SPH tree traversal are spread over the
+//  OpenMP threads of each rank
+#ifndef sph_threaded_traversal
+DECLARE_PARAM(bool, sph_threaded_traversal, false)
+#endif
+
+//- if true, the neighbors found by the SPH tree traversal are stored and
+//  reused by the next traversals until the tree is rebuilt, and by the
+//  smoothing length update for the particles whose h does not grow
+#ifndef sph_neighbors_cache
+DECLARE_PARAM(bool, sph_neighbors_cache, false)
+#endif
+
+//- if true, the hydro kernels read the neighbors from contiguous arrays of
+//  fields indexed by the neighbors cache, instead of gathering them from
+//  the bodies
+#ifndef sph_soa_kernels
+DECLARE_PARAM(bool, sph_soa_kernels, false)
+#endif
+
+//- if true, the tree is also stored as an array in depth first order and the
+//  traversals reach the children without hash table lookups
+#ifndef linear_tree
+DECLARE_PARAM(bool, linear_tree, false)
+#endif
+
+//- if true, the tree is built with the OpenMP threads
+#ifndef tree_parallel_build
+DECLARE_PARAM(bool, tree_parallel_build, false)
+#endif
+
+//- if true, the key range is split between the ranks by the cost of the
+//  particles (1 + number of neighbors at the last density computation)
+//  instead of by the number of particles
+#ifndef weighted_decomposition
+DECLARE_PARAM(bool, weighted_decomposition, false)
+#endif
+
+//- distributed sort of the particles:
+//  "psort": sort and split the particles themselves
+//  "keys":  sort and split (key, id) pairs, then move the particles once
+#ifndef sort_engine
+DECLARE_KEYWORD_PARAM(sort_engine, sort_psort)
+#endif
+
+//- if true, the particles are re-sorted locally and only the ones leaving
+//  the key range of their rank are sent. The full sort is used when the
+//  load imbalance (max/mean of the particles or of the cost in weighted
+//  decomposition) exceeds sort_imbalance_max
+#ifndef sort_incremental
+DECLARE_PARAM(bool, sort_incremental, false)
+#endif
+
+#ifndef sort_imbalance_max
+DECLARE_PARAM(double, sort_imbalance_max, 1.1)
+#endif
+
 //
 // Geometric parameters
 //
@@ -371,6 +478,70 @@ DECLARE_PARAM(double, out_h5data_dt, 0)
 DECLARE_PARAM(bool, out_h5data_separate_iterations, false)
 #endif
 
+//- write the HDF5 snapshots from a dedicated I/O thread, the bodies are
+//  packed in a staging buffer and the time loop continues at once
+#ifndef out_h5data_async
+DECLARE_PARAM(bool, out_h5data_async, false)
+#endif
+
+//- maximum number of snapshots in flight in the asynchronous output
+#ifndef out_h5data_async_max
+DECLARE_PARAM(int32_t, out_h5data_async_max, 2)
+#endif
+
+//- comma-separated list of the fields written in the HDF5 snapshots, or
+//  "all". Restarting needs x,y,z,vx,vy,vz,h,rho,P,m,dt,id,type,state (and u
+//  with the internal energy); x,y,z are always written
+#ifndef out_h5data_fields
+DECLARE_STRING_PARAM(out_h5data_fields, "all")
+#endif
+
+//- deflate level (1-9) of the HDF5 snapshots, with the shuffle filter;
+//  0: no compression
+#ifndef out_h5data_compression
+DECLARE_PARAM(int32_t, out_h5data_compression, 0)
+#endif
+
+//- chunk size (number of particles) of the HDF5 datasets; 0: contiguous
+//  datasets, or chunks of 65536 particles if compressed
+#ifndef out_h5data_chunk
+DECLARE_PARAM(int64_t, out_h5data_chunk, 0)
+#endif
+
+//- write the fields not needed for restarting in single precision
+#ifndef out_h5data_float32
+DECLARE_PARAM(bool, out_h5data_float32, false)
+#endif
+
+//- checkpoint frequency by iteration; 0: no checkpoint. The checkpoint is a
+//  raw dump of the bodies in one file per rank, only the last one is kept
+#ifndef out_checkpoint_every
+DECLARE_PARAM(int32_t, out_checkpoint_every, 0)
+#endif
+
+//- prefix of the checkpoint files: <prefix>_<iteration>.<rank>.chk
+#ifndef checkpoint_prefix
+DECLARE_STRING_PARAM(checkpoint_prefix, "checkpoint")
+#endif
+
+//- restart from the checkpoint of initial_iteration instead of the HDF5
+//  output file
+#ifndef restart_from_checkpoint
+DECLARE_PARAM(bool, restart_from_checkpoint, false)
+#endif
+
+//- phase timers output frequency by iteration; 0: no output. The min, mean
+//  and max over the ranks of the time spent in every timed region since the
+//  previous output are appended to out_timers_file
+#ifndef out_timers_every
+DECLARE_PARAM(int32_t, out_timers_every, 0)
+#endif
+
+//- CSV file of the phase timers
+#ifndef out_timers_file
+DECLARE_STRING_PARAM(out_timers_file, "timers.csv")
+#endif
+
 // WVT parameters
 // Method:
 // * Diehl et al., PASA 2015
@@ -464,6 +635,7 @@ DECLARE_PARAM(double, wvt_radius, 1.0)
 //  * "polytropic"
 //  * "white dwarf"
 //  * "piecewise polytropic"
+//  * "tabulated": HDF5 table read from eos_tab_file_path
 #ifndef eos_type
 DECLARE_KEYWORD_PARAM(eos_type, eos_ideal)
 #endif
@@ -473,6 +645,48 @@ DECLARE_KEYWORD_PARAM(eos_type, eos_ideal)
 DECLARE_STRING_PARAM(eos_tab_file_path, ".")
 #endif
 
+//- if true, the pressure and sound speed of the analytic EOS (ideal fluid or
+//  white dwarf) are interpolated in a table of it, see eos::tabulate
+#ifndef eos_tabulate
+DECLARE_PARAM(bool, eos_tabulate, false)
+#endif
+
+//- ranges of the table of the analytic EOS: density, specific internal
+//  energy and electron fraction
+#ifndef eos_tab_rho_min
+DECLARE_PARAM(double, eos_tab_rho_min, 1e-6)
+#endif
+
+#ifndef eos_tab_rho_max
+DECLARE_PARAM(double, eos_tab_rho_max, 1e12)
+#endif
+
+#ifndef eos_tab_eps_min
+DECLARE_PARAM(double, eos_tab_eps_min, 1e-6)
+#endif
+
+#ifndef eos_tab_eps_max
+DECLARE_PARAM(double, eos_tab_eps_max, 1e20)
+#endif
+
+#ifndef eos_tab_ye_min
+DECLARE_PARAM(double, eos_tab_ye_min, 0.5)
+#endif
+
+#ifndef eos_tab_ye_max
+DECLARE_PARAM(double, eos_tab_ye_max, 0.5)
+#endif
+
+//- number of points per decade of density and energy of the table
+#ifndef eos_tab_points_per_decade
+DECLARE_PARAM(int32_t, eos_tab_points_per_decade, 20)
+#endif
+
+//- number of points in electron fraction, if eos_tab_ye_max > eos_tab_ye_min
+#ifndef eos_tab_ye_points
+DECLARE_PARAM(int32_t, eos_tab_ye_points, 11)
+#endif
+
 //- polytropic index
 #ifndef poly_gamma
 DECLARE_PARAM(double, poly_gamma, 1.4)
@@ -719,6 +933,12 @@ DECLARE_PARAM(int, lattice_type, 0)
 DECLARE_PARAM(double, lattice_perturbation_amplitude, 0.0)
 #endif
 
+// initial data generators: number of particles generated and written at
+// once by each rank (bounds the generator memory footprint)
+#ifndef lattice_stream_chunk
+DECLARE_PARAM(int64_t, lattice_stream_chunk, 1048576)
+#endif
+
 // in several tests: initial velocity of the flow
 #ifndef flow_velocity
 DECLARE_PARAM(double, flow_velocity, 0.0)
@@ -781,6 +1001,39 @@ DECLARE_PARAM(double, airfoil_anchor_y, 0.0)
 DECLARE_PARAM(double, airfoil_attack_angle, 0.0)
 #endif
 
+//
+// Benchmark suite parameters
+//
+//- number of timed repetitions of every benchmark
+#ifndef bench_repetitions
+DECLARE_PARAM(int32_t, bench_repetitions, 5)
+#endif
+
+//- number of evaluations per rank of every kernel and kernel gradient
+#ifndef bench_kernel_samples
+DECLARE_PARAM(int64_t, bench_kernel_samples, 1000000)
+#endif
+
+//- only run the benchmarks whose name contains this string; "": all
+#ifndef bench_filter
+DECLARE_STRING_PARAM(bench_filter, "")
+#endif
+
+//- JSON file of the results
+#ifndef bench_output
+DECLARE_STRING_PARAM(bench_output, "benchmarks.json")
+#endif
+
+//- JSON results of a previous run to compare with; "": no comparison
+#ifndef bench_baseline
+DECLARE_STRING_PARAM(bench_baseline, "")
+#endif
+
+//- relative slowdown over the baseline reported as a regression
+#ifndef bench_tolerance
+DECLARE_PARAM(double, bench_tolerance, 0.1)
+#endif
+
 // ---
 
 /*!
@@ -858,6 +1111,14 @@ set_param(const std::string & param_name, const std::string & param_value) {
   READ_BOOLEAN_PARAM(adaptive_timestep)
 #endif
 
+#ifndef block_timestep_levels
+  READ_NUMERIC_PARAM(block_timestep_levels)
+#endif
+
+#ifndef block_timestep_neighbor_levels
+  READ_NUMERIC_PARAM(block_timestep_neighbor_levels)
+#endif
+
 # ifndef pressure_updates_number
   READ_NUMERIC_PARAM(pressure_updates_number)
 # endif
@@ -933,6 +1194,14 @@ set_param(const std::string & param_name, const std::string & param_value) {
   READ_NUMERIC_PARAM(sph_sinc_index)
 #endif
 
+#ifndef sph_kernel_tabulated
+  READ_BOOLEAN_PARAM(sph_kernel_tabulated)
+#endif
+
+#ifndef sph_kernel_table_size
+  READ_NUMERIC_PARAM(sph_kernel_table_size)
+#endif
+
 #ifndef sph_update_uniform_h
   READ_BOOLEAN_PARAM(sph_update_uniform_h)
 #endif
@@ -941,6 +1210,50 @@ set_param(const std::string & param_name, const std::string & param_value) {
   READ_BOOLEAN_PARAM(sph_variable_h)
 #endif
 
+#ifndef sph_h_tolerance
+  READ_NUMERIC_PARAM(sph_h_tolerance)
+#endif
+
+#ifndef sph_h_max_iterations
+  READ_NUMERIC_PARAM(sph_h_max_iterations)
+#endif
+
+#ifndef sph_h_search_factor
+  READ_NUMERIC_PARAM(sph_h_search_factor)
+#endif
+
+#ifndef sph_threaded_traversal
+  READ_BOOLEAN_PARAM(sph_threaded_traversal)
+#endif
+
+#ifndef sph_neighbors_cache
+  READ_BOOLEAN_PARAM(sph_neighbors_cache)
+#endif
+
+#ifndef sph_soa_kernels
+  READ_BOOLEAN_PARAM(sph_soa_kernels)
+#endif
+
+#ifndef linear_tree
+  READ_BOOLEAN_PARAM(linear_tree)
+#endif
+
+#ifndef tree_parallel_build
+  READ_BOOLEAN_PARAM(tree_parallel_build)
+#endif
+
+#ifndef weighted_decomposition
+  READ_BOOLEAN_PARAM(weighted_decomposition)
+#endif
+
+#ifndef sort_incremental
+  READ_BOOLEAN_PARAM(sort_incremental)
+#endif
+
+#ifndef sort_imbalance_max
+  READ_NUMERIC_PARAM(sort_imbalance_max)
+#endif
+
   // geometric configuration  -----------------------------------------------
 #ifndef domain_type
   READ_NUMERIC_PARAM(domain_type)
@@ -1036,6 +1349,50 @@ set_param(const std::string & param_name, const std::string & param_value) {
   READ_BOOLEAN_PARAM(out_h5data_separate_iterations)
 #endif
 
+#ifndef out_h5data_async
+  READ_BOOLEAN_PARAM(out_h5data_async)
+#endif
+
+#ifndef out_h5data_async_max
+  READ_NUMERIC_PARAM(out_h5data_async_max)
+#endif
+
+#ifndef out_h5data_fields
+  READ_STRING_PARAM(out_h5data_fields)
+#endif
+
+#ifndef out_h5data_compression
+  READ_NUMERIC_PARAM(out_h5data_compression)
+#endif
+
+#ifndef out_h5data_chunk
+  READ_NUMERIC_PARAM(out_h5data_chunk)
+#endif
+
+#ifndef out_h5data_float32
+  READ_BOOLEAN_PARAM(out_h5data_float32)
+#endif
+
+#ifndef out_checkpoint_every
+  READ_NUMERIC_PARAM(out_checkpoint_every)
+#endif
+
+#ifndef checkpoint_prefix
+  READ_STRING_PARAM(checkpoint_prefix)
+#endif
+
+#ifndef restart_from_checkpoint
+  READ_BOOLEAN_PARAM(restart_from_checkpoint)
+#endif
+
+#ifndef out_timers_every
+  READ_NUMERIC_PARAM(out_timers_every)
+#endif
+
+#ifndef out_timers_file
+  READ_STRING_PARAM(out_timers_file)
+#endif
+
   // wvt parameters ---------------------------------------------------------
 #ifndef wvt_method
   READ_STRING_PARAM(wvt_method)
@@ -1098,6 +1455,9 @@ set_param(const std::string & param_name, const std::string & param_value) {
          or boost::iequals(str_value, "none"))
       _eos_type = eos_no_eos;
 
+    else if(boost::iequals(str_value, "tabulated"))
+      _eos_type = eos_tabulated;
+
     else {
       assert(false);
     }
@@ -1117,6 +1477,42 @@ set_param(const std::string & param_name, const std::string & param_value) {
   READ_STRING_PARAM(eos_tab_file_path)
 #endif
 
+#ifndef eos_tabulate
+  READ_BOOLEAN_PARAM(eos_tabulate)
+#endif
+
+#ifndef eos_tab_rho_min
+  READ_NUMERIC_PARAM(eos_tab_rho_min)
+#endif
+
+#ifndef eos_tab_rho_max
+  READ_NUMERIC_PARAM(eos_tab_rho_max)
+#endif
+
+#ifndef eos_tab_eps_min
+  READ_NUMERIC_PARAM(eos_tab_eps_min)
+#endif
+
+#ifndef eos_tab_eps_max
+  READ_NUMERIC_PARAM(eos_tab_eps_max)
+#endif
+
+#ifndef eos_tab_ye_min
+  READ_NUMERIC_PARAM(eos_tab_ye_min)
+#endif
+
+#ifndef eos_tab_ye_max
+  READ_NUMERIC_PARAM(eos_tab_ye_max)
+#endif
+
+#ifndef eos_tab_points_per_decade
+  READ_NUMERIC_PARAM(eos_tab_points_per_decade)
+#endif
+
+#ifndef eos_tab_ye_points
+  READ_NUMERIC_PARAM(eos_tab_ye_points)
+#endif
+
 #ifndef poly_gamma
   READ_NUMERIC_PARAM(poly_gamma)
 #endif
@@ -1159,6 +1555,33 @@ set_param(const std::string & param_name, const std::string & param_value) {
     unknown_param = false;
   }
 
+// parsing sort_engine keywords
+  if (param_name == "sort_engine") {
+#   ifndef sort_engine
+    if (boost::iequals(str_value,"psort"))
+      _sort_engine =             sort_psort;
+
+    else if (boost::iequals(str_value,"keys"))
+      _sort_engine =              sort_keys;
+
+    else {
+      log_one(error)
+          << "ERROR: wrong value for sort_engine parameter"
+          << std::endl;
+      exit(2);
+    }
+#   else
+    if (not boost::iequals(str_value,QUOTE(sort_engine))) {
+      log_one(error)
+          << "ERROR: sort_engine #define'd as \"" << QUOTE(sort_engine)
+          << "\" but is reset to \"" << str_value << "\" in parameter file"
+          << std::endl;
+      exit(2);
+    }
+#   endif
+    unknown_param = false;
+  }
+
 #ifndef sph_viscosity_alpha
   READ_NUMERIC_PARAM(sph_viscosity_alpha)
 #endif
@@ -1312,6 +1735,10 @@ set_param(const std::string & param_name, const std::string & param_value) {
   READ_NUMERIC_PARAM(lattice_perturbation_amplitude)
 #endif
 
+#ifndef lattice_stream_chunk
+  READ_NUMERIC_PARAM(lattice_stream_chunk)
+#endif
+
 #ifndef flow_velocity
   READ_NUMERIC_PARAM(flow_velocity)
 #endif
@@ -1365,6 +1792,31 @@ set_param(const std::string & param_name, const std::string & param_value) {
   READ_NUMERIC_PARAM(airfoil_attack_angle)
 #endif
 
+  // benchmark parameters  --------------------------------------------------
+#ifndef bench_repetitions
+  READ_NUMERIC_PARAM(bench_repetitions)
+#endif
+
+#ifndef bench_kernel_samples
+  READ_NUMERIC_PARAM(bench_kernel_samples)
+#endif
+
+#ifndef bench_filter
+  READ_STRING_PARAM(bench_filter)
+#endif
+
+#ifndef bench_output
+  READ_STRING_PARAM(bench_output)
+#endif
+
+#ifndef bench_baseline
+  READ_STRING_PARAM(bench_baseline)
+#endif
+
+#ifndef bench_tolerance
+  READ_NUMERIC_PARAM(bench_tolerance)
+#endif
+
   // unknown parameter -------------------------------
   if(unknown_param) {
     log_one(error) << "ERROR: unknown parameter " << param_name << endl;
@@ -47,6 +47,12 @@ double total_kinetic_energy;
 double total_internal_energy;
 double total_gravitational_energy;
 double velocity_part;
+// Total energy at the first scalar output of the run and largest relative
+// variation since, at the outputs where the particles are synchronized
+double initial_total_energy;
+double energy_drift;
+// Block timesteps: number of particles per timebin
+std::vector<int64_t> timebin_histogram;
 
 /**
  * @brief      Compute the linear momentum
@@ -123,6 +129,20 @@ compute_total_energy(std::vector<body> & bodies) {
   mpi_utils::reduce_sum(total_energy);
 }
 
+/**
+ * @brief      Block timesteps: count the particles per timebin
+ *
+ * @param      bodies  Vector of all the local bodies
+ */
+void
+compute_timebin_histogram(std::vector<body> & bodies) {
+  timebin_histogram.assign(param::block_timestep_levels, 0);
+  for(size_t i = 0; i < bodies.size(); ++i)
+    ++timebin_histogram[bodies[i].getTimebin()];
+  MPI_Allreduce(MPI_IN_PLACE, timebin_histogram.data(),
+    timebin_histogram.size(), MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+}
+
 /**
  * @brief      Sum up total kinetic energy
  *
@@ -227,6 +247,12 @@ set_initial_time_iteration() {
   totaltime = initial_time;
   dt = initial_dt;
   dt_saved = 0.0;
+  block_tick = -1;
+  block_step = 1;
+  block_dt = 0.0;
+  block_time_end = totaltime;
+  initial_total_energy = 0.0;
+  energy_drift = 0.0;
 
   if (out_screen_dt > 0.0) { // set next screen output time
     t_screen_output = out_screen_dt*((int64_t)(totaltime/out_screen_dt));
@@ -322,6 +348,19 @@ scalar_output(body_system<double, gdimension> & bs, const int rank) {
   bs.get_all(compute_total_internal_energy);
   bs.get_all(compute_total_gravitational_energy);
   bs.get_all(compute_total_ang_mom);
+  if (physics::iteration == param::initial_iteration)
+    initial_total_energy = total_energy;
+  if (initial_total_energy != 0. &&
+      integration::block_now() % integration::block_period() == 0)
+    energy_drift = std::max(energy_drift,
+      fabs(total_energy / initial_total_energy - 1.));
+  if (integration::block_timesteps_enabled()) {
+    bs.get_all(compute_timebin_histogram);
+    std::ostringstream oss_bins;
+    for(auto n : timebin_histogram)
+      oss_bins << " " << n;
+    log_one(info) << "Particles per timebin:" << oss_bins.str() << std::endl;
+  }
 
   // output only from rank #0
   if(rank != 0)
@@ -424,9 +463,49 @@ h5data_output(body_system<double, gdimension> & bs, const int rank) {
     if (iteration % out_h5data_every != 0)
       return;
   }
+  timers::scope_t timer("io");
   bs.write_bodies(output_h5data_prefix, iteration, totaltime);
 } // h5data_output
 
+/**
+ * @brief Periodic checkpoint for the restarts, delayed to the end of the
+ * cycle of the block timesteps
+ */
+void
+checkpoint_output(body_system<double, gdimension> & bs, const int rank) {
+  using namespace param;
+  using namespace physics;
+  static bool pending = false;
+
+  if (out_checkpoint_every <= 0)
+    return;
+  if (iteration % out_checkpoint_every == 0)
+    pending = true;
+  // With block timesteps the particles are synchronized at the end of a
+  // cycle only, the restart starts a new cycle
+  if (!pending ||
+      integration::block_now() % integration::block_period() != 0)
+    return;
+  pending = false;
+  timers::scope_t timer("io");
+  bs.write_checkpoint(checkpoint_prefix, iteration);
+} // checkpoint_output
+
+/**
+ * @brief Periodic output of the phase timers: the file is truncated at the
+ * first output of the run, then the timers are appended. Collective.
+ */
+void
+timers_output(const int rank) {
+  static bool first_time = true;
+  if (param::out_timers_every <= 0)
+    return;
+  if (physics::iteration % param::out_timers_every != 0)
+    return;
+  timers::output(param::out_timers_file, physics::iteration, first_time);
+  first_time = false;
+} // timers_output
+
 bool
 check_conservation(const std::vector<e_conservation> & check) {
   int rank;
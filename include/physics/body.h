@@ -36,6 +36,18 @@ enum particle_type_t : int { NORMAL = 0, WALL = 1 };
 
 enum state_t : int { NONE = 0, STAR1 = 1, STAR2 = 2, POINTP = 3 };
 
+// Fields of the bodies sent in the ghosts update, combined as bitmask
+enum ghost_field_t : unsigned {
+  GHOST_DENSITY = 1 << 0,
+  GHOST_PRESSURE = 1 << 1,
+  GHOST_SOUNDSPEED = 1 << 2,
+  GHOST_ALPHA = 1 << 3,
+  GHOST_DIVERGENCEV = 1 << 4,
+  GHOST_VELOCITY = 1 << 5,
+  GHOST_VELOCITYHALF = 1 << 6,
+  GHOST_TIMEBIN = 1 << 7
+};
+
 template<class KEY>
 class body_u : public flecsi::topology::entity<gdimension, type_t, KEY>
 {
@@ -49,7 +61,7 @@ class body_u : public flecsi::topology::entity<gdimension, type_t, KEY>
 public:
   body_u()
     : flecsi::topology::entity<gdimension, type_t, KEY>(), type_(NORMAL),
-      state_(NONE){};
+      neighbors_(0), state_(NONE), timebin_(0){};
 
   double getPressure() const {
     return pressure_;
@@ -98,6 +110,9 @@ public:
   double getDt() {
     return dt_;
   };
+  int getTimebin() const {
+    return timebin_;
+  }
   particle_type_t getType() const {
     return type_;
   };
@@ -144,6 +159,9 @@ public:
   void setDt(const double & dt) {
     dt_ = dt;
   }
+  void setTimebin(const int & timebin) {
+    timebin_ = timebin;
+  }
   void setType(const particle_type_t & type) {
     type_ = type;
   }
@@ -198,6 +216,70 @@ public:
     return signalspeed_;
   }
 
+  /**
+   * @brief Number of values used by the fields in the ghosts update
+   */
+  static int ghost_size(const unsigned & fields) {
+    int n = 0;
+    n += !!(fields & GHOST_DENSITY);
+    n += !!(fields & GHOST_PRESSURE);
+    n += !!(fields & GHOST_SOUNDSPEED);
+    n += !!(fields & GHOST_ALPHA);
+    n += !!(fields & GHOST_DIVERGENCEV);
+    n += !!(fields & GHOST_VELOCITY) * dimension;
+    n += !!(fields & GHOST_VELOCITYHALF) * dimension;
+    n += !!(fields & GHOST_TIMEBIN);
+    return n;
+  }
+
+  /**
+   * @brief Pack the fields for the ghosts update in buf
+   */
+  void pack_ghost(const unsigned & fields, element_t * buf) const {
+    if(fields & GHOST_DENSITY)
+      *buf++ = density_;
+    if(fields & GHOST_PRESSURE)
+      *buf++ = pressure_;
+    if(fields & GHOST_SOUNDSPEED)
+      *buf++ = soundspeed_;
+    if(fields & GHOST_ALPHA)
+      *buf++ = alpha_;
+    if(fields & GHOST_DIVERGENCEV)
+      *buf++ = divergenceV_;
+    if(fields & GHOST_VELOCITY)
+      for(size_t d = 0; d < dimension; ++d)
+        *buf++ = velocity_[d];
+    if(fields & GHOST_VELOCITYHALF)
+      for(size_t d = 0; d < dimension; ++d)
+        *buf++ = velocityhalf_[d];
+    if(fields & GHOST_TIMEBIN)
+      *buf++ = timebin_;
+  }
+
+  /**
+   * @brief Unpack the fields of the ghosts update from buf
+   */
+  void unpack_ghost(const unsigned & fields, const element_t * buf) {
+    if(fields & GHOST_DENSITY)
+      density_ = *buf++;
+    if(fields & GHOST_PRESSURE)
+      pressure_ = *buf++;
+    if(fields & GHOST_SOUNDSPEED)
+      soundspeed_ = *buf++;
+    if(fields & GHOST_ALPHA)
+      alpha_ = *buf++;
+    if(fields & GHOST_DIVERGENCEV)
+      divergenceV_ = *buf++;
+    if(fields & GHOST_VELOCITY)
+      for(size_t d = 0; d < dimension; ++d)
+        velocity_[d] = *buf++;
+    if(fields & GHOST_VELOCITYHALF)
+      for(size_t d = 0; d < dimension; ++d)
+        velocityhalf_[d] = *buf++;
+    if(fields & GHOST_TIMEBIN)
+      timebin_ = static_cast<int>(*buf++);
+  }
+
   friend std::ostream & operator<<(std::ostream & os, const body_u & b) {
     // TODO change regarding to dimension
     os << std::setprecision(10);
@@ -247,6 +329,7 @@ private:
   particle_type_t type_;
   size_t neighbors_;
   state_t state_;
+  int timebin_; // level of the block timestep, step block_dt * 2^timebin_
   double pressuremin_;
   double signalspeed_;
 }; // class body
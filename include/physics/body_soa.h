@@ -0,0 +1,169 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file body_soa.h
+ * @brief Structure of arrays storage of the bodies fields read from the
+ *        neighbors. The local bodies are stored first, followed by the
+ *        ghosts, in the order of the tree entities and shared entities.
+ */
+
+#ifndef body_soa_h
+#define body_soa_h
+
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "body.h"
+
+/**
+ * @brief Allocator returning ALIGN bytes aligned memory
+ */
+template<typename T, size_t ALIGN = 64>
+struct aligned_allocator {
+  using value_type = T;
+
+  template<typename U>
+  struct rebind {
+    using other = aligned_allocator<U, ALIGN>;
+  };
+
+  aligned_allocator() = default;
+  template<typename U>
+  aligned_allocator(const aligned_allocator<U, ALIGN> &) {}
+
+  T * allocate(size_t n) {
+    size_t bytes = (n * sizeof(T) + ALIGN - 1) / ALIGN * ALIGN;
+    void * ptr = std::aligned_alloc(ALIGN, bytes);
+    if(ptr == nullptr)
+      throw std::bad_alloc();
+    return static_cast<T *>(ptr);
+  }
+
+  void deallocate(T * ptr, size_t) {
+    std::free(ptr);
+  }
+
+  template<typename U>
+  bool operator==(const aligned_allocator<U, ALIGN> &) const {
+    return true;
+  }
+  template<typename U>
+  bool operator!=(const aligned_allocator<U, ALIGN> &) const {
+    return false;
+  }
+}; // struct aligned_allocator
+
+template<class BODY>
+class body_soa_u
+{
+
+  static const size_t dimension = gdimension;
+  using element_t = type_t;
+  using array_t = std::vector<element_t, aligned_allocator<element_t>>;
+
+public:
+  /**
+   * @brief Copy the fields of the local bodies and the ghosts.
+   * The coordinates, smoothing length and mass are always loaded, the other
+   * fields only if present in the ghost_field_t bitmask.
+   */
+  void load(const unsigned & fields,
+    const std::vector<BODY> & local,
+    const std::vector<BODY> & ghosts) {
+    nlocal_ = local.size();
+    size_ = local.size() + ghosts.size();
+    fields_ = fields;
+    for(size_t d = 0; d < dimension; ++d)
+      x[d].resize(size_);
+    h.resize(size_);
+    m.resize(size_);
+    if(fields & GHOST_DENSITY)
+      rho.resize(size_);
+    if(fields & GHOST_PRESSURE)
+      P.resize(size_);
+    if(fields & GHOST_SOUNDSPEED)
+      c.resize(size_);
+    if(fields & GHOST_ALPHA)
+      alpha.resize(size_);
+    if(fields & GHOST_DIVERGENCEV)
+      divv.resize(size_);
+    for(size_t d = 0; d < dimension; ++d) {
+      if(fields & GHOST_VELOCITY)
+        v[d].resize(size_);
+      if(fields & GHOST_VELOCITYHALF)
+        v12[d].resize(size_);
+    } // for
+
+    const int64_t nghosts = ghosts.size();
+#pragma omp parallel for schedule(static)
+    for(int64_t i = 0; i < nlocal_; ++i)
+      load_(i, local[i]);
+#pragma omp parallel for schedule(static)
+    for(int64_t i = 0; i < nghosts; ++i)
+      load_(nlocal_ + i, ghosts[i]);
+  }
+
+  int64_t size() const {
+    return size_;
+  }
+
+  int64_t nlocal() const {
+    return nlocal_;
+  }
+
+  unsigned fields() const {
+    return fields_;
+  }
+
+  array_t x[dimension];
+  array_t h, m;
+  array_t rho, P, c, alpha, divv;
+  array_t v[dimension], v12[dimension];
+
+private:
+  void load_(const int64_t & i, const BODY & b) {
+    for(size_t d = 0; d < dimension; ++d)
+      x[d][i] = b.coordinates()[d];
+    h[i] = b.radius();
+    m[i] = b.mass();
+    if(fields_ & GHOST_DENSITY)
+      rho[i] = b.getDensity();
+    if(fields_ & GHOST_PRESSURE)
+      P[i] = b.getPressure();
+    if(fields_ & GHOST_SOUNDSPEED)
+      c[i] = b.getSoundspeed();
+    if(fields_ & GHOST_ALPHA)
+      alpha[i] = b.getAlpha();
+    if(fields_ & GHOST_DIVERGENCEV)
+      divv[i] = b.getDivergenceV();
+    for(size_t d = 0; d < dimension; ++d) {
+      if(fields_ & GHOST_VELOCITY)
+        v[d][i] = b.getVelocity()[d];
+      if(fields_ & GHOST_VELOCITYHALF)
+        v12[d][i] = b.getVelocityhalf()[d];
+    } // for
+  }
+
+  int64_t nlocal_ = 0;
+  int64_t size_ = 0;
+  unsigned fields_ = 0;
+}; // class body_soa_u
+
+#endif // body_soa_h
@@ -37,6 +37,15 @@ double t_h5data_output = 0.0;
 double t_screen_output = 0.0;
 double t_scalar_output = 0.0;
 int64_t iteration = 0;
+// Block timesteps: tick of the cycle at the start of the iteration, the
+// initial iteration ends a cycle
+int64_t block_tick = -1;
+// Block timesteps: ticks in the iteration, dt = block_step * block_dt
+int64_t block_step = 1;
+// Block timesteps: duration of a tick, the smallest step of the cycle
+double block_dt = 0.0;
+// Block timesteps: time at the end of the cycle
+double block_time_end = 0.0;
 } // namespace physics
 
 #include "eforce.h"
@@ -116,6 +125,46 @@ compute_cofm(node * cofm, std::vector<body *> ents, std::vector<node *> nodes) {
   cofm->set_bmin(bmin);
   cofm->set_bmax(bmax);
 
+#if FMM_ORDER > 1
+  // Multipole moments around the center of mass, the dipole vanishes
+  flecsi::sym_tensor_rank2 Q = 0.;
+#if FMM_ORDER > 2
+  flecsi::sym_tensor_rank3 H = 0.;
+#endif
+  for(int i = 0; i < ents.size(); ++i) {
+    const double m = ents[i]->mass();
+    const point_t d = ents[i]->coordinates() - coordinates;
+    for(int a = 0; a < gdimension; ++a)
+      for(int b = a; b < gdimension; ++b) {
+        Q(a, b) += m * d[a] * d[b];
+#if FMM_ORDER > 2
+        for(int c = b; c < gdimension; ++c)
+          H(a, b, c) += m * d[a] * d[b] * d[c];
+#endif
+      } // for
+  } // for
+  for(int i = 0; i < nodes.size(); ++i) {
+    // Shift the moments of the sub-node to the new center of mass
+    const node * c = nodes[i];
+    const double m = c->mass();
+    const point_t d = c->coordinates() - coordinates;
+    const flecsi::sym_tensor_rank2 & Qc = c->quad();
+    for(int a = 0; a < gdimension; ++a)
+      for(int b = a; b < gdimension; ++b) {
+        Q(a, b) += Qc(a, b) + m * d[a] * d[b];
+#if FMM_ORDER > 2
+        for(int e = b; e < gdimension; ++e)
+          H(a, b, e) += c->octo()(a, b, e) + d[a] * Qc(b, e) +
+                        d[b] * Qc(a, e) + d[e] * Qc(a, b) +
+                        m * d[a] * d[b] * d[e];
+#endif
+      } // for
+  } // for
+  cofm->quad() = Q;
+#if FMM_ORDER > 2
+  cofm->octo() = H;
+#endif
+#endif
 }
 
 /**
@@ -155,8 +204,7 @@ recompute_pressure_soundspeed(body& particle) {
   const double uint = particle.getInternalenergy();
   const double dudt = particle.getDudt();
   particle.setInternalenergy(uint + 0.5*dt*dudt);
-  eos::compute_pressure(particle);
-  eos::compute_soundspeed(particle);
+  eos::compute_pressure_soundspeed(particle);
   particle.setInternalenergy(uint);
 }
 
@@ -176,11 +224,113 @@ recompute_pressure_soundspeed_thermokinetic(body& particle) {
   const point_t & a_a = particle.getAcceleration();
   const double v_dot_a = flecsi::dot(v_a, a_a);
   particle.setInternalenergy(uint + 0.5*dt*(dedt - v_dot_a));
-  eos::compute_pressure(particle);
-  eos::compute_soundspeed(particle);
+  eos::compute_pressure_soundspeed(particle);
   particle.setInternalenergy(uint);
 }
 
+/*============================================================================*/
+/*   Hydro passes                                                             */
+/*============================================================================*/
+/**
+ * The passes over the neighbors are written once in hydro_t, for a physics P
+ * providing the kernel, the artificial viscosity and the EOS:
+ * - runtime_physics_t calls the ones installed by kernels::select,
+ *   viscosity::select and eos::select, through function pointers unless they
+ *   are fixed in user.h;
+ * - static_physics_t fixes them at compile time so that the calls are inlined
+ *   in the loops over the neighbors. With ENABLE_PHYSICS_PIPELINES,
+ *   select_pipeline instantiates the passes for the common combinations and
+ *   picks the one of the parameter file.
+ */
+struct runtime_physics_t {
+  static double kernel(const double & r, const double & h) {
+    return kernels::sph_kernel_function(r, h);
+  }
+  static point_t kernel_gradient(const point_t & pos, const double & h) {
+    return kernels::sph_kernel_gradient(pos, h);
+  }
+  static double viscosity(const double alpha_ab,
+    const double rho_ab,
+    const double c_ab,
+    const double mu_ab) {
+    return viscosity::sph_artificial_viscosity(alpha_ab, rho_ab, c_ab, mu_ab);
+  }
+  static void pressure_soundspeed(body & particle) {
+    eos::compute_pressure_soundspeed(particle);
+  }
+  static bool cullen() {
+    return sph_viscosity == visc_cullen;
+  }
+}; // struct runtime_physics_t
+
+//! Analytic kernel K for static_physics_t
+template<param::sph_kernel_keyword K>
+struct analytic_kernel_t {
+  static double kernel(const double & r, const double & h) {
+    return kernels::kernel<K, gdimension>(r, h);
+  }
+  static point_t kernel_gradient(const point_t & pos, const double & h) {
+    return kernels::kernel_gradient<K, gdimension>(pos, h);
+  }
+}; // struct analytic_kernel_t
+
+//! Table of any kernel for static_physics_t, see kernels::tabulate
+struct tabulated_kernel_t {
+  static double kernel(const double & r, const double & h) {
+    return kernels::tabulated_kernel(r, h);
+  }
+  static point_t kernel_gradient(const point_t & pos, const double & h) {
+    return kernels::tabulated_kernel_gradient(pos, h);
+  }
+}; // struct tabulated_kernel_t
+
+template<typename KERNEL,
+  param::sph_viscosity_keyword V,
+  param::eos_type_keyword E>
+struct static_physics_t : KERNEL {
+  static double viscosity(const double alpha_ab,
+    const double rho_ab,
+    const double c_ab,
+    const double mu_ab) {
+    return viscosity::viscosity_function<V>(alpha_ab, rho_ab, c_ab, mu_ab);
+  }
+  static void pressure_soundspeed(body & particle) {
+    eos::pressure_soundspeed<E>(particle);
+  }
+  static constexpr bool cullen() {
+    return V == visc_cullen;
+  }
+}; // struct static_physics_t
+
+template<typename P>
+class hydro_t
+{
+public:
+  static void compute_density(body & particle, std::vector<body *> & nbs);
+  static void compute_divv(body & particle, std::vector<body *> & nbs);
+  static void compute_density_pressure_soundspeed(body & particle,
+    std::vector<body *> & nbs);
+  static void compute_density_soa(body & particle,
+    const body_soa & soa,
+    const int64_t * nbs,
+    const int64_t & n_nb);
+  static void compute_divv_soa(body & particle,
+    const body_soa & soa,
+    const int64_t * nbs,
+    const int64_t & n_nb);
+  static void compute_density_pressure_soundspeed_soa(body & particle,
+    const body_soa & soa,
+    const int64_t * nbs,
+    const int64_t & n_nb);
+  static void compute_acceleration(body & particle, std::vector<body *> & nbs);
+  static void compute_acceleration_soa(body & particle,
+    const body_soa & soa,
+    const int64_t * nbs,
+    const int64_t & n_nb);
+  static void compute_dudt(body & particle, std::vector<body *> & nbs);
+  static void compute_dedt(body & particle, std::vector<body *> & nbs);
+}; // class hydro_t
+
 /**
  * @brief      Computes the density in "vanilla sph" formulation
  *             [Rosswog'09, eq.(13)]:
@@ -190,8 +340,9 @@ recompute_pressure_soundspeed_thermokinetic(body& particle) {
  * @param      particle  The particle body
  * @param      nbs       Vector of neighbor particles
  */
+template<typename P>
 void
-compute_density(body & particle, std::vector<body *> & nbs) {
+hydro_t<P>::compute_density(body & particle, std::vector<body *> & nbs) {
   using namespace kernels;
   const double h_a = particle.radius();
   const point_t pos_a = particle.coordinates();
@@ -209,7 +360,7 @@ compute_density(body & particle, std::vector<body *> & nbs) {
 
   double rho_a = 0.0;
   for(int b = 0; b < n_nb; ++b) { // Vectorized
-    double Wab = sph_kernel_function(r_a_[b], .5 * (h_a + h_[b]));
+    double Wab = P::kernel(r_a_[b], .5 * (h_a + h_[b]));
     rho_a += m_[b] * Wab;
   } // for
   if(not(rho_a > 0)) {
@@ -225,6 +376,7 @@ compute_density(body & particle, std::vector<body *> & nbs) {
     assert(false);
   }
   particle.setDensity(rho_a);
+  particle.setNeighbors(n_nb);
 } // compute_density
 
 /**
@@ -270,8 +422,9 @@ compute_signalspeed(body & particle, std::vector<body *> & nbs) {
  * @param      particle  The particle body
  * @param      nbs       Vector of neighbor particles
  */
+template<typename P>
 void
-compute_divv(body & particle, std::vector<body *> & nbs) {
+hydro_t<P>::compute_divv(body & particle, std::vector<body *> & nbs) {
   using namespace kernels;
 
   // compute the divergence
@@ -285,7 +438,7 @@ compute_divv(body & particle, std::vector<body *> & nbs) {
     const double h_ab = .5*(h_a + nb->radius());
     // const double h_b = nb->radius(); // DEBUG
     const double  m_b = nb->mass();
-    const point_t DiWab = sph_kernel_gradient(pos_a - pos_b,h_ab);
+    const point_t DiWab = P::kernel_gradient(pos_a - pos_b,h_ab);
     //point_t DiWab = .5*(sph_kernel_gradient(pos_a - pos_b,h_a)   // DEBUG
     //                 +  sph_kernel_gradient(pos_a - pos_b,h_b));
     div_v += m_b*dot(v_a, DiWab);
@@ -306,19 +459,145 @@ compute_divv(body & particle, std::vector<body *> & nbs) {
  * @param      particle  The particle body
  * @param      nbs       Vector of neighbor particles
  */
+template<typename P>
 void
-compute_density_pressure_soundspeed(body & particle,
+hydro_t<P>::compute_density_pressure_soundspeed(body & particle,
   std::vector<body *> & nbs) {
   compute_density(particle, nbs);
   if (evolve_internal_energy and thermokinetic_formulation)
     recover_internal_energy(particle);
-  eos::compute_pressure(particle);
-  eos::compute_soundspeed(particle);
-  compute_signalspeed(particle, nbs);
-  if (sph_viscosity == visc_cullen)
+  P::pressure_soundspeed(particle);
+  if (P::cullen())
     compute_divv(particle,nbs);
 }
 
+/**
+ * @brief      Computes the density, same as compute_density with the
+ *             neighbors read from a structure of arrays
+ *
+ * @param      particle  The particle body
+ * @param      soa       Fields of the local particles and ghosts
+ * @param      nbs       Indices of the neighbors in soa
+ * @param      n_nb      Number of neighbors
+ */
+template<typename P>
+void
+hydro_t<P>::compute_density_soa(body & particle,
+  const body_soa & soa,
+  const int64_t * nbs,
+  const int64_t & n_nb) {
+  using namespace kernels;
+  const double h_a = particle.radius();
+  const point_t pos_a = particle.coordinates();
+  mpi_assert(n_nb > 0);
+
+  double rho_a = 0.0;
+  for(int64_t b = 0; b < n_nb; ++b) {
+    const int64_t j = nbs[b];
+    double r2 = 0.0;
+    for(size_t d = 0; d < gdimension; ++d) {
+      const double dx = pos_a[d] - soa.x[d][j];
+      r2 += dx * dx;
+    }
+    double Wab = P::kernel(std::sqrt(r2), .5 * (h_a + soa.h[j]));
+    rho_a += soa.m[j] * Wab;
+  } // for
+  if(not(rho_a > 0)) {
+    std::cout << "Density of a particle is not a positive number: "
+              << "rho = " << rho_a << std::endl;
+    std::cout << "Failed particle id: " << particle.id() << std::endl;
+    std::cerr << "particle position: " << particle.coordinates() << std::endl;
+    std::cerr << "smoothing length:  " << particle.radius() << std::endl;
+    assert(false);
+  }
+  particle.setDensity(rho_a);
+  particle.setNeighbors(n_nb);
+} // compute_density_soa
+
+/**
+ * @brief      Computes maximum signal speed, same as compute_signalspeed
+ *             with the neighbors read from a structure of arrays.
+ *             Needs GHOST_SOUNDSPEED and GHOST_VELOCITY in soa.
+ */
+void
+compute_signalspeed_soa(body & particle,
+  const body_soa & soa,
+  const int64_t * nbs,
+  const int64_t & n_nb) {
+  const double c_a = particle.getSoundspeed();
+  const point_t pos_a = particle.coordinates(),
+                  v_a = particle.getVelocity();
+
+  double vsig = 0.0;
+  for(int64_t b = 0; b < n_nb; ++b) {
+    const int64_t j = nbs[b];
+    double r2 = 0.0, vn = 0.0;
+    for(size_t d = 0; d < gdimension; ++d) {
+      const double dx = pos_a[d] - soa.x[d][j];
+      r2 += dx * dx;
+    }
+    const double r = std::sqrt(r2);
+    for(size_t d = 0; d < gdimension; ++d)
+      vn += (v_a[d] - soa.v[d][j]) * ((pos_a[d] - soa.x[d][j]) / r);
+    const double c_ab = std::max(c_a, soa.c[j]);
+    vsig = std::max(vsig, c_ab - std::min(vn, 0.0));
+  } // for
+
+  particle.setSignalspeed(vsig);
+} // compute_signalspeed_soa
+
+/**
+ * @brief      Compute divergence of the velocity field, same as
+ *             compute_divv with the neighbors read from a structure of
+ *             arrays
+ */
+template<typename P>
+void
+hydro_t<P>::compute_divv_soa(body & particle,
+  const body_soa & soa,
+  const int64_t * nbs,
+  const int64_t & n_nb) {
+  using namespace kernels;
+
+  double div_v = 0.0;
+  const double h_a = particle.radius();
+  const point_t & pos_a = particle.coordinates();
+  const point_t & v_a = particle.getVelocity();
+  for(int64_t b = 0; b < n_nb; ++b) {
+    const int64_t j = nbs[b];
+    point_t pos_ab;
+    for(size_t d = 0; d < gdimension; ++d)
+      pos_ab[d] = pos_a[d] - soa.x[d][j];
+    const double h_ab = .5 * (h_a + soa.h[j]);
+    const point_t DiWab = P::kernel_gradient(pos_ab, h_ab);
+    div_v += soa.m[j] * dot(v_a, DiWab);
+  }
+  div_v /= particle.getDensity();
+
+  const double div_v_p = particle.getDivergenceV();
+  particle.setDdivvdt((div_v - div_v_p) / physics::dt);
+  particle.setDivergenceV(div_v);
+} // compute_divv_soa
+
+/**
+ * @brief      Compute the density, EOS and soundspeed in one place, with the
+ *             neighbors read from a structure of arrays.
+ *             Needs GHOST_VELOCITY in soa for the Cullen viscosity.
+ */
+template<typename P>
+void
+hydro_t<P>::compute_density_pressure_soundspeed_soa(body & particle,
+  const body_soa & soa,
+  const int64_t * nbs,
+  const int64_t & n_nb) {
+  compute_density_soa(particle, soa, nbs, n_nb);
+  if (evolve_internal_energy and thermokinetic_formulation)
+    recover_internal_energy(particle);
+  P::pressure_soundspeed(particle);
+  if (P::cullen())
+    compute_divv_soa(particle, soa, nbs, n_nb);
+}
+
 /**
  * @brief      Calculates total energy for every particle
  *             NOTE: total energy does not include grav. energy
@@ -342,11 +621,16 @@ set_total_energy(body & particle) {
  *     (----)   = -sum_b m_b ( -----  +  -----   + Pi_ab ) D_i Wab  + ext_i
  *     ( dt )_i              (rho_a^2   rho_b^2          )
  *
+ *             Also computes the signal speed, which reads the soundspeeds of
+ *             the neighbors: they are final only after the density pass.
+ *
  * @param      particle  The particle body
  * @param      nbs       Vector of neighbor particles
  */
+template<typename P>
 void
-compute_acceleration(body & particle, std::vector<body *> & nbs) {
+hydro_t<P>::compute_acceleration(body & particle,
+  std::vector<body *> & nbs) {
   using namespace param;
   using namespace viscosity;
   using namespace kernels;
@@ -388,8 +672,8 @@ compute_acceleration(body & particle, std::vector<body *> & nbs) {
               alpha_ab = .5*(alpha_a + alpha_[b]),
                 rho_ab = .5*(rho_a + rho_[b]),
                   c_ab = .5*(c_a + c_[b]);
-    Pi_a_[b] = sph_artificial_viscosity(alpha_ab, rho_ab, c_ab, mu_ab);
-    DiWa_[b] = sph_kernel_gradient(pos_ab,h_ab);
+    Pi_a_[b] = P::viscosity(alpha_ab, rho_ab, c_ab, mu_ab);
+    DiWa_[b] = P::kernel_gradient(pos_ab,h_ab);
     // DiWa_[b] = .5*(sph_kernel_gradient(pos_ab,h_a)   // DEBUG
     //             + sph_kernel_gradient(pos_ab,h_[b]));
   }
@@ -405,8 +689,70 @@ compute_acceleration(body & particle, std::vector<body *> & nbs) {
   particle.setAcceleration(acc_a);
   particle.setGAcceleration(0);
   particle.setGPotential(0);
+  compute_signalspeed(particle, nbs);
 } // compute_acceleration
 
+/**
+ * @brief      Calculates the hydro acceleration, same as
+ *             compute_acceleration with the neighbors read from a structure
+ *             of arrays. Needs GHOST_DENSITY, GHOST_PRESSURE,
+ *             GHOST_SOUNDSPEED, GHOST_ALPHA, GHOST_VELOCITY and
+ *             GHOST_VELOCITYHALF in soa.
+ *
+ * @param      particle  The particle body
+ * @param      soa       Fields of the local particles and ghosts
+ * @param      nbs       Indices of the neighbors in soa
+ * @param      n_nb      Number of neighbors
+ */
+template<typename P>
+void
+hydro_t<P>::compute_acceleration_soa(body & particle,
+  const body_soa & soa,
+  const int64_t * nbs,
+  const int64_t & n_nb) {
+  using namespace param;
+  using namespace viscosity;
+  using namespace kernels;
+
+  // this particle (index 'a')
+  const double h_a = particle.radius(),
+             rho_a = particle.getDensity(),
+               P_a = particle.getPressure(),
+               c_a = particle.getSoundspeed(),
+           alpha_a = particle.getAlpha();
+  const point_t pos_a = particle.coordinates(),
+                v12_a = particle.getVelocityhalf();
+
+  const double Prho2_a = P_a / (rho_a * rho_a);
+  point_t acc_a = 0.0;
+  for(int64_t b = 0; b < n_nb; ++b) {
+    const int64_t j = nbs[b];
+    point_t pos_ab, v12_ab;
+    bool same = true;
+    for(size_t d = 0; d < gdimension; ++d) {
+      pos_ab[d] = pos_a[d] - soa.x[d][j];
+      v12_ab[d] = v12_a[d] - soa.v12[d][j];
+      same = same && soa.x[d][j] == pos_a[d];
+    }
+    if(same) // if same particle, m_b->0
+      continue;
+    const double h_ab = .5*(h_a + soa.h[j]);
+    const double mu_ab = mu(h_ab, v12_ab, pos_ab),
+              alpha_ab = .5*(alpha_a + soa.alpha[j]),
+                rho_ab = .5*(rho_a + soa.rho[j]),
+                  c_ab = .5*(c_a + soa.c[j]);
+    const double Pi_ab = P::viscosity(alpha_ab, rho_ab, c_ab, mu_ab);
+    const point_t DiWab = P::kernel_gradient(pos_ab,h_ab);
+    const double Prho2_b = soa.P[j] / (soa.rho[j] * soa.rho[j]);
+    acc_a += -soa.m[j] * (Prho2_a + Prho2_b + Pi_ab) * DiWab;
+  }
+  acc_a += external_force::acceleration(particle);
+  particle.setAcceleration(acc_a);
+  particle.setGAcceleration(0);
+  particle.setGPotential(0);
+  compute_signalspeed_soa(particle, soa, nbs, n_nb);
+} // compute_acceleration_soa
+
 /**
  * @brief      Calculates the dudt, time derivative of internal energy.
  *             [Rosswog'09, eqs.(29,55)]:
@@ -418,8 +764,9 @@ compute_acceleration(body & particle, std::vector<body *> & nbs) {
  * @param      particle  The particle body
  * @param      nbs       Vector of neighbor particles
  */
+template<typename P>
 void
-compute_dudt(body & particle, std::vector<body *> & nbs) {
+hydro_t<P>::compute_dudt(body & particle, std::vector<body *> & nbs) {
   // Do not change internal energy in relaxation phase
   if(iteration < relaxation_steps) {
     particle.setDudt(0.0);
@@ -467,8 +814,8 @@ compute_dudt(body & particle, std::vector<body *> & nbs) {
               alpha_ab = .5*(alpha_a + alpha_[b]),
                 rho_ab = .5*(rho_a + rho_[b]),
                   c_ab = .5*(c_a + c_[b]);
-    Pi_a_[b] = sph_artificial_viscosity(alpha_ab, rho_ab, c_ab, mu_ab);
-    point_t DiWab  = sph_kernel_gradient(pos_ab,h_ab);
+    Pi_a_[b] = P::viscosity(alpha_ab, rho_ab, c_ab, mu_ab);
+    point_t DiWab  = P::kernel_gradient(pos_ab,h_ab);
     // point_t DiWab = .5*(sph_kernel_gradient(pos_ab,h_a)  // DEBUG
     //                  + sph_kernel_gradient(pos_ab,h_[b]));
     vab_dot_DiWa_[b] = dot(vel_ab, DiWab);
@@ -499,8 +846,9 @@ compute_dudt(body & particle, std::vector<body *> & nbs) {
  * @param      srch  The source's body holder
  * @param      nbsh  The neighbors' body holders
  */
+template<typename P>
 void
-compute_dedt(body & particle, std::vector<body *> & nbs) {
+hydro_t<P>::compute_dedt(body & particle, std::vector<body *> & nbs) {
   using namespace viscosity;
   using namespace kernels;
 
@@ -545,8 +893,8 @@ compute_dedt(body & particle, std::vector<body *> & nbs) {
               alpha_ab = .5*(alpha_a + alpha_[b]),
                 rho_ab = .5*(rho_a + rho_[b]),
                   c_ab = .5*(c_a + c_[b]);
-    Pi_a_[b] = sph_artificial_viscosity(alpha_ab, rho_ab, c_ab, mu_ab);
-    point_t DiWab = sph_kernel_gradient(pos_ab,h_ab);
+    Pi_a_[b] = P::viscosity(alpha_ab, rho_ab, c_ab, mu_ab);
+    point_t DiWab = P::kernel_gradient(pos_ab,h_ab);
     // point_t DiWab = .5*(sph_kernel_gradient(pos_ab,h_a) // DEBUG
     //                  + sph_kernel_gradient(pos_ab,h_[b]));
     va_dot_DiWa_[b] = dot(vel_a, DiWab);
@@ -565,6 +913,193 @@ compute_dedt(body & particle, std::vector<body *> & nbs) {
 
 } // compute_dedt
 
+/*
+ * The passes with the kernel, viscosity and EOS selected at runtime
+ */
+void
+compute_density(body & particle, std::vector<body *> & nbs) {
+  hydro_t<runtime_physics_t>::compute_density(particle, nbs);
+}
+
+void
+compute_divv(body & particle, std::vector<body *> & nbs) {
+  hydro_t<runtime_physics_t>::compute_divv(particle, nbs);
+}
+
+void
+compute_density_pressure_soundspeed(body & particle,
+  std::vector<body *> & nbs) {
+  hydro_t<runtime_physics_t>::compute_density_pressure_soundspeed(
+    particle, nbs);
+}
+
+void
+compute_density_soa(body & particle,
+  const body_soa & soa,
+  const int64_t * nbs,
+  const int64_t & n_nb) {
+  hydro_t<runtime_physics_t>::compute_density_soa(particle, soa, nbs, n_nb);
+}
+
+void
+compute_divv_soa(body & particle,
+  const body_soa & soa,
+  const int64_t * nbs,
+  const int64_t & n_nb) {
+  hydro_t<runtime_physics_t>::compute_divv_soa(particle, soa, nbs, n_nb);
+}
+
+void
+compute_density_pressure_soundspeed_soa(body & particle,
+  const body_soa & soa,
+  const int64_t * nbs,
+  const int64_t & n_nb) {
+  hydro_t<runtime_physics_t>::compute_density_pressure_soundspeed_soa(
+    particle, soa, nbs, n_nb);
+}
+
+void
+compute_acceleration(body & particle, std::vector<body *> & nbs) {
+  hydro_t<runtime_physics_t>::compute_acceleration(particle, nbs);
+}
+
+void
+compute_acceleration_soa(body & particle,
+  const body_soa & soa,
+  const int64_t * nbs,
+  const int64_t & n_nb) {
+  hydro_t<runtime_physics_t>::compute_acceleration_soa(
+    particle, soa, nbs, n_nb);
+}
+
+void
+compute_dudt(body & particle, std::vector<body *> & nbs) {
+  hydro_t<runtime_physics_t>::compute_dudt(particle, nbs);
+}
+
+void
+compute_dedt(body & particle, std::vector<body *> & nbs) {
+  hydro_t<runtime_physics_t>::compute_dedt(particle, nbs);
+}
+
+/**
+ * @brief      Hydro passes called by the drivers, installed by
+ *             select_pipeline
+ */
+typedef void (*hydro_pass_t)(body &, std::vector<body *> &);
+typedef void (*hydro_soa_pass_t)(body &,
+  const body_soa &,
+  const int64_t *,
+  const int64_t &);
+
+struct pipeline_t {
+  hydro_pass_t density_pressure_soundspeed = nullptr;
+  hydro_soa_pass_t density_pressure_soundspeed_soa = nullptr;
+  hydro_pass_t acceleration = nullptr;
+  hydro_soa_pass_t acceleration_soa = nullptr;
+  hydro_pass_t dudt = nullptr;
+  hydro_pass_t dedt = nullptr;
+}; // struct pipeline_t
+pipeline_t pipeline;
+
+template<typename P>
+void
+set_pipeline() {
+  pipeline.density_pressure_soundspeed =
+    hydro_t<P>::compute_density_pressure_soundspeed;
+  pipeline.density_pressure_soundspeed_soa =
+    hydro_t<P>::compute_density_pressure_soundspeed_soa;
+  pipeline.acceleration = hydro_t<P>::compute_acceleration;
+  pipeline.acceleration_soa = hydro_t<P>::compute_acceleration_soa;
+  pipeline.dudt = hydro_t<P>::compute_dudt;
+  pipeline.dedt = hydro_t<P>::compute_dedt;
+}
+
+#ifdef ENABLE_PHYSICS_PIPELINES
+#ifdef eos_type
+#error "eos_type cannot be #defined with ENABLE_PHYSICS_PIPELINES"
+#endif
+// Instantiated combinations: the cheap analytic kernels (cubic spline and
+// Wendland) and the kernel table, which covers all the kernels, with both
+// viscosities and the ideal and polytropic EOS, analytic or tabulated
+template<typename KERNEL, param::sph_viscosity_keyword V>
+bool
+select_pipeline_eos() {
+  if(eos::use_table) {
+    set_pipeline<static_physics_t<KERNEL, V, eos_tabulated>>();
+    return true;
+  }
+  switch(eos_type) {
+    case(eos_ideal):
+      set_pipeline<static_physics_t<KERNEL, V, eos_ideal>>();
+      return true;
+    case(eos_polytropic):
+      set_pipeline<static_physics_t<KERNEL, V, eos_polytropic>>();
+      return true;
+    default:
+      return false;
+  }
+}
+
+template<typename KERNEL>
+bool
+select_pipeline_viscosity() {
+  switch(sph_viscosity) {
+    case(visc_constant):
+      return select_pipeline_eos<KERNEL, visc_constant>();
+    case(visc_cullen):
+      return select_pipeline_eos<KERNEL, visc_cullen>();
+    default:
+      return false;
+  }
+}
+#endif
+
+/**
+ * @brief      Install the hydro passes: specialized for the kernel,
+ *             viscosity and EOS of the parameters if they are instantiated,
+ *             generic otherwise. To call after kernels::select,
+ *             viscosity::select and eos::select.
+ */
+void
+select_pipeline() {
+  set_pipeline<runtime_physics_t>();
+#ifdef ENABLE_PHYSICS_PIPELINES
+  bool specialized = false;
+  if(sph_kernel_tabulated)
+    specialized = select_pipeline_viscosity<tabulated_kernel_t>();
+  else {
+    switch(sph_kernel) {
+      case(cubic_spline):
+        specialized =
+          select_pipeline_viscosity<analytic_kernel_t<cubic_spline>>();
+        break;
+      case(wendland_c2):
+        specialized =
+          select_pipeline_viscosity<analytic_kernel_t<wendland_c2>>();
+        break;
+      case(wendland_c4):
+        specialized =
+          select_pipeline_viscosity<analytic_kernel_t<wendland_c4>>();
+        break;
+      case(wendland_c6):
+        specialized =
+          select_pipeline_viscosity<analytic_kernel_t<wendland_c6>>();
+        break;
+      default:
+        break;
+    }
+  }
+  if(specialized)
+    log_one(info) << "Hydro passes specialized for the kernel, viscosity "
+                  << "and EOS" << std::endl;
+  else
+    log_one(warn) << "No specialized hydro passes for this kernel, viscosity "
+                  << "and EOS: using the generic ones (sph_kernel_tabulated "
+                  << "covers all the kernels)" << std::endl;
+#endif
+}
+
 /**
  * @brief      Adds energy dissipation rate due to artificial
  *             particle relaxation drag force
@@ -822,6 +1357,110 @@ set_adaptive_timestep(std::vector<body> & bodies) {
 
 }
 
+/**
+ * @brief      Block timesteps: shorten the cycle starting at totaltime to end
+ *             on the next output by time, as set_adaptive_timestep does for
+ *             dt. The output times already reached are moved to the next
+ *             ones.
+ *
+ * @param      cycle     Duration of the cycle
+ * @param[in]  out_dt    Output period, no output by time if 0
+ * @param      t_output  Time of the next output
+ */
+void
+match_block_output(double & cycle, const double out_dt, double & t_output) {
+  if(out_dt <= 0)
+    return;
+  while(totaltime >= t_output)
+    t_output += out_dt;
+  if(totaltime + cycle > t_output - 0.1 * out_dt)
+    cycle = t_output - totaltime;
+}
+
+/**
+ * @brief      Block timesteps: set the timebins of the particles ending
+ *             their step with the current iteration. The hierarchy is fixed
+ *             for a cycle of block_period() ticks of block_dt and the
+ *             particles take steps of block_dt * 2^timebin aligned on the
+ *             ticks: the largest level below the timestep of the particle,
+ *             down to one tick. At the start of a cycle all the particles
+ *             are active and the cycle is anchored on the largest timestep,
+ *             at most twice the previous cycle and block_period() / 2 times
+ *             the smallest timestep, so that the particles can shrink their
+ *             step during the cycle. The cycle ends on the outputs by time.
+ *
+ * @param      bodies   Set of bodies
+ */
+void
+set_block_timesteps(std::vector<body> & bodies) {
+  const int64_t period = integration::block_period();
+  const int64_t now = integration::block_now() % period;
+  if(now == 0) {
+    double dtmin = 1e24; // some ludicrous number
+    double dtmax = 0.;
+    for(size_t i = 0; i < bodies.size(); ++i) {
+      dtmin = std::min(dtmin, bodies[i].getDt());
+      dtmax = std::max(dtmax, bodies[i].getDt());
+    }
+    mpi_utils::reduce_min(dtmin);
+    mpi_utils::reduce_max(dtmax);
+
+    double cycle = std::min(dtmax, dtmin * (period / 2));
+    if(block_dt > 0.)
+      cycle = std::min(cycle, 2. * period * block_dt);
+    match_block_output(cycle, out_screen_dt, t_screen_output);
+    match_block_output(cycle, out_scalar_dt, t_scalar_output);
+    match_block_output(cycle, out_h5data_dt, t_h5data_output);
+    block_dt = cycle / period;
+    block_time_end = totaltime + cycle;
+  } // if
+
+  uint64_t too_short = 0;
+  for(size_t i = 0; i < bodies.size(); ++i) {
+    if(!integration::is_active(bodies[i]))
+      continue;
+    int bin = 0;
+    while(bin + 1 < block_timestep_levels &&
+          now % (int64_t(2) << bin) == 0 &&
+          block_dt * (int64_t(2) << bin) <= bodies[i].getDt())
+      ++bin;
+    if(block_dt > bodies[i].getDt())
+      ++too_short;
+    bodies[i].setTimebin(bin);
+  } // for
+
+  mpi_utils::reduce_sum(too_short);
+  if(too_short > 0)
+    log_one(warn) << too_short << " particles with a timestep below "
+                  << block_dt << ", increase block_timestep_levels"
+                  << std::endl;
+}
+
+/**
+ * @brief      Block timesteps: set the next iteration, up to the first tick
+ *             ending the step of a particle. The ticks without active
+ *             particles are skipped. Called after the timebins are set by
+ *             set_block_timesteps and the neighbor limiter.
+ *
+ * @param      bodies   Set of bodies
+ */
+void
+set_block_step(std::vector<body> & bodies) {
+  const int64_t period = integration::block_period();
+  const int64_t now = integration::block_now() % period;
+  uint64_t step = period - now;
+  for(size_t i = 0; i < bodies.size(); ++i) {
+    const int64_t length = int64_t(1) << bodies[i].getTimebin();
+    step = std::min(step, uint64_t(length - now % length));
+  }
+  mpi_utils::reduce_min(step);
+
+  block_tick = now;
+  block_step = step;
+  dt = block_step * block_dt;
+  totaltime_next = block_time_end - (period - now - block_step) * block_dt;
+}
+
 void
 compute_smoothinglength(std::vector<body> & bodies) {
   if constexpr (gdimension == 1) {
@@ -847,6 +1486,70 @@ compute_smoothinglength(std::vector<body> & bodies) {
   } // if gdimension
 }
 
+/**
+ * @brief      Variable smoothing length: Newton-Raphson solve of
+ *             $g(h) = \sum_b m_b W(r_ab, h) - m_a (\eta k / h)^D = 0$,
+ *             i.e. $h = \eta k (m_a / \rho_a(h))^{1/D}$ with a fixed
+ *             number of neighbors, starting from h. The neighbors nbs are
+ *             the candidates found in the search radius of the particle,
+ *             the solve stops when h grows beyond it.
+ *
+ *             $\partial W / \partial h = -(D W + r \partial W / \partial r)/h$
+ *
+ * @param      particle  The particle body, its radius is the search radius
+ * @param      nbs       Vector of the candidate neighbors
+ * @param      h         Initial guess, the solution on return
+ *
+ * @return     false if h exceeds the search radius: the particle has to be
+ *             searched again with a larger radius
+ */
+bool
+solve_smoothinglength(const body & particle,
+  std::vector<body *> & nbs,
+  double & h) {
+  using namespace kernels;
+  const double search = particle.radius();
+  const point_t pos_a = particle.coordinates();
+  const int n_nb = nbs.size();
+  mpi_assert(n_nb > 0);
+
+  double r_a_[n_nb], m_[n_nb];
+  for(int b = 0; b < n_nb; ++b) {
+    m_[b] = nbs[b]->mass();
+    r_a_[b] = flecsi::magnitude(pos_a - nbs[b]->coordinates());
+  }
+
+  const double D = gdimension;
+  const double target = particle.mass() * pow(sph_eta * kernel_width, D);
+  for(int it = 0; it < sph_h_max_iterations; ++it) {
+    double rho_a = 0., drho_a = 0.;
+    for(int b = 0; b < n_nb; ++b) {
+      if(!(r_a_[b] < h))
+        continue;
+      point_t r_ab = 0.;
+      r_ab[0] = r_a_[b];
+      const double Wab = sph_kernel_function(r_a_[b], h);
+      const double dWab = sph_kernel_gradient(r_ab, h)[0];
+      rho_a += m_[b] * Wab;
+      drho_a -= m_[b] * (D * Wab + r_a_[b] * dWab) / h;
+    } // for
+    const double rho_h = target / pow(h, D);
+    const double dg = drho_a + D * rho_h / h;
+    // Fixed point iteration where g is not increasing
+    double h_new = dg > 0. ? h - (rho_a - rho_h) / dg
+                           : sph_eta * kernel_width * pow(particle.mass() /
+                                                            rho_a, 1. / D);
+    h_new = std::min(std::max(h_new, .5 * h), 2. * h);
+    const bool converged = fabs(h_new - h) < sph_h_tolerance * h;
+    h = h_new;
+    if(h > search)
+      return false;
+    if(converged)
+      return true;
+  } // for
+  return true;
+}
+
 /**
  * @brief  Advance time
  */
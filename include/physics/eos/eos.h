@@ -37,6 +37,7 @@
 #endif
 
 #include "eos_consts.h"
+#include "eos_table.h"
 
 namespace eos {
 using namespace param;
@@ -431,6 +432,85 @@ public:
   static void compute_internal_energy(body& particle){}
 };
 
+/**
+* @brief      Interpolation in eos_table, see eos_table.h: either a table
+*             read from eos_tab_file_path (eos_type = "tabulated"), or the
+*             table of an analytic EOS made by select (eos_tabulate)
+*/
+template<>
+class eos_t<param::eos_tabulated>{
+
+public:
+  static void read_data(){
+    read_table(eos_tab_file_path);
+  }
+
+  static void init(body & particle){
+    compute_pressure_soundspeed(particle);
+    compute_temperature(particle);
+  }
+
+  static void
+  compute_pressure(body & particle){
+    particle.setPressure(table_pressure(particle.getDensity(),
+      particle.getInternalenergy(), particle.getElectronfraction()));
+  }
+
+  static void
+  compute_soundspeed(body & particle){
+    particle.setSoundspeed(table_soundspeed(particle.getDensity(),
+      particle.getInternalenergy(), particle.getElectronfraction()));
+  }
+
+  static void
+  compute_temperature(body & particle){
+    particle.setTemperature(table_temperature(particle.getDensity(),
+      particle.getInternalenergy(), particle.getElectronfraction()));
+  }
+
+  /**
+  * @brief      Pressure and sound speed from a single lookup
+  *
+  * @param      particle
+  */
+  static void
+  compute_pressure_soundspeed(body & particle){
+    double f[2];
+    table_interpolate<2>(particle.getDensity(), particle.getInternalenergy(),
+      particle.getElectronfraction(), f);
+    particle.setPressure(exp10_(f[0]));
+    particle.setSoundspeed(exp10_(f[1]));
+  }
+
+  /**
+  * @brief      The table is indexed by the internal energy, which is
+  *             evolved and not recomputed: this function does nothing
+  *
+  * @param      particle
+  */
+  static void
+  compute_internal_energy(body & particle) {}
+}; // ...<eos_tabulated>
+
+/**
+* @brief      Pressure and sound speed of a particle, with a single lookup
+*             for the tabulated EOS
+*
+* @param      particle
+*/
+template<param::eos_type_keyword E>
+void
+pressure_soundspeed(body & particle) {
+  eos_t<E>::compute_pressure(particle);
+  eos_t<E>::compute_soundspeed(particle);
+}
+
+template<>
+void
+pressure_soundspeed<param::eos_tabulated>(body & particle) {
+  eos_t<param::eos_tabulated>::compute_pressure_soundspeed(particle);
+}
+
 // eos function types and pointers
 typedef void (*compute_quantity_t)(body &);
 typedef void (*read_data_t)();
@@ -440,7 +520,8 @@ typedef void (*read_data_t)();
 #  define init                 eos_t<eos_type>::init
 #  define compute_pressure     eos_t<eos_type>::compute_pressure
 #  define compute_soundspeed   eos_t<eos_type>::compute_soundspeed
-#  define compute_temperature  eos_t<eos_type>compute_temperature
+#  define compute_temperature  eos_t<eos_type>::compute_temperature
+#  define compute_pressure_soundspeed  pressure_soundspeed<eos_type>
 #else
 read_data_t read_data = nullptr;
 compute_quantity_t init = nullptr;
@@ -448,8 +529,12 @@ compute_quantity_t compute_pressure = nullptr;
 compute_quantity_t compute_soundspeed = nullptr;
 compute_quantity_t compute_temperature = nullptr;
 compute_quantity_t compute_internal_energy = nullptr;
+compute_quantity_t compute_pressure_soundspeed = nullptr;
 #endif
 
+// true if the pressure and sound speed are interpolated in eos_table
+bool use_table = false;
+
 /**
  * @brief  Installs the 'compute_pressure' and 'compute_soundspeed'
  *         function pointers, depending on the value of eos_type
@@ -465,30 +550,44 @@ select() {
       compute_pressure = eos_t<eos_polytropic>::compute_pressure;
       compute_soundspeed = eos_t<eos_polytropic>::compute_soundspeed;
       compute_internal_energy = eos_t<eos_polytropic>::compute_internal_energy;
+      compute_pressure_soundspeed = pressure_soundspeed<eos_polytropic>;
       break;
     case(eos_ideal):
       init = eos_t<eos_ideal>::init;
       compute_pressure = eos_t<eos_ideal>::compute_pressure;
       compute_soundspeed = eos_t<eos_ideal>::compute_soundspeed;
       compute_internal_energy = eos_t<eos_ideal>::compute_internal_energy;
+      compute_pressure_soundspeed = pressure_soundspeed<eos_ideal>;
       break;
     case(eos_wd):
       init = eos_t<eos_wd>::init;
       compute_pressure = eos_t<eos_wd>::compute_pressure;
       compute_soundspeed = eos_t<eos_wd>::compute_soundspeed;
       compute_internal_energy = eos_t<eos_wd>::compute_internal_energy;
+      compute_pressure_soundspeed = pressure_soundspeed<eos_wd>;
       break;
     case(eos_ppt):
       init = eos_t<eos_ppt>::init;
       compute_pressure = eos_t<eos_ppt>::compute_pressure;
       compute_soundspeed = eos_t<eos_ppt>::compute_soundspeed;
       compute_internal_energy = eos_t<eos_ppt>::compute_internal_energy;
+      compute_pressure_soundspeed = pressure_soundspeed<eos_ppt>;
       break;
     case(eos_no_eos):
       init = eos_t<eos_no_eos>::init;
       compute_pressure = eos_t<eos_no_eos>::compute_pressure;
       compute_soundspeed = eos_t<eos_no_eos>::compute_soundspeed;
       compute_internal_energy = eos_t<eos_no_eos>::compute_internal_energy;
+      compute_pressure_soundspeed = pressure_soundspeed<eos_no_eos>;
+      break;
+    case(eos_tabulated):
+      read_data = eos_t<eos_tabulated>::read_data;
+      init = eos_t<eos_tabulated>::init;
+      compute_pressure = eos_t<eos_tabulated>::compute_pressure;
+      compute_soundspeed = eos_t<eos_tabulated>::compute_soundspeed;
+      compute_temperature = eos_t<eos_tabulated>::compute_temperature;
+      compute_internal_energy = eos_t<eos_tabulated>::compute_internal_energy;
+      compute_pressure_soundspeed = pressure_soundspeed<eos_tabulated>;
       break;
     default:
       std::cerr << "Undefined eos type" << std::endl;
@@ -496,6 +595,65 @@ select() {
       exit(0);
   }
 #endif // eos_type
+
+  use_table = eos_type == eos_tabulated;
+  if(use_table) {
+    read_table(eos_tab_file_path);
+    const eos_table_t & t = eos_table;
+    log_one(info) << "EOS table " << eos_tab_file_path << ": " << t.n[0]
+                  << " x " << t.n[1] << " x " << t.n[2]
+                  << " points in (rho, T, Ye)" << std::endl;
+  }
+  else if(eos_tabulate) {
+    // The pressure of the polytropic EOS depends on the adiabatic
+    // invariant, not on the internal energy
+    if(eos_type != eos_ideal and eos_type != eos_wd) {
+      log_one(warn) << "eos_tabulate: only the ideal fluid and white dwarf "
+                    << "EOS can be tabulated, the EOS stays analytic"
+                    << std::endl;
+      return;
+    }
+#ifdef eos_type
+    log_fatal("eos_type is #defined: the analytic EOS cannot be tabulated"
+              << std::endl);
+#else
+    const double lo[3] = {eos_tab_rho_min, eos_tab_eps_min, eos_tab_ye_min},
+                 hi[3] = {eos_tab_rho_max, eos_tab_eps_max, eos_tab_ye_max};
+    if(!(lo[0] > 0. and lo[1] > 0. and hi[0] > lo[0] and hi[1] > lo[1]
+         and hi[2] >= lo[2] and eos_tab_points_per_decade > 0))
+      log_fatal("Bad EOS table ranges" << std::endl);
+    const int n[3] = {
+      int(ceil(log10(hi[0] / lo[0]) * eos_tab_points_per_decade)) + 1,
+      int(ceil(log10(hi[1] / lo[1]) * eos_tab_points_per_decade)) + 1,
+      hi[2] > lo[2] ? std::max(int(eos_tab_ye_points), 2) : 1};
+    tabulate(compute_pressure_soundspeed, lo, hi, n);
+    compute_pressure = eos_t<eos_tabulated>::compute_pressure;
+    compute_soundspeed = eos_t<eos_tabulated>::compute_soundspeed;
+    compute_pressure_soundspeed = pressure_soundspeed<eos_tabulated>;
+    use_table = true;
+    log_one(info) << "EOS table: " << n[0] << " x " << n[1] << " x " << n[2]
+                  << " points in (rho, eps, Ye), relative error "
+                  << eos_table.p_error << " (P), " << eos_table.cs_error
+                  << " (cs)" << std::endl;
+#endif
+  }
 } // select
 
+/**
+ * @brief  Pressure and sound speed of n contiguous particles
+ */
+void
+compute_pressure_soundspeed_span(body * particles, const int64_t n) {
+  if(use_table) {
+#pragma omp parallel for schedule(static)
+    for(int64_t i = 0; i < n; ++i)
+      pressure_soundspeed<eos_tabulated>(particles[i]);
+  }
+  else {
+#pragma omp parallel for schedule(static)
+    for(int64_t i = 0; i < n; ++i)
+      compute_pressure_soundspeed(particles[i]);
+  }
+}
+
 } // namespace eos
@@ -0,0 +1,407 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2018 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file eos_table.h
+ * @brief Tabulated equation of state: table in (rho, T, Ye), reader of the
+ *        stellarcollapse.org HDF5 tables and tabulation of the analytic EOS.
+ *
+ * The table is uniform in log10(rho), log10(T) and Ye, the axes of the HDF5
+ * tables, and holds log10(P), log10(cs) and log10(eps + energy_shift) at its
+ * nodes. The particles evolve eps: a lookup locates rho and Ye with a
+ * multiplication and a truncation, brackets eps along the T axis of the
+ * cell, on log10(eps + energy_shift) interpolated at (rho, Ye), from a
+ * linear guess refined by bisection, and interpolates trilinearly in the
+ * cell it found. The nodes are the ones of the file: a table regridded on
+ * one eps axis would leave the columns, whose range of eps moves with rho,
+ * with a fraction of its nodes. The three quantities of a node are
+ * contiguous, with rho the fastest axis.
+ *
+ * The table is read by rank 0 and broadcast, every rank holds a copy.
+ *
+ * Outside of the table the values are clamped to its boundary.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <hdf5.h>
+#include <mpi.h>
+
+#include "body.h"
+#include "log.h"
+#include "params.h"
+
+namespace eos {
+
+struct eos_table_t {
+  // log10 P, log10 cs, log10(eps + energy_shift)
+  static constexpr int nfields = 3;
+  // axes: log10(rho), log10(T), Ye. The tables of an analytic EOS have
+  // log10(eps) as second axis
+  int n[3] = {0, 0, 0};
+  double x0[3] = {0., 0., 0.}, dx[3] = {1., 1., 1.}, idx[3] = {0., 0., 0.};
+  // distance between consecutive nodes along an axis, 0 if it has one node
+  int64_t stride[3] = {0, 0, 0};
+  double energy_shift = 0.;
+  std::vector<double> data;
+  // measured interpolation errors of P and cs, relative, for the tables of
+  // an analytic EOS
+  double p_error = 0., cs_error = 0.;
+
+  int64_t size() const {
+    return int64_t(n[0]) * n[1] * n[2];
+  }
+
+  //! Derived quantities of the axes, once n, x0 and dx are set
+  void set_axes() {
+    int64_t s = 1;
+    for(int a = 0; a < 3; ++a) {
+      idx[a] = n[a] > 1 ? 1. / dx[a] : 0.;
+      stride[a] = n[a] > 1 ? s : 0;
+      s *= n[a];
+    } // for
+  }
+}; // struct eos_table_t
+eos_table_t eos_table;
+
+// log2 and exp2 are about twice as fast as log10 and exp10
+inline double
+log10_(const double x) {
+  return M_LN2 / M_LN10 * log2(x);
+}
+
+inline double
+exp10_(const double x) {
+  return exp2(M_LN10 / M_LN2 * x);
+}
+
+/**
+ * @brief      Cell and weight of the position s, in steps, on an axis of n
+ *             nodes. NaN and -inf, from rho or eps + shift <= 0, go to the
+ *             lower boundary
+ */
+inline void
+table_locate(double s, const int n, int & i, double & w) {
+  s = s > 0. ? std::min(s, n - 1.) : 0.;
+  i = std::max(std::min(int(s), n - 2), 0);
+  w = s - i;
+}
+
+/**
+ * @brief      Interpolate the NF first quantities at (rho, eps, Ye)
+ *
+ * @param[out] f     log10 of P, cs and T
+ */
+template<int NF = eos_table_t::nfields>
+inline void
+table_interpolate(const double rho,
+  const double eps,
+  const double ye,
+  double f[NF]) {
+  const eos_table_t & t = eos_table;
+  int i, k;
+  double w[3];
+  table_locate((log10_(rho) - t.x0[0]) * t.idx[0], t.n[0], i, w[0]);
+  table_locate((ye - t.x0[2]) * t.idx[2], t.n[2], k, w[2]);
+
+  constexpr int nf = eos_table_t::nfields;
+  const double * c = t.data.data() + nf * (i * t.stride[0] + k * t.stride[2]);
+  const int64_t s0 = nf * t.stride[0], s1 = nf * t.stride[1],
+                s2 = nf * t.stride[2];
+  // log10(eps + energy_shift) at (rho, Ye) on the node j of the T axis,
+  // increasing with j. Tables at a single electron fraction, as the ones of
+  // the analytic EOS, are bilinear
+  auto energy = [&](const int j) {
+    const double * cj = c + j * s1 + 2;
+    const double e0 = cj[0] + w[0] * (cj[s0] - cj[0]);
+    if(s2 == 0)
+      return e0;
+    const double e1 = cj[s2] + w[0] * (cj[s2 + s0] - cj[s2]);
+    return e0 + w[2] * (e1 - e0);
+  };
+
+  // Bracket eps between the nodes j and j + 1, clamped as the other axes:
+  // first guess from the energies at the ends of the T axis, exact for the
+  // analytic tables, then bisection on the side of the guess that misses
+  const double le = log10_(eps + t.energy_shift);
+  const int n1 = t.n[1];
+  const double ea = energy(0);
+  int j;
+  double wg;
+  table_locate((le - ea) * (n1 - 1) / (energy(n1 - 1) - ea), n1, j, wg);
+  int len = 1;
+  if(!(energy(j) <= le)) {
+    len = std::max(j, 1);
+    j = 0;
+  }
+  else if(j < n1 - 2 and energy(j + 1) <= le) {
+    len = n1 - 2 - j;
+    ++j;
+  }
+  while(len > 1) {
+    const int half = len / 2;
+    j = energy(j + half) <= le ? j + half : j;
+    len -= half;
+  } // while
+  const double e0 = energy(j);
+  const double s = (le - e0) / (energy(j + 1) - e0);
+  w[1] = s > 0. ? std::min(s, 1.) : 0.;
+
+  // The temperature is the position on the T axis
+  constexpr int nq = NF < 2 ? NF : 2;
+  c += j * s1;
+  for(int q = 0; q < nq; ++q) {
+    const double * cq = c + q;
+    const double c00 = cq[0] + w[0] * (cq[s0] - cq[0]);
+    const double c10 = cq[s1] + w[0] * (cq[s1 + s0] - cq[s1]);
+    f[q] = c00 + w[1] * (c10 - c00);
+  } // for
+  if(NF > 2)
+    f[NF - 1] = t.x0[1] + (j + w[1]) * t.dx[1];
+  if(s2 == 0)
+    return;
+  c += s2;
+  for(int q = 0; q < nq; ++q) {
+    const double * cq = c + q;
+    const double c01 = cq[0] + w[0] * (cq[s0] - cq[0]);
+    const double c11 = cq[s1] + w[0] * (cq[s1 + s0] - cq[s1]);
+    f[q] += w[2] * (c01 + w[1] * (c11 - c01) - f[q]);
+  } // for
+}
+
+inline double
+table_pressure(const double rho, const double eps, const double ye) {
+  double f[1];
+  table_interpolate<1>(rho, eps, ye, f);
+  return exp10_(f[0]);
+}
+
+inline double
+table_soundspeed(const double rho, const double eps, const double ye) {
+  double f[2];
+  table_interpolate<2>(rho, eps, ye, f);
+  return exp10_(f[1]);
+}
+
+inline double
+table_temperature(const double rho, const double eps, const double ye) {
+  double f[eos_table_t::nfields];
+  table_interpolate(rho, eps, ye, f);
+  return exp10_(f[2]);
+}
+
+/**
+ * @brief      Fill the table from an analytic EOS, on n[a] points between
+ *             lo[a] and hi[a] for rho, eps (logarithmic) and Ye (linear),
+ *             and measure the relative errors at the centers of the cells.
+ *             The temperature is not tabulated, the second axis is eps.
+ *
+ * @param[in]  function  Analytic pressure and sound speed
+ */
+void
+tabulate(void (*function)(body &),
+  const double lo[3],
+  const double hi[3],
+  const int n[3]) {
+  eos_table_t & t = eos_table;
+  for(int a = 0; a < 3; ++a) {
+    t.n[a] = n[a];
+    t.x0[a] = a < 2 ? log10_(lo[a]) : lo[a];
+    const double x1 = a < 2 ? log10_(hi[a]) : hi[a];
+    t.dx[a] = n[a] > 1 ? (x1 - t.x0[a]) / (n[a] - 1) : 1.;
+  } // for
+  t.energy_shift = 0.;
+  t.set_axes();
+
+  auto value = [&](const double x, const int a) {
+    return a < 2 ? exp10_(x) : x;
+  };
+  body particle;
+  auto evaluate = [&](const double x[3], double & P, double & cs) {
+    particle.setDensity(value(x[0], 0));
+    particle.setInternalenergy(value(x[1], 1));
+    particle.setElectronfraction(x[2]);
+    function(particle);
+    P = particle.getPressure();
+    cs = particle.getSoundspeed();
+  };
+
+  constexpr int nf = eos_table_t::nfields;
+  t.data.assign(nf * t.size(), 0.);
+  for(int k = 0; k < n[2]; ++k)
+    for(int j = 0; j < n[1]; ++j)
+      for(int i = 0; i < n[0]; ++i) {
+        const double x[3] = {t.x0[0] + i * t.dx[0], t.x0[1] + j * t.dx[1],
+          t.x0[2] + k * t.dx[2]};
+        double P, cs;
+        evaluate(x, P, cs);
+        double * node = t.data.data() +
+                        nf * (i * t.stride[0] + j * t.stride[1] +
+                               k * t.stride[2]);
+        node[0] = log10(std::max(P, DBL_MIN));
+        node[1] = log10(std::max(cs, DBL_MIN));
+        node[2] = x[1];
+      } // for
+
+  // The axes with a single node have their center on it
+  t.p_error = t.cs_error = 0.;
+  const int m[3] = {std::max(n[0] - 1, 1), std::max(n[1] - 1, 1),
+    std::max(n[2] - 1, 1)};
+  for(int k = 0; k < m[2]; ++k)
+    for(int j = 0; j < m[1]; ++j)
+      for(int i = 0; i < m[0]; ++i) {
+        const double c[3] = {i + .5 * (n[0] > 1), j + .5 * (n[1] > 1),
+          k + .5 * (n[2] > 1)};
+        double x[3];
+        for(int a = 0; a < 3; ++a)
+          x[a] = t.x0[a] + c[a] * t.dx[a];
+        double P, cs;
+        evaluate(x, P, cs);
+        double f[nf];
+        table_interpolate(value(x[0], 0), value(x[1], 1), x[2], f);
+        if(P > 0.)
+          t.p_error = std::max(t.p_error, fabs(exp10_(f[0]) / P - 1.));
+        if(cs > 0.)
+          t.cs_error = std::max(t.cs_error, fabs(exp10_(f[1]) / cs - 1.));
+      } // for
+}
+
+/**
+ * @brief      Check that the axis x is uniform and return its origin and step
+ */
+inline bool
+uniform_axis(const std::vector<double> & x, double & x0, double & dx) {
+  x0 = x.front();
+  dx = x.size() > 1 ? (x.back() - x.front()) / (x.size() - 1) : 1.;
+  for(size_t i = 0; i < x.size(); ++i)
+    if(fabs(x[i] - (x0 + i * dx)) > 1e-6 * fabs(dx))
+      return false;
+  return true;
+}
+
+inline std::vector<double>
+read_table_dataset(hid_t file, const char * name, const int64_t size) {
+  std::vector<double> values(size);
+  hid_t dset = H5Dopen(file, name, H5P_DEFAULT);
+  if(dset < 0)
+    log_fatal("EOS table: no dataset " << name << std::endl);
+  hid_t space = H5Dget_space(dset);
+  const int64_t npoints = H5Sget_simple_extent_npoints(space);
+  H5Sclose(space);
+  if(npoints != size)
+    log_fatal("EOS table: dataset " << name << " has " << npoints
+                                    << " values, expected " << size
+                                    << std::endl);
+  if(H5Dread(dset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+       values.data()) < 0)
+    log_fatal("EOS table: cannot read dataset " << name << std::endl);
+  H5Dclose(dset);
+  return values;
+}
+
+/**
+ * @brief      Read a table in the stellarcollapse.org format, see
+ *             tools/dummyTabEOS: 1D axes logrho, logtemp and ye, and the 3D
+ *             datasets logpress, logenergy = log10(eps + energy_shift) and
+ *             cs2, indexed [ye][temp][rho], in CGS. The axes are uniform
+ *             and the energy increases with the temperature.
+ *
+ *             Collective: the file is read by rank 0 only.
+ */
+void
+read_table(const char * filename) {
+  eos_table_t & t = eos_table;
+  constexpr int nf = eos_table_t::nfields;
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  // n, x0, dx and energy_shift
+  double header[10];
+  if(rank == 0) {
+    hid_t file = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
+    if(file < 0)
+      log_fatal("EOS table: cannot open " << filename << std::endl);
+    const int nr = read_table_dataset(file, "pointsrho", 1)[0],
+              nt = read_table_dataset(file, "pointstemp", 1)[0],
+              ny = read_table_dataset(file, "pointsye", 1)[0];
+    if(nr < 2 || nt < 2 || ny < 1)
+      log_fatal("EOS table: too few points in " << filename << std::endl);
+    const int64_t size = int64_t(nr) * nt * ny;
+    const std::vector<double> logrho = read_table_dataset(file, "logrho", nr),
+                              logtemp = read_table_dataset(file, "logtemp", nt),
+                              ye = read_table_dataset(file, "ye", ny),
+                              logpress =
+                                read_table_dataset(file, "logpress", size),
+                              logenergy =
+                                read_table_dataset(file, "logenergy", size),
+                              cs2 = read_table_dataset(file, "cs2", size);
+    t.energy_shift = read_table_dataset(file, "energy_shift", 1)[0];
+    H5Fclose(file);
+
+    t.n[0] = nr;
+    t.n[1] = nt;
+    t.n[2] = ny;
+    if(!uniform_axis(logrho, t.x0[0], t.dx[0]) ||
+       !uniform_axis(logtemp, t.x0[1], t.dx[1]) ||
+       !uniform_axis(ye, t.x0[2], t.dx[2]))
+      log_fatal("EOS table: the axes of " << filename << " are not uniform"
+                                          << std::endl);
+    t.set_axes();
+
+    // The lookups bisect the energy along the T axis
+    t.data.assign(nf * size, 0.);
+    for(int k = 0; k < ny; ++k)
+      for(int j = 0; j < nt; ++j)
+        for(int i = 0; i < nr; ++i) {
+          const int64_t src = (int64_t(k) * nt + j) * nr + i;
+          if(j > 0 and logenergy[src] < logenergy[src - nr])
+            log_fatal("EOS table: energy not increasing with the temperature"
+                      << std::endl);
+          double * node = t.data.data() + nf * src;
+          node[0] = logpress[src];
+          node[1] = .5 * log10(std::max(cs2[src], DBL_MIN));
+          node[2] = logenergy[src];
+        } // for
+    for(int a = 0; a < 3; ++a) {
+      header[a] = t.n[a];
+      header[3 + a] = t.x0[a];
+      header[6 + a] = t.dx[a];
+    } // for
+    header[9] = t.energy_shift;
+  }
+
+  MPI_Bcast(header, 10, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  for(int a = 0; a < 3; ++a) {
+    t.n[a] = header[a];
+    t.x0[a] = header[3 + a];
+    t.dx[a] = header[6 + a];
+  } // for
+  t.energy_shift = header[9];
+  t.set_axes();
+  t.data.resize(nf * t.size());
+  MPI_Bcast(t.data.data(), t.data.size(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  t.p_error = t.cs_error = 0.;
+}
+
+} // namespace eos
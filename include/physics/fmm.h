@@ -45,6 +45,142 @@ gravitation_p2p(double & gpot,
   return res;
 }
 
+#if FMM_ORDER > 1
+using sym_tensor_rank2 = flecsi::sym_tensor_rank2;
+using sym_tensor_rank3 = flecsi::sym_tensor_rank3;
+using sym_tensor_rank4 = flecsi::sym_tensor_rank4;
+
+/*
+ * @brief Derivatives of 1/|R| with respect to R, up to the fourth order
+ */
+struct inverse_derivatives_t {
+  double d0;
+  point_t d1;
+  sym_tensor_rank2 d2;
+  sym_tensor_rank3 d3;
+  sym_tensor_rank4 d4;
+};
+
+/*
+ * @brief Compute the derivatives of 1/|R| up to the given order,
+ *        only the independent components of the symmetric tensors are set
+ */
+inline void
+inverse_derivatives(const point_t & R,
+  const int & order,
+  inverse_derivatives_t & D) {
+  const double ir = 1. / flecsi::magnitude(R);
+  const double ir2 = ir * ir;
+  const double ir3 = ir * ir2, ir5 = ir3 * ir2, ir7 = ir5 * ir2,
+               ir9 = ir7 * ir2;
+  auto delta = [](const int & i, const int & j) { return double(i == j); };
+  D.d0 = ir;
+  for(int i = 0; i < gdimension; ++i)
+    D.d1[i] = -R[i] * ir3;
+  for(int i = 0; i < gdimension; ++i)
+    for(int j = i; j < gdimension; ++j)
+      D.d2(i, j) = 3. * R[i] * R[j] * ir5 - delta(i, j) * ir3;
+  if(order < 3)
+    return;
+  for(int i = 0; i < gdimension; ++i)
+    for(int j = i; j < gdimension; ++j)
+      for(int k = j; k < gdimension; ++k)
+        D.d3(i, j, k) = -15. * R[i] * R[j] * R[k] * ir7 +
+                        3. *
+                          (delta(i, j) * R[k] + delta(i, k) * R[j] +
+                            delta(j, k) * R[i]) *
+                          ir5;
+  if(order < 4)
+    return;
+  for(int i = 0; i < gdimension; ++i)
+    for(int j = i; j < gdimension; ++j)
+      for(int k = j; k < gdimension; ++k)
+        for(int l = k; l < gdimension; ++l)
+          D.d4(i, j, k, l) =
+            105. * R[i] * R[j] * R[k] * R[l] * ir9 -
+            15. *
+              (delta(i, j) * R[k] * R[l] + delta(i, k) * R[j] * R[l] +
+                delta(i, l) * R[j] * R[k] + delta(j, k) * R[i] * R[l] +
+                delta(j, l) * R[i] * R[k] + delta(k, l) * R[i] * R[j]) *
+              ir7 +
+            3. *
+              (delta(i, j) * delta(k, l) + delta(i, k) * delta(j, l) +
+                delta(i, l) * delta(j, k)) *
+              ir5;
+}
+
+/*
+ * @brief Add the field of a source to the Taylor coefficients at distance R
+ *        of its center of mass. The source has a mass M and optionally the
+ *        quadrupole Q and octupole H moments around its center of mass.
+ *        A multipole of order n contributes to the coefficient of order m
+ *        if n + m <= FMM_ORDER + 1. dfcdr and dfcdrdr can be null.
+ */
+inline void
+taylor_expansion(const point_t & R,
+  const double & M,
+  const sym_tensor_rank2 * Q,
+  const sym_tensor_rank3 * H,
+  double & pc,
+  point_t & fc,
+  sym_tensor_rank2 * dfcdr,
+  sym_tensor_rank3 * dfcdrdr) {
+  inverse_derivatives_t D;
+  inverse_derivatives(R, FMM_ORDER + 1, D);
+
+  // Potential
+  double pot = M * D.d0;
+  if(Q)
+    for(int j = 0; j < gdimension; ++j)
+      for(int k = 0; k < gdimension; ++k)
+        pot += .5 * (*Q)(j, k) * D.d2(j, k);
+  if(H)
+    for(int j = 0; j < gdimension; ++j)
+      for(int k = 0; k < gdimension; ++k)
+        for(int l = 0; l < gdimension; ++l)
+          pot -= 1. / 6. * (*H)(j, k, l) * D.d3(j, k, l);
+  pc += -gc * pot;
+
+  // Acceleration
+  for(int i = 0; i < gdimension; ++i) {
+    double f = M * D.d1[i];
+    if(Q)
+      for(int j = 0; j < gdimension; ++j)
+        for(int k = 0; k < gdimension; ++k)
+          f += .5 * (*Q)(j, k) * D.d3(i, j, k);
+    if(H)
+      for(int j = 0; j < gdimension; ++j)
+        for(int k = 0; k < gdimension; ++k)
+          for(int l = 0; l < gdimension; ++l)
+            f -= 1. / 6. * (*H)(j, k, l) * D.d4(i, j, k, l);
+    fc[i] += gc * f;
+  } // for
+
+  // Gradient of the acceleration
+  if(dfcdr == nullptr)
+    return;
+  for(int i = 0; i < gdimension; ++i)
+    for(int j = i; j < gdimension; ++j) {
+      double f = M * D.d2(i, j);
+#if FMM_ORDER > 2
+      if(Q)
+        for(int k = 0; k < gdimension; ++k)
+          for(int l = 0; l < gdimension; ++l)
+            f += .5 * (*Q)(k, l) * D.d4(i, j, k, l);
+#endif
+      (*dfcdr)(i, j) += gc * f;
+    } // for
+
+  // Hessian of the acceleration
+  if(dfcdrdr == nullptr)
+    return;
+  for(int i = 0; i < gdimension; ++i)
+    for(int j = i; j < gdimension; ++j)
+      for(int k = j; k < gdimension; ++k)
+        (*dfcdrdr)(i, j, k) += gc * M * D.d3(i, j, k);
+}
+#endif
+
 /*
  * @brief Compute the gravitation interaction between point and cell
  */
@@ -55,6 +191,7 @@ gravitation_fc(double & pc,
   const node * source) {
   const point_t & dist_coordinates = source->coordinates();
   const double M = source->mass();
+#if FMM_ORDER == 1
   double d = flecsi::distance(local_coordinates,dist_coordinates);
   double d3 = d*d*d;
   point_t r = local_coordinates - dist_coordinates;
@@ -63,6 +200,13 @@ gravitation_fc(double & pc,
   for(int m = 0; m < gdimension; ++m) {
     fc[m] += -gc*M*r[m]/d3; // Monopole
   }
+#elif FMM_ORDER == 2
+  taylor_expansion(local_coordinates - dist_coordinates, M, &source->quad(),
+    nullptr, pc, fc, nullptr, nullptr);
+#else
+  taylor_expansion(local_coordinates - dist_coordinates, M, &source->quad(),
+    &source->octo(), pc, fc, nullptr, nullptr);
+#endif
 }
 
 /*
@@ -85,7 +229,7 @@ gravitation_fc(double & pc,
 }
 
 /*
- * @brief Taylor expansion up to first order using gravity 
+ * @brief Taylor expansion up to FMM_ORDER using gravity
  *        at the cell center of mass
  */
 void 
@@ -102,44 +246,89 @@ interaction_c2p(body * sink, const node * source) {
   for(int i = 0 ; i < gdimension; ++i){
     pot += -r[i]*fc[i];
   }
+#if FMM_ORDER > 1
+  const sym_tensor_rank2 & dfcdr = source->dfcdr();
+  for(int i = 0; i < gdimension; ++i) {
+    for(int j = 0; j < gdimension; ++j) {
+      grav[i] += dfcdr(i, j) * r[j];
+      pot += -.5 * r[i] * dfcdr(i, j) * r[j];
+    }
+  }
+#endif
+#if FMM_ORDER > 2
+  const sym_tensor_rank3 & dfcdrdr = source->dfcdrdr();
+  for(int i = 0; i < gdimension; ++i) {
+    for(int j = 0; j < gdimension; ++j) {
+      for(int k = 0; k < gdimension; ++k) {
+        grav[i] += .5 * dfcdrdr(i, j, k) * r[j] * r[k];
+        pot += -1. / 6. * dfcdrdr(i, j, k) * r[i] * r[j] * r[k];
+      }
+    }
+  }
+#endif
   sink->setGPotential(sink->getGPotential()+pot);
   sink->setGAcceleration(grav+sink->getGAcceleration());
 }
 
 
 /**
- * @brief For all sub_entities, add gravitational force and potential of the
- *        node nd, using Taylor expansion coefficients stored in the node.
+ * @brief For the n contiguous sinks, add gravitational force and potential of
+ *        the node nd, using Taylor expansion coefficients stored in the node.
  */
 void
-fmm_c2p(const node* nd, std::vector<body *> & sub_entities) {
-  for (int k = 0; k < sub_entities.size(); ++k) {
-    interaction_c2p(sub_entities[k], nd);
+fmm_c2p(const node * nd, body * sinks, const int64_t & n) {
+  for (int64_t k = 0; k < n; ++k) {
+    interaction_c2p(&sinks[k], nd);
   }
 }
 
 /**
- * @brief Particle-particle interactions between 'sources' and 'sinks'
+ * @brief Direct interaction between the node source and the particle sink
  */
-void 
-fmm_p2p(std::vector<body *> & sinks,
-  const node * node_sources,
-  const std::vector<body *> & particle_sources) {
-  for (int i=0; i<sinks.size(); ++i) {
-    body *p = sinks[i];
-    double pc = p->getGPotential();
-    point_t acc = p->getGAcceleration();
-    if(node_sources != nullptr)
-    gravitation_fc(pc, acc, p->coordinates(), node_sources);
-    for (int k = 0; k < particle_sources.size(); ++k) {
-      body *q = particle_sources[k];
-      if (q->id() == p->id())
-        continue;
-      acc+= gravitation_p2p(pc,p->coordinates(),q->coordinates(),q->mass());
-    } // for
-    p->setGPotential(pc);
-    p->setGAcceleration(acc);
-  }
+void
+fmm_m2p(body & sink, const node * source) {
+  double pc = sink.getGPotential();
+  point_t acc = sink.getGAcceleration();
+  gravitation_fc(pc, acc, sink.coordinates(), source);
+  sink.setGPotential(pc);
+  sink.setGAcceleration(acc);
+}
+
+/**
+ * @brief Particle-particle interactions between the sink and the packed
+ *        sources in [begin, end). The sink itself is not in the range.
+ */
+void
+fmm_p2p(body & sink,
+  const tree_topology_t::fmm_sources_t & sources,
+  const int64_t & begin,
+  const int64_t & end) {
+  const point_t & pos_a = sink.coordinates();
+  const double * m = sources.mass.data();
+  const double * x[gdimension];
+  for(int d = 0; d < gdimension; ++d)
+    x[d] = sources.x[d].data();
+
+  double pc = 0.0;
+  double acc[gdimension] = {};
+  for(int64_t b = begin; b < end; ++b) { // Vectorized
+    double r[gdimension], r2 = 0.0;
+    for(int d = 0; d < gdimension; ++d) {
+      r[d] = pos_a[d] - x[d][b];
+      r2 += r[d] * r[d];
+    }
+    const double ir = 1. / std::sqrt(r2);
+    const double mir = m[b] * ir;
+    pc -= mir;
+    for(int d = 0; d < gdimension; ++d)
+      acc[d] -= mir * ir * ir * r[d];
+  } // for
+
+  point_t grav = sink.getGAcceleration();
+  for(int d = 0; d < gdimension; ++d)
+    grav[d] += gc * acc[d];
+  sink.setGPotential(sink.getGPotential() + gc * pc);
+  sink.setGAcceleration(grav);
 }
 
 /**
@@ -147,7 +336,17 @@ fmm_p2p(std::vector<body *> & sinks,
  */
 void
 taylor_c2c(node * sink, const node * source) {
+#if FMM_ORDER == 1
   gravitation_fc(sink->pc(), sink->fc(), sink->coordinates(), source);
+#elif FMM_ORDER == 2
+  taylor_expansion(sink->coordinates() - source->coordinates(),
+    source->mass(), &source->quad(), nullptr, sink->pc(), sink->fc(),
+    &sink->dfcdr(), nullptr);
+#else
+  taylor_expansion(sink->coordinates() - source->coordinates(),
+    source->mass(), &source->quad(), &source->octo(), sink->pc(), sink->fc(),
+    &sink->dfcdr(), &sink->dfcdrdr());
+#endif
 }
 
 /**
@@ -155,7 +354,17 @@ taylor_c2c(node * sink, const node * source) {
  */
 void 
 taylor_p2c(node * sink, const body * source) {
+#if FMM_ORDER == 1
   gravitation_fc(sink->pc(), sink->fc(), sink->coordinates(), source);
+#elif FMM_ORDER == 2
+  taylor_expansion(sink->coordinates() - source->coordinates(),
+    source->mass(), nullptr, nullptr, sink->pc(), sink->fc(), &sink->dfcdr(),
+    nullptr);
+#else
+  taylor_expansion(sink->coordinates() - source->coordinates(),
+    source->mass(), nullptr, nullptr, sink->pc(), sink->fc(), &sink->dfcdr(),
+    &sink->dfcdrdr());
+#endif
 }
 
 } // namespace fmm
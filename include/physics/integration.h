@@ -34,6 +34,59 @@
 namespace integration {
 using namespace param;
 
+/**
+ * @brief  True if the particles have their own power-of-two timesteps
+ */
+inline bool
+block_timesteps_enabled() {
+  return adaptive_timestep && block_timestep_levels > 1;
+}
+
+/**
+ * @brief  Number of ticks of physics::block_dt in a cycle of the block
+ *         timesteps, the longest step. All the particles are synchronized
+ *         at its end.
+ */
+inline int64_t
+block_period() {
+  return block_timesteps_enabled() ? int64_t(1) << (block_timestep_levels - 1)
+                                   : 1;
+}
+
+/**
+ * @brief  Tick of the cycle at the end of the current iteration
+ */
+inline int64_t
+block_now() {
+  return physics::block_tick + physics::block_step;
+}
+
+/**
+ * @brief  Timestep of the particle, block_dt * 2^timebin
+ */
+inline double
+block_timestep(const body & particle) {
+  return physics::block_dt * (int64_t(1) << particle.getTimebin());
+}
+
+/**
+ * @brief  True if the timestep of the particle starts with the current
+ *         iteration
+ */
+inline bool
+is_starting(const body & particle) {
+  return physics::block_tick % (int64_t(1) << particle.getTimebin()) == 0;
+}
+
+/**
+ * @brief  True if the timestep of the particle ends with the current
+ *         iteration: its forces are evaluated and it is kicked
+ */
+inline bool
+is_active(const body & particle) {
+  return block_now() % (int64_t(1) << particle.getTimebin()) == 0;
+}
+
 /**
  * @brief      Integrate the internal energy variation, update internal energy
  *
@@ -109,6 +162,158 @@ leapfrog_drift(body & source) {
     source.coordinates() + physics::dt * source.getVelocity());
 }
 
+/**
+ * @brief      Block timesteps: first kick of the particles starting their
+ *             step, with their own timestep dt_i
+ *             v^{n+1/2} = v^{n} + (dv/dt)^n * dt_i/2,  v12 = v^{n+1/2}
+ *
+ * @param      srch  The source's body holder
+ */
+void
+block_kick_one_v(body & source) {
+  if(!is_starting(source))
+    return;
+  source.setVelocity(source.getVelocity() +
+                     0.5 * block_timestep(source) *
+                       (source.getAcceleration() + source.getGAcceleration()));
+  source.setVelocityhalf(source.getVelocity());
+}
+
+/**
+ * @brief      Block timesteps: second kick of the active particles, from the
+ *             velocity at the half step
+ *             v^{n+1} = v^{n+1/2} + (dv/dt)^{n+1} * dt_i/2
+ *
+ * @param      srch  The source's body holder
+ */
+void
+block_kick_two_v(body & source) {
+  if(!is_active(source))
+    return;
+  source.setVelocity(source.getVelocityhalf() +
+                     0.5 * block_timestep(source) *
+                       (source.getAcceleration() + source.getGAcceleration()));
+}
+
+/**
+ * @brief      Block timesteps: kick internal energy of the particles starting
+ *             their step, u^{n+1/2} = u^{n} + (du/dt)^n * dt_i/2
+ *
+ * @param      srch  The source's body holder
+ */
+void
+block_kick_one_u(body & source) {
+  if(is_starting(source))
+    source.setInternalenergy(source.getInternalenergy() +
+                             0.5 * block_timestep(source) *
+                               source.getDudt());
+}
+
+/**
+ * @brief      Block timesteps: kick internal energy of the active particles,
+ *             u^{n+1} = u^{n+1/2} + (du/dt)^{n+1} * dt_i/2
+ *
+ * @param      srch  The source's body holder
+ */
+void
+block_kick_two_u(body & source) {
+  if(is_active(source))
+    source.setInternalenergy(source.getInternalenergy() +
+                             0.5 * block_timestep(source) *
+                               source.getDudt());
+}
+
+/**
+ * @brief      Block timesteps: kick thermokinetic or total energy of the
+ *             particles starting their step,
+ *             e^{n+1/2} = e^{n} + (de/dt)^n * dt_i/2
+ *
+ * @param      srch  The source's body holder
+ */
+void
+block_kick_one_e(body & source) {
+  if(is_starting(source))
+    source.setTotalenergy(source.getTotalenergy() +
+                          0.5 * block_timestep(source) *
+                            source.getDedt());
+}
+
+/**
+ * @brief      Block timesteps: kick thermokinetic or total energy of the
+ *             active particles, e^{n+1} = e^{n+1/2} + (de/dt)^{n+1} * dt_i/2
+ *
+ * @param      srch  The source's body holder
+ */
+void
+block_kick_two_e(body & source) {
+  if(is_active(source))
+    source.setTotalenergy(source.getTotalenergy() +
+                          0.5 * block_timestep(source) *
+                            source.getDedt());
+}
+
+/**
+ * @brief      Block timesteps: drift all the particles over the iteration
+ *             with their velocity at the half step, r += v^{n+1/2} * dt.
+ *             The velocity of the particles not active at the end of the
+ *             iteration is predicted at this time from their last
+ *             acceleration, for the neighbors of the active particles.
+ *
+ * @param      srch  The source's body holder
+ */
+void
+block_drift(body & source) {
+  source.set_coordinates(
+    source.coordinates() + physics::dt * source.getVelocityhalf());
+  if(is_active(source))
+    return;
+  // Ticks from the middle of the step of the particle to the end of the
+  // iteration
+  const int64_t half = (int64_t(1) << source.getTimebin()) / 2;
+  const int64_t k = block_now() % (2 * half) - half;
+  source.setVelocity(source.getVelocityhalf() +
+                     k * physics::block_dt *
+                       (source.getAcceleration() + source.getGAcceleration()));
+}
+
+/**
+ * @brief      Block timesteps: move the particle to a smaller timebin at
+ *             the end of the current iteration. A particle in the middle of
+ *             its step ends it earlier: the first kick is reduced to the
+ *             half of the new step and the drift since the start of the
+ *             step is redone with the new velocity at the half step. The
+ *             timebin is raised to the first one ending after the current
+ *             iteration and is never increased.
+ *
+ * @param      source  The particle
+ * @param[in]  bin     The new timebin
+ */
+void
+block_demote(body & source, int bin) {
+  const int64_t step = int64_t(1) << source.getTimebin();
+  const int64_t elapsed = block_now() % step;
+  while((int64_t(1) << bin) <= elapsed)
+    ++bin;
+  if(bin >= source.getTimebin())
+    return;
+  if(elapsed > 0) {
+    const double dstep = physics::block_dt * ((int64_t(1) << bin) - step);
+    const point_t dv =
+      0.5 * dstep * (source.getAcceleration() + source.getGAcceleration());
+    source.setVelocityhalf(source.getVelocityhalf() + dv);
+    source.setVelocity(source.getVelocity() + dv);
+    source.set_coordinates(
+      source.coordinates() + elapsed * physics::block_dt * dv);
+    if(evolve_internal_energy && thermokinetic_formulation)
+      source.setTotalenergy(
+        source.getTotalenergy() + 0.5 * dstep * source.getDedt());
+    else if(evolve_internal_energy)
+      source.setInternalenergy(
+        source.getInternalenergy() + 0.5 * dstep * source.getDudt());
+  }
+  source.setTimebin(bin);
+}
+
 }; // namespace integration
 
 #endif // _integration_h_
@@ -26,6 +26,7 @@
 #ifndef _physics_kernel_h_
 #define _physics_kernel_h_
 
+#include <algorithm>
 #include <boost/algorithm/string.hpp>
 #include <vector>
 
@@ -696,7 +697,119 @@ kernel_gradient<param::sinc_ker, gdimension>(const point_t & vecP,
   return result;
 }
 
-#ifdef sph_kernel
+/*============================================================================*/
+/*   Tabulated kernel                                                         */
+/*============================================================================*/
+/**
+ * The selected kernel W and its derivative dW/dq are sampled at h = 1 on
+ * sph_kernel_table_size + 1 uniform points of q = r/h in [0, 1], the support
+ * of all the kernels, and linearly interpolated. A kernel evaluation is then
+ * a multiplication by 1/h^D, a truncation and two loads, with neither pow,
+ * exp nor sin, and does not depend on the kernel: the same inlined functions
+ * serve all the kernels.
+ *
+ * Accuracy: the error of the linear interpolation of f = W or f = dW/dq is
+ * below max|f''| / (8 n^2) for n intervals. tabulate measures it at the
+ * midpoints of the intervals; relative to max|W| and max|dW/dq|, it is below
+ * 5e-7 for all the kernels with the default n = 4096 in 1, 2 and 3D, and
+ * decreases as 1/n^2.
+ */
+struct kernel_table_t {
+  int n = 0;
+  // W(q_i) and W(q_i+1) - W(q_i), with q_i = i/n, then the same for dW/dq.
+  // The entry n holds the limit at q = 1 from below, so that the truncated
+  // kernels (gaussians) are not interpolated to 0 in the last interval; the
+  // evaluations beyond the support read it and are masked to 0
+  std::vector<double> w, dw, g, dg;
+  // measured interpolation errors, relative to max|W| and max|dW/dq|
+  double w_error = 0., g_error = 0.;
+};
+kernel_table_t kernel_table;
+
+/**
+ * @brief      Interpolated kernel, see kernel_table_t
+ */
+inline double
+tabulated_kernel(const double & r, const double & h) {
+  const kernel_table_t & t = kernel_table;
+  const double ih = 1. / h;
+  double ihd = ih;
+  for(unsigned int d = 1; d < gdimension; ++d)
+    ihd *= ih;
+  const double x = std::min(r * ih * t.n, double(t.n));
+  const int i = x;
+  return (x < t.n) * ihd * (t.w[i] + (x - i) * t.dw[i]);
+}
+
+/**
+ * @brief      Interpolated kernel gradient, see kernel_table_t
+ */
+inline point_t
+tabulated_kernel_gradient(const point_t & vecP, const double & h) {
+  const kernel_table_t & t = kernel_table;
+  const double r = flecsi::magnitude(vecP);
+  const double ih = 1. / h;
+  double ihd1 = ih * ih;
+  for(unsigned int d = 1; d < gdimension; ++d)
+    ihd1 *= ih;
+  const double x = std::min(r * ih * t.n, double(t.n));
+  const int i = x;
+  const double dWdq = t.g[i] + (x - i) * t.dg[i];
+  point_t result = vecP;
+  result *= (x < t.n) * ihd1 * dWdq / (r + TINY);
+  return result;
+}
+
+/**
+ * @brief      Fill the kernel table from the analytic kernel
+ *
+ * @param[in]  function  Analytic kernel
+ * @param[in]  gradient  Its gradient
+ * @param[in]  n         Number of intervals
+ */
+void
+tabulate(kernel_function_t function,
+  kernel_gradient_t gradient,
+  const int n) {
+  kernel_table_t & t = kernel_table;
+  t.n = n;
+  std::vector<double> w(n + 1), g(n + 1);
+  point_t e = 0.;
+  for(int i = 0; i <= n; ++i) {
+    e[0] = i < n ? double(i) / n : std::nextafter(1., 0.);
+    w[i] = function(e[0], 1.);
+    g[i] = gradient(e, 1.)[0];
+  } // for
+  t.w = w;
+  t.g = g;
+  t.dw.assign(n + 1, 0.);
+  t.dg.assign(n + 1, 0.);
+  for(int i = 0; i < n; ++i) {
+    t.dw[i] = w[i + 1] - w[i];
+    t.dg[i] = g[i + 1] - g[i];
+  } // for
+
+  double w_max = 0., g_max = 0.;
+  t.w_error = t.g_error = 0.;
+  for(int i = 0; i < n; ++i) {
+    w_max = std::max(w_max, fabs(w[i]));
+    g_max = std::max(g_max, fabs(g[i]));
+    e[0] = (i + .5) / n;
+    t.w_error = std::max(t.w_error, fabs(tabulated_kernel(e[0], 1.) - function(e[0], 1.)));
+    t.g_error = std::max(t.g_error,
+      fabs(tabulated_kernel_gradient(e, 1.)[0] - gradient(e, 1.)[0]));
+  } // for
+  t.w_error /= w_max;
+  t.g_error /= g_max;
+}
+
+// The kernel is called through function pointers unless it is fixed at
+// compile time, either analytic with sph_kernel or tabulated with
+// sph_kernel_tabulated defined as true
+#if defined(sph_kernel_tabulated) && sph_kernel_tabulated
+# define  sph_kernel_function  tabulated_kernel
+# define  sph_kernel_gradient  tabulated_kernel_gradient
+#elif defined(sph_kernel)
 # define  sph_kernel_function  kernel<param::sph_kernel,gdimension>
 # define  sph_kernel_gradient  kernel_gradient<param::sph_kernel,gdimension>
 #else
@@ -711,44 +824,45 @@ kernel_gradient_t sph_kernel_gradient = nullptr;
 void
 select() {
   using namespace param;
-#ifndef sph_kernel
+  // Analytic kernel, also the source of the table
+  kernel_function_t function = nullptr;
+  kernel_gradient_t gradient = nullptr;
   switch(sph_kernel) {
     case(cubic_spline):
-      sph_kernel_function = kernel<cubic_spline, gdimension>;
-      sph_kernel_gradient = kernel_gradient<cubic_spline, gdimension>;
+      function = kernel<cubic_spline, gdimension>;
+      gradient = kernel_gradient<cubic_spline, gdimension>;
       break;
     case(quintic_spline):
-      sph_kernel_function = kernel<quintic_spline, gdimension>;
-      sph_kernel_gradient = kernel_gradient<quintic_spline, gdimension>;
+      function = kernel<quintic_spline, gdimension>;
+      gradient = kernel_gradient<quintic_spline, gdimension>;
       break;
     case(wendland_c2):
-      sph_kernel_function = kernel<wendland_c2, gdimension>;
-      sph_kernel_gradient = kernel_gradient<wendland_c2, gdimension>;
+      function = kernel<wendland_c2, gdimension>;
+      gradient = kernel_gradient<wendland_c2, gdimension>;
       break;
     case(wendland_c4):
-      sph_kernel_function = kernel<wendland_c4, gdimension>;
-      sph_kernel_gradient = kernel_gradient<wendland_c4, gdimension>;
+      function = kernel<wendland_c4, gdimension>;
+      gradient = kernel_gradient<wendland_c4, gdimension>;
       break;
     case(wendland_c6):
-      sph_kernel_function = kernel<wendland_c6, gdimension>;
-      sph_kernel_gradient = kernel_gradient<wendland_c6, gdimension>;
+      function = kernel<wendland_c6, gdimension>;
+      gradient = kernel_gradient<wendland_c6, gdimension>;
       break;
     case(sinc_ker):
-      sph_kernel_function = kernel<sinc_ker, gdimension>;
-      sph_kernel_gradient = kernel_gradient<sinc_ker, gdimension>;
+      function = kernel<sinc_ker, gdimension>;
+      gradient = kernel_gradient<sinc_ker, gdimension>;
       break;
     case(gaussian):
-      sph_kernel_function = kernel<gaussian, gdimension>;
-      sph_kernel_gradient = kernel_gradient<gaussian, gdimension>;
+      function = kernel<gaussian, gdimension>;
+      gradient = kernel_gradient<gaussian, gdimension>;
       break;
     case(super_gaussian):
-      sph_kernel_function = kernel<super_gaussian, gdimension>;
-      sph_kernel_gradient = kernel_gradient<super_gaussian, gdimension>;
+      function = kernel<super_gaussian, gdimension>;
+      gradient = kernel_gradient<super_gaussian, gdimension>;
       break;
     default:
       log_fatal("Bad kernel parameter" << std::endl);
   } // switch(sph_kernel)
-#endif
 
   if(sph_kernel == cubic_spline or sph_kernel == wendland_c2 or
      sph_kernel == wendland_c4 or sph_kernel == wendland_c6) {
@@ -765,6 +879,28 @@ select() {
   else {
     log_fatal("Bad kernel parameter" << std::endl);
   }
+
+  if(sph_kernel_tabulated) {
+    if(sph_kernel_table_size < 2)
+      log_fatal("Bad kernel table size" << std::endl);
+    tabulate(function, gradient, sph_kernel_table_size);
+    log_one(info) << "Kernel table: " << sph_kernel_table_size
+                  << " intervals, relative error " << kernel_table.w_error
+                  << " (W), " << kernel_table.g_error << " (dW/dq)"
+                  << std::endl;
+  }
+
+#if defined(sph_kernel_tabulated) && sph_kernel_tabulated
+#elif defined(sph_kernel)
+  if(sph_kernel_tabulated)
+    log_fatal("sph_kernel is #defined: #define sph_kernel_tabulated to true "
+              "to use the kernel table"
+              << std::endl);
+#else
+  sph_kernel_function = sph_kernel_tabulated ? tabulated_kernel : function;
+  sph_kernel_gradient =
+    sph_kernel_tabulated ? tabulated_kernel_gradient : gradient;
+#endif
 }
 
 }; // namespace kernels
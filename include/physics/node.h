@@ -46,7 +46,7 @@ using sym_tensor_rank4 = flecsi::tensor_u<type_t,
   gdimension>;
 } // namespace flecsi
 
-template<class KEY, size_t FMM_ORDER>
+template<class KEY, size_t ORDER>
 class node_u : public flecsi::topology::cofm_u<gdimension, type_t, KEY>
 {
 
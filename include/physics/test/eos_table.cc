@@ -0,0 +1,207 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <cstdio>
+#include <mpi.h>
+#include <vector>
+
+#include <hdf5.h>
+
+#include "eos.h"
+#include "params.h"
+
+namespace flecsi {
+namespace execution {
+void
+driver(int, char **) {}
+} // namespace execution
+} // namespace flecsi
+
+using namespace eos;
+
+const double lo[3] = {1e2, 1e-2, 0.5}, hi[3] = {1e10, 1e2, 0.5};
+
+// The pressure of the ideal fluid is linear in log-log, the table is exact
+TEST(eos_table, ideal) {
+  const int n[3] = {81, 41, 1};
+  tabulate(pressure_soundspeed<param::eos_ideal>, lo, hi, n);
+  ASSERT_LT(eos_table.p_error, 1e-12);
+  ASSERT_LT(eos_table.cs_error, 1e-12);
+
+  // Clamped outside of the table
+  body particle;
+  particle.setDensity(1e12);
+  particle.setInternalenergy(0.);
+  particle.setElectronfraction(0.5);
+  pressure_soundspeed<param::eos_tabulated>(particle);
+  ASSERT_NEAR(particle.getPressure(),
+    (param::poly_gamma - 1.) * hi[0] * lo[1],
+    1e-10 * particle.getPressure());
+}
+
+TEST(eos_table, white_dwarf) {
+  const int ppd = 20;
+  const int n[3] = {8 * ppd + 1, 4 * ppd + 1, 1};
+  tabulate(pressure_soundspeed<param::eos_wd>, lo, hi, n);
+  ASSERT_LT(eos_table.p_error, 1e-3);
+  ASSERT_LT(eos_table.cs_error, 1e-3);
+
+  // The error decreases as the square of the spacing
+  const double p_error = eos_table.p_error;
+  const int n2[3] = {16 * ppd + 1, 4 * ppd + 1, 1};
+  tabulate(pressure_soundspeed<param::eos_wd>, lo, hi, n2);
+  ASSERT_LT(eos_table.p_error, 0.3 * p_error);
+}
+
+void
+write_dataset(hid_t file,
+  const char * name,
+  const std::vector<double> & values,
+  const int rank,
+  const hsize_t * dims) {
+  hid_t space = H5Screate_simple(rank, dims, nullptr);
+  hid_t dset = H5Dcreate(file, name, H5T_NATIVE_DOUBLE, space, H5P_DEFAULT,
+    H5P_DEFAULT, H5P_DEFAULT);
+  H5Dwrite(dset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+    values.data());
+  H5Dclose(dset);
+  H5Sclose(space);
+}
+
+// Table in (rho, T, Ye) of a gas of pressure P = rho T (1 + Ye) and energy
+// eps = 1.5 T (1 + Ye), with an energy shift, in the format of
+// tools/dummyTabEOS
+TEST(eos_table, read_table) {
+  MPI_Init(nullptr, nullptr);
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  const char * filename = "eos_table_utest.h5";
+  const int nr = 41, nt = 61, ny = 5;
+  const double shift = 10.;
+  auto pressure = [](double rho, double T, double ye) {
+    return rho * T * (1. + ye);
+  };
+  auto energy = [](double T, double ye) { return 1.5 * T * (1. + ye); };
+
+  if(rank == 0) {
+    std::vector<double> logrho(nr), logtemp(nt), ye(ny);
+    for(int i = 0; i < nr; ++i)
+      logrho[i] = -2. + 0.1 * i;
+    for(int j = 0; j < nt; ++j)
+      logtemp[j] = -1. + 0.1 * j;
+    for(int k = 0; k < ny; ++k)
+      ye[k] = 0.1 + 0.1 * k;
+    std::vector<double> logpress, logenergy, cs2;
+    for(int k = 0; k < ny; ++k)
+      for(int j = 0; j < nt; ++j)
+        for(int i = 0; i < nr; ++i) {
+          const double rho = pow(10., logrho[i]), T = pow(10., logtemp[j]);
+          logpress.push_back(log10(pressure(rho, T, ye[k])));
+          logenergy.push_back(log10(energy(T, ye[k]) + shift));
+          cs2.push_back(5. / 3. * pressure(rho, T, ye[k]) / rho);
+        } // for
+
+    hid_t file =
+      H5Fcreate(filename, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    const hsize_t one = 1, dr = nr, dt = nt, dy = ny;
+    const hsize_t dims[3] = {dy, dt, dr};
+    write_dataset(file, "pointsrho", {double(nr)}, 1, &one);
+    write_dataset(file, "pointstemp", {double(nt)}, 1, &one);
+    write_dataset(file, "pointsye", {double(ny)}, 1, &one);
+    write_dataset(file, "energy_shift", {shift}, 1, &one);
+    write_dataset(file, "logrho", logrho, 1, &dr);
+    write_dataset(file, "logtemp", logtemp, 1, &dt);
+    write_dataset(file, "ye", ye, 1, &dy);
+    write_dataset(file, "logpress", logpress, 3, dims);
+    write_dataset(file, "logenergy", logenergy, 3, dims);
+    write_dataset(file, "cs2", cs2, 3, dims);
+    H5Fclose(file);
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  read_table(filename);
+  ASSERT_EQ(eos_table.n[0], nr);
+  ASSERT_EQ(eos_table.n[1], nt);
+  ASSERT_EQ(eos_table.n[2], ny);
+
+  // Inside of the table, away from the temperatures where eps + shift is
+  // flat and the inversion of eps(T) ill-conditioned
+  body particle;
+  for(double ye : {0.15, 0.3, 0.42})
+    for(double T : {10., 31., 200., 800.})
+      for(double rho : {0.05, 1., 70.}) {
+        particle.setDensity(rho);
+        particle.setInternalenergy(energy(T, ye));
+        particle.setElectronfraction(ye);
+        pressure_soundspeed<param::eos_tabulated>(particle);
+        eos_t<param::eos_tabulated>::compute_temperature(particle);
+        const double P = pressure(rho, T, ye);
+        ASSERT_NEAR(particle.getPressure(), P, 1e-2 * P);
+        ASSERT_NEAR(particle.getSoundspeed(), sqrt(5. / 3. * P / rho),
+          1e-2 * sqrt(5. / 3. * P / rho));
+        ASSERT_NEAR(particle.getTemperature(), T, 1e-2 * T);
+      } // for
+
+  // Energy with a degenerate part, eps = rho^(2/3) + 1.5 T (1 + Ye): the
+  // range of eps moves with rho, the error is the one of the interpolation in
+  // (rho, T, Ye) and not of a regridding in eps (2.7e-2 on one eps axis)
+  auto degenerate = [](double rho, double T, double ye) {
+    return pow(rho, 2. / 3.) + 1.5 * T * (1. + ye);
+  };
+  if(rank == 0) {
+    std::vector<double> logrho(nr), logtemp(nt), ye(ny);
+    for(int i = 0; i < nr; ++i)
+      logrho[i] = 0.1 * i;
+    for(int j = 0; j < nt; ++j)
+      logtemp[j] = -1. + 0.1 * j;
+    for(int k = 0; k < ny; ++k)
+      ye[k] = 0.1 + 0.1 * k;
+    std::vector<double> logpress, logenergy, cs2;
+    for(int k = 0; k < ny; ++k)
+      for(int j = 0; j < nt; ++j)
+        for(int i = 0; i < nr; ++i) {
+          const double rho = pow(10., logrho[i]), T = pow(10., logtemp[j]);
+          logpress.push_back(log10(pressure(rho, T, ye[k])));
+          logenergy.push_back(log10(degenerate(rho, T, ye[k])));
+          cs2.push_back(5. / 3. * pressure(rho, T, ye[k]) / rho);
+        } // for
+
+    hid_t file =
+      H5Fcreate(filename, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    const hsize_t one = 1, dr = nr, dt = nt, dy = ny;
+    const hsize_t dims[3] = {dy, dt, dr};
+    write_dataset(file, "pointsrho", {double(nr)}, 1, &one);
+    write_dataset(file, "pointstemp", {double(nt)}, 1, &one);
+    write_dataset(file, "pointsye", {double(ny)}, 1, &one);
+    write_dataset(file, "energy_shift", {0.}, 1, &one);
+    write_dataset(file, "logrho", logrho, 1, &dr);
+    write_dataset(file, "logtemp", logtemp, 1, &dt);
+    write_dataset(file, "ye", ye, 1, &dy);
+    write_dataset(file, "logpress", logpress, 3, dims);
+    write_dataset(file, "logenergy", logenergy, 3, dims);
+    write_dataset(file, "cs2", cs2, 3, dims);
+    H5Fclose(file);
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  read_table(filename);
+  for(double ye : {0.15, 0.3, 0.42})
+    for(double T : {50., 200., 800.})
+      for(double rho : {3., 70., 1500.}) {
+        particle.setDensity(rho);
+        particle.setInternalenergy(degenerate(rho, T, ye));
+        particle.setElectronfraction(ye);
+        pressure_soundspeed<param::eos_tabulated>(particle);
+        eos_t<param::eos_tabulated>::compute_temperature(particle);
+        const double P = pressure(rho, T, ye);
+        ASSERT_NEAR(particle.getPressure(), P, 3e-3 * P);
+        ASSERT_NEAR(particle.getSoundspeed(), sqrt(5. / 3. * P / rho),
+          3e-3 * sqrt(5. / 3. * P / rho));
+        ASSERT_NEAR(particle.getTemperature(), T, 3e-3 * T);
+      } // for
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  if(rank == 0)
+    remove(filename);
+  MPI_Finalize();
+}
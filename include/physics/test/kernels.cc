@@ -113,3 +113,37 @@ TEST(kernel, wendland_c2_1d) {
 
   fclose(output);
 }
+
+template<param::sph_kernel_keyword K>
+void
+check_tabulated() {
+  tabulate(kernel<K, gdimension>, kernel_gradient<K, gdimension>, 4096);
+  ASSERT_LT(kernel_table.w_error, 5e-7);
+  ASSERT_LT(kernel_table.g_error, 5e-7);
+
+  // Scaling with h, any direction, zero beyond the support
+  const double h = 1.1;
+  point_t p;
+  for(size_t d = 0; d < gdimension; ++d)
+    p[d] = 0.1 * (d + 1);
+  const double r = flecsi::magnitude(p);
+  const double w = kernel<K, gdimension>(r, h);
+  const point_t g = kernel_gradient<K, gdimension>(p, h);
+  ASSERT_NEAR(tabulated_kernel(r, h), w, 1e-5 * fabs(w));
+  for(size_t d = 0; d < gdimension; ++d)
+    ASSERT_NEAR(tabulated_kernel_gradient(p, h)[d], g[d], 1e-5 * fabs(g[d]));
+  ASSERT_EQ(tabulated_kernel(1.5 * h, h), 0.);
+  ASSERT_EQ(tabulated_kernel_gradient(p * (2. * h / r), h)[0], 0.);
+}
+
+TEST(kernel, tabulated) {
+  set_sinc_kernel_normalization(param::sph_sinc_index);
+  check_tabulated<param::cubic_spline>();
+  check_tabulated<param::quintic_spline>();
+  check_tabulated<param::wendland_c2>();
+  check_tabulated<param::wendland_c4>();
+  check_tabulated<param::wendland_c6>();
+  check_tabulated<param::gaussian>();
+  check_tabulated<param::super_gaussian>();
+  check_tabulated<param::sinc_ker>();
+}
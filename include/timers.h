@@ -0,0 +1,250 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file timers.h
+ * @brief Hierarchical timers of the phases of the code.
+ *
+ * A region is timed by a timers::scope_t living in the scope to measure. The
+ * regions opened while another one is active are nested in it, giving paths
+ * like "update_iteration/psort" or "traversal_sph/comm_wait". Only the thread
+ * that created the registry (the main thread) records: the scopes opened by
+ * the other OpenMP threads cost one comparison and are ignored.
+ *
+ * The times are accumulated per rank and timers::output reports, for every
+ * region, the min/mean/max over the ranks and the imbalance max/mean of the
+ * time spent since the previous report, as CSV lines.
+ */
+
+#ifndef _timers_h_
+#define _timers_h_
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mpi.h>
+#include <omp.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace timers {
+
+class registry_t
+{
+public:
+  struct region_t {
+    std::string path; // names of the enclosing regions separated by '/'
+    const char * name;
+    int parent;
+    double time = 0.;
+    int64_t calls = 0;
+    std::vector<int> children;
+  }; // struct region_t
+
+  registry_t() : owner_(std::this_thread::get_id()) {
+    regions_.push_back({"", "", -1});
+  }
+
+  bool owner() const {
+    return std::this_thread::get_id() == owner_;
+  }
+
+  /**
+   * @brief Make the child region "name" of the current one current, creating
+   * it on its first use, and return its index.
+   */
+  int enter(const char * name) {
+    const int parent = current_;
+    for(int c : regions_[parent].children)
+      if(regions_[c].name == name || strcmp(regions_[c].name, name) == 0)
+        return current_ = c;
+    const int idx = regions_.size();
+    std::string path = regions_[parent].path.empty()
+                         ? std::string(name)
+                         : regions_[parent].path + "/" + name;
+    regions_.push_back({path, name, parent});
+    regions_[parent].children.push_back(idx);
+    return current_ = idx;
+  }
+
+  void leave(const int idx, const double elapsed) {
+    regions_[idx].time += elapsed;
+    ++regions_[idx].calls;
+    current_ = regions_[idx].parent;
+  }
+
+  //! Add the time measured elsewhere of a child region of the current one
+  void add(const char * name, const double elapsed) {
+    if(owner())
+      leave(enter(name), elapsed);
+  }
+
+  const std::vector<region_t> & regions() const {
+    return regions_;
+  }
+
+  void reset() {
+    for(auto & r : regions_) {
+      r.time = 0.;
+      r.calls = 0;
+    } // for
+  }
+
+private:
+  std::thread::id owner_;
+  std::vector<region_t> regions_;
+  int current_ = 0;
+}; // class registry_t
+
+inline registry_t &
+registry() {
+  static registry_t r;
+  return r;
+}
+
+/**
+ * @brief Times the enclosing scope as the region "name", nested in the region
+ * currently open. The name has to outlive the registry, a literal in practice.
+ */
+class scope_t
+{
+public:
+  explicit scope_t(const char * name) {
+    registry_t & r = registry();
+    if(!r.owner())
+      return;
+    idx_ = r.enter(name);
+    start_ = omp_get_wtime();
+  }
+
+  ~scope_t() {
+    stop();
+  }
+
+  //! Close the region before the end of the scope
+  void stop() {
+    if(idx_ >= 0)
+      registry().leave(idx_, omp_get_wtime() - start_);
+    idx_ = -1;
+  }
+
+  scope_t(const scope_t &) = delete;
+  scope_t & operator=(const scope_t &) = delete;
+
+private:
+  int idx_ = -1;
+  double start_ = 0.;
+}; // class scope_t
+
+/**
+ * @brief Gather the regions of all the ranks and append one line per region
+ * to filename on rank 0: iteration, region, calls (max over the ranks), min,
+ * mean and max time over the ranks, and the imbalance max/mean. The header is
+ * written if the file is truncated. The accumulated times are then reset.
+ * Collective.
+ */
+inline void
+output(const char * filename,
+  const int64_t iteration,
+  const bool truncate = false,
+  MPI_Comm comm = MPI_COMM_WORLD) {
+  int rank, size;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+  registry_t & r = registry();
+
+  // The ranks do not necessarily open the same regions: the union of the
+  // paths is made on rank 0, in the order of first appearance
+  std::string local;
+  for(size_t i = 1; i < r.regions().size(); ++i)
+    local += r.regions()[i].path + '\n';
+  int nlocal = local.size();
+  std::vector<int> counts(size), displs(size);
+  MPI_Gather(&nlocal, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, comm);
+  std::string all;
+  if(rank == 0) {
+    for(int i = 1; i < size; ++i)
+      displs[i] = displs[i - 1] + counts[i - 1];
+    all.resize(displs[size - 1] + counts[size - 1]);
+  }
+  MPI_Gatherv(local.data(), nlocal, MPI_CHAR, &all[0], counts.data(),
+    displs.data(), MPI_CHAR, 0, comm);
+
+  std::vector<std::string> paths;
+  std::string merged;
+  if(rank == 0) {
+    std::map<std::string, int> known;
+    size_t begin = 0, end;
+    while((end = all.find('\n', begin)) != std::string::npos) {
+      std::string path = all.substr(begin, end - begin);
+      if(known.emplace(path, paths.size()).second) {
+        paths.push_back(path);
+        merged += path + '\n';
+      }
+      begin = end + 1;
+    } // while
+  }
+  int nmerged = merged.size();
+  MPI_Bcast(&nmerged, 1, MPI_INT, 0, comm);
+  merged.resize(nmerged);
+  MPI_Bcast(&merged[0], nmerged, MPI_CHAR, 0, comm);
+
+  std::map<std::string, int> index;
+  for(size_t i = 1; i < r.regions().size(); ++i)
+    index[r.regions()[i].path] = i;
+  std::vector<double> time;
+  std::vector<int64_t> calls;
+  size_t begin = 0, end;
+  while((end = merged.find('\n', begin)) != std::string::npos) {
+    auto it = index.find(merged.substr(begin, end - begin));
+    time.push_back(it == index.end() ? 0. : r.regions()[it->second].time);
+    calls.push_back(it == index.end() ? 0 : r.regions()[it->second].calls);
+    begin = end + 1;
+  } // while
+
+  const int n = time.size();
+  std::vector<double> tmin(n), tmax(n), tsum(n);
+  std::vector<int64_t> cmax(n);
+  MPI_Reduce(time.data(), tmin.data(), n, MPI_DOUBLE, MPI_MIN, 0, comm);
+  MPI_Reduce(time.data(), tmax.data(), n, MPI_DOUBLE, MPI_MAX, 0, comm);
+  MPI_Reduce(time.data(), tsum.data(), n, MPI_DOUBLE, MPI_SUM, 0, comm);
+  MPI_Reduce(calls.data(), cmax.data(), n, MPI_INT64_T, MPI_MAX, 0, comm);
+  r.reset();
+
+  if(rank != 0)
+    return;
+  FILE * file = fopen(filename, truncate ? "w" : "a");
+  if(file == nullptr) {
+    fprintf(stderr, "timers: cannot open %s\n", filename);
+    return;
+  }
+  if(truncate)
+    fprintf(file, "iteration,region,calls,min,mean,max,imbalance\n");
+  for(int i = 0; i < n; ++i) {
+    const double mean = tsum[i] / size;
+    fprintf(file, "%ld,%s,%ld,%.6e,%.6e,%.6e,%.4f\n", (long)iteration,
+      paths[i].c_str(), (long)cmax[i], tmin[i], mean, tmax[i],
+      mean > 0. ? tmax[i] / mean : 1.);
+  } // for
+  fclose(file);
+}
+
+} // namespace timers
+
+#endif // _timers_h_
@@ -35,12 +35,19 @@
 //#include "utils.h"
 
 #include "body.h"
+#include "body_soa.h"
 #include "node.h"
 #include <boost/multiprecision/cpp_int.hpp>
 
 using namespace flecsi;
 using boost::multiprecision::uint128_t;
 
+// Order of the FMM multipole and Taylor expansions
+#ifndef FMM_ORDER
+#define FMM_ORDER 1
+#endif
+static_assert(FMM_ORDER >= 1 && FMM_ORDER <= 3, "FMM_ORDER must be 1, 2 or 3");
+
 #ifdef KEY_INTEGER_TYPE
 using key_type_t = KEY_INTEGER_TYPE;
 #else
@@ -62,11 +69,15 @@ public:
   using key_int_t = key_type_t;
   static const size_t dimension = gdimension;
   using element_t = type_t;
+#ifdef HILBERT_KEYS
+  using key_t = flecsi::hilbert_curve_u<dimension, key_type_t>;
+#else
   using key_t = flecsi::morton_curve_u<dimension, key_type_t>;
+#endif
   using point_t = flecsi::space_vector_u<element_t, dimension>;
   using geometry_t = flecsi::topology::tree_geometry<element_t, gdimension>;
   using entity_t = body_u<key_t>;
-  using cofm_t = node_u<key_t,1>; 
+  using cofm_t = node_u<key_t, FMM_ORDER>;
 }; // class tree_policy
 
 using tree_topology_t = flecsi::topology::tree_topology<tree_policy>;
@@ -75,6 +86,7 @@ using point_t = tree_topology_t::point_t;
 using node = tree_topology_t::cofm_t;
 using key_type = tree_topology_t::key_t;
 using body = tree_topology_t::entity_t;
+using body_soa = body_soa_u<body>;
 
 using range_t = std::array<point_t, 2>;
 
@@ -238,7 +238,7 @@ class hilbert_curve_u : public filling_curve<DIM, T, hilbert_curve_u<DIM, T>>
 
   using filling_curve<DIM, T, hilbert_curve_u>::value_;
   using filling_curve<DIM, T, hilbert_curve_u>::max_depth_;
-  using filling_curve<DIM, T, hilbert_curve_u>::bits_; 
+  using filling_curve<DIM, T, hilbert_curve_u>::bits_;
 
 public:
   hilbert_curve_u() : filling_curve<DIM, T, hilbert_curve_u>() {}
@@ -258,7 +258,6 @@ public:
     return *this;
   }
 
-
   //! Hilbert key is always generated to the max_depth_ and then truncated
   //! otherwise the key will not be the same
   hilbert_curve_u(const std::array<point_t, 2> & range,
@@ -266,8 +265,8 @@ public:
     const size_t depth) {
     *this = filling_curve<DIM, T, hilbert_curve_u>::min();
     assert(depth <= max_depth_);
-    std::array<int_t, dimension> coords;
-    const int_t max_val = (int_t(1) << (bits_ - 1) / dimension)-1;
+    coord_t coords;
+    const int_t max_val = (int_t(1) << (bits_ - 1) / dimension) - 1;
 
     // Convert the position to integer
     for(size_t i = 0; i < dimension; ++i) {
@@ -276,60 +275,23 @@ public:
       coords[i] = std::min(max_val,
         static_cast<int_t>((p[i] - min) / scale * (int_t(1) << (max_depth_))));
     }
-    // Handle 1D case
-    if(dimension == 1) {
-      assert(value_ & 1UL << max_depth_);
-      value_ |= coords[0] >> dimension;
-      value_ >>= (max_depth_ - depth);
-      return;
-    }
-    int_t mask = static_cast<int_t>(1) << (max_depth_);
-    for(int_t s = mask >> 1; s > 0; s >>= 1) {
-      std::array<int_t, dimension> bits;
+    axes_to_transpose_(coords);
+    // Interleave the transposed coordinates, the first axis holds the most
+    // significant bit of each digit
+    for(size_t l = max_depth_; l > 0; --l) {
       for(size_t j = 0; j < dimension; ++j) {
-        bits[j] = (s & coords[j]) > 0;
-      }
-      if constexpr (dimension == 2) {
-        value_ += s * s * ((3 * bits[0]) ^ bits[1]);
-        rotation2d(s, coords, bits);
-      }
-      if constexpr (dimension == 3) {
-        value_ += s * s * s * ((7 * bits[0]) ^ (3 * bits[1]) ^ bits[2]);
-        rotation3d(s, coords, bits);
-      }
-    }
+        int_t bit = (coords[j] >> (l - 1)) & int_t(1);
+        value_ |= bit << ((l - 1) * dimension + dimension - 1 - j);
+      } // for
+    } // for
     // Then truncate the key to the depth
     value_ >>= (max_depth_ - depth) * dimension;
   }
 
   /*! Convert this id to coordinates in range. */
   void coordinates(const std::array<point_t, 2> & range, point_t & p) {
-    int_t key = value_;
-    std::array<int_t, dimension> coords;
-    coords.fill(int_t(0));
-
-    int_t n = int_t(1) << (max_depth_); // Number of cells to an edge.
-    for(int_t mask = int_t(1); mask < n; mask <<= 1) {
-      std::array<int_t, dimension> bits = {};
-      if constexpr (dimension == 3) {
-        bits[0] = (key & 4) > 0;
-        bits[1] = ((key & 2) ^ bits[0]) > 0;
-        bits[2] = ((key & 1) ^ bits[0] ^ bits[1]) > 0;
-        rotation3d(mask, coords, bits);
-        coords[0] += bits[0] * mask;
-        coords[1] += bits[1] * mask;
-        coords[2] += bits[2] * mask;
-      }
-      if constexpr (dimension == 2) {
-        bits[0] = (key & 2) > 0;
-        bits[1] = ((key & 1) ^ bits[0]) > 0;
-        rotation2d(mask, coords, bits);
-        coords[0] += bits[0] * mask;
-        coords[1] += bits[1] * mask;
-      }
-      key >>= dimension;
-    }
-    assert(key == int_t(1));
+    coord_t coords;
+    decode_(value_, coords);
     for(size_t j = 0; j < dimension; ++j) {
       double min = range[0][j];
       double scale = range[1][j] - min;
@@ -340,127 +302,90 @@ public:
 
   /**
    * @brief Compute the range of a branch from its key
-   * The space is recursively decomposed regarding the dimension
+   * The branch is a cell of the regular grid at its depth: the key is
+   * extended with zeros up to max_depth_ and the cell is found from the
+   * coordinates of this first descendant.
    */
   std::array<point_t, 2> range(const std::array<point_t, 2> & range) {
-    return std::array<point_t, 2>{};
+    const size_t d = this->depth();
+    coord_t coords;
+    decode_(value_ << (max_depth_ - d) * dimension, coords);
+    std::array<point_t, 2> result;
+    for(size_t j = 0; j < dimension; ++j) {
+      const int_t cell = coords[j] >> (max_depth_ - d);
+      const double width = (range[1][j] - range[0][j]) / (int_t(1) << d);
+      result[0][j] = range[0][j] + width * static_cast<double>(cell);
+      result[1][j] = result[0][j] + width;
+    } // for
+    return result;
   } // range
 
 private:
-  void rotation2d(const int_t & n,
-    std::array<int_t, dimension> & coords,
-    const std::array<int_t, dimension> & bits) {
-    if(bits[1] == 0) {
-      if(bits[0] == 1) {
-        coords[0] = n - 1 - coords[0];
-        coords[1] = n - 1 - coords[1];
-      }
-      // Swap X-Y 
-      int t = coords[0];
-      coords[0] = coords[1];
-      coords[1] = t;
-    }
-  }
-
-  void rotate_90_x(const int_t & n, std::array<int_t, dimension> & coords) {
-    coord_t tmp = coords;
-    coords[0] = tmp[0];
-    coords[1] = n - 1 - tmp[2];
-    coords[2] = tmp[1];
-  }
-  void rotate_90_y(const int_t & n, std::array<int_t, dimension> & coords) {
-    coord_t tmp = coords;
-    coords[0] = tmp[2];
-    coords[1] = tmp[1];
-    coords[2] = n - 1 - tmp[0];
-  }
-  void rotate_90_z(const int_t & n, std::array<int_t, dimension> & coords) {
-    coord_t tmp = coords;
-    coords[0] = n - 1 - tmp[1];
-    coords[1] = tmp[0];
-    coords[2] = tmp[2];
-  }
-  void rotate_180_x(const int_t & n, std::array<int_t, dimension> & coords) {
-    coord_t tmp = coords;
-    coords[0] = tmp[0];
-    coords[1] = n - 1 - tmp[1];
-    coords[2] = n - 1 - tmp[2];
-  }
-  void rotate_270_x(const int_t & n, std::array<int_t, dimension> & coords) {
-    coord_t tmp = coords;
-    coords[0] = tmp[0];
-    coords[1] = tmp[2];
-    coords[2] = n - 1 - tmp[1];
-  }
-  void rotate_270_y(const int_t & n, std::array<int_t, dimension> & coords) {
-    coord_t tmp = coords;
-    coords[0] = n - 1 - tmp[2];
-    coords[1] = tmp[1];
-    coords[2] = tmp[0];
-  }
-  void rotate_270_z(const int_t & n, std::array<int_t, dimension> & coords) {
-    coord_t tmp = coords;
-    coords[0] = tmp[1];
-    coords[1] = n - 1 - tmp[0];
-    coords[2] = tmp[2];
-  }
-
-  void rotation3d(const int_t & n,
-    std::array<int_t, dimension> & coords,
-    const std::array<int_t, dimension> & bits) {
-    if(!bits[0] && !bits[1] && !bits[2]) {
-      // Left front bottom
-      rotate_270_z(n, coords);
-      rotate_270_x(n, coords);
-    }
-    else if(!bits[0] && bits[2]) {
-      // Left top
-      rotate_90_z(n, coords);
-      rotate_90_y(n, coords);
-    }
-    else if(bits[1] && !bits[2]) {
-      // Back bottom
-      rotate_180_x(n, coords);
-    }
-    else if(bits[0] && bits[2]) {
-      // Right top
-      rotate_270_z(n, coords);
-      rotate_270_y(n, coords);
-    }
-    else if(bits[0] && !bits[2] && !bits[1]) {
-      // Right front bottom
-      rotate_90_y(n, coords);
-      rotate_90_z(n, coords);
-    }
+  /*! Integer coordinates of a key of depth max_depth_ */
+  void decode_(const int_t & key, coord_t & coords) {
+    coords.fill(int_t(0));
+    for(size_t l = max_depth_; l > 0; --l) {
+      for(size_t j = 0; j < dimension; ++j) {
+        int_t bit = (key >> ((l - 1) * dimension + dimension - 1 - j)) & int_t(1);
+        coords[j] |= bit << (l - 1);
+      } // for
+    } // for
+    transpose_to_axes_(coords);
   }
 
-  void unrotation3d(const int_t & n,
-    std::array<int_t, dimension> & coords,
-    const std::array<int_t, dimension> & bits) {
-    if(!bits[0] && !bits[1] && !bits[2]) {
-      // Left front bottom
-      rotate_90_x(n, coords);
-      rotate_90_z(n, coords);
-    }
-    else if(!bits[0] && bits[2]) {
-      // Left top
-      rotate_270_y(n, coords);
-      rotate_270_z(n, coords);
-    }
-    else if(bits[1] && !bits[2]) {
-      // Back bottom
-      rotate_180_x(n, coords);
-    }
-    else if(bits[0] && bits[2]) {
-      // Right top
-      rotate_90_y(n, coords);
-      rotate_90_z(n, coords);
-    }
-    else if(bits[0] && !bits[2] && !bits[1]) {
-      // Right front bottom
-      rotate_270_z(n, coords);
-      rotate_270_y(n, coords);
-    }
+  /**
+   * @brief Transform the coordinates in the "transposed" Hilbert index.
+   * Skilling, "Programming the Hilbert curve", AIP Conf. Proc. 707 (2004).
+   */
+  void axes_to_transpose_(coord_t & x) {
+    const int_t m = int_t(1) << (max_depth_ - 1);
+    // Inverse undo
+    for(int_t q = m; q > 1; q >>= 1) {
+      const int_t p = q - 1;
+      for(size_t i = 0; i < dimension; ++i) {
+        if(x[i] & q) {
+          x[0] ^= p;
+        }
+        else {
+          int_t t = (x[0] ^ x[i]) & p;
+          x[0] ^= t;
+          x[i] ^= t;
+        } // if
+      } // for
+    } // for
+    // Gray encode
+    for(size_t i = 1; i < dimension; ++i)
+      x[i] ^= x[i - 1];
+    int_t t = 0;
+    for(int_t q = m; q > 1; q >>= 1)
+      if(x[dimension - 1] & q)
+        t ^= q - 1;
+    for(size_t i = 0; i < dimension; ++i)
+      x[i] ^= t;
+  }
+
+  /*! Inverse of axes_to_transpose_ */
+  void transpose_to_axes_(coord_t & x) {
+    const int_t n = int_t(1) << max_depth_;
+    // Gray decode
+    int_t t = x[dimension - 1] >> 1;
+    for(size_t i = dimension - 1; i > 0; --i)
+      x[i] ^= x[i - 1];
+    x[0] ^= t;
+    // Undo excess work
+    for(int_t q = 2; q != n; q <<= 1) {
+      const int_t p = q - 1;
+      for(size_t i = dimension; i > 0; --i) {
+        if(x[i - 1] & q) {
+          x[0] ^= p;
+        }
+        else {
+          t = (x[0] ^ x[i - 1]) & p;
+          x[0] ^= t;
+          x[i - 1] ^= t;
+        } // if
+      } // for
+    } // for
   }
 }; // class hilbert
 
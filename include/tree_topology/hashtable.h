@@ -18,85 +18,190 @@
 
 #pragma once
 
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <utility>
 #include <vector>
 
 /**
- * @brief Class for hashtable
+ * @brief Mixing hash for the tree keys (splitmix64 finalizer): all the bits
+ * of the key contribute to the low bits used by the table
  */
-template<typename KEY, typename TYPE>
+template<typename KEY>
+struct hashtable_hasher {
+  size_t operator()(const KEY & k) const noexcept {
+    uint64_t x = static_cast<uint64_t>(k.value());
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return static_cast<size_t>(x ^ (x >> 31));
+  }
+};
+
+/**
+ * @brief Open addressing hashtable with linear probing.
+ * The probing array only stores the keys and the index of the elements, the
+ * elements are stored in chunks that are never reallocated: pointers and
+ * iterators stay valid when adding elements, like for std::unordered_map.
+ * clear() keeps the memory of the probing array and the chunks, to be
+ * reused by the next tree.
+ * Elements cannot be erased.
+ */
+template<typename KEY, typename TYPE, typename HASH = hashtable_hasher<KEY>>
 class hashtable
 {
 
+  using value_type = std::pair<KEY, TYPE>;
+  using chunk_t = std::vector<value_type>;
+  static constexpr size_t chunk_bits_ = 12;
+  static constexpr size_t chunk_size_ = size_t(1) << chunk_bits_;
+  static constexpr size_t npos_ = size_t(-1);
+
+  struct slot_t {
+    KEY key;
+    size_t index = npos_;
+  };
+
 public:
   /**
-   * @brief Iterator on hashtable
+   * @brief Iterator on hashtable, an index in the elements
    */
-  typedef typename std::vector<std::pair<KEY, TYPE>>::iterator iterator;
+  class iterator
+  {
+  public:
+    iterator() = default;
+    iterator(hashtable * ht, size_t index) : ht_(ht), index_(index) {}
 
-  //! @brief Creation of the hashtable: no collisions
-  hashtable() {
-    collision_ = 0;
-    ht_.resize(hash_size_);
-  }
+    value_type & operator*() const {
+      return ht_->element_(index_);
+    }
+    value_type * operator->() const {
+      return &ht_->element_(index_);
+    }
+    iterator & operator++() {
+      if(++index_ == ht_->size_)
+        index_ = npos_;
+      return *this;
+    }
+    bool operator==(const iterator & it) const {
+      return index_ == it.index_;
+    }
+    bool operator!=(const iterator & it) const {
+      return index_ != it.index_;
+    }
 
-  ~hashtable() {
-    ht_.clear();
+  private:
+    hashtable * ht_ = nullptr;
+    size_t index_ = npos_;
+  }; // class iterator
+
+  hashtable() {
+    slots_.resize(min_capacity_);
+    mask_ = min_capacity_ - 1;
   }
 
   /**
-   * @brief Find a key in the hash table
-   * Keys can be listed if conflict
+   * @brief Find a key in the hash table, end() if not present
    */
-  typename std::vector<std::pair<KEY, TYPE>>::iterator find(const KEY & k) {
-    unsigned int index = hash_(k);
-    assert(index < ht_.size());
-    auto it = ht_[index].begin();
-    while(it != ht_[index].end() && it->first != k)
-      ++it;
-    if(it == ht_[index].end())
-      return ht_[0].end();
-    return it;
+  iterator find(const KEY & k) {
+    for(size_t i = hash_(k) & mask_;; i = (i + 1) & mask_) {
+      const slot_t & s = slots_[i];
+      if(s.index == npos_)
+        return end();
+      if(s.key == k)
+        return iterator(this, s.index);
+    } // for
   }
 
   /**
-   * @brief Emplace an object in the hashtable, if conflict: advance
+   * @brief Emplace an object in the hashtable if the key is not present.
+   * Returns the iterator on the element and true if inserted
    */
   template<typename... ARGS>
-  void emplace(const KEY & k, ARGS &&... args) {
-    unsigned int index = hash_(k);
-    // Find an empty spot
-    ht_[index].emplace_back(k, std::forward<ARGS>(args)...);
-    ++nelement_;
+  std::pair<iterator, bool> emplace(const KEY & k, ARGS &&... args) {
+    if(2 * (size_ + 1) > slots_.size())
+      rehash_(2 * slots_.size());
+    size_t i = hash_(k) & mask_;
+    for(; slots_[i].index != npos_; i = (i + 1) & mask_)
+      if(slots_[i].key == k)
+        return {iterator(this, slots_[i].index), false};
+
+    const size_t c = size_ >> chunk_bits_;
+    if(c == chunks_.size()) {
+      chunks_.emplace_back(new chunk_t);
+      chunks_.back()->reserve(chunk_size_);
+    }
+    chunks_[c]->emplace_back(std::piecewise_construct,
+      std::forward_as_tuple(k),
+      std::forward_as_tuple(std::forward<ARGS>(args)...));
+    slots_[i].key = k;
+    slots_[i].index = size_;
+    return {iterator(this, size_++), true};
   }
 
-  size_t collision() {
-    return collision_;
+  /**
+   * @brief Prepare the table for n elements without rehashing
+   */
+  void reserve(size_t n) {
+    if(2 * n > slots_.size())
+      rehash_(2 * n);
   }
 
+  /**
+   * @brief Remove all the elements, the memory is kept
+   */
   void clear() {
-    ht_.clear();
-    ht_.resize(hash_size_);
-    collision_ = 0;
-    nelement_ = 0;
+    for(auto & c : chunks_)
+      c->clear();
+    for(auto & s : slots_)
+      s.index = npos_;
+    size_ = 0;
   }
 
-  size_t size() {
-    return nelement_;
+  size_t size() const {
+    return size_;
+  }
+  iterator begin() {
+    return iterator(this, size_ ? 0 : npos_);
   }
   iterator end() {
-    return ht_[0].end();
+    return iterator(this, npos_);
   }
 
 private:
-  unsigned int hash_(const KEY & k) {
-    return static_cast<typename KEY::type>(k) & hash_mask_;
+  value_type & element_(size_t index) {
+    assert(index < size_);
+    return (*chunks_[index >> chunk_bits_])[index & (chunk_size_ - 1)];
+  }
+
+  size_t hash_(const KEY & k) const {
+    return HASH()(k);
   }
 
-  const unsigned int hash_bit_ = 22;
-  const size_t hash_size_ = 1 << hash_bit_;
-  const unsigned int hash_mask_ = (1 << hash_bit_) - 1;
-  std::vector<std::vector<std::pair<KEY, TYPE>>> ht_;
+  // Only the probing array is rebuilt, the elements do not move
+  void rehash_(size_t n) {
+    size_t capacity = min_capacity_;
+    while(capacity < n)
+      capacity <<= 1;
+    if(capacity <= slots_.size())
+      return;
+    std::vector<slot_t> slots(capacity);
+    mask_ = capacity - 1;
+    for(auto & s : slots_) {
+      if(s.index == npos_)
+        continue;
+      size_t i = hash_(s.key) & mask_;
+      while(slots[i].index != npos_)
+        i = (i + 1) & mask_;
+      slots[i] = s;
+    } // for
+    slots_.swap(slots);
+  }
 
-  size_t collision_;
-  size_t nelement_;
-}; // class hastable
+  static constexpr size_t min_capacity_ = 1024;
+  std::vector<slot_t> slots_;
+  std::vector<std::unique_ptr<chunk_t>> chunks_;
+  size_t mask_ = 0;
+  size_t size_ = 0;
+}; // class hashtable
@@ -114,9 +114,9 @@ TEST(hilbert,rnd_3d){
     hcs[i] = hc(range,points[i]);
     point_t inv;
     hcs[i].coordinates(range,inv);
-    //double dist = distance(points[i],inv);
+    double dist = distance(points[i],inv);
     std::cout << points[i] <<" "<< hcs[i] << " = "<<inv<<std::endl;
-    //ASSERT_TRUE(dist<1.0e-4);
+    ASSERT_TRUE(dist<1.0e-4);
   }
 
   // rnd
@@ -128,9 +128,45 @@ TEST(hilbert,rnd_3d){
     point_t inv;
     hc h(range,pt);
     h.coordinates(range,inv);
-    //double dist = distance(pt,inv);
+    double dist = distance(pt,inv);
     std::cout << pt <<" = "<< h << " = "<<inv<<std::endl;
-    //ASSERT_TRUE(dist<1.0e-4);
+    ASSERT_TRUE(dist<1.0e-4);
+  }
+} // TEST
+
+TEST(hilbert, locality) {
+  using namespace flecsi;
+  range_t range;
+  range[0] = {0, 0, 0};
+  range[1] = {1, 1, 1};
+  // Consecutive keys at a given depth are face neighbors: their cells are
+  // one cell width apart along exactly one axis. The range of each branch
+  // contains the points of its cell.
+  const size_t depth = 4;
+  const uint64_t ncells = uint64_t(1) << 3 * depth;
+  const double width = 1. / (1 << depth);
+  for(uint64_t i = 0; i < ncells; ++i) {
+    hc key(ncells | i);
+    range_t cell = key.range(range);
+    for(size_t d = 0; d < 3; ++d)
+      ASSERT_NEAR(cell[1][d] - cell[0][d], width, 1.0e-10);
+    point_t center = (cell[0] + cell[1]) / 2.;
+    hc h(range, center);
+    h.truncate(depth);
+    ASSERT_TRUE(h == key);
+    if(i + 1 < ncells) {
+      hc next(ncells | (i + 1));
+      range_t ncell = next.range(range);
+      int moved = 0;
+      for(size_t d = 0; d < 3; ++d) {
+        const double step = std::abs(ncell[0][d] - cell[0][d]);
+        if(step > 1.0e-10) {
+          ASSERT_NEAR(step, width, 1.0e-10);
+          ++moved;
+        }
+      } // for
+      ASSERT_EQ(moved, 1);
+    }
   }
 } // TEST
 
@@ -29,6 +29,7 @@
 #include <bitset>
 #include <cassert>
 #include <cmath>
+#include <cstring>
 #include <float.h>
 #include <functional>
 #include <iostream>
@@ -36,6 +37,7 @@
 #include <math.h>
 #include <mpi.h>
 #include <mutex>
+#include <numeric>
 #include <omp.h>
 #include <set>
 #include <stack>
@@ -46,10 +48,11 @@
 #include "flecsi/data/data_client.h"
 
 #include "log.h"
+#include "timers.h"
 
 #include "space_vector.h"
 
-//#include "hashtable.h"
+#include "hashtable.h"
 #include "tree_geometry.h"
 #include "tree_types.h"
 
@@ -112,6 +115,31 @@ private:
     int nchildren;
   };
 
+  /**
+   * @brief Scratch data for the SPH traversal of a leaf group.
+   * One instance per thread in the threaded traversal.
+   */
+  struct sph_scratch_t {
+    sph_scratch_t(const int & size) : request_keys(size) {}
+    std::vector<hcell_t *> queue;
+    std::vector<hcell_t *> new_queue;
+    std::vector<entity_t *> cur_entities;
+    std::vector<std::vector<entity_t *>> neighbors;
+    std::vector<std::vector<key_t>> request_keys;
+  };
+
+  /**
+   * @brief Cell of the linearized tree, in depth first order of the keys.
+   * The subtree of a cell is [index, next), the children are chained by
+   * their next index starting from first_child.
+   */
+  struct linear_cell_t {
+    hcell_t * cell;
+    int64_t first_child;
+    int64_t next;
+    int nchildren;
+  };
+
   /**
    * @brief Types for MPI communications
    * REQUEST: send a key request to another rank
@@ -144,6 +172,9 @@ public:
     htable_.clear();
     shared_entities_.clear();
     shared_nodes_.clear();
+    nbs_cache_valid_ = false;
+    ghosts_map_valid_ = false;
+    linear_tree_.clear();
   }
 
   /**
@@ -156,6 +187,84 @@ public:
     build_tree(f_c);
   }
 
+  /**
+   * @brief Update the ghosts data without rebuilding the tree.
+   * The topology and the shared entities are kept, the owners send the
+   * values of the fields required to the ranks holding the ghosts.
+   * PACK(const entity_t&, element_t*) and UNPACK(entity_t&, const
+   * element_t*) handle nvalues values per entity.
+   */
+  template<typename PACK, typename UNPACK>
+  void update_ghosts(const int & nvalues, PACK && pack, UNPACK && unpack) {
+    log_one(trace) << "Update ghosts: " << nvalues << " values" << std::endl;
+    timers::scope_t timer("update_ghosts");
+    double start = omp_get_wtime();
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    // New ghosts may have been received during the traversals
+    int stale = !ghosts_map_valid_ ||
+                ghosts_map_nshared_ != shared_entities_.size();
+    MPI_Allreduce(MPI_IN_PLACE, &stale, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    if(stale)
+      build_ghosts_map_();
+
+    const int nbytes = nvalues * sizeof(element_t);
+    std::vector<element_t> send_buf(ghosts_send_idx_.size() * nvalues);
+    std::vector<element_t> recv_buf(ghosts_recv_idx_.size() * nvalues);
+#pragma omp parallel for
+    for(int64_t i = 0; i < ghosts_send_idx_.size(); ++i) {
+      pack(entities_[ghosts_send_idx_[i]], &send_buf[i * nvalues]);
+    } // for
+
+    std::vector<int> send_count(size), send_displ(size);
+    std::vector<int> recv_count(size), recv_displ(size);
+    for(int i = 0; i < size; ++i) {
+      send_count[i] = ghosts_send_count_[i] * nbytes;
+      send_displ[i] = ghosts_send_displ_[i] * nbytes;
+      recv_count[i] = ghosts_recv_count_[i] * nbytes;
+      recv_displ[i] = ghosts_recv_displ_[i] * nbytes;
+    } // for
+    MPI_Alltoallv(send_buf.data(), &send_count[0], &send_displ[0], MPI_BYTE,
+      recv_buf.data(), &recv_count[0], &recv_displ[0], MPI_BYTE,
+      MPI_COMM_WORLD);
+
+#pragma omp parallel for
+    for(int64_t i = 0; i < ghosts_recv_idx_.size(); ++i) {
+      unpack(shared_entities_[ghosts_recv_idx_[i]], &recv_buf[i * nvalues]);
+    } // for
+
+    log_one(trace) << std::fixed << std::setprecision(3)
+                   << "Update ghosts.done: " << ghosts_recv_idx_.size()
+                   << " ghosts " << omp_get_wtime() - start << "s" << std::endl;
+  }
+
+  /**
+   * @brief Set the projection of the entities sent to other ranks in the
+   * tree construction and traversals.
+   * Only the coordinates, radius, mass and id are sent in addition to the
+   * nvalues values handled by PACK(const entity_t&, element_t*) and
+   * UNPACK(entity_t&, const element_t*). The other fields of the ghosts are
+   * left unset. This needs to be called by all the ranks.
+   */
+  template<typename PACK, typename UNPACK>
+  void set_ghost_projection(const int & nvalues,
+    PACK && pack,
+    UNPACK && unpack) {
+    ghost_nvalues_ = nvalues;
+    ghost_pack_ = pack;
+    ghost_unpack_ = unpack;
+  }
+
+  /**
+   * @brief Send the whole entities to other ranks
+   */
+  void reset_ghost_projection() {
+    ghost_nvalues_ = -1;
+    ghost_pack_ = nullptr;
+    ghost_unpack_ = nullptr;
+  }
+
   /**
    * \brief Change the range of the tree topology
    */
@@ -177,6 +286,13 @@ public:
     return entities_;
   }
 
+  /**
+   * @brief Return a reference to the vector of the shared entities
+   */
+  std::vector<entity_t> & shared_entities() {
+    return shared_entities_;
+  }
+
   /**
    * @brief Return an entity by its id
    */
@@ -190,6 +306,37 @@ public:
    */
   template<typename FUNC, typename... ARGS>
   void traversal(hcell_t * cell, FUNC && func, ARGS &&... args) {
+    // Stackless loop on the linearized subtree
+    if(cell->linear_idx() >= 0) {
+      int64_t i = cell->linear_idx();
+      const int64_t end = linear_tree_[i].next;
+      while(i < end) {
+        const linear_cell_t & lc = linear_tree_[i];
+        i = lc.next;
+        if(!func(lc.cell, std::forward<ARGS>(args)...))
+          continue;
+        if(lc.nchildren == lc.cell->nchildren()) {
+          if(lc.nchildren > 0)
+            i = lc.first_child;
+          continue;
+        } // if
+        // Children received after the linearization
+        hcell_t * daughters[nchildren_] = {nullptr};
+        int children = 0;
+        daughters_(lc.cell, daughters, children);
+        for(int c = 0; c < children; ++c)
+          traversal_hash_(daughters[c], func, std::forward<ARGS>(args)...);
+      } // while
+      return;
+    } // if
+    traversal_hash_(cell, func, std::forward<ARGS>(args)...);
+  }
+
+  /**
+   * @brief Traversal using the hash table for the children
+   */
+  template<typename FUNC, typename... ARGS>
+  void traversal_hash_(hcell_t * cell, FUNC && func, ARGS &&... args) {
     std::stack<hcell_t *> stk;
     stk.push(cell);
     while(!stk.empty()) {
@@ -208,15 +355,37 @@ public:
 
   /**
 ` * @brief Apply a function EF to the sub_cells using asynchronous comms.
+   * If the threaded traversal is enabled the leaf groups are spread over the
+   * OpenMP threads. EF must then only modify the entity it is applied to,
+   * and must not read the fields of the neighbors written in the same pass:
+   * another thread may be writing them. Such fields belong to a later pass.
+   * If the neighbors cache is enabled, the neighbors found are stored and
+   * reused by the next calls until the tree is cleaned.
   */
   template<typename EF, typename... ARGS>
   void traversal_sph(EF && ef, ARGS &&... args) {
     log_one(trace) << "Traversal SPH" << std::endl;
+    timers::scope_t timer("traversal_sph");
     double start = omp_get_wtime();
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
+    if(nbs_cache_enabled_) {
+      // All the ranks need to skip the traversal to avoid pending requests
+      int valid = nbs_cache_valid_;
+      MPI_Allreduce(MPI_IN_PLACE, &valid, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+      if(valid) {
+        traversal_sph_cached_(ef, std::forward<ARGS>(args)...);
+        log_one(trace) << std::fixed << std::setprecision(3)
+                       << "Traversal SPH cached.done: "
+                       << omp_get_wtime() - start << "s" << std::endl;
+        return;
+      } // if
+      nbs_record_.clear();
+      nbs_record_.resize(entities_.size());
+    } // if
+
     // Find all nodes of the tree with at most sub_entities_ elements
     std::vector<key_t> cells;
     traversal(
@@ -236,177 +405,54 @@ public:
 
     // prepare comms arrays
     init_comms_(size);
-    std::stack<key_t> stk_nonlocal;
 
-    // Traversal data
-    std::vector<std::vector<key_t>> request_keys;
-    request_keys.resize(size);
-    std::vector<hcell_t *> * queue = new std::vector<hcell_t *>();
-    std::vector<hcell_t *> * new_queue = new std::vector<hcell_t *>();
-    std::vector<std::vector<entity_t *>> neighbors;
-    hcell_t* daughters[nchildren_];
-    int children;
+    if(threaded_traversal_ && omp_get_max_threads() > 1) {
+      traversal_sph_threaded_(cells, ef, std::forward<ARGS>(args)...);
+    }
+    else {
+      std::stack<key_t> stk_nonlocal;
+      sph_scratch_t scratch(size);
 
-    int i = 0;
-    double lost_time;
-    bool alternate = true;
-    while(i < cells.size() || !stk_nonlocal.empty()) {
+      int i = 0;
+      double lost_time;
+      bool alternate = true;
+      while(i < cells.size() || !stk_nonlocal.empty()) {
 
-      if(size > 1)
-        check_comms_();
+        if(size > 1)
+          check_comms_();
 
-      key_t curkey = key_t(0);
-#ifdef _DEBUG_TREE_
-      lost_time = omp_get_wtime();
-#endif
-      if(i >= cells.size())
-        alternate = false;
-      if(alternate) {
-        curkey = cells[i++];
-        alternate = false;
-      }
-      else {
-        if(!stk_nonlocal.empty()) {
-          curkey = stk_nonlocal.top();
-          stk_nonlocal.pop();
+        key_t curkey = key_t(0);
+        lost_time = omp_get_wtime();
+        if(i >= cells.size())
+          alternate = false;
+        if(alternate) {
+          curkey = cells[i++];
+          alternate = false;
         }
         else {
-          if(i < cells.size())
-            curkey = cells[i++];
-          else
-            break;
-        }
-        alternate = true;
-      } // if
-#ifdef _DEBUG_TREE_
-      assert(curkey != key_t(0));
-#endif
-      bool non_local = false;
-      bool rank_request = false;
-
-      hcell_t * cur = &(htable_.find(curkey)->second);
-      std::vector<entity_t *> cur_entities;
-
-      cofm_t * cur_node = nullptr;
-
-      if(cur->is_node()) {
-        traversal(
-          cur,
-          [&](hcell_t * cell, std::vector<entity_t *> & ce) {
-            if(cell->is_node()) {
-              return true;
-            }
-            else {
-              if(!cell->is_shared())
-                ce.push_back(get_entity(cell));
-            }
-            return false;
-          },
-          cur_entities); // lambda
-        cur_node = get_node(cur);
-      }
-      else {
-        cur_entities.push_back(get_entity(cur));
-      } // if
-
-      neighbors.clear();
-      neighbors.resize(cur_entities.size());
-      queue->clear();
-      queue->push_back(root());
-
-      while(!queue->empty()) {
-        new_queue->clear();
-        // Eliminate geometrically
-        for(int j = 0; j < queue->size(); ++j) {
-          bool accepted = false;
-          hcell_t * hcur = (*queue)[j];
-          if(hcur->is_node()) {
-            cofm_t * c = get_node(hcur);
-            // Check if node concerned
-            if(cur_node != nullptr) {
-              if(!geometry_t::intersects_box_box(
-                   c->bmin(), c->bmax(), cur_node->bmin(), cur_node->bmax())) {
-                continue;
-              }
-            } // if
-            // If yes, check for all entities before request
-            for(int k = 0; k < cur_entities.size() && !accepted; ++k) {
-              if(geometry_t::intersects_sphere_box(c->bmin(), c->bmax(),
-                   cur_entities[k]->coordinates(), cur_entities[k]->radius())) {
-                accepted = true;
-                if(hcur->is_empty_node()) {
-                  non_local = true;
-                  if(!hcur->requested()) {
-#ifdef _DEBUG_TREE_
-                    assert(hcur->owner() != rank);
-#endif
-                    hcur->set_requested();
-                    request_keys[hcur->owner()].push_back(hcur->key());
-                    rank_request = true;
-                  }
-                }
-                else {
-                  children = 0;
-                  daughters_(hcur, daughters, children);
-                  for(int l = 0; l < children; ++l)
-                    new_queue->push_back(daughters[l]);
-                } // if
-              } // if
-            } // if
+          if(!stk_nonlocal.empty()) {
+            curkey = stk_nonlocal.top();
+            stk_nonlocal.pop();
           }
           else {
+            if(i < cells.size())
+              curkey = cells[i++];
+            else
+              break;
+          }
+          alternate = true;
+        } // if
 #ifdef _DEBUG_TREE_
-            assert(hcur->is_entity());
-#endif
-            entity_t * e = get_entity(hcur);
-#ifdef _DEBUG_TREE_
-            assert(e != nullptr);
+        assert(curkey != key_t(0));
 #endif
-            if(cur_node != nullptr) {
-              element_t extent_ent =
-                std::max(e->radius(), cur_node->lap()) + cur_node->radius();
-              if(!geometry_t::within_distance2(
-                   e->coordinates(), cur_node->coordinates(), extent_ent))
-                continue;
-            }
-            for(int k = 0; k < cur_entities.size(); ++k) {
-              element_t extent =
-                std::max(cur_entities[k]->radius(), e->radius());
-              if(geometry_t::within_distance2(
-                   cur_entities[k]->coordinates(), e->coordinates(), extent)) {
-                neighbors[k].push_back(e);
-              } // if
-            } // for
-          } // if
-        } // for
-        if(non_local) {
-          if(rank_request) {
-            request_(request_keys);
-            for(int k = 0; k < size; ++k) {
-              request_keys[k].clear();
-            } // for
-          } // if
-#ifdef _DEBUG_TREE_
+        if(!sph_group_(curkey, scratch, ef, std::forward<ARGS>(args)...)) {
+          flush_requests_(scratch.request_keys);
           lost_timer_ += omp_get_wtime() - lost_time;
-#endif
           stk_nonlocal.push(curkey);
-          break;
         } // if
-
-        auto tmp = queue;
-        queue = new_queue;
-        new_queue = tmp;
-
       } // while
-      if(!non_local) {
-        for(int j = 0; j < cur_entities.size(); ++j) {
-#ifdef _DEBUG_TREE_
-          assert(neighbors[j].size() != 0);
-#endif
-          ef(*cur_entities[j], neighbors[j], std::forward<ARGS>(args)...);
-        } // for
-      } // if
-    } // while
+    } // if
+
     if(size > 1) {
       comms_all_done_ = false;
       std::vector<MPI_Request> done_requests(size);
@@ -423,35 +469,184 @@ public:
 
     clean_comms_();
 
-    queue->clear();
-    new_queue->clear();
-    delete queue;
-    delete new_queue;
+    // The shared entities are now in place, store the neighbors
+    if(nbs_cache_enabled_)
+      build_nbs_cache_();
 
-    MPI_Barrier(MPI_COMM_WORLD);
+    timers::registry().add("comm_poll", comms_timer_);
+    timers::registry().add("comm_wait", wait_timer_);
+    timers::registry().add("lost", lost_timer_);
+    {
+      timers::scope_t barrier("barrier");
+      MPI_Barrier(MPI_COMM_WORLD);
+    }
     double tree_timer = omp_get_wtime() - start;
+    const double comms = comms_timer_ + wait_timer_;
     log_one(trace) << std::fixed << std::setprecision(3)
                    << "Traversal SPH.done: " << tree_timer << "s"
-#ifdef _DEBUG_TREE_
-                   << " comms_: " << comms_timer_ << "s ("
-                   << comms_timer_ * 100 / tree_timer << "%) "
+                   << " comms_: " << comms << "s ("
+                   << comms * 100 / tree_timer << "%) "
                    << "lost_: " << lost_timer_ << "s ("
                    << lost_timer_ * 100 / tree_timer << "%)"
-#endif
                    << std::endl;
   } // traversal_sph
 
+  /**
+   * @brief Enable/disable the OpenMP threaded SPH traversal
+   */
+  void set_threaded_traversal(bool threaded) {
+    threaded_traversal_ = threaded;
+  }
+
+  /**
+   * @brief Enable/disable the OpenMP threaded construction of the tree
+   */
+  void set_parallel_build(bool parallel) {
+    parallel_build_ = parallel;
+  }
+
+  /**
+   * @brief Enable/disable the linearized tree, built with the tree and used
+   * by the traversals instead of the hash table lookups of the children
+   */
+  void set_linear_tree(bool linear) {
+    linear_tree_enabled_ = linear;
+  }
+
+  /**
+   * @brief Enable/disable the neighbors cache of the SPH traversal
+   */
+  void set_neighbors_cache(bool cache) {
+    nbs_cache_enabled_ = cache;
+    nbs_cache_valid_ = false;
+  }
+
+  /**
+   * @brief Restrict the SPH traversals to the local entities for which
+   * active returns true, e.g. the particles ending their block timestep.
+   * The groups without active entities are skipped, their neighbors are not
+   * searched. nullptr applies the traversals to all the entities.
+   * The neighbors cache only holds the active entities, it is invalidated.
+   */
+  void set_active_sinks(std::function<bool(const entity_t &)> active) {
+    active_sinks_ = std::move(active);
+    nbs_cache_valid_ = false;
+  }
+
+  /**
+   * @brief Invalidate the neighbors cache, needed if the positions or
+   * smoothing lengths are modified without cleaning the tree.
+   */
+  void reset_neighbors_cache() {
+    nbs_cache_valid_ = false;
+  }
+
+  /**
+   * @brief True if the neighbors cache is valid on all the ranks. Collective.
+   */
+  bool neighbors_cache_valid() {
+    int valid = nbs_cache_valid_;
+    MPI_Allreduce(MPI_IN_PLACE, &valid, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    return valid;
+  }
+
+  /**
+   * @brief Apply EF to the active local entities with their cached
+   * neighbors, even if the cache is disabled for traversal_sph. Requires a
+   * valid neighbors cache, EF follows the rule of traversal_sph.
+   */
+  template<typename EF, typename... ARGS>
+  void traversal_sph_cached(EF && ef, ARGS &&... args) {
+    timers::scope_t timer("traversal_sph_cached");
+#ifdef _DEBUG_TREE_
+    assert(nbs_cache_valid_);
+#endif
+    traversal_sph_cached_(ef, std::forward<ARGS>(args)...);
+  }
+
+  /**
+   * @brief Build the neighbors cache if it is not valid on all the ranks,
+   * even if the cache is disabled for traversal_sph.
+   */
+  void build_neighbors_cache() {
+    if(neighbors_cache_valid())
+      return;
+    bool enabled = nbs_cache_enabled_;
+    nbs_cache_enabled_ = true;
+    nbs_cache_valid_ = false;
+    traversal_sph([](entity_t &, std::vector<entity_t *> &) {});
+    nbs_cache_enabled_ = enabled;
+  }
+
+  /**
+   * @brief Apply EF to the local entities with the index span of their
+   * cached neighbors: EF(entity, indices, n_indices, args...).
+   * Index i < entities().size() is a local entity, otherwise the shared
+   * entity i - entities().size(). Requires a valid neighbors cache.
+   * Same rule as traversal_sph for the threaded traversal: EF only modifies
+   * its entity and does not read the neighbor fields written in the pass.
+   */
+  template<typename EF, typename... ARGS>
+  void traversal_sph_span(EF && ef, ARGS &&... args) {
+    log_one(trace) << "Traversal SPH span" << std::endl;
+    timers::scope_t timer("traversal_sph_span");
+    double start = omp_get_wtime();
+#ifdef _DEBUG_TREE_
+    assert(nbs_cache_valid_);
+#endif
+    const int64_t n = entities_.size();
+#pragma omp parallel for schedule(static) if(threaded_traversal_)
+    for(int64_t i = 0; i < n; ++i) {
+      if(active_sinks_ && !active_sinks_(entities_[i]))
+        continue;
+      ef(entities_[i], &nbs_index_[nbs_offset_[i]],
+        nbs_offset_[i + 1] - nbs_offset_[i], std::forward<ARGS>(args)...);
+    } // for
+    log_one(trace) << std::fixed << std::setprecision(3)
+                   << "Traversal SPH span.done: " << omp_get_wtime() - start
+                   << "s" << std::endl;
+  }
+
+  /**
+   * @brief Packed coordinates and masses of the local entities followed by
+   * the shared entities, sources of the FMM direct interactions
+   */
+  struct fmm_sources_t {
+    std::vector<element_t> x[dimension];
+    std::vector<element_t> mass;
+
+    void resize(const size_t & n) {
+      for(size_t d = 0; d < dimension; ++d)
+        x[d].resize(n);
+      mass.resize(n);
+    }
+  }; // struct fmm_sources_t
+
   /**
    * @brief Fast Multipole Method Traversal.
    * Perform a tree traversal and update the missing neighbors.
+   * The cell-cell interactions are applied during the traversal, the
+   * interactions with the entities are gathered in lists and evaluated
+   * after the communications:
+   * - f_c2p(node, sinks, n): Taylor expansion of node to n contiguous
+   *   local entities,
+   * - f_m2p(sink, node): direct cell-entity interaction,
+   * - f_p2p(sink, sources, begin, end): direct interactions with the
+   *   packed sources in [begin, end).
    */
-  template<typename C2C, typename P2C, typename P2P, typename C2P>
+  template<typename C2C,
+    typename P2C,
+    typename P2P,
+    typename C2P,
+    typename M2P>
   void traversal_fmm(const double MAC,
     C2C && t_c2c,
     P2C && t_p2c,
     P2P && f_p2p,
-    C2P && f_c2p) {
+    C2P && f_c2p,
+    M2P && f_m2p) {
     log_one(trace) << "Traversal FMM (" << MAC << ")" << std::endl;
+    timers::scope_t timer("traversal_fmm");
     double start = omp_get_wtime();
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
@@ -463,9 +658,11 @@ public:
     using interaction_t = std::pair<key_t, key_t>;
     std::vector<interaction_t> * queue = new std::vector<interaction_t>();
     std::vector<interaction_t> * new_queue = new std::vector<interaction_t>();
-    std::vector<interaction_t> p2p;
-    std::vector<entity_t *> subs;
-    std::vector<entity_t *> neighbors;
+    std::vector<interaction_t> p2p_cells;
+    // Local sink index, source index in the packed sources
+    std::vector<std::pair<int64_t, int64_t>> p2p;
+    // Local sink index, node index, -(i+1) for a shared node
+    std::vector<std::pair<int64_t, int64_t>> m2p;
     hcell_t * daughters[nchildren_];
     int children;
     double lost_time;
@@ -484,9 +681,7 @@ public:
       new_queue->clear();
       for(int i = 0; i < queue->size(); ++i) {
 
-#ifdef _DEBUG_TREE_
         lost_time = omp_get_wtime();
-#endif
 
         key_t khc1 = (*queue)[i].first;
         key_t khc2 = (*queue)[i].second;
@@ -498,7 +693,8 @@ public:
         if(!hc2->is_empty_node()) {
           if(hc1->is_entity() && hc2->is_entity()) {
             // both are entities: append interaction to the p2p list
-            p2p.push_back((*queue)[i]);
+            if(get_entity(hc1)->id() != get_entity(hc2)->id())
+              p2p.emplace_back(hc1->entity_idx(), source_idx_(hc2));
           }
           else { // at least one is a node
 
@@ -506,7 +702,7 @@ public:
               // check for the number of subentities
 
               if(get_node(hc1)->sub_entities() < fmm_sub_entities_) {
-                p2p.push_back((*queue)[i]);
+                p2p_cells.push_back((*queue)[i]);
               }
               else {
                 // split it for self-interaction
@@ -570,16 +766,14 @@ public:
                   n1->set_affected(true);
                 }
                 else { // hc1 is an entity
-                  neighbors.clear();
-                  subs.clear();
-                  subs.push_back(get_entity(hc1));
-                  f_p2p(subs, get_node(hc2), neighbors);
+                  m2p.emplace_back(hc1->entity_idx(),
+                    hc2->is_shared() ? -hc2->node_idx() - 1 : hc2->node_idx());
                 }
               }
               else { // nodes do not satisfy MAC
                 if(subent1 + subent2 < fmm_sub_entities_) {
                   // if not enough subentities, give up with splitting
-                  p2p.push_back((*queue)[i]);
+                  p2p_cells.push_back((*queue)[i]);
                   std::vector<std::vector<key_t>> request_keys_subtree(size);
                   bool rqst_subtree = false;
                   if(hc2->is_shared()) {
@@ -646,9 +840,7 @@ public:
             rank_request = true;
           }
           new_queue->emplace_back(hc1->key(), hc2->key());
-#ifdef _DEBUG_TREE_
           lost_timer_ += omp_get_wtime() - lost_time;
-#endif
         } // if
       } // loop over the queue
       if(rank_request) {
@@ -677,102 +869,7 @@ public:
       MPI_Waitall(size, &done_requests[0], &done_status[0]);
     }
 
-
-    // node-node interaction
-    std::vector<hcell_t *> affected_nodes;
-    traversal(
-      root(),
-      [&](hcell_t * cell, std::vector<hcell_t *> & hc) {
-        if(!cell->iam_owner()) {
-          return false; // do not expand others' nodes
-        }
-        if(cell->is_node() && get_node(cell)->affected()) {
-          hc.push_back(cell);
-        }
-        return true;
-      } // lambda
-      ,
-      affected_nodes);
-
-    neighbors.clear();
-    for(int i = 0; i < affected_nodes.size(); ++i) {
-      hcell_t * hc = affected_nodes[i];
-      subs.clear();
-
-      // Find all sub entities
-      traversal(
-        hc,
-        [&](hcell_t * cell, std::vector<entity_t *> & e) {
-          if(cell->is_node()) {
-            return true;
-          }
-          if(cell->is_entity() && !cell->is_shared()) {
-            e.push_back(get_entity(cell));
-          }
-          return false;
-        } // lambda
-        ,
-        subs);
-
-      f_c2p(get_node(hc), subs);
-    }
-
-    for(int i = 0; i < p2p.size(); ++i) {
-      hcell_t * hc1 = &(htable_.find(p2p[i].first)->second);
-      hcell_t * hc2 = &(htable_.find(p2p[i].second)->second);
-
-      // subentities of hc1
-      std::vector<entity_t *> subs;
-      if(hc1->is_node()) {
-        traversal(
-          hc1,
-          [&](hcell_t * cell, std::vector<entity_t *> & e) {
-            if(cell->is_node()) {
-              return true;
-            }
-            if(cell->is_entity() && !cell->is_shared()) {
-              e.push_back(get_entity(cell));
-            }
-            return false;
-          } // lambda
-          ,
-          subs);
-      }
-      else {
-        subs.push_back(get_entity(hc1));
-      }
-
-      // use 'neighbors' vector to store subentities of hc2
-      neighbors.clear();
-      if(hc2->is_node()) {
-        traversal(
-          hc2,
-          [&](hcell_t * cell, std::vector<entity_t *> & e) {
-            if(cell->is_node()) {
-              return true;
-            }
-            if(cell->is_entity() && !cell->is_shared()) {
-              e.push_back(get_entity(cell));
-            }
-            return false;
-          } // lambda
-          ,
-          neighbors);
-      }
-      else {
-        neighbors.push_back(get_entity(hc2));
-      }
-
-      if(hc1->is_node()) {
-        f_c2p(get_node(hc1), subs);
-      }
-      else {
-        subs.clear();
-        subs.push_back(get_entity(hc1));
-        f_p2p(subs, nullptr, neighbors);
-      }
-
-    } // for p2p interactions
+    fmm_evaluate_(p2p_cells, p2p, m2p, f_p2p, f_c2p, f_m2p);
 
     clean_comms_();
 
@@ -781,16 +878,21 @@ public:
     delete queue;
     delete new_queue;
 
-    MPI_Barrier(MPI_COMM_WORLD);
+    timers::registry().add("comm_poll", comms_timer_);
+    timers::registry().add("comm_wait", wait_timer_);
+    timers::registry().add("lost", lost_timer_);
+    {
+      timers::scope_t barrier("barrier");
+      MPI_Barrier(MPI_COMM_WORLD);
+    }
     double tree_timer = omp_get_wtime() - start;
+    const double comms = comms_timer_ + wait_timer_;
     log_one(trace) << std::fixed << std::setprecision(3)
                    << "Traversal FMM.done: " << tree_timer << "s"
-#ifdef _DEBUG_TREE_
-                   << " comms_: " << comms_timer_ << "s ("
-                   << comms_timer_ * 100 / tree_timer << "%) "
+                   << " comms_: " << comms << "s ("
+                   << comms * 100 / tree_timer << "%) "
                    << "lost_: " << lost_timer_ << "s ("
                    << lost_timer_ * 100 / tree_timer << "%)"
-#endif
                    << std::endl;
   }
 
@@ -878,20 +980,46 @@ public:
   template<typename CCOFM>
   void build_tree(CCOFM && f_cc) {
     log_one(trace) << "Building tree" << std::endl;
+    timers::scope_t timer("build_tree");
     double start = omp_get_wtime();
-    int size, rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &size);
 
     /* Exchange high and low bound */
     key_t lokey = entities_[0].key();
     key_t hikey = entities_[entities_.size() - 1].key();
     exchange_boundaries_(hikey, lokey, hibound_, lobound_);
+#ifdef _DEBUG_TREE_
+    assert(lobound_ <= lokey);
+    assert(hibound_ >= hikey);
+#endif
     max_depth_ = 0;
     // Add the root
+    // Cells: one per entity and the nodes, the table grows if needed
+    htable_.reserve(2 * entities_.size());
     htable_.emplace(key_t::root(), key_t::root());
     root_ = htable_.find(key_t::root());
 
+    if(parallel_build_)
+      build_parallel_(f_cc);
+    else
+      build_serial_(f_cc);
+    share_nodes_(f_cc);
+    if(linear_tree_enabled_)
+      build_linear_tree_();
+    MPI_Barrier(MPI_COMM_WORLD);
+    log_one(trace) << "Building tree.done: " << omp_get_wtime() - start << "s"
+                   << std::endl;
+  }
+
+  /**
+   * @brief Insert the sorted entities and their parents one by one,
+   * computing the CoFM of the local nodes as they are completed
+   */
+  template<typename CCOFM>
+  void build_serial_(CCOFM && f_cc) {
+    int size, rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
     size_t current_depth = key_t::max_depth();
     // Entity keys, last and current
     key_t lastekey = key_t(0);
@@ -908,11 +1036,6 @@ public:
     bool iam0 = rank == 0;
     bool iamlast = rank == size - 1;
 
-#ifdef _DEBUG_TREE_
-    assert(lobound_ <= lokey);
-    assert(hibound_ >= hikey);
-#endif
-
     // The extra turn in the loop is to finish the missing
     // parent of the last entity
     for(size_t i = 0; i <= entities_.size(); ++i) {
@@ -990,10 +1113,140 @@ public:
       lastnkey = nkey;
       max_depth_ = std::max(max_depth_, current_depth);
     } // for
-    share_nodes_(f_cc);
-    MPI_Barrier(MPI_COMM_WORLD);
-    log_one(trace) << "Building tree.done: " << omp_get_wtime() - start << "s"
-                   << std::endl;
+  }
+
+  /**
+   * @brief Build the same tree as build_serial_ with the OpenMP threads.
+   * An entity is placed one level below its longest common prefix with its
+   * neighbors in the key order, the bounds of the neighbor ranks for the
+   * first and last entities. The nodes are all the prefixes above. The
+   * depths are computed in parallel, the cells are inserted in one pass and
+   * the CoFM of the local nodes are computed level by level from the
+   * deepest. The nodes keep the order of build_serial_ in cofm_.
+   */
+  template<typename CCOFM>
+  void build_parallel_(CCOFM && f_cc) {
+    int size, rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    const bool iam0 = rank == 0;
+    const bool iamlast = rank == size - 1;
+    const int64_t n = entities_.size();
+    const int max_depth = key_t::max_depth();
+
+    // Number of common levels of two keys at max depth
+    auto lcp = [max_depth](const key_t & a, const key_t & b) {
+      auto x = a.value() ^ b.value();
+      int ndiff = 0;
+      while(x) {
+        x >>= dimension;
+        ++ndiff;
+      } // while
+      return std::max(0, max_depth - ndiff);
+    };
+    auto prefix = [max_depth](key_t k, const int & depth) {
+      k.pop(max_depth - depth);
+      return k;
+    };
+
+    // common[i]: levels shared by the entities i-1 and i, the rank bounds
+    // for 0 and n, -1 if no neighbor
+    std::vector<int> common(n + 1), depth(n);
+    std::vector<int64_t> nfinish(n + 1, 0);
+    common[0] = iam0 ? -1 : lcp(entities_[0].key(), lobound_);
+    common[n] = iamlast ? -1 : lcp(entities_[n - 1].key(), hibound_);
+#pragma omp parallel for schedule(static)
+    for(int64_t i = 1; i < n; ++i)
+      common[i] = lcp(entities_[i - 1].key(), entities_[i].key());
+
+    // Local nodes: not containing the bounds of the neighbor ranks
+    auto is_local = [&](const key_t & nkey, const int & d) {
+      return (iam0 || nkey > prefix(lobound_, d)) &&
+             (iamlast || nkey < prefix(hibound_, d));
+    };
+
+    // Depth of the entities and number of nodes completed after each one
+    int max_depth_tree = 0;
+#pragma omp parallel for schedule(static) reduction(max : max_depth_tree)
+    for(int64_t i = 0; i < n; ++i) {
+      depth[i] = 1 + std::max(0, std::max(common[i], common[i + 1]));
+#ifdef _DEBUG_TREE_
+      assert(depth[i] <= max_depth);
+#endif
+      const key_t & ekey = entities_[i].key();
+      for(int d = depth[i] - 1; d > common[i + 1]; --d)
+        nfinish[i + 1] += is_local(prefix(ekey, d), d);
+      max_depth_tree =
+        std::max(max_depth_tree, max_depth - 1 - std::max(0, common[i]));
+    } // for
+    if(!iamlast)
+      max_depth_tree =
+        std::max(max_depth_tree, max_depth - 1 - std::max(0, common[n]));
+    max_depth_ = max_depth_tree;
+
+    // Insert the cells, the nodes shared with the previous entity exist
+    for(int64_t i = 0; i < n; ++i) {
+      const key_t & ekey = entities_[i].key();
+      const int first = i == 0 ? 1 : common[i] + 1;
+      hcell_t * parent = first == 1
+                           ? &(root_->second)
+                           : &(htable_.find(prefix(ekey, first - 1))->second);
+      for(int d = first; d < depth[i]; ++d) {
+        key_t nkey = prefix(ekey, d);
+        parent->add_child(nkey.last_value());
+        parent = &(htable_.emplace(nkey, nkey).first->second);
+      } // for
+      key_t nkey = prefix(ekey, depth[i]);
+      parent->add_child(nkey.last_value());
+      htable_.emplace(nkey, hcell_t(nkey, i));
+    } // for
+
+    // Local nodes in the order of completion of build_serial_
+    std::partial_sum(nfinish.begin(), nfinish.end(), nfinish.begin());
+    const int64_t nnodes = nfinish[n];
+    std::vector<key_t> node_keys(nnodes);
+    std::vector<int> node_depths(nnodes);
+#pragma omp parallel for schedule(static)
+    for(int64_t i = 0; i < n; ++i) {
+      const key_t & ekey = entities_[i].key();
+      int64_t j = nfinish[i];
+      for(int d = depth[i] - 1; d > common[i + 1]; --d) {
+        key_t nkey = prefix(ekey, d);
+        if(is_local(nkey, d)) {
+          node_keys[j] = nkey;
+          node_depths[j++] = d;
+        } // if
+      } // for
+    } // for
+    const int64_t first_node = cofm_.size();
+    cofm_.reserve(first_node + nnodes);
+    for(int64_t j = 0; j < nnodes; ++j)
+      cofm_.emplace_back(node_keys[j]);
+
+    // Group the nodes by level
+    std::vector<std::vector<int64_t>> levels(max_depth + 1);
+    for(int64_t j = 0; j < nnodes; ++j)
+      levels[node_depths[j]].push_back(j);
+
+#pragma omp parallel
+    {
+      std::vector<hcell_t *> daughters;
+      daughters.reserve(nchildren_);
+      for(int d = max_depth; d >= 0; --d) {
+        const std::vector<int64_t> & level = levels[d];
+#pragma omp for schedule(dynamic, 64)
+        for(int64_t k = 0; k < static_cast<int64_t>(level.size()); ++k) {
+          const int64_t j = level[k];
+          hcell_t * cell = &(htable_.find(node_keys[j])->second);
+          cell->set_node_idx(first_node + j);
+          daughters.resize(nchildren_);
+          int children = 0;
+          daughters_(cell, &daughters[0], children);
+          daughters.resize(children);
+          cofm_children_(&cofm_[first_node + j], daughters, f_cc);
+        } // for
+      } // for
+    } // omp parallel
   }
 
   /**
@@ -1135,14 +1388,542 @@ private:
     output.close();
   }
 
+  /**
+   * @brief Threaded version of the SPH traversal.
+   * The leaf groups are processed by blocks spread over the OpenMP threads,
+   * each thread keeping its own scratch data. The comms are handled by the
+   * master thread between the blocks, the tree is then only read during the
+   * parallel part. The groups requiring distant data are retried in the next
+   * blocks and the keys requested by the threads are aggregated to be sent
+   * in one message per owner rank. EF must follow the rule of
+   * traversal_sph.
+   */
+  template<typename EF, typename... ARGS>
+  void traversal_sph_threaded_(const std::vector<key_t> & cells,
+    EF && ef,
+    ARGS &&... args) {
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    const int nthreads = omp_get_max_threads();
+    log_one(trace) << "Traversal SPH threaded: " << nthreads << " threads"
+                   << std::endl;
+
+    std::vector<sph_scratch_t> scratch(nthreads, sph_scratch_t(size));
+    std::vector<std::vector<key_t>> request_keys(size);
+    std::mutex aggregator_mutex;
+    std::vector<key_t> block;
+    std::vector<key_t> pending;
+
+    size_t i = 0;
+    while(i < cells.size() || !pending.empty()) {
+      if(size > 1)
+        check_comms_();
+      // Retry the groups waiting for distant data with a new block of groups
+      block.clear();
+      block.swap(pending);
+      size_t nblock =
+        std::min(cells.size() - i, size_t(nthreads * sph_thread_block_));
+      block.insert(block.end(), cells.begin() + i, cells.begin() + i + nblock);
+      i += nblock;
+
+#pragma omp parallel num_threads(nthreads)
+      {
+        sph_scratch_t & s = scratch[omp_get_thread_num()];
+        std::vector<key_t> retry;
+#pragma omp for schedule(dynamic, 1)
+        for(int64_t j = 0; j < static_cast<int64_t>(block.size()); ++j) {
+          if(!sph_group_(block[j], s, ef, std::forward<ARGS>(args)...)) {
+            retry.push_back(block[j]);
+          } // if
+        } // for
+        // Aggregate the retries and requests of this thread
+        std::lock_guard<std::mutex> lock(aggregator_mutex);
+        pending.insert(pending.end(), retry.begin(), retry.end());
+        for(int k = 0; k < size; ++k) {
+          request_keys[k].insert(request_keys[k].end(),
+            s.request_keys[k].begin(), s.request_keys[k].end());
+          s.request_keys[k].clear();
+        } // for
+      } // omp parallel
+
+      flush_requests_(request_keys);
+    } // while
+  }
+
+  /**
+   * @brief Search the neighbors of the entities of a leaf group and apply
+   * EF on them. The tree is not modified: the keys of the distant nodes
+   * required are added in the request_keys of the scratch data.
+   * @return false if distant data are missing, the group has to be retried
+   */
+  template<typename EF, typename... ARGS>
+  bool sph_group_(const key_t & curkey,
+    sph_scratch_t & s,
+    EF && ef,
+    ARGS &&... args) {
+    bool non_local = false;
+    hcell_t * daughters[nchildren_];
+    int children;
+
+    hcell_t * cur = &(htable_.find(curkey)->second);
+    std::vector<entity_t *> & cur_entities = s.cur_entities;
+    cur_entities.clear();
+
+    cofm_t * cur_node = nullptr;
+
+    if(cur->is_node()) {
+      traversal(
+        cur,
+        [&](hcell_t * cell, std::vector<entity_t *> & ce) {
+          if(cell->is_node()) {
+            return true;
+          }
+          else {
+            if(!cell->is_shared())
+              ce.push_back(get_entity(cell));
+          }
+          return false;
+        },
+        cur_entities); // lambda
+      cur_node = get_node(cur);
+    }
+    else {
+      cur_entities.push_back(get_entity(cur));
+    } // if
+
+    if(active_sinks_) {
+      cur_entities.erase(std::remove_if(cur_entities.begin(),
+                           cur_entities.end(),
+                           [&](entity_t * e) { return !active_sinks_(*e); }),
+        cur_entities.end());
+      if(cur_entities.empty())
+        return true;
+    } // if
+
+    std::vector<std::vector<entity_t *>> & neighbors = s.neighbors;
+    if(neighbors.size() < cur_entities.size())
+      neighbors.resize(cur_entities.size());
+    for(int j = 0; j < cur_entities.size(); ++j)
+      neighbors[j].clear();
+    // Check a cell against the group, return true to open it
+    auto visit = [&](hcell_t * hcur) {
+      if(hcur->is_node()) {
+        cofm_t * c = get_node(hcur);
+        // Check if node concerned
+        if(cur_node != nullptr) {
+          if(!geometry_t::intersects_box_box(
+               c->bmin(), c->bmax(), cur_node->bmin(), cur_node->bmax())) {
+            return false;
+          }
+        } // if
+        // If yes, check for all entities before request
+        for(int k = 0; k < cur_entities.size(); ++k) {
+          if(geometry_t::intersects_sphere_box(c->bmin(), c->bmax(),
+               cur_entities[k]->coordinates(), cur_entities[k]->radius())) {
+            if(hcur->is_empty_node()) {
+              non_local = true;
+              if(!hcur->requested()) {
+#ifdef _DEBUG_TREE_
+                int rank;
+                MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+                assert(hcur->owner() != rank);
+#endif
+                s.request_keys[hcur->owner()].push_back(hcur->key());
+              }
+              return false;
+            } // if
+            return true;
+          } // if
+        } // for
+        return false;
+      } // if
+#ifdef _DEBUG_TREE_
+      assert(hcur->is_entity());
+#endif
+      entity_t * e = get_entity(hcur);
+#ifdef _DEBUG_TREE_
+      assert(e != nullptr);
+#endif
+      if(cur_node != nullptr) {
+        element_t extent_ent =
+          std::max(e->radius(), cur_node->lap()) + cur_node->radius();
+        if(!geometry_t::within_distance2(
+             e->coordinates(), cur_node->coordinates(), extent_ent))
+          return false;
+      }
+      for(int k = 0; k < cur_entities.size(); ++k) {
+        element_t extent = std::max(cur_entities[k]->radius(), e->radius());
+        if(geometry_t::within_distance2(
+             cur_entities[k]->coordinates(), e->coordinates(), extent)) {
+          neighbors[k].push_back(e);
+        } // if
+      } // for
+      return false;
+    };
+
+    s.queue.clear();
+    if(root()->linear_idx() >= 0) {
+      // Stackless loop on the linearized tree, the subtrees received after
+      // the linearization are handled by the queue
+      int64_t i = root()->linear_idx();
+      const int64_t end = linear_tree_[i].next;
+      while(i < end) {
+        const linear_cell_t & lc = linear_tree_[i];
+        i = lc.next;
+        if(!visit(lc.cell))
+          continue;
+        if(lc.nchildren == lc.cell->nchildren()) {
+          if(lc.nchildren > 0)
+            i = lc.first_child;
+          continue;
+        } // if
+        children = 0;
+        daughters_(lc.cell, daughters, children);
+        s.queue.insert(s.queue.end(), daughters, daughters + children);
+      } // while
+      if(non_local)
+        return false;
+    }
+    else {
+      s.queue.push_back(root());
+    } // if
+
+    while(!s.queue.empty()) {
+      s.new_queue.clear();
+      // Eliminate geometrically
+      for(int j = 0; j < s.queue.size(); ++j) {
+        if(visit(s.queue[j])) {
+          children = 0;
+          daughters_(s.queue[j], daughters, children);
+          s.new_queue.insert(
+            s.new_queue.end(), daughters, daughters + children);
+        } // if
+      } // for
+      if(non_local)
+        return false;
+      s.queue.swap(s.new_queue);
+    } // while
+
+    for(int j = 0; j < cur_entities.size(); ++j) {
+#ifdef _DEBUG_TREE_
+      assert(neighbors[j].size() != 0);
+#endif
+      if(nbs_cache_enabled_)
+        record_nbs_(cur_entities[j], neighbors[j]);
+      ef(*cur_entities[j], neighbors[j], std::forward<ARGS>(args)...);
+    } // for
+    return true;
+  }
+
+  /**
+   * @brief Record the neighbors of a local entity for the cache.
+   * The shared entities vector can be reallocated during the traversal,
+   * the neighbors are stored as indices: i for local and -(i+1) for shared.
+   * Each entity is handled by a single thread.
+   */
+  void record_nbs_(entity_t * ent, const std::vector<entity_t *> & nbs) {
+    std::vector<int64_t> & rec = nbs_record_[ent - &entities_[0]];
+    rec.resize(nbs.size());
+    const entity_t * lbegin = &entities_[0];
+    const entity_t * lend = lbegin + entities_.size();
+    for(int i = 0; i < nbs.size(); ++i) {
+      if(nbs[i] >= lbegin && nbs[i] < lend)
+        rec[i] = nbs[i] - lbegin;
+      else
+        rec[i] = -(nbs[i] - &shared_entities_[0]) - 1;
+    } // for
+  }
+
+  /**
+   * @brief Convert the recorded neighbors in CSR arrays of pointers and of
+   * indices, local first then shared. They stay valid until the next clean
+   * of the tree.
+   */
+  void build_nbs_cache_() {
+    const int64_t n = entities_.size();
+    nbs_offset_.resize(n + 1);
+    nbs_offset_[0] = 0;
+    for(int64_t i = 0; i < n; ++i)
+      nbs_offset_[i + 1] = nbs_offset_[i] + nbs_record_[i].size();
+    nbs_list_.resize(nbs_offset_[n]);
+    nbs_index_.resize(nbs_offset_[n]);
+    for(int64_t i = 0; i < n; ++i) {
+      for(int64_t j = 0; j < nbs_record_[i].size(); ++j) {
+        int64_t idx = nbs_record_[i][j];
+        nbs_list_[nbs_offset_[i] + j] =
+          idx >= 0 ? &entities_[idx] : &shared_entities_[-idx - 1];
+        nbs_index_[nbs_offset_[i] + j] = idx >= 0 ? idx : n - idx - 1;
+      } // for
+    } // for
+    nbs_record_.clear();
+    nbs_cache_valid_ = true;
+  }
+
+  /**
+   * @brief Apply EF using the cached neighbors, no tree walk or comms.
+   * The list given to EF is a copy, the cache is not modified by EF.
+   * EF must follow the rule of traversal_sph.
+   */
+  template<typename EF, typename... ARGS>
+  void traversal_sph_cached_(EF && ef, ARGS &&... args) {
+    const int64_t n = entities_.size();
+#pragma omp parallel if(threaded_traversal_)
+    {
+      std::vector<entity_t *> nbs;
+#pragma omp for schedule(static)
+      for(int64_t i = 0; i < n; ++i) {
+        if(active_sinks_ && !active_sinks_(entities_[i]))
+          continue;
+        nbs.assign(nbs_list_.begin() + nbs_offset_[i],
+          nbs_list_.begin() + nbs_offset_[i + 1]);
+        ef(entities_[i], nbs, std::forward<ARGS>(args)...);
+      } // for
+    } // omp parallel
+  }
+
+  /**
+   * @brief Index of an entity in the packed FMM sources
+   */
+  int64_t source_idx_(const hcell_t * hc) {
+    return hc->is_shared() ? entities_.size() + hc->entity_idx()
+                           : hc->entity_idx();
+  }
+
+  /**
+   * @brief Range [first, last) of the local entities under a node.
+   * The entities are sorted by key, the sub-entities of a node are the
+   * ones between its first and last descendant keys at max depth.
+   */
+  void entity_range_(const key_t & nkey, int64_t & first, int64_t & last) {
+    key_t lo = nkey, hi = nkey;
+    for(size_t d = nkey.depth(); d < key_t::max_depth(); ++d) {
+      lo.push(0);
+      hi.push(nchildren_ - 1);
+    } // for
+    first = std::lower_bound(entities_.begin(), entities_.end(), lo,
+              [](const entity_t & e, const key_t & k) { return e.key() < k; }) -
+            entities_.begin();
+    last = std::upper_bound(entities_.begin(), entities_.end(), hi,
+             [](const key_t & k, const entity_t & e) { return k < e.key(); }) -
+           entities_.begin();
+  }
+
+  /**
+   * @brief Evaluate the FMM interactions gathered during the traversal.
+   * The C2P are applied to the contiguous ranges of the affected nodes,
+   * level by level to avoid overlapping ranges between threads. The direct
+   * interactions are grouped by sink and the sorted sources are merged in
+   * contiguous ranges of the packed coordinates and masses.
+   */
+  template<typename P2P, typename C2P, typename M2P>
+  void fmm_evaluate_(const std::vector<std::pair<key_t, key_t>> & p2p_cells,
+    std::vector<std::pair<int64_t, int64_t>> & p2p,
+    const std::vector<std::pair<int64_t, int64_t>> & m2p,
+    P2P && f_p2p,
+    C2P && f_c2p,
+    M2P && f_m2p) {
+    const int64_t nlocal = entities_.size();
+    const int64_t nshared = shared_entities_.size();
+
+    // Expand the cell-cell direct interactions
+    std::vector<hcell_t *> sinks, sources;
+    for(int i = 0; i < p2p_cells.size(); ++i) {
+      sinks.clear();
+      sources.clear();
+      traversal(&(htable_.find(p2p_cells[i].first)->second),
+        [&](hcell_t * cell) {
+          if(cell->is_entity() && !cell->is_shared())
+            sinks.push_back(cell);
+          return cell->is_node();
+        });
+      traversal(&(htable_.find(p2p_cells[i].second)->second),
+        [&](hcell_t * cell) {
+          if(cell->is_entity())
+            sources.push_back(cell);
+          return cell->is_node();
+        });
+      for(hcell_t * s : sinks)
+        for(hcell_t * t : sources)
+          if(get_entity(s)->id() != get_entity(t)->id())
+            p2p.emplace_back(s->entity_idx(), source_idx_(t));
+    } // for
+
+    // Pack the sources
+    fmm_sources_.resize(nlocal + nshared);
+#pragma omp parallel for schedule(static)
+    for(int64_t i = 0; i < nlocal + nshared; ++i) {
+      const entity_t & e =
+        i < nlocal ? entities_[i] : shared_entities_[i - nlocal];
+      for(size_t d = 0; d < dimension; ++d)
+        fmm_sources_.x[d][i] = e.coordinates()[d];
+      fmm_sources_.mass[i] = e.mass();
+    } // for
+
+    // Cell to particles, nodes of the same depth have disjoint ranges
+    std::vector<std::vector<hcell_t *>> affected(key_t::max_depth() + 1);
+    traversal(root(), [&](hcell_t * cell) {
+      if(!cell->iam_owner()) {
+        return false; // do not expand others' nodes
+      }
+      if(cell->is_node() && get_node(cell)->affected()) {
+        affected[cell->key().depth()].push_back(cell);
+      }
+      return true;
+    });
+    {
+      timers::scope_t timer("c2p");
+      for(int l = 0; l < affected.size(); ++l) {
+        const int64_t nnodes = affected[l].size();
+#pragma omp parallel for schedule(dynamic)
+        for(int64_t i = 0; i < nnodes; ++i) {
+          int64_t first, last;
+          entity_range_(affected[l][i]->key(), first, last);
+          if(last > first)
+            f_c2p(get_node(affected[l][i]), &entities_[first], last - first);
+        } // for
+      } // for
+    }
+
+    // Group the direct interactions by sink
+    std::vector<int64_t> p2p_offset(nlocal + 1, 0), m2p_offset(nlocal + 1, 0);
+    for(int64_t i = 0; i < p2p.size(); ++i)
+      ++p2p_offset[p2p[i].first + 1];
+    for(int64_t i = 0; i < m2p.size(); ++i)
+      ++m2p_offset[m2p[i].first + 1];
+    for(int64_t i = 0; i < nlocal; ++i) {
+      p2p_offset[i + 1] += p2p_offset[i];
+      m2p_offset[i + 1] += m2p_offset[i];
+    } // for
+    std::vector<int64_t> p2p_sources(p2p.size()), m2p_nodes(m2p.size());
+    {
+      std::vector<int64_t> p2p_pos(p2p_offset.begin(), p2p_offset.end() - 1);
+      std::vector<int64_t> m2p_pos(m2p_offset.begin(), m2p_offset.end() - 1);
+      for(int64_t i = 0; i < p2p.size(); ++i)
+        p2p_sources[p2p_pos[p2p[i].first]++] = p2p[i].second;
+      for(int64_t i = 0; i < m2p.size(); ++i)
+        m2p_nodes[m2p_pos[m2p[i].first]++] = m2p[i].second;
+    }
+
+    // Direct interactions, m2p included
+    timers::scope_t timer("p2p");
+#pragma omp parallel for schedule(dynamic, 64)
+    for(int64_t i = 0; i < nlocal; ++i) {
+      entity_t & sink = entities_[i];
+      for(int64_t j = m2p_offset[i]; j < m2p_offset[i + 1]; ++j) {
+        const int64_t n = m2p_nodes[j];
+        f_m2p(sink, n >= 0 ? &cofm_[n] : &shared_nodes_[-n - 1]);
+      } // for
+      int64_t * src = p2p_sources.data();
+      std::sort(src + p2p_offset[i], src + p2p_offset[i + 1]);
+      int64_t j = p2p_offset[i];
+      while(j < p2p_offset[i + 1]) {
+        const int64_t begin = src[j];
+        int64_t end = begin + 1;
+        for(++j; j < p2p_offset[i + 1] && src[j] == end; ++j)
+          ++end;
+        f_p2p(sink, fmm_sources_, begin, end);
+      } // while
+    } // for
+  }
+
+  /**
+   * @brief Request the keys gathered during the SPH traversal.
+   * The keys already requested are removed, the requested flag of the
+   * cells is set here to keep the traversal read-only.
+   */
+  void flush_requests_(std::vector<std::vector<key_t>> & keys) {
+    bool rank_request = false;
+    for(int i = 0; i < keys.size(); ++i) {
+      int nkeys = 0;
+      for(int j = 0; j < keys[i].size(); ++j) {
+        hcell_t * cell = &(htable_.find(keys[i][j])->second);
+        if(!cell->requested()) {
+          cell->set_requested();
+          keys[i][nkeys++] = keys[i][j];
+        } // if
+      } // for
+      keys[i].resize(nkeys);
+      rank_request = rank_request || nkeys > 0;
+    } // for
+    if(rank_request)
+      request_(keys);
+    for(int i = 0; i < keys.size(); ++i) {
+      keys[i].clear();
+    } // for
+  }
+
+  /**
+   * @brief Build the map of the ghosts for the updates.
+   * Each rank sends to the owners the keys of the shared entities it holds,
+   * the owners find the corresponding local entities. The order of the
+   * keys is then used for all the updates until the tree is cleaned.
+   */
+  void build_ghosts_map_() {
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    std::vector<std::vector<key_t>> keys(size);
+    std::vector<std::vector<int64_t>> recv_idx(size);
+    for(auto & cell : htable_) {
+      if(cell.second.is_entity() && cell.second.is_shared()) {
+        keys[cell.second.owner()].push_back(cell.first);
+        recv_idx[cell.second.owner()].push_back(cell.second.entity_idx());
+      } // if
+    } // for
+
+    ghosts_recv_count_.resize(size);
+    ghosts_recv_displ_.resize(size);
+    ghosts_send_count_.resize(size);
+    ghosts_send_displ_.resize(size);
+    ghosts_recv_idx_.clear();
+    std::vector<key_t> send_keys;
+    for(int i = 0; i < size; ++i) {
+      ghosts_recv_count_[i] = keys[i].size();
+      ghosts_recv_displ_[i] = ghosts_recv_idx_.size();
+      ghosts_recv_idx_.insert(
+        ghosts_recv_idx_.end(), recv_idx[i].begin(), recv_idx[i].end());
+      send_keys.insert(send_keys.end(), keys[i].begin(), keys[i].end());
+    } // for
+
+    // The ghosts received are the entities to send for the owner
+    MPI_Alltoall(&ghosts_recv_count_[0], 1, MPI_INT, &ghosts_send_count_[0],
+      1, MPI_INT, MPI_COMM_WORLD);
+    int nsend = 0;
+    for(int i = 0; i < size; ++i) {
+      ghosts_send_displ_[i] = nsend;
+      nsend += ghosts_send_count_[i];
+    } // for
+    std::vector<key_t> recv_keys(nsend);
+    std::vector<int> scount(size), sdispl(size), rcount(size), rdispl(size);
+    for(int i = 0; i < size; ++i) {
+      scount[i] = ghosts_recv_count_[i] * sizeof(key_t);
+      sdispl[i] = ghosts_recv_displ_[i] * sizeof(key_t);
+      rcount[i] = ghosts_send_count_[i] * sizeof(key_t);
+      rdispl[i] = ghosts_send_displ_[i] * sizeof(key_t);
+    } // for
+    MPI_Alltoallv(send_keys.data(), &scount[0], &sdispl[0], MPI_BYTE,
+      recv_keys.data(), &rcount[0], &rdispl[0], MPI_BYTE, MPI_COMM_WORLD);
+
+    ghosts_send_idx_.resize(nsend);
+    for(int i = 0; i < nsend; ++i) {
+      auto cell = htable_.find(recv_keys[i]);
+#ifdef _DEBUG_TREE_
+      assert(cell != htable_.end());
+      assert(cell->second.is_entity() && !cell->second.is_shared());
+#endif
+      ghosts_send_idx_[i] = cell->second.entity_idx();
+    } // for
+
+    ghosts_map_nshared_ = shared_entities_.size();
+    ghosts_map_valid_ = true;
+  }
+
   /**
    * @brief Check for communciation: requests or replies from other
    * ranks.
    */
   void check_comms_() {
-#ifdef _DEBUG_TREE_
     double start = omp_get_wtime();
-#endif
     int flag = 1, size, rank;
     MPI_Status status;
     // static int tree_num = 1 ;
@@ -1197,18 +1978,14 @@ private:
         } // switch
       } // if
     } // while
-#ifdef _DEBUG_TREE_
     comms_timer_ += omp_get_wtime() - start;
-#endif
     // if(updated_tree){
     //  graphviz_draw(tree_num++);
     //}
   }
 
   void wait_comms_() {
-#ifdef _DEBUG_TREE_
     double start = omp_get_wtime();
-#endif
     int size, rank;
     bool end = false;
     MPI_Status status;
@@ -1262,9 +2039,7 @@ private:
           exit(1);
       } // switch
     } // while
-#ifdef _DEBUG_TREE_
-    comms_timer_ += omp_get_wtime() - start;
-#endif
+    wait_timer_ += omp_get_wtime() - start;
     // if(updated_tree){
     //  graphviz_draw(tree_num++);
     //}
@@ -1360,10 +2135,11 @@ private:
     } // if
     if(tmp_entities_replies.size() != 0) {
       mpi_replies_[current_replies_].push_back(MPI_Request{});
-      entities_replies_.push_back(tmp_entities_replies);
-      MPI_Issend(&entities_replies_[entities_replies_.size() - 1][0],
-        sizeof(share_entity_t) * tmp_entities_replies.size(), MPI_BYTE, partner,
-        REPLY_ENTITY, MPI_COMM_WORLD, &mpi_replies_[current_replies_].back());
+      entities_replies_.emplace_back();
+      pack_entities_(tmp_entities_replies, entities_replies_.back());
+      MPI_Issend(entities_replies_.back().data(),
+        entities_replies_.back().size(), MPI_BYTE, partner, REPLY_ENTITY,
+        MPI_COMM_WORLD, &mpi_replies_[current_replies_].back());
       found = true;
       if(mpi_replies_[current_replies_].size() >= requests_keys_max_ - 1) {
         current_replies_++;
@@ -1446,10 +2222,11 @@ private:
     } // if
     if(tmp_entities_replies.size() != 0) {
       mpi_replies_[current_replies_].push_back(MPI_Request{});
-      entities_replies_.push_back(tmp_entities_replies);
-      MPI_Issend(&entities_replies_[entities_replies_.size() - 1][0],
-        sizeof(share_entity_t) * tmp_entities_replies.size(), MPI_BYTE, partner,
-        REPLY_ENTITY, MPI_COMM_WORLD, &mpi_replies_[current_replies_].back());
+      entities_replies_.emplace_back();
+      pack_entities_(tmp_entities_replies, entities_replies_.back());
+      MPI_Issend(entities_replies_.back().data(),
+        entities_replies_.back().size(), MPI_BYTE, partner, REPLY_ENTITY,
+        MPI_COMM_WORLD, &mpi_replies_[current_replies_].back());
       found = true;
       if(mpi_replies_[current_replies_].size() >= requests_keys_max_ - 1) {
         current_replies_++;
@@ -1470,10 +2247,11 @@ private:
   void recv_entity_replies_(const int & partner, const int & nrecv) {
     int rank;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    int nentities = nrecv / sizeof(share_entity_t);
-    std::vector<share_entity_t> recv_entities(nentities);
-    MPI_Recv(&recv_entities[0], nrecv, MPI_BYTE, partner, REPLY_ENTITY,
+    std::vector<char> buffer(nrecv);
+    MPI_Recv(buffer.data(), nrecv, MPI_BYTE, partner, REPLY_ENTITY,
       MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    std::vector<share_entity_t> recv_entities;
+    unpack_entities_(buffer.data(), nrecv, recv_entities);
 
     for(int i = 0; i < recv_entities.size(); ++i) {
       key_t pkey = recv_entities[i].key;
@@ -1548,6 +2326,7 @@ private:
    */
   template<typename CCOFM>
   void share_nodes_(CCOFM && f_cc) {
+    timers::scope_t timer("share_nodes");
     double start = omp_get_wtime();
     log_one(trace) << "Sharing nodes/entities " << std::endl;
 
@@ -1572,7 +2351,7 @@ private:
     }
     std::vector<share_entity_t> ghosts_entities, r_ghosts_entities;
     std::vector<share_node_t> ghosts_nodes, r_ghosts_nodes;
-    const int sz_entities = sizeof(share_entity_t);
+    std::vector<char> s_ge_buffer, r_ge_buffer;
     const int sz_nodes = sizeof(share_node_t);
     int s_ge_size, s_gn_size;
 
@@ -1592,7 +2371,8 @@ private:
         assert(partner >= 0 && partner != rank && partner < size);
 #endif
         // Send lobound and hibound and bytes for nodes/entities
-        s_ge_size = ghosts_entities.size() * sz_entities;
+        pack_entities_(ghosts_entities, s_ge_buffer);
+        s_ge_size = s_ge_buffer.size();
         s_gn_size = ghosts_nodes.size() * sz_nodes;
         std::pair<int[2], key_t[2]> s_keys;
         s_keys.first[0] = s_ge_size;
@@ -1606,10 +2386,12 @@ private:
         lobound_ = std::min(s_rkeys.second[0], lobound_);
         hibound_ = std::max(s_rkeys.second[1], hibound_);
         // Send entities
-        r_ghosts_entities.resize(s_rkeys.first[0] / sz_entities);
-        MPI_Sendrecv(&ghosts_entities[0], s_ge_size, MPI_BYTE, partner, 0,
-          &r_ghosts_entities[0], s_rkeys.first[0], MPI_BYTE, partner, 0,
+        r_ge_buffer.resize(s_rkeys.first[0]);
+        MPI_Sendrecv(s_ge_buffer.data(), s_ge_size, MPI_BYTE, partner, 0,
+          r_ge_buffer.data(), s_rkeys.first[0], MPI_BYTE, partner, 0,
           MPI_COMM_WORLD, &status);
+        unpack_entities_(r_ge_buffer.data(), r_ge_buffer.size(),
+          r_ghosts_entities);
         // Send nodes
         r_ghosts_nodes.resize(s_rkeys.first[1] / sz_nodes);
         MPI_Sendrecv(&ghosts_nodes[0], s_gn_size, MPI_BYTE, partner, 0,
@@ -1686,7 +2468,8 @@ private:
           assert(partner >= 0 && partner != rank && partner < size);
 #endif
           // Send lobound and hibound and bytes for nodes/entities
-          s_ge_size = ghosts_entities.size() * sz_entities;
+          pack_entities_(ghosts_entities, s_ge_buffer);
+          s_ge_size = s_ge_buffer.size();
           s_gn_size = ghosts_nodes.size() * sz_nodes;
           std::pair<int[2], key_t[2]> s_keys;
           s_keys.first[0] = s_ge_size;
@@ -1700,10 +2483,12 @@ private:
           lobound_ = std::min(s_rkeys.second[0], lobound_);
           hibound_ = std::max(s_rkeys.second[1], hibound_);
           // Send entities
-          r_ghosts_entities.resize(s_rkeys.first[0] / sz_entities);
-          MPI_Sendrecv(&ghosts_entities[0], s_ge_size, MPI_BYTE, partner, 0,
-            &r_ghosts_entities[0], s_rkeys.first[0], MPI_BYTE, partner, 0,
+          r_ge_buffer.resize(s_rkeys.first[0]);
+          MPI_Sendrecv(s_ge_buffer.data(), s_ge_size, MPI_BYTE, partner, 0,
+            r_ge_buffer.data(), s_rkeys.first[0], MPI_BYTE, partner, 0,
             MPI_COMM_WORLD, &status);
+          unpack_entities_(r_ge_buffer.data(), r_ge_buffer.size(),
+            r_ghosts_entities);
           // Send nodes
           r_ghosts_nodes.resize(s_rkeys.first[1] / sz_nodes);
           MPI_Sendrecv(&ghosts_nodes[0], s_gn_size, MPI_BYTE, partner, 0,
@@ -1781,6 +2566,105 @@ private:
     }
   }
 
+  /**
+   * @brief Size in bytes of an entity sent to another rank.
+   * With a ghost projection only the owner, the key in the tree, the
+   * coordinates, radius, mass, id, key of the entity and the projected
+   * values are sent. Otherwise the whole entity is sent.
+   */
+  size_t entity_bytes_() const {
+    if(ghost_nvalues_ < 0)
+      return sizeof(int) + sizeof(key_int_t) + sizeof(entity_t);
+    return sizeof(int) + 2 * sizeof(key_int_t) + sizeof(size_t) +
+           (dimension + 2 + ghost_nvalues_) * sizeof(element_t);
+  }
+
+  /**
+   * @brief Pack the entities to be sent in a dense buffer
+   */
+  void pack_entities_(const std::vector<share_entity_t> & entities,
+    std::vector<char> & buffer) {
+    const size_t nbytes = entity_bytes_();
+    buffer.resize(entities.size() * nbytes);
+    std::vector<element_t> values(dimension + 2 + std::max(ghost_nvalues_, 0));
+    for(size_t i = 0; i < entities.size(); ++i) {
+      char * buf = &buffer[i * nbytes];
+      const entity_t & e = entities[i].entity;
+      std::memcpy(buf, &entities[i].owner, sizeof(int));
+      buf += sizeof(int);
+      const key_int_t key = entities[i].key.value();
+      std::memcpy(buf, &key, sizeof(key_int_t));
+      buf += sizeof(key_int_t);
+      if(ghost_nvalues_ < 0) {
+        std::memcpy(buf, &e, sizeof(entity_t));
+        continue;
+      } // if
+      const key_int_t ekey = e.key().value();
+      size_t id = e.id();
+      std::memcpy(buf, &ekey, sizeof(key_int_t));
+      buf += sizeof(key_int_t);
+      std::memcpy(buf, &id, sizeof(size_t));
+      buf += sizeof(size_t);
+      point_t coordinates = e.coordinates();
+      for(size_t d = 0; d < dimension; ++d)
+        values[d] = coordinates[d];
+      values[dimension] = e.radius();
+      values[dimension + 1] = e.mass();
+      if(ghost_nvalues_ > 0)
+        ghost_pack_(e, &values[dimension + 2]);
+      std::memcpy(buf, values.data(), values.size() * sizeof(element_t));
+    } // for
+  }
+
+  /**
+   * @brief Unpack the entities received from another rank
+   */
+  void unpack_entities_(const char * buffer,
+    const size_t & nrecv,
+    std::vector<share_entity_t> & entities) {
+    const size_t nbytes = entity_bytes_();
+#ifdef _DEBUG_TREE_
+    assert(nrecv % nbytes == 0);
+#endif
+    entities.resize(nrecv / nbytes);
+    std::vector<element_t> values(dimension + 2 + std::max(ghost_nvalues_, 0));
+    for(size_t i = 0; i < entities.size(); ++i) {
+      const char * buf = &buffer[i * nbytes];
+      entity_t & e = entities[i].entity;
+      std::memcpy(&entities[i].owner, buf, sizeof(int));
+      buf += sizeof(int);
+      key_int_t key;
+      std::memcpy(&key, buf, sizeof(key_int_t));
+      entities[i].key = key_t(key);
+      buf += sizeof(key_int_t);
+      if(ghost_nvalues_ < 0) {
+        // The buffer is not aligned for entity_t
+        alignas(entity_t) char bytes[sizeof(entity_t)];
+        std::memcpy(bytes, buf, sizeof(entity_t));
+        e = *reinterpret_cast<const entity_t *>(bytes);
+        continue;
+      } // if
+      key_int_t ekey;
+      size_t id;
+      std::memcpy(&ekey, buf, sizeof(key_int_t));
+      buf += sizeof(key_int_t);
+      std::memcpy(&id, buf, sizeof(size_t));
+      buf += sizeof(size_t);
+      std::memcpy(values.data(), buf, values.size() * sizeof(element_t));
+      point_t coordinates;
+      for(size_t d = 0; d < dimension; ++d)
+        coordinates[d] = values[d];
+      e.set_coordinates(coordinates);
+      e.set_radius(values[dimension]);
+      e.set_mass(values[dimension + 1]);
+      e.set_key(key_t(ekey));
+      e.set_id(id);
+      e.set_owner(entities[i].owner);
+      if(ghost_nvalues_ > 0)
+        ghost_unpack_(e, &values[dimension + 2]);
+    } // for
+  }
+
   /**
    * @brief Find the nodes or entities to be shared with other ranks.
    * This searches for the first nodes/entities that have an index.
@@ -1917,9 +2801,45 @@ private:
     cofm_children_(&cofm_[n->node_idx()], daughters, f_c);
   }
 
+  /**
+   * @brief Linearize the tree in depth first order of the keys.
+   * The cells added later by the traversals (distant nodes and entities)
+   * are not in the linear tree, they are reached through the hash table.
+   */
+  void build_linear_tree_() {
+    linear_tree_.clear();
+    linear_tree_.reserve(htable_.size());
+    std::vector<int64_t> parents;
+    parents.reserve(htable_.size());
+    std::stack<std::pair<hcell_t *, int64_t>> stk;
+    stk.push({root(), -1});
+    while(!stk.empty()) {
+      hcell_t * cur = stk.top().first;
+      parents.push_back(stk.top().second);
+      stk.pop();
+      const int64_t idx = linear_tree_.size();
+      hcell_t * daughters[nchildren_];
+      int children = 0;
+      daughters_(cur, daughters, children);
+      cur->set_linear_idx(idx);
+      linear_tree_.push_back({cur, children ? idx + 1 : -1, idx + 1, children});
+      // Push in reverse order, the first child is handled first
+      for(int c = children - 1; c >= 0; --c)
+        stk.push({daughters[c], idx});
+    } // while
+    // Size of the subtrees, the children are after their parent
+    const int64_t ncells = linear_tree_.size();
+    std::vector<int64_t> subtree(ncells, 1);
+    for(int64_t i = ncells - 1; i > 0; --i)
+      subtree[parents[i]] += subtree[i];
+    for(int64_t i = 0; i < ncells; ++i)
+      linear_tree_[i].next = i + subtree[i];
+  }
+
   /**
    * @brief Return a pointer to the hcell daughters of a node.
-   * Using the key of the current hcell and pushing the child number in
+   * Using the linearized tree if it contains all the children of the cell,
+   * otherwise the key of the current hcell and pushing the child number in
    * the parent key.
    */
   void daughters_(hcell_t * cell, hcell_t ** daughters, int & children) {
@@ -1927,8 +2847,17 @@ private:
     assert(cell != nullptr);
     assert(daughters != nullptr);
 #endif
-    key_t nkey = cell->key();
     children = 0;
+    if(cell->linear_idx() >= 0) {
+      const linear_cell_t & lc = linear_tree_[cell->linear_idx()];
+      if(lc.nchildren == cell->nchildren()) {
+        for(int64_t c = lc.first_child; children < lc.nchildren;
+            c = linear_tree_[c].next)
+          daughters[children++] = linear_tree_[c].cell;
+        return;
+      } // if
+    } // if
+    key_t nkey = cell->key();
     for(int i = 0; i < nchildren_; ++i) {
       if(cell->get_child(i)) {
         key_t ckey = nkey;
@@ -2022,6 +2951,8 @@ private:
   /**
    * @brief Find the min (1XX00..) and max (1XX77..) keys around a key
    * in the tree. This key might not be at the max depth.
+   * The digits are ordered along the curve, this holds for both the Morton
+   * and the Hilbert keys.
    */
   void key_boundary_(const key_t & key, key_t & min_key, key_t & max_key) {
     key_t stop;
@@ -2047,6 +2978,7 @@ private:
     current_requests_ = 0;
     current_replies_ = 0;
     comms_timer_ = 0;
+    wait_timer_ = 0;
     lost_timer_ = 0;
   }
 
@@ -2087,7 +3019,7 @@ private:
   template<class key_t>
   struct branch_id_hasher__ {
     size_t operator()(const key_t & k) const noexcept {
-      return static_cast<size_t>(k.value() & ((1 << 22) - 1));
+      return hashtable_hasher<key_t>()(k);
     }
   };
 
@@ -2095,8 +3027,9 @@ private:
   size_t max_depth_;
   // KEEP this to switch with hashtable
   // to see the best implementation
-  using umap_t = std::unordered_map<key_t, hcell_t, branch_id_hasher__<key_t>>;
-  // using umap_t = hashtable<key_t, hcell_t>;
+  // using umap_t =
+  //  std::unordered_map<key_t, hcell_t, branch_id_hasher__<key_t>>;
+  using umap_t = hashtable<key_t, hcell_t, branch_id_hasher__<key_t>>;
   typename umap_t::iterator root_;
   umap_t htable_;
   range_t range_;
@@ -2112,14 +3045,44 @@ private:
   std::vector<std::vector<MPI_Request>> mpi_requests_;
   std::vector<std::vector<MPI_Request>> mpi_replies_;
   std::vector<std::vector<share_node_t>> nodes_replies_;
-  std::vector<std::vector<share_entity_t>> entities_replies_;
+  std::vector<std::vector<char>> entities_replies_;
   std::vector<bool> comms_done_;
   bool comms_all_done_;
   const int requests_keys_max_ = 100;
-  double comms_timer_, lost_timer_;
+  // Time spent in the traversal handling the messages while working
+  // (comm_poll), waiting for the other ranks at the end (comm_wait) and on
+  // the groups postponed for distant data (lost)
+  double comms_timer_, wait_timer_, lost_timer_;
   // Traversal
   const int sub_entities_ = 128;
   const int fmm_sub_entities_ = 0;
+  const int sph_thread_block_ = 64;
+  bool threaded_traversal_ = false;
+  bool parallel_build_ = false;
+  // Linearized tree, depth first order
+  bool linear_tree_enabled_ = false;
+  std::vector<linear_cell_t> linear_tree_;
+  // Neighbors cache, CSR of the neighbors of the local entities
+  bool nbs_cache_enabled_ = false;
+  bool nbs_cache_valid_ = false;
+  std::vector<std::vector<int64_t>> nbs_record_;
+  std::vector<int64_t> nbs_offset_;
+  std::vector<entity_t *> nbs_list_;
+  std::vector<int64_t> nbs_index_;
+  // Filter of the sinks of the SPH traversals, all the entities if empty
+  std::function<bool(const entity_t &)> active_sinks_;
+  fmm_sources_t fmm_sources_;
+  // Ghosts update, local entities to send and shared entities to receive
+  bool ghosts_map_valid_ = false;
+  size_t ghosts_map_nshared_ = 0;
+  std::vector<int64_t> ghosts_send_idx_;
+  std::vector<int64_t> ghosts_recv_idx_;
+  std::vector<int> ghosts_send_count_, ghosts_send_displ_;
+  std::vector<int> ghosts_recv_count_, ghosts_recv_displ_;
+  // Projection of the entities sent, -1 to send the whole entity
+  int ghost_nvalues_ = -1;
+  std::function<void(const entity_t &, element_t *)> ghost_pack_;
+  std::function<void(entity_t &, const element_t *)> ghost_unpack_;
 };
 
 } // namespace topology
@@ -277,6 +277,16 @@ public:
     return node_idx_ == -1 && entity_idx_ == -1;
   }
 
+  /*
+   * Index in the linearized tree, -1 if added after the linearization
+   */
+  void set_linear_idx(const int linear_idx) {
+    linear_idx_ = linear_idx;
+  }
+  int linear_idx() const {
+    return linear_idx_;
+  }
+
 private:
   KEY key_;
   int node_idx_ = -1;
@@ -284,6 +294,7 @@ private:
   int owner_;
   unsigned int type_ = 0;
   int rank_;
+  int linear_idx_ = -1;
 };
 
 /*----------------------------------------------------------------------------*
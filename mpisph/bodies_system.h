@@ -23,6 +23,7 @@
 #include <typeinfo>
 
 #include "psort.h"
+#include "timers.h"
 
 #define DEBUG_TREE
 
@@ -55,12 +56,38 @@ public:
     if(param::sph_variable_h) {
       log_one(warn) << "Variable smoothing length ENABLE" << std::endl;
     }
+
+    tree_.set_threaded_traversal(param::sph_threaded_traversal);
+    if(param::sph_threaded_traversal) {
+      log_one(warn) << "Threaded SPH traversal ENABLE: " << omp_get_max_threads()
+                    << " threads" << std::endl;
+    }
+    tree_.set_neighbors_cache(param::sph_neighbors_cache);
+    tree_.set_linear_tree(param::linear_tree);
+    if(param::linear_tree) {
+      log_one(warn) << "Linearized tree ENABLE" << std::endl;
+    }
+    tree_.set_parallel_build(param::tree_parallel_build);
+    if(param::tree_parallel_build) {
+      log_one(warn) << "Threaded tree construction ENABLE: "
+                    << omp_get_max_threads() << " threads" << std::endl;
+    }
+    if(param::weighted_decomposition) {
+      log_one(warn) << "Cost weighted decomposition ENABLE" << std::endl;
+    }
+    if(param::sort_incremental) {
+      log_one(warn) << "Incremental sort ENABLE: imbalance max="
+                    << param::sort_imbalance_max << std::endl;
+    }
   };
 
   /**
    * @brief      Destroys the object.
    */
-  ~body_system(){};
+  ~body_system() {
+    // Snapshots still in flight in the asynchronous output
+    io::finalizeOutput();
+  };
 
   /**
    * @brief      Sets the Multipole Acceptance Criterion for FMM
@@ -73,7 +100,8 @@ public:
 
   /**
    * @brief      Read the bodies from H5part file Compute also the total to
-   *             check for mass lost
+   *             check for mass lost. With restart_from_checkpoint, the
+   *             bodies are read from the checkpoint of startiteration
    *
    * @param[in]  input_prefix    Input filename without format extension or
    *                             step number (i.e. sim_00000.h5part -> "sim")
@@ -84,6 +112,13 @@ public:
     const char * output_prefix,
     const int startiteration) {
 
+    if(param::restart_from_checkpoint && startiteration > 0) {
+      // The bodies come back key-sorted on the same number of ranks
+      sorted_ = io::inputCheckpoint(tree_.entities(), param::checkpoint_prefix,
+        startiteration, totalnbodies_, localnbodies_);
+      restored_ = sorted_;
+      return;
+    }
     io::inputDataHDF5(tree_.entities(), input_prefix, output_prefix,
       totalnbodies_, localnbodies_, startiteration);
   }
@@ -103,6 +138,16 @@ public:
     io::outputDataHDF5(tree_.entities(), output_prefix, iter, totaltime);
   }
 
+  /**
+   * @brief      Write the checkpoint of the bodies, one file per rank
+   *
+   * @param[in]  prefix  The checkpoint file prefix
+   * @param[in]  iter    The iteration of the checkpoint
+   */
+  void write_checkpoint(const char * prefix, int64_t iter) {
+    io::outputCheckpoint(tree_.entities(), prefix, iter);
+  }
+
   /**
    * @brief      Compute the largest smoothing length in the system This is
    *             really useful for particles with differents smoothing length
@@ -150,6 +195,7 @@ public:
    *    - Compute and exchange ghosts in real smoothing length
    */
   void update_iteration() {
+    timers::scope_t iteration_timer("update_iteration");
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
@@ -185,27 +231,49 @@ public:
 
     // Distributed sort
     log_one(trace) << "QSort (" << size << ")" << std::endl;
+    timers::scope_t sort_timer("psort");
     double timer = omp_get_wtime();
 
-    int dist[size];
-    dist[rank] = tree_.entities().size();
-
-    MPI_Allgather(MPI_IN_PLACE, 1, MPI_INT, dist, 1, MPI_INT, MPI_COMM_WORLD);
+    auto key_comp = [](const body & left, const body & right) {
+      if(left.key() < right.key()) {
+        return true;
+      }
+      if(left.key() == right.key()) {
+        return left.id() < right.id();
+      }
+      return false;
+    };
+
+    // Right after a restart on the same number of ranks the bodies are
+    // still sorted: no distributed sort, only the bodies whose key moved
+    // out of the range of their rank are sent
+    const bool restored = restored_;
+    restored_ = false;
+    bool incremental = (param::sort_incremental || restored) && size > 1 &&
+                       sorted_ && sort_incremental_(key_comp);
+    if(!incremental) {
+      std::vector<int64_t> dist(size);
+      dist[rank] = tree_.entities().size();
+      MPI_Allgather(MPI_IN_PLACE, 1, MPI_INT64_T, &dist[0], 1, MPI_INT64_T,
+        MPI_COMM_WORLD);
 
-    psort::psort(
-      tree_.entities(),
-      [](auto & left, auto & right) {
-        if(left.key() < right.key()) {
-          return true;
-        }
-        if(left.key() == right.key()) {
-          return left.id() < right.id();
-        }
-        return false;
-      },
-      dist);
+      if(param::sort_engine == param::sort_keys) {
+        psort::key_sort(tree_.entities(), &dist[0]);
+      }
+      else {
+        std::vector<int> idist(dist.begin(), dist.end());
+        psort::psort(tree_.entities(), key_comp, &idist[0]);
+      } // if
+
+      // The incremental steps change the counts, balance them again
+      if((param::weighted_decomposition || param::sort_incremental) &&
+         size > 1)
+        balance_cost_();
+    } // if
+    sorted_ = true;
     log_one(trace) << "QSort.done: ppp=" << tree_.entities().size() << "+-1 "
                    << omp_get_wtime() - timer << "s" << std::endl;
+    sort_timer.stop();
 
 #ifdef DEBUG_TREE
     std::vector<int> totalprocbodies;
@@ -218,7 +286,8 @@ public:
     int max = *std::max_element(totalprocbodies.begin(), totalprocbodies.end());
     int total = std::accumulate(totalprocbodies.begin(), totalprocbodies.end(), 0);
     assert(total == totalnbodies_);
-    assert(max - min <= 1);
+    assert(param::weighted_decomposition || param::sort_incremental ||
+           restored || max - min <= 1);
 #endif // DEBUG_TREE
 
     tree_.build_tree(physics::compute_cofm);
@@ -274,6 +343,163 @@ public:
     tree_.reset_ghosts(physics::compute_cofm);
   }
 
+  /**
+   * @brief      Variable smoothing length: solve h of the active local
+   *             particles (set_active_sinks) with
+   *             physics::solve_smoothinglength. If the neighbors cache of
+   *             the last density pass is valid (sph_neighbors_cache or
+   *             sph_soa_kernels), the particles did not move since and its
+   *             lists are the candidates in the current radius: only the
+   *             particles for which h grows beyond it are walked. Otherwise
+   *             all of them are walked with a search radius of
+   *             sph_h_search_factor * h. The particles not solved are walked
+   *             again with a larger radius.
+   *             Must be called on all ranks, the tree is rebuilt by the next
+   *             update_iteration.
+   */
+  void update_smoothinglength() {
+    timers::scope_t timer("smoothinglength");
+    std::vector<body> & ents = tree_.entities();
+    const int64_t n = ents.size();
+    const body * first = ents.data();
+    std::vector<double> h(n);
+    std::vector<char> unsolved(n);
+    for(int64_t i = 0; i < n; ++i) {
+      h[i] = ents[i].radius();
+      unsolved[i] = !active_ || active_(ents[i]);
+    }
+
+    if(tree_.neighbors_cache_valid())
+      tree_.traversal_sph_cached(
+        [&](body & particle, std::vector<body *> & nbs) {
+          const int64_t i = &particle - first;
+          unsolved[i] = !physics::solve_smoothinglength(particle, nbs, h[i]);
+        });
+
+    int64_t nwalks = 0, remaining = 0;
+    while(true) {
+      remaining = 0;
+      for(int64_t i = 0; i < n; ++i) {
+        if(unsolved[i]) {
+          ents[i].set_radius(param::sph_h_search_factor * h[i]);
+          ++remaining;
+        }
+        else
+          ents[i].set_radius(h[i]);
+      } // for
+      MPI_Allreduce(
+        MPI_IN_PLACE, &remaining, 1, MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+      if(remaining == 0 || nwalks >= param::sph_h_max_iterations)
+        break;
+      ++nwalks;
+      // The node bounds depend on the radii
+      reset_ghosts();
+      tree_.set_active_sinks(
+        [&](const body & b) { return unsolved[&b - first]; });
+      tree_.traversal_sph([&](body & particle, std::vector<body *> & nbs) {
+        const int64_t i = &particle - first;
+        unsolved[i] = !physics::solve_smoothinglength(particle, nbs, h[i]);
+      });
+    } // while
+    tree_.set_active_sinks(active_);
+
+    if(remaining > 0) {
+      log_one(warn) << "Smoothing length not solved for " << remaining
+                    << " particles" << std::endl;
+      for(int64_t i = 0; i < n; ++i)
+        ents[i].set_radius(h[i]);
+    }
+    log_one(trace) << "Smoothing length: " << nwalks << " walks" << std::endl;
+  }
+
+  /**
+   * @brief      Block timesteps: neighbor timebin limiter (Saitoh & Makino
+   *             2009). The step of a particle is at most
+   *             2^block_timestep_neighbor_levels times the steps of its
+   *             neighbors, the particles above are demoted with
+   *             integration::block_demote, in the middle of their step if
+   *             needed. Called after physics::set_block_timesteps, the
+   *             ghost fields must contain GHOST_TIMEBIN.
+   *             Must be called on all ranks, the tree is rebuilt by the next
+   *             update_iteration.
+   */
+  void limit_timebins() {
+    timers::scope_t timer("timebin_limiter");
+    std::vector<body> & ents = tree_.entities();
+    const int64_t n = ents.size();
+    const body * first = ents.data();
+    const int levels = param::block_timestep_neighbor_levels;
+    // Only the particles above the smallest timebin can be demoted
+    int minbin = param::block_timestep_levels;
+    std::vector<int> bins(n);
+    for(int64_t i = 0; i < n; ++i) {
+      bins[i] = ents[i].getTimebin();
+      minbin = std::min(minbin, bins[i]);
+    }
+    reduce_min(minbin);
+
+    // The neighbors timebins are read from the bodies, the limited ones are
+    // stored apart
+    reset_ghosts();
+    tree_.set_active_sinks(
+      [&](const body & b) { return b.getTimebin() > minbin + levels; });
+    tree_.traversal_sph([&](body & particle, std::vector<body *> & nbs) {
+      int & bin = bins[&particle - first];
+      for(auto nb : nbs)
+        bin = std::min(bin, nb->getTimebin() + levels);
+    });
+    tree_.set_active_sinks(active_);
+
+    int64_t demoted = 0;
+    for(int64_t i = 0; i < n; ++i) {
+      if(bins[i] < ents[i].getTimebin()) {
+        integration::block_demote(ents[i], bins[i]);
+        ++demoted;
+      }
+    } // for
+    log_one(trace) << "Timebin limiter: " << demoted << " local particles"
+                   << std::endl;
+  }
+
+  /**
+   * @brief      Set the fields of the ghosts sent during the tree
+   *             construction and traversals, in addition to the position,
+   *             smoothing length, mass and id. Must be called on all ranks.
+   *
+   * @param[in]  fields  Bitmask of ghost_field_t to send
+   */
+  void set_ghost_fields(const unsigned & fields) {
+    tree_.set_ghost_projection(body::ghost_size(fields),
+      [fields](const body & b, type_t * buf) { b.pack_ghost(fields, buf); },
+      [fields](body & b, const type_t * buf) { b.unpack_ghost(fields, buf); });
+  }
+
+  /**
+   * @brief      Restrict apply_in_smoothinglength and
+   *             apply_in_smoothinglength_soa to the local particles for which
+   *             active returns true, the neighbors are then only searched for
+   *             these particles. Must be called on all ranks.
+   *
+   * @param[in]  active  Filter of the particles, nullptr for all
+   */
+  void set_active_sinks(std::function<bool(const body &)> active) {
+    active_ = active;
+    tree_.set_active_sinks(std::move(active));
+  }
+
+  /**
+   * @brief      Update the fields of the ghosts without rebuilding the tree.
+   *             The positions and smoothing lengths must not have changed
+   *             since the last update_iteration.
+   *
+   * @param[in]  fields  Bitmask of ghost_field_t to send
+   */
+  void update_ghosts(const unsigned & fields) {
+    tree_.update_ghosts(body::ghost_size(fields),
+      [fields](const body & b, type_t * buf) { b.pack_ghost(fields, buf); },
+      [fields](body & b, const type_t * buf) { b.unpack_ghost(fields, buf); });
+  }
+
   /**
    * @brief      Compute the gravition interction between all the particles
    * @details    The function is based on Fast Multipole Method. The functions
@@ -283,7 +509,8 @@ public:
     assert (gdimension == 3);
     if constexpr (gdimension == 3) {
       using namespace fmm;
-      tree_.traversal_fmm(macangle_, taylor_c2c, taylor_p2c, fmm_p2p, fmm_c2p);
+      tree_.traversal_fmm(
+        macangle_, taylor_c2c, taylor_p2c, fmm_p2p, fmm_c2p, fmm_m2p);
     }
   }
 
@@ -291,7 +518,9 @@ public:
    * @brief      Apply the function EF with ARGS in the smoothing length of all
    *             the lcoal particles. This function need a previous call to
    *             update_iteration and update_neighbors for the remote particles'
-   *             data.
+   *             data. EF only modifies the particle it is applied to, and does
+   *             not read the fields of the neighbors written by the same pass,
+   *             which the threaded traversal would race on.
    *
    * @param[in]  ef    The function to apply in the smoothing length
    * @param[in]  args  Arguments of the physics function applied in the
@@ -306,6 +535,35 @@ public:
     tree_.traversal_sph(ef, std::forward<ARGS>(args)...);
   }
 
+  /**
+   * @brief      Apply the function EF with ARGS in the smoothing length of all
+   *             the local particles, reading the neighbors from a structure
+   *             of arrays instead of a vector of bodies.
+   *             EF(particle, soa, nbs, n_nb, args...) with nbs the n_nb
+   *             indices of the neighbors in soa. The neighbors cache is
+   *             built if needed, the arrays are loaded from the local
+   *             particles and the ghosts before applying EF.
+   *
+   * @param[in]  fields  Bitmask of ghost_field_t read by EF from the arrays,
+   *                     in addition to position, smoothing length and mass
+   * @param[in]  ef      The function to apply in the smoothing length
+   * @param[in]  args    Arguments of the physics function
+   */
+  template<typename EF, typename... ARGS>
+  void apply_in_smoothinglength_soa(const unsigned & fields,
+    EF && ef,
+    ARGS &&... args) {
+    tree_.build_neighbors_cache();
+    {
+      timers::scope_t timer("soa_load");
+      soa_.load(fields, tree_.entities(), tree_.shared_entities());
+    }
+    tree_.traversal_sph_span(
+      [&](body & particle, const int64_t * nbs, const int64_t & n_nb) {
+        ef(particle, soa_, nbs, n_nb, std::forward<ARGS>(args)...);
+      });
+  }
+
   /**
    * @brief      Apply a function to all the particles.
    *
@@ -346,6 +604,22 @@ public:
     return tree_.entities();
   };
 
+  /**
+   * @brief      Replace the local bodies, e.g. generated in memory instead of
+   *             read from a file. The tree has to be updated before use.
+   *             Collective.
+   *
+   * @param[in]  bodies  The new local bodies
+   */
+  void setLocalbodies(const std::vector<body> & bodies) {
+    tree_.clean();
+    tree_.entities() = bodies;
+    sorted_ = restored_ = false;
+    localnbodies_ = bodies.size();
+    MPI_Allreduce(&localnbodies_, &totalnbodies_, 1, MPI_INT64_T, MPI_SUM,
+      MPI_COMM_WORLD);
+  }
+
   size_t nbodies() {
     return tree_.entities().size();
   }
@@ -366,13 +640,129 @@ public:
   }
 
 private:
+  /**
+   * @brief      Re-sort the nearly sorted bodies and only send the ones
+   *             leaving the key range of the rank. The ranges are given by
+   *             the bodies at the boundaries of the previous sort, with the
+   *             new keys. Return false if the full sort is needed: empty
+   *             rank or load imbalance above sort_imbalance_max.
+   */
+  template<typename COMP>
+  bool sort_incremental_(COMP && comp) {
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    std::vector<body> & bodies = tree_.entities();
+
+    int64_t nsent = 0;
+    if(!psort::incremental_sort(bodies, comp, nsent))
+      return false;
+
+    double load = bodies.size();
+    if(param::weighted_decomposition) {
+      load = 0.;
+      for(auto & b : bodies)
+        load += 1. + b.getNeighbors();
+    } // if
+    double max_load = load, total_load = load;
+    MPI_Allreduce(
+      MPI_IN_PLACE, &max_load, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Allreduce(
+      MPI_IN_PLACE, &total_load, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(
+      MPI_IN_PLACE, &nsent, 1, MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+    const double imbalance = max_load * size / total_load;
+
+    log_one(trace) << "Incremental sort: sent=" << nsent
+                   << " imbalance=" << imbalance << std::endl;
+    if(imbalance > param::sort_imbalance_max) {
+      log_one(trace) << "Incremental sort: imbalance above "
+                     << param::sort_imbalance_max << ", full sort" << std::endl;
+      return false;
+    } // if
+    return true;
+  }
+
+  /**
+   * @brief      Move the sorted bodies between the ranks so that each rank
+   *             holds a contiguous part of the key range with the same total
+   *             cost. The cost of a body is 1 + its number of neighbors in
+   *             weighted decomposition, 1 otherwise.
+   *             The bodies keep the global order, the distribution is kept
+   *             by the next sort and only the difference is moved.
+   */
+  void balance_cost_() {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    std::vector<body> & bodies = tree_.entities();
+    const int64_t n = bodies.size();
+
+    double local_cost = 0., offset = 0., total_cost = 0.;
+    auto body_cost = [](const body & b) {
+      return param::weighted_decomposition ? 1. + b.getNeighbors() : 1.;
+    };
+    for(int64_t i = 0; i < n; ++i)
+      local_cost += body_cost(bodies[i]);
+    MPI_Exscan(
+      &local_cost, &offset, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    if(rank == 0)
+      offset = 0.;
+    MPI_Allreduce(
+      &local_cost, &total_cost, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+    // Destination of each body: rank owning the middle of its cost interval
+    std::vector<int> send_counts(size, 0), recv_counts(size);
+    const double rank_cost = total_cost / size;
+    for(int64_t i = 0; i < n; ++i) {
+      const double cost = body_cost(bodies[i]);
+      int dest = std::min(size - 1, int((offset + .5 * cost) / rank_cost));
+      ++send_counts[dest];
+      offset += cost;
+    } // for
+    MPI_Alltoall(&send_counts[0], 1, MPI_INT, &recv_counts[0], 1, MPI_INT,
+      MPI_COMM_WORLD);
+    int64_t nrecv = std::accumulate(recv_counts.begin(), recv_counts.end(), 0L);
+    int64_t nsent = n - send_counts[rank];
+
+    // Keep the count distribution if a rank would end up empty
+    int64_t stats[2] = {nrecv, -nsent};
+    MPI_Allreduce(MPI_IN_PLACE, stats, 2, MPI_INT64_T, MPI_MIN, MPI_COMM_WORLD);
+    if(stats[0] == 0) {
+      log_one(warn) << "Cost balance skipped: empty rank"
+                    << std::endl;
+      return;
+    }
+
+    std::vector<int> send_disps(size, 0), recv_disps(size, 0);
+    std::partial_sum(
+      send_counts.begin(), send_counts.end() - 1, send_disps.begin() + 1);
+    std::partial_sum(
+      recv_counts.begin(), recv_counts.end() - 1, recv_disps.begin() + 1);
+
+    MPI_Datatype MPI_body;
+    MPI_Type_contiguous(sizeof(body), MPI_BYTE, &MPI_body);
+    MPI_Type_commit(&MPI_body);
+    std::vector<body> recv(nrecv);
+    MPI_Alltoallv(&bodies[0], &send_counts[0], &send_disps[0], MPI_body,
+      &recv[0], &recv_counts[0], &recv_disps[0], MPI_body, MPI_COMM_WORLD);
+    MPI_Type_free(&MPI_body);
+    bodies.swap(recv);
+
+    log_one(trace) << "Cost balance: max sent=" << -stats[1]
+                   << " ppp=" << bodies.size() << std::endl;
+  }
+
   int64_t totalnbodies_; // Total number of local particles
   int64_t localnbodies_; // Local number of particles
   double macangle_; // Macangle for FMM
   double maxmasscell_; // Mass criterion for FMM
   range_t range_;
   tree_topology_t tree_; // The particle tree data structure
+  body_soa soa_; // Neighbors fields for apply_in_smoothinglength_soa
   double epsilon_ = 0.;
+  bool sorted_ = false; // Entities sorted by a previous update_iteration
+  bool restored_ = false; // Sorted entities read from a checkpoint
+  std::function<bool(const body &)> active_; // Filter of set_active_sinks
 
   const int refresh_tree = 0;
   int current_refresh = refresh_tree;
@@ -26,14 +26,24 @@
 #ifndef _mpisph_io_h_
 #define _mpisph_io_h_
 
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <dirent.h>
 #include <iostream>
 #include <libgen.h>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
 #include <vector>
 
 #include "default_physics.h"
 #include "params.h"
+#include "timers.h"
 
 #include <hdf5.h>
 //#include <H5hut.h>
@@ -66,6 +76,9 @@ H5P_getType(T * data) {
   else if(typeid(T) == typeid(double)) {
     type = H5T_NATIVE_DOUBLE;
   }
+  else if(typeid(T) == typeid(float)) {
+    type = H5T_NATIVE_FLOAT;
+  }
   else if(typeid(T) == typeid(int64_t)) {
     type = H5T_NATIVE_LLONG;
   }
@@ -133,48 +146,89 @@ H5P_setStep(hid_t & file_id, size_t step) {
   H5Pclose(plist_id);
 }
 
+/**
+ * @brief Create the dataset dsname of IO_nparticles elements in the current
+ * step. Collective.
+ */
 template<typename T>
 hid_t
-H5P_writeDataset(hid_t & file_id,
-  const char * dsname,
-  T * data,
-  size_t dim = IO_nparticlesproc) {
-
+H5P_createDataset(const char * dsname, T * data) {
   hid_t type = H5P_getType(data);
 
-  hid_t status = 1;
-  hsize_t hdim = dim;
   /* Create the dataspace for the dataset.*/
   hsize_t total = IO_nparticles;
   hid_t filespace = H5Screate_simple(1, &total, NULL);
-  hid_t dset_id = H5Dcreate(IO_group_id, dsname, type, filespace, H5P_DEFAULT,
-    H5P_DEFAULT, H5P_DEFAULT);
+  /* Chunked layout, needed by the shuffle and deflate filters. The filters
+   * are applied in parallel by HDF5 with the collective writes */
+  hid_t dcpl_id = H5Pcreate(H5P_DATASET_CREATE);
+  hsize_t chunk = param::out_h5data_chunk;
+  if(param::out_h5data_compression > 0 && chunk == 0)
+    chunk = 65536;
+  if(chunk > 0 && total > 0) {
+    chunk = std::min(chunk, total);
+    H5Pset_chunk(dcpl_id, 1, &chunk);
+    if(param::out_h5data_compression > 0) {
+      H5Pset_shuffle(dcpl_id);
+      H5Pset_deflate(dcpl_id, std::min(param::out_h5data_compression, 9));
+    }
+  }
+  hid_t dset_id = H5Dcreate(
+    IO_group_id, dsname, type, filespace, H5P_DEFAULT, dcpl_id, H5P_DEFAULT);
   H5Sclose(filespace);
+  H5Pclose(dcpl_id);
+  return dset_id;
+}
 
-  hsize_t offset_in = 0;
-  hsize_t count_in = dim;
+/**
+ * @brief Write count elements of data at offset in the dataset.
+ * Collective: every rank has to call it, possibly with count == 0.
+ */
+template<typename T>
+hid_t
+H5P_writeDatasetSlab(hid_t dset_id, T * data, hsize_t offset, hsize_t count) {
+  hid_t type = H5P_getType(data);
+
+  hsize_t count_in = std::max(count, (hsize_t)1);
   hid_t memspace = H5Screate_simple(1, &count_in, NULL);
 
   // Select the hyperslab
   hid_t dataspace = H5Dget_space(dset_id);
-  H5Sselect_hyperslab(
-    dataspace, H5S_SELECT_SET, &IO_offset, NULL, &IO_count, NULL);
+  if(count > 0) {
+    H5Sselect_hyperslab(
+      dataspace, H5S_SELECT_SET, &offset, NULL, &count, NULL);
+  }
+  else {
+    H5Sselect_none(memspace);
+    H5Sselect_none(dataspace);
+  }
 
   /*Create property list for collective dataset write.*/
   hid_t plist_id = H5Pcreate(H5P_DATASET_XFER);
   H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_COLLECTIVE);
 
-  status = H5Dwrite(dset_id, type, memspace, dataspace, plist_id, data);
+  hid_t status = H5Dwrite(dset_id, type, memspace, dataspace, plist_id, data);
 
   // Close everythings
   H5Sclose(memspace);
   H5Sclose(dataspace);
-  H5Dclose(dset_id);
   H5Pclose(plist_id);
 
   return status;
 }
 
+/**
+ * @brief Create the dataset dsname and write the IO_count elements of data at
+ * IO_offset. Collective.
+ */
+template<typename T>
+hid_t
+H5P_writeDataset(hid_t & file_id, const char * dsname, T * data) {
+  hid_t dset_id = H5P_createDataset(dsname, data);
+  hid_t status = H5P_writeDatasetSlab(dset_id, data, IO_offset, IO_count);
+  H5Dclose(dset_id);
+  return status;
+}
+
 template<typename T>
 hid_t
 H5P_readAttribute(hid_t & file_id, const char * dsname, T * data) {
@@ -869,219 +923,676 @@ inputDataHDF5(std::vector<body> & bodies,
 
 } // inputDataHDF5
 
-// Output data in HDF5 format
-// Generate the associate XDMF file
-void
-outputDataHDF5(std::vector<body> & bodies,
-  const char * fileprefix,
-  int64_t iteration,
-  double totaltime,
-  MPI_Comm comm = MPI_COMM_WORLD) {
-
-  comm_ = comm;
-  int step = output_step++;
+/**
+ * @brief Field of the snapshots, read from a body by the real or the integer
+ * accessor. The real fields not needed for restarting may be written in
+ * single precision.
+ */
+typedef enum snapshot_type_enum {
+  snapshot_real,
+  snapshot_int64,
+  snapshot_int32
+} snapshot_type_t;
+
+struct snapshot_field_t {
+  const char * name;
+  snapshot_type_t type;
+  bool restart;
+  double (*real)(body &, int);
+  int64_t (*integer)(body &, int);
+}; // struct snapshot_field_t
+
+const std::vector<snapshot_field_t> snapshot_fields = {
+  {"x", snapshot_real, true,
+    [](body & b, int) { return b.coordinates()[0]; }, nullptr},
+  {"y", snapshot_real, true,
+    [](body & b, int) { return gdimension > 1 ? b.coordinates()[1] : 0.; },
+    nullptr},
+  {"z", snapshot_real, true,
+    [](body & b, int) { return gdimension > 2 ? b.coordinates()[2] : 0.; },
+    nullptr},
+  {"vx", snapshot_real, true,
+    [](body & b, int) { return b.getVelocity()[0]; }, nullptr},
+  {"vy", snapshot_real, true,
+    [](body & b, int) { return gdimension > 1 ? b.getVelocity()[1] : 0.; },
+    nullptr},
+  {"vz", snapshot_real, true,
+    [](body & b, int) { return gdimension > 2 ? b.getVelocity()[2] : 0.; },
+    nullptr},
+  {"ax", snapshot_real, false,
+    [](body & b, int) {
+      return b.getAcceleration()[0] + b.getGAcceleration()[0];
+    },
+    nullptr},
+  {"ay", snapshot_real, false,
+    [](body & b, int) {
+      return gdimension > 1
+               ? b.getAcceleration()[1] + b.getGAcceleration()[1]
+               : 0.;
+    },
+    nullptr},
+  {"az", snapshot_real, false,
+    [](body & b, int) {
+      return gdimension > 2
+               ? b.getAcceleration()[2] + b.getGAcceleration()[2]
+               : 0.;
+    },
+    nullptr},
+  {"gradV", snapshot_real, false,
+    [](body & b, int) { return b.getGradV(); }, nullptr},
+  {"h", snapshot_real, true, [](body & b, int) { return b.radius(); },
+    nullptr},
+  {"rho", snapshot_real, true,
+    [](body & b, int) { return b.getDensity(); }, nullptr},
+#ifdef INTERNAL_ENERGY
+  {"u", snapshot_real, true,
+    [](body & b, int) { return b.getInternalenergy(); }, nullptr},
+#endif
+  {"P", snapshot_real, true,
+    [](body & b, int) { return b.getPressure(); }, nullptr},
+  {"m", snapshot_real, true, [](body & b, int) { return b.mass(); },
+    nullptr},
+  {"dt", snapshot_real, true, [](body & b, int) { return b.getDt(); },
+    nullptr},
+  {"traceSS", snapshot_real, false,
+    [](body & b, int) { return b.getTraceSS(); }, nullptr},
+  {"alpha", snapshot_real, false,
+    [](body & b, int) { return b.getAlpha(); }, nullptr},
+  {"divergenceV", snapshot_real, false,
+    [](body & b, int) { return b.getDivergenceV(); }, nullptr},
+  {"dDivVdt", snapshot_real, false,
+    [](body & b, int) { return b.getDdivvdt(); }, nullptr},
+  {"trigger", snapshot_real, false,
+    [](body & b, int) { return b.getTrigger(); }, nullptr},
+  {"xi", snapshot_real, false, [](body & b, int) { return b.getXi(); },
+    nullptr},
+  {"id", snapshot_int64, true, nullptr,
+    [](body & b, int) { return int64_t(b.id()); }},
+  {"rank", snapshot_int64, false, nullptr,
+    [](body &, int rank) { return int64_t(rank); }},
+  {"neighbors", snapshot_int64, false, nullptr,
+    [](body & b, int) { return int64_t(b.getNeighbors()); }},
+  {"type", snapshot_int32, true, nullptr,
+    [](body & b, int) { return int64_t(b.getType()); }},
+  {"state", snapshot_int32, true, nullptr,
+    [](body & b, int) { return int64_t(b.state()); }}};
 
-  int size, rank;
-  MPI_Comm_size(comm_, &size);
-  MPI_Comm_rank(comm_, &rank);
+/**
+ * @brief Staging buffer of a snapshot. The selected fields of the local
+ * bodies are packed once and the buffer is then written by the calling
+ * thread or by the I/O thread. The buffers are kept and reused from one
+ * output to the next.
+ */
+struct snapshot_t {
+  // Selected field and its block in the buffer of its type
+  struct column_t {
+    const snapshot_field_t * field;
+    bool float32;
+    size_t block;
+  };
+
+  std::string filename;
+  int step;
+  int rank;
+  int64_t iteration;
+  double totaltime;
+  double dt;
+  int64_t nparticlesproc;
+  int64_t nparticles;
+  int64_t offset;
+  std::vector<column_t> columns;
+  // One block of nparticlesproc values per field
+  std::vector<double> real;
+  std::vector<float> real32;
+  std::vector<int64_t> integer;
+  std::vector<int32_t> integer32;
+}; // struct snapshot_t
 
-  MPI_Barrier(comm_);
-  log_one(trace) << "Output particles" << std::flush;
+/**
+ * @brief Fields selected by out_h5data_fields, a comma or space separated
+ * list of names or "all". The positions are always written: the readers
+ * get the number of particles from "x".
+ */
+std::vector<const snapshot_field_t *>
+H5P_snapshotFields() {
+  static std::string selection;
+  static std::vector<const snapshot_field_t *> fields;
+  if(!fields.empty() && selection == param::out_h5data_fields)
+    return fields;
+  selection = param::out_h5data_fields;
+  fields.clear();
+
+  std::vector<std::string> names;
+  std::string name;
+  for(char c : selection + ",") {
+    if(c == ',' || isspace(c)) {
+      if(!name.empty())
+        names.push_back(name);
+      name.clear();
+    }
+    else {
+      name += c;
+    }
+  } // for
+  bool all = names.empty() ||
+             std::find(names.begin(), names.end(), "all") != names.end();
+  for(auto & n : names) {
+    if(n == "all")
+      continue;
+    auto it = std::find_if(snapshot_fields.begin(), snapshot_fields.end(),
+      [&n](const snapshot_field_t & f) { return n == f.name; });
+    if(it == snapshot_fields.end())
+      log_one(warn) << "Unknown snapshot field " << n << std::endl;
+  } // for
+  for(auto & f : snapshot_fields) {
+    bool position = !strcmp(f.name, "x") || !strcmp(f.name, "y") ||
+                    !strcmp(f.name, "z");
+    if(all || position ||
+       std::find(names.begin(), names.end(), f.name) != names.end())
+      fields.push_back(&f);
+  } // for
+  return fields;
+} // H5P_snapshotFields
 
+/**
+ * @brief Pack the fields of the bodies in the snapshot staging buffer.
+ * Only the offsets of the hyperslab need communications.
+ */
+void
+H5P_packSnapshot(snapshot_t & snap,
+  std::vector<body> & bodies,
+  const char * fileprefix,
+  int step,
+  int64_t iteration,
+  MPI_Comm comm) {
   char filename[128];
   if(param::out_h5data_separate_iterations)
     sprintf(filename, "%s_%05d.h5part", fileprefix, step);
   else
     sprintf(filename, "%s.h5part", fileprefix);
+  snap.filename = filename;
+  snap.step = step;
+  snap.iteration = iteration;
+  snap.totaltime = physics::totaltime;
+  snap.dt = physics::dt;
+  MPI_Comm_rank(comm, &snap.rank);
+
+  const int64_t n = bodies.size();
+  snap.nparticlesproc = n;
+  snap.offset = 0;
+  MPI_Exscan(&n, &snap.offset, 1, MPI_INT64_T, MPI_SUM, comm);
+  if(snap.rank == 0)
+    snap.offset = 0;
+  MPI_Allreduce(&n, &snap.nparticles, 1, MPI_INT64_T, MPI_SUM, comm);
+
+  size_t nblocks[4] = {0, 0, 0, 0};
+  snap.columns.clear();
+  for(auto f : H5P_snapshotFields()) {
+    bool float32 =
+      f->type == snapshot_real && !f->restart && param::out_h5data_float32;
+    int kind = float32 ? 1 : f->type == snapshot_real ? 0 : f->type + 1;
+    snap.columns.push_back({f, float32, nblocks[kind]++});
+  } // for
+  snap.real.resize(nblocks[0] * n);
+  snap.real32.resize(nblocks[1] * n);
+  snap.integer.resize(nblocks[2] * n);
+  snap.integer32.resize(nblocks[3] * n);
+
+  const int rank = snap.rank;
+  const auto & columns = snap.columns;
+  double * real = snap.real.data();
+  float * real32 = snap.real32.data();
+  int64_t * integer = snap.integer.data();
+  int32_t * integer32 = snap.integer32.data();
+#pragma omp parallel for schedule(static)
+  for(int64_t i = 0; i < n; ++i) {
+    body & b = bodies[i];
+    for(auto & c : columns) {
+      const int64_t pos = c.block * n + i;
+      if(c.field->type == snapshot_real) {
+        if(c.float32)
+          real32[pos] = c.field->real(b, rank);
+        else
+          real[pos] = c.field->real(b, rank);
+      }
+      else if(c.field->type == snapshot_int64) {
+        integer[pos] = c.field->integer(b, rank);
+      }
+      else {
+        integer32[pos] = c.field->integer(b, rank);
+      } // if
+    } // for
+  } // for
+} // H5P_packSnapshot
 
+/**
+ * @brief Write a packed snapshot, collective on comm
+ */
+void
+H5P_writeSnapshot(snapshot_t & snap, MPI_Comm comm) {
+  comm_ = comm;
   // Wait for removing the file before writing in
   MPI_Barrier(comm_);
   // Check if file exists
-  hid_t dataFile = H5P_openFile(filename, H5F_ACC_RDWR);
+  hid_t dataFile = H5P_openFile(snap.filename.c_str(), H5F_ACC_RDWR);
 
   //-------------------GLOBAL HEADER-------------------------------------------
   // Only for the first output
-  if(step == 0 or param::out_h5data_separate_iterations) {
+  if(snap.step == 0 or param::out_h5data_separate_iterations) {
     int gdimension32 = gdimension;
     H5P_writeAttribute(dataFile, "dimension", &gdimension32);
   }
 
   //------------------STEP HEADER----------------------------------------------
   // Put the step header
-  H5P_setStep(dataFile, step);
-  H5P_writeAttributeStep(dataFile, "time", &physics::totaltime);
-  H5P_writeAttributeStep(dataFile, "iteration", &iteration);
-  H5P_writeAttributeStep(dataFile, "timestep", &physics::dt);
+  H5P_setStep(dataFile, snap.step);
+  H5P_writeAttributeStep(dataFile, "time", &snap.totaltime);
+  H5P_writeAttributeStep(dataFile, "iteration", &snap.iteration);
+  H5P_writeAttributeStep(dataFile, "timestep", &snap.dt);
   //------------------STEP DATA------------------------------------------------
 
-  H5P_setNumParticles(bodies.size());
-
-  // 4 buffers, 3 double and 1 int64
-  double *b1 = new double[IO_nparticlesproc];
-  double *b2 = new double[IO_nparticlesproc];
-  double *b3 = new double[IO_nparticlesproc];
-  double *b4 = new double[IO_nparticlesproc];
-  int64_t *bi = new int64_t[IO_nparticlesproc];
-  int32_t *bint = new int32_t[IO_nparticlesproc];
-
-  // Position
-  int64_t pos = 0L;
-  // Extract data from bodies
-  for(auto bi : bodies) {
-    b1[pos] = bi.coordinates()[0];
-    if(gdimension > 1) {
-      b2[pos] = bi.coordinates()[1];
-    }
-    else {
-      b2[pos] = 0.;
+  const int64_t n = snap.nparticlesproc;
+  IO_nparticlesproc = n;
+  IO_nparticles = snap.nparticles;
+  IO_offset = snap.offset;
+  IO_count = n;
+
+  for(auto & c : snap.columns) {
+    const char * name = c.field->name;
+    const int64_t pos = c.block * n;
+    if(c.field->type == snapshot_real) {
+      if(c.float32)
+        H5P_writeDataset(dataFile, name, snap.real32.data() + pos);
+      else
+        H5P_writeDataset(dataFile, name, snap.real.data() + pos);
     }
-    if(gdimension > 2) {
-      b3[pos++] = bi.coordinates()[2];
+    else if(c.field->type == snapshot_int64) {
+      H5P_writeDataset(dataFile, name, snap.integer.data() + pos);
     }
     else {
-      b3[pos++] = 0.;
-    }
-  }
-  H5P_writeDataset(dataFile, "x", b1);
-  H5P_writeDataset(dataFile, "y", b2);
-  H5P_writeDataset(dataFile, "z", b3);
-
-  // Velocity
-  pos = 0L;
-  // Extract data from bodies
-  for(auto bi : bodies) {
-    b1[pos] = bi.getVelocity()[0];
-    if(gdimension > 1) {
-      b2[pos] = bi.getVelocity()[1];
-    }
-    else {
-      b2[pos] = 0;
-    }
-    if(gdimension > 2) {
-      b3[pos++] = bi.getVelocity()[2];
-    }
-    else {
-      b3[pos++] = 0.;
-    }
+      H5P_writeDataset(dataFile, name, snap.integer32.data() + pos);
+    } // if
+  } // for
+
+  H5P_closeFile(dataFile);
+} // H5P_writeSnapshot
+
+/**
+ * @brief Asynchronous snapshot output. The snapshots are written in order by
+ * a dedicated thread on a duplicate of the communicator, this requires
+ * MPI_THREAD_MULTIPLE. The HDF5 calls are made by this thread while it runs:
+ * the synchronous output first calls wait().
+ */
+class async_writer_t
+{
+public:
+  ~async_writer_t() {
+    assert(!thread_.joinable());
   }
-  H5P_writeDataset(dataFile, "vx", b1);
-  H5P_writeDataset(dataFile, "vy", b2);
-  H5P_writeDataset(dataFile, "vz", b3);
-
-  // Acceleration
-  pos = 0L;
-  // Extract data from bodies
-  for(auto bi : bodies) {
-    b1[pos] = bi.getAcceleration()[0] + bi.getGAcceleration()[0];
-    b4[pos] = bi.getGradV();
-    if(gdimension > 1) {
-      b2[pos] = bi.getAcceleration()[1] + bi.getGAcceleration()[1];
-    }
-    else {
-      b2[pos] = 0.;
-    }
-    if(gdimension > 2) {
-      b3[pos++] = bi.getAcceleration()[2] + bi.getGAcceleration()[2];
+
+  /**
+   * @brief Get a free staging buffer, blocks while max snapshots are in
+   * flight. Starts the I/O thread on the first call, collective on comm.
+   */
+  snapshot_t & acquire(MPI_Comm comm, size_t max) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if(!thread_.joinable()) {
+      MPI_Comm_dup(comm, &comm_);
+      stop_ = false;
+      thread_ = std::thread(&async_writer_t::run_, this);
     }
-    else {
-      b3[pos++] = 0.;
+    max = std::max(max, size_t(1));
+    while(free_.empty() && pool_.size() >= max)
+      cv_.wait(lock);
+    if(free_.empty()) {
+      pool_.emplace_back(new snapshot_t);
+      return *pool_.back();
     }
+    snapshot_t * snap = free_.back();
+    free_.pop_back();
+    return *snap;
   }
-  H5P_writeDataset(dataFile, "ax", b1);
-  H5P_writeDataset(dataFile, "ay", b2);
-  H5P_writeDataset(dataFile, "az", b3);
-  H5P_writeDataset(dataFile, "gradV", b4);
-
-  // Smoothing length, Density, Internal Energy
-  pos = 0L;
-  // Extract data from bodies
-  for(auto bi : bodies) {
-    b1[pos] = bi.radius();
-    b2[pos] = bi.getDensity();
-#ifdef INTERNAL_ENERGY
-    b3[pos] = bi.getInternalenergy();
-#endif
-    pos++;
+
+  /** @brief Queue a packed snapshot for writing */
+  void push(snapshot_t & snap) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(&snap);
+    cv_.notify_all();
   }
-  H5P_writeDataset(dataFile, "h", b1);
-  H5P_writeDataset(dataFile, "rho", b2);
-#ifdef INTERNAL_ENERGY
-  H5P_writeDataset(dataFile, "u", b3);
-#endif
 
-  // Pressure, Mass, Id, timestep
-  pos = 0L;
-  // Extract data from bodies
-  for(auto bid : bodies) {
-    b1[pos] = bid.getPressure();
-    b2[pos] = bid.mass();
-    b3[pos] = bid.getDt();
-    b4[pos] = bid.getTraceSS();
-    bi[pos] = bid.id();
-    bint[pos++] = bid.getType();
+  /** @brief Wait until all the queued snapshots are written */
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(!queue_.empty())
+      cv_.wait(lock);
   }
-  H5P_writeDataset(dataFile, "P", b1);
-  H5P_writeDataset(dataFile, "m", b2);
-  H5P_writeDataset(dataFile, "dt", b3);
-  H5P_writeDataset(dataFile, "traceSS", b4);
-  H5P_writeDataset(dataFile, "id", bi);
-  H5P_writeDataset(dataFile, "type", bint);
-
-  // Pressure, Mass, Id, timestep
-  pos = 0L;
-  // Extract data from bodies
-  for (auto bid : bodies) {
-    b1[pos] = bid.getAlpha();
-    b2[pos] = bid.getDivergenceV();
-    b3[pos] = bid.getDdivvdt();
-    pos++;
+
+  /** @brief Flush and stop the I/O thread, before MPI_Finalize */
+  void finalize() {
+    if(!thread_.joinable())
+      return;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+      cv_.notify_all();
+    }
+    thread_.join();
+    MPI_Comm_free(&comm_);
   }
-  H5P_writeDataset(dataFile, "alpha", b1);
-  H5P_writeDataset(dataFile, "divergenceV", b2);
-  H5P_writeDataset(dataFile, "dDivVdt", b3);
-
-  // Pressure, Mass, Id, timestep
-  pos = 0L;
-  // Extract data from bodies
-  for (auto bid : bodies) {
-    b1[pos] = bid.getTrigger();
-    b2[pos] = bid.getXi();
-    bint[pos] = bid.state();
-    pos++;
+
+private:
+  void run_() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for(;;) {
+      while(queue_.empty() && !stop_)
+        cv_.wait(lock);
+      if(queue_.empty())
+        break;
+      snapshot_t * snap = queue_.front();
+      lock.unlock();
+      H5P_writeSnapshot(*snap, comm_);
+      lock.lock();
+      queue_.pop_front();
+      free_.push_back(snap);
+      cv_.notify_all();
+    } // for
   }
-  H5P_writeDataset(dataFile, "trigger", b1);
-  H5P_writeDataset(dataFile, "xi", b2);
-  H5P_writeDataset(dataFile, "state", bint);
-
-  // Output the rank for analysis
-  std::fill(bi, bi + IO_nparticlesproc, rank);
-  H5P_writeDataset(dataFile, "rank", bi);
-
-  // pos = 0L;
-  // for (auto bid : bodies) {
-  //  bi[pos++] = bid.key().value();
-  //}
-  // H5P_writeDataset(dataFile, "key", bi);
-
-  pos = 0L;
-  for(auto bid : bodies) {
-    bi[pos++] = bid.getNeighbors();
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<snapshot_t *> queue_;
+  std::vector<std::unique_ptr<snapshot_t>> pool_;
+  std::vector<snapshot_t *> free_;
+  MPI_Comm comm_ = MPI_COMM_NULL;
+  bool stop_ = false;
+}; // class async_writer_t
+
+async_writer_t IO_writer;
+snapshot_t IO_snapshot;
+
+/**
+ * @brief Check that MPI provides the thread level of the asynchronous output
+ */
+bool
+H5P_asyncSupported() {
+  static bool warned = false;
+  int provided;
+  MPI_Query_thread(&provided);
+  if(provided == MPI_THREAD_MULTIPLE)
+    return true;
+  if(!warned) {
+    log_one(warn) << "Asynchronous output requires MPI_THREAD_MULTIPLE, "
+                  << "writing synchronously" << std::endl;
+    warned = true;
   }
-  H5P_writeDataset(dataFile, "neighbors", bi);
+  return false;
+}
 
-  H5P_closeFile(dataFile);
+/**
+ * @brief Wait for the snapshots in flight and stop the I/O thread
+ */
+void
+finalizeOutput() {
+  IO_writer.wait();
+  IO_writer.finalize();
+}
 
-  delete[] b1;
-  delete[] b2;
-  delete[] b3;
-  delete[] b4;
-  delete[] bi;
-  delete[] bint;
+// Output data in HDF5 format
+// Generate the associate XDMF file
+void
+outputDataHDF5(std::vector<body> & bodies,
+  const char * fileprefix,
+  int64_t iteration,
+  double totaltime,
+  MPI_Comm comm = MPI_COMM_WORLD) {
+
+  timers::scope_t timer("write");
+  int step = output_step++;
+
+  log_one(trace) << "Output particles" << std::flush;
+
+  if(param::out_h5data_async && H5P_asyncSupported()) {
+    snapshot_t & snap = IO_writer.acquire(comm, param::out_h5data_async_max);
+    H5P_packSnapshot(snap, bodies, fileprefix, step, iteration, comm);
+    IO_writer.push(snap);
+  }
+  else {
+    IO_writer.wait();
+    H5P_packSnapshot(IO_snapshot, bodies, fileprefix, step, iteration, comm);
+    H5P_writeSnapshot(IO_snapshot, comm);
+  } // if
 
   log_one(trace) << ".done" << std::endl;
 
 } // outputDataHDF5
 
+/**
+ * @brief Header of the per-rank checkpoint files. The key-sorted bodies
+ * follow as a raw dump, like in the distributed sort, at a page aligned
+ * offset: the files can be memory mapped.
+ */
+struct checkpoint_header_t {
+  char magic[8];
+  int32_t version;
+  int32_t dimension;
+  int32_t rank;
+  int32_t size;
+  int64_t body_size;
+  int64_t iteration;
+  double totaltime;
+  double dt;
+  int64_t nbodies;
+  int64_t totalnbodies;
+  int64_t offset;
+  uint64_t checksum;
+}; // struct checkpoint_header_t
+
+const char checkpoint_magic[8] = "FSPHCHK";
+const int32_t checkpoint_version = 1;
+const int64_t checkpoint_alignment = 4096;
+
+/**
+ * @brief Checksum of the bodies, 64 bits words mixed with the FNV-1a prime
+ */
+uint64_t
+checkpointChecksum(const void * data, size_t bytes) {
+  const unsigned char * ptr = static_cast<const unsigned char *>(data);
+  uint64_t hash = 14695981039346656037ULL;
+  size_t i = 0;
+  for(; i + sizeof(uint64_t) <= bytes; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, ptr + i, sizeof(uint64_t));
+    hash = (hash ^ word) * 1099511628211ULL;
+    hash ^= hash >> 29;
+  }
+  for(; i < bytes; ++i)
+    hash = (hash ^ ptr[i]) * 1099511628211ULL;
+  return hash;
+} // checkpointChecksum
+
+void
+checkpointFilename(char * filename,
+  const char * prefix,
+  int64_t iteration,
+  int rank) {
+  sprintf(filename, "%s_%08ld.%05d.chk", prefix, (long)iteration, rank);
+}
+
+/**
+ * @brief Write the local bodies in the checkpoint file of this rank.
+ * The file is written under a temporary name and renamed, the checkpoint
+ * of the previous call is removed once every rank wrote the new one.
+ */
+void
+outputCheckpoint(std::vector<body> & bodies,
+  const char * prefix,
+  int64_t iteration,
+  MPI_Comm comm = MPI_COMM_WORLD) {
+  timers::scope_t timer("checkpoint");
+  static int64_t last_iteration = -1;
+  int rank, size;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+
+  log_one(trace) << "Output checkpoint" << std::flush;
+
+  checkpoint_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+  header.version = checkpoint_version;
+  header.dimension = gdimension;
+  header.rank = rank;
+  header.size = size;
+  header.body_size = sizeof(body);
+  header.iteration = iteration;
+  header.totaltime = physics::totaltime;
+  header.dt = physics::dt;
+  header.nbodies = bodies.size();
+  MPI_Allreduce(
+    &header.nbodies, &header.totalnbodies, 1, MPI_INT64_T, MPI_SUM, comm);
+  header.offset = checkpoint_alignment;
+  header.checksum =
+    checkpointChecksum(bodies.data(), bodies.size() * sizeof(body));
+
+  char filename[MAX_FNAME_LEN], tmpname[MAX_FNAME_LEN + 4];
+  checkpointFilename(filename, prefix, iteration, rank);
+  sprintf(tmpname, "%s.tmp", filename);
+  FILE * file = fopen(tmpname, "wb");
+  bool ok = file != nullptr;
+  if(ok) {
+    std::vector<char> page(checkpoint_alignment, 0);
+    memcpy(page.data(), &header, sizeof(header));
+    ok = fwrite(page.data(), 1, page.size(), file) == page.size();
+    ok = ok && fwrite(bodies.data(), sizeof(body), bodies.size(), file) ==
+                 bodies.size();
+    ok = (fclose(file) == 0) && ok;
+    ok = ok && rename(tmpname, filename) == 0;
+  }
+  if(!ok) {
+    log_one(error) << "Cannot write checkpoint " << filename << std::endl;
+    FULLSTOP;
+  }
+
+  MPI_Barrier(comm);
+  if(last_iteration >= 0 && last_iteration != iteration) {
+    checkpointFilename(filename, prefix, last_iteration, rank);
+    remove(filename);
+  }
+  last_iteration = iteration;
+
+  log_one(trace) << ".done" << std::endl;
+} // outputCheckpoint
+
+/**
+ * @brief Read the checkpoint files of an iteration.
+ * With the same number of ranks each rank reads back its own file and the
+ * key-sorted distribution of the bodies is restored. Otherwise the files are
+ * read round-robin and the bodies are dealt evenly to the ranks.
+ *
+ * @return true if the distribution of the bodies was restored
+ */
+bool
+inputCheckpoint(std::vector<body> & bodies,
+  const char * prefix,
+  int64_t iteration,
+  int64_t & totalnbodies,
+  int64_t & nbodies,
+  MPI_Comm comm = MPI_COMM_WORLD) {
+  int rank, size;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+
+  log_one(trace) << "Input checkpoint" << std::endl;
+
+  auto read_header = [&](int file_rank, checkpoint_header_t & header) {
+    char filename[MAX_FNAME_LEN];
+    checkpointFilename(filename, prefix, iteration, file_rank);
+    FILE * file = fopen(filename, "rb");
+    if(file == nullptr ||
+       fread(&header, sizeof(header), 1, file) != 1 ||
+       memcmp(header.magic, checkpoint_magic, sizeof(header.magic)) ||
+       header.version != checkpoint_version ||
+       header.dimension != gdimension || header.body_size != sizeof(body) ||
+       header.iteration != iteration) {
+      std::cerr << "Invalid checkpoint " << filename << std::endl;
+      if(file != nullptr)
+        fclose(file);
+      return (FILE *)nullptr;
+    }
+    return file;
+  };
+
+  // The number of files of this checkpoint, same header for all the ranks
+  checkpoint_header_t header;
+  FILE * file = read_header(0, header);
+  if(file == nullptr)
+    FULLSTOP;
+  fclose(file);
+  const int nfiles = header.size;
+  physics::totaltime = header.totaltime;
+  physics::dt = header.dt;
+  totalnbodies = header.totalnbodies;
+
+  bodies.clear();
+  int valid = true;
+  for(int f = rank; f < nfiles && valid; f += size) {
+    file = read_header(f, header);
+    if(file == nullptr) {
+      valid = false;
+      break;
+    }
+    const size_t start = bodies.size();
+    bodies.resize(start + header.nbodies);
+    valid = fseek(file, header.offset, SEEK_SET) == 0 &&
+            fread(bodies.data() + start, sizeof(body), header.nbodies,
+              file) == size_t(header.nbodies) &&
+            checkpointChecksum(bodies.data() + start,
+              header.nbodies * sizeof(body)) == header.checksum;
+    fclose(file);
+    if(!valid)
+      std::cerr << "Corrupted checkpoint file " << f << " of iteration "
+                << iteration << std::endl;
+  } // for
+  MPI_Allreduce(MPI_IN_PLACE, &valid, 1, MPI_INT, MPI_LAND, comm);
+  if(!valid) {
+    log_one(error) << "Cannot restart from the checkpoint" << std::endl;
+    FULLSTOP;
+  }
+
+  if(nfiles != size && totalnbodies > 0) {
+    // Deal the bodies evenly to the ranks, they are sorted by the next
+    // update of the tree
+    int64_t nlocal = bodies.size(), first = 0;
+    MPI_Exscan(&nlocal, &first, 1, MPI_INT64_T, MPI_SUM, comm);
+    if(rank == 0)
+      first = 0;
+    std::vector<int> scount(size, 0), rcount(size), sdispl(size), rdispl(size);
+    for(int64_t i = 0; i < nlocal; ++i)
+      ++scount[(first + i) * size / totalnbodies];
+    MPI_Alltoall(&scount[0], 1, MPI_INT, &rcount[0], 1, MPI_INT, comm);
+    std::partial_sum(scount.begin(), scount.end() - 1, sdispl.begin() + 1);
+    std::partial_sum(rcount.begin(), rcount.end() - 1, rdispl.begin() + 1);
+    sdispl[0] = rdispl[0] = 0;
+    std::vector<body> recv(rdispl[size - 1] + rcount[size - 1]);
+    MPI_Datatype body_type;
+    MPI_Type_contiguous(sizeof(body), MPI_BYTE, &body_type);
+    MPI_Type_commit(&body_type);
+    MPI_Alltoallv(bodies.data(), &scount[0], &sdispl[0], body_type,
+      recv.data(), &rcount[0], &rdispl[0], body_type, comm);
+    MPI_Type_free(&body_type);
+    bodies.swap(recv);
+  } // if
+  nbodies = bodies.size();
+
+  int64_t total = 0;
+  MPI_Allreduce(&nbodies, &total, 1, MPI_INT64_T, MPI_SUM, comm);
+  assert(total == totalnbodies);
+
+  log_one(trace) << "Input checkpoint.done" << std::endl;
+  return nfiles == size;
+} // inputCheckpoint
+
 } // namespace io
 
 #undef FULLSTOP
@@ -19,7 +19,9 @@
 #pragma once
 
 #include "mpi.h"
+#include <algorithm>
 #include <numeric>
+#include <type_traits>
 #include <vector>
 
 /**
@@ -33,14 +35,18 @@ namespace psort {
 class Split
 {
 public:
-  template<typename _Iterator, typename _Compare>
+  template<typename _Iterator, typename _Compare, typename _Count = int>
   void split(_Iterator first,
     _Iterator last,
-    int * dist,
+    _Count * dist,
     _Compare comp,
-    std::vector<std::vector<int>> & right_ends,
+    std::vector<std::vector<_Count>> & right_ends,
     MPI_Datatype & MPI_valueType) {
     typedef typename std::iterator_traits<_Iterator>::value_type _ValueType;
+    static_assert(sizeof(_Count) == sizeof(int) || sizeof(_Count) == 8,
+      "Counts are exchanged as MPI_INT or MPI_INT64_T");
+    MPI_Datatype MPI_countType =
+      sizeof(_Count) == sizeof(int) ? MPI_INT : MPI_INT64_T;
 
     int size, rank;
     MPI_Comm_size(MPI_COMM_WORLD, &size);
@@ -56,23 +62,25 @@ public:
 
     // union of [0, right_end[i+1]) on each processor produces dist[i] total
     // values
-    std::vector<int> targets_v(size - 1);
-    int * targets = &targets_v.at(0);
+    std::vector<_Count> targets_v(size - 1);
+    _Count * targets = &targets_v.at(0);
     std::partial_sum(dist, dist + (size - 1), targets);
 
     // keep a list of ranges, trying to "activate" them at each branch
     std::vector<std::pair<_Iterator, _Iterator>> d_ranges(size - 1);
-    std::vector<std::pair<int *, int *>> t_ranges(size - 1);
+    std::vector<std::pair<_Count *, _Count *>> t_ranges(size - 1);
     d_ranges[0] = std::pair<_Iterator, _Iterator>(first, last);
-    t_ranges[0] = std::pair<int *, int *>(targets, targets + (size - 1));
+    t_ranges[0] = std::pair<_Count *, _Count *>(targets, targets + (size - 1));
 
     // invariant: subdist[i][rank] == d_ranges[i].second - d_ranges[i].first
     // amount of data each proc still has in the search
-    std::vector<std::vector<int>> subdist(size - 1, std::vector<int>(size));
+    std::vector<std::vector<_Count>> subdist(
+      size - 1, std::vector<_Count>(size));
     std::copy(dist, dist + size, subdist[0].begin());
 
     // for each processor, d_ranges - first
-    std::vector<std::vector<int>> outleft(size - 1, std::vector<int>(size, 0));
+    std::vector<std::vector<_Count>> outleft(
+      size - 1, std::vector<_Count>(size, 0));
 
     for(int n_act = 1; n_act > 0;) {
       for(int k = 0; k < n_act; ++k) {
@@ -85,7 +93,7 @@ public:
       _ValueType * medians = new _ValueType[size * n_act];
       for(int k = 0; k < n_act; ++k) {
         _ValueType * ptr = &d_ranges[k].first[0];
-        int index = subdist[k][rank] / 2;
+        _Count index = subdist[k][rank] / 2;
         mymedians[k] = ptr[index];
       } // for
       MPI_Allgather(mymedians, n_act, MPI_valueType, medians, n_act,
@@ -102,7 +110,8 @@ public:
           ms_perm[i] = i * n_act + k;
         std::sort(ms_perm, ms_perm + n_real,
           PermCompare<_ValueType, _Compare>(medians, comp));
-        int mid = accumulate(subdist[k].begin(), subdist[k].end(), 0) / 2;
+        _Count mid =
+          accumulate(subdist[k].begin(), subdist[k].end(), _Count(0)) / 2;
         int query_ind = -1;
         for(int i = 0; i < n_real; ++i) {
           if(subdist[k][ms_perm[i] / n_act] == 0)
@@ -120,8 +129,8 @@ public:
       delete[] medians;
 
       //------- find min and max ranks of the guesses
-      std::vector<int> ind_local_v(2 * n_act);
-      int * ind_local = &ind_local_v.at(0);
+      std::vector<_Count> ind_local_v(2 * n_act);
+      _Count * ind_local = &ind_local_v.at(0);
       for(int k = 0; k < n_act; ++k) {
         std::pair<_Iterator, _Iterator> ind_local_p = std::equal_range(
           d_ranges[k].first, d_ranges[k].second, queries[k], comp);
@@ -130,14 +139,14 @@ public:
         ind_local[2 * k + 1] = ind_local_p.second - first;
       } // for
 
-      std::vector<int> ind_all_v(2 * n_act * size);
-      int * ind_all = &ind_all_v.at(0);
-      MPI_Allgather(ind_local, 2 * n_act, MPI_INT, ind_all, 2 * n_act, MPI_INT,
-        MPI_COMM_WORLD);
+      std::vector<_Count> ind_all_v(2 * n_act * size);
+      _Count * ind_all = &ind_all_v.at(0);
+      MPI_Allgather(ind_local, 2 * n_act, MPI_countType, ind_all, 2 * n_act,
+        MPI_countType, MPI_COMM_WORLD);
       // sum to get the global range of indices
-      std::vector<std::pair<int, int>> ind_global(n_act);
+      std::vector<std::pair<_Count, _Count>> ind_global(n_act);
       for(int k = 0; k < n_act; ++k) {
-        ind_global[k] = std::make_pair(0, 0);
+        ind_global[k] = std::make_pair(_Count(0), _Count(0));
         for(int i = 0; i < size; ++i) {
           ind_global[k].first += ind_all[2 * (i * n_act + k)];
           ind_global[k].second += ind_all[2 * (i * n_act + k) + 1];
@@ -146,27 +155,28 @@ public:
 
       // state to pass on to next iteration
       std::vector<std::pair<_Iterator, _Iterator>> d_ranges_x(size - 1);
-      std::vector<std::pair<int *, int *>> t_ranges_x(size - 1);
-      std::vector<std::vector<int>> subdist_x(size - 1, std::vector<int>(size));
-      std::vector<std::vector<int>> outleft_x(
-        size - 1, std::vector<int>(size, 0));
+      std::vector<std::pair<_Count *, _Count *>> t_ranges_x(size - 1);
+      std::vector<std::vector<_Count>> subdist_x(
+        size - 1, std::vector<_Count>(size));
+      std::vector<std::vector<_Count>> outleft_x(
+        size - 1, std::vector<_Count>(size, 0));
       int n_act_x = 0;
 
       for(int k = 0; k < n_act; ++k) {
-        int * split_low = std::lower_bound(
+        _Count * split_low = std::lower_bound(
           t_ranges[k].first, t_ranges[k].second, ind_global[k].first);
-        int * split_high = std::upper_bound(
+        _Count * split_high = std::upper_bound(
           t_ranges[k].first, t_ranges[k].second, ind_global[k].second);
 
         // iterate over targets we hit
-        for(int * s = split_low; s != split_high; ++s) {
+        for(_Count * s = split_low; s != split_high; ++s) {
           assert(*s > 0);
           // a bit sloppy: if more than one target in range, excess won't zero
           // out
-          int excess = *s - ind_global[k].first;
+          _Count excess = *s - ind_global[k].first;
           // low procs to high take excess for stability
           for(int i = 0; i < size; ++i) {
-            int amount = std::min(ind_all[2 * (i * n_act + k)] + excess,
+            _Count amount = std::min(ind_all[2 * (i * n_act + k)] + excess,
               ind_all[2 * (i * n_act + k) + 1]);
             right_ends[(s - targets) + 1][i] = amount;
             excess -= amount - ind_all[2 * (i * n_act + k)];
@@ -320,4 +330,245 @@ psort(std::vector<TYPE> & vec, _Compare comp, int * dist_in) {
   // Finish
   return;
 }
+
+/**
+ * Element of the key sort: the sort only moves these, the bodies are moved
+ * once using the index
+ **/
+template<typename KEY>
+struct key_item_t {
+  KEY key;
+  int64_t id;
+  int64_t index;
+};
+
+/**
+ * Distributed sort by (key, id) with a single migration of the elements.
+ * The (key, id, index) items are sorted locally and the splitters are
+ * searched on the items only, with 64 bits counts. The elements are then
+ * packed in their sorted order, exchanged and placed by a last local
+ * permutation.
+ * dist_in is the number of elements per rank before and after the sort.
+ * Only the per rank counts given to MPI_Alltoallv are limited to INT_MAX.
+ **/
+template<typename TYPE>
+void
+key_sort(std::vector<TYPE> & vec, const int64_t * dist_in) {
+  using key_t = std::decay_t<decltype(vec[0].key())>;
+  using item_t = key_item_t<key_t>;
+
+  int size, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  auto comp = [](const item_t & left, const item_t & right) {
+    if(left.key < right.key)
+      return true;
+    if(left.key == right.key)
+      return left.id < right.id;
+    return false;
+  };
+
+  // Sort the items and move the elements once in the sorted order
+  auto sort_items = [&](std::vector<TYPE> & in, std::vector<item_t> & items) {
+    const int64_t n = in.size();
+    items.resize(n);
+#pragma omp parallel for schedule(static)
+    for(int64_t i = 0; i < n; ++i)
+      items[i] = {in[i].key(), static_cast<int64_t>(in[i].id()), i};
+    std::sort(items.begin(), items.end(), comp);
+  };
+  auto permute = [](const std::vector<TYPE> & in,
+                   const std::vector<item_t> & items, std::vector<TYPE> & out) {
+    const int64_t n = items.size();
+    out.resize(n);
+#pragma omp parallel for schedule(static)
+    for(int64_t i = 0; i < n; ++i)
+      out[i] = in[items[i].index];
+  };
+
+  std::vector<item_t> items;
+  std::vector<TYPE> buffer;
+  sort_items(vec, items);
+  permute(vec, items, buffer);
+
+  // For one rank, no work
+  if(size == 1) {
+    vec.swap(buffer);
+    return;
+  }
+
+  // Find splitters on the items
+  MPI_Datatype MPI_itemType;
+  MPI_Type_contiguous(sizeof(item_t), MPI_CHAR, &MPI_itemType);
+  MPI_Type_commit(&MPI_itemType);
+  std::vector<int64_t> dist(dist_in, dist_in + size);
+  std::vector<std::vector<int64_t>> right_ends(
+    size + 1, std::vector<int64_t>(size, 0));
+  Split mysplit;
+  mysplit.split(
+    items.begin(), items.end(), &dist[0], comp, right_ends, MPI_itemType);
+  MPI_Type_free(&MPI_itemType);
+
+  // Single exchange of the elements, packed in the sorted order
+  char errMsg[] = "32-bit limit for MPI has overflowed";
+  if(dist[rank] > INT_MAX || static_cast<int64_t>(vec.size()) > INT_MAX)
+    throw std::overflow_error(errMsg);
+  std::vector<int> send_counts(size), send_disps(size, 0);
+  std::vector<int> recv_counts(size), recv_disps(size, 0);
+  for(int i = 0; i < size; ++i) {
+    send_counts[i] =
+      static_cast<int>(right_ends[i + 1][rank] - right_ends[i][rank]);
+    recv_counts[i] =
+      static_cast<int>(right_ends[rank + 1][i] - right_ends[rank][i]);
+  }
+  std::partial_sum(
+    send_counts.begin(), send_counts.end() - 1, send_disps.begin() + 1);
+  std::partial_sum(
+    recv_counts.begin(), recv_counts.end() - 1, recv_disps.begin() + 1);
+  assert(std::accumulate(recv_counts.begin(), recv_counts.end(), 0) ==
+         dist[rank]);
+
+  MPI_Datatype MPI_valueType;
+  MPI_Type_contiguous(sizeof(TYPE), MPI_CHAR, &MPI_valueType);
+  MPI_Type_commit(&MPI_valueType);
+  vec.resize(dist[rank]);
+  MPI_Alltoallv(&buffer[0], &send_counts[0], &send_disps[0], MPI_valueType,
+    &vec[0], &recv_counts[0], &recv_disps[0], MPI_valueType, MPI_COMM_WORLD);
+  MPI_Type_free(&MPI_valueType);
+
+  // Place the received sorted streams
+  sort_items(vec, items);
+  permute(vec, items, buffer);
+  vec.swap(buffer);
+}
+
+/**
+ * Local sort for nearly sorted data.
+ * The elements breaking the order are moved to a side buffer while the
+ * others are compacted in place, the side buffer is sorted and merged back
+ * from the end. Linear in the number of elements plus the sort of the
+ * displaced ones.
+ **/
+template<typename TYPE, typename _Compare>
+void
+adaptive_sort(std::vector<TYPE> & vec, _Compare comp) {
+  const int64_t n = vec.size();
+  std::vector<TYPE> side;
+  int64_t kept = 0;
+  for(int64_t i = 0; i < n; ++i) {
+    if(kept == 0 || !comp(vec[i], vec[kept - 1])) {
+      vec[kept++] = vec[i];
+    }
+    else if(kept == 1 || !comp(vec[i], vec[kept - 2])) {
+      // The last kept element is the displaced one
+      side.push_back(vec[kept - 1]);
+      vec[kept - 1] = vec[i];
+    }
+    else {
+      side.push_back(vec[i]);
+    } // if
+  } // for
+  if(side.empty())
+    return;
+  std::sort(side.begin(), side.end(), comp);
+
+  // Merge from the end, the free space is after the kept elements
+  int64_t i = kept - 1, j = side.size() - 1, w = n - 1;
+  while(j >= 0) {
+    if(i >= 0 && comp(side[j], vec[i]))
+      vec[w--] = vec[i--];
+    else
+      vec[w--] = side[j--];
+  } // while
+}
+
+/**
+ * Redistribution of nearly sorted data.
+ * vec is in the order of the previous sort, with updated keys. The
+ * boundary between two ranks is the middle of the last elements of the
+ * lower rank and the first elements of the upper rank, which does not move
+ * with a few elements jumping along the curve. The local data is sorted
+ * with adaptive_sort and only the elements outside of the rank range are
+ * sent to their owners.
+ * Returns false, without changes, if a rank is empty. nsent is the number
+ * of elements sent by this rank.
+ **/
+template<typename TYPE, typename _Compare>
+bool
+incremental_sort(std::vector<TYPE> & vec, _Compare comp, int64_t & nsent) {
+  int size, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  nsent = 0;
+
+  int64_t nedge = vec.size();
+  MPI_Allreduce(MPI_IN_PLACE, &nedge, 1, MPI_INT64_T, MPI_MIN, MPI_COMM_WORLD);
+  if(nedge == 0)
+    return false;
+  nedge = std::min(nedge, int64_t(16));
+
+  MPI_Datatype MPI_valueType;
+  MPI_Type_contiguous(sizeof(TYPE), MPI_CHAR, &MPI_valueType);
+  MPI_Type_commit(&MPI_valueType);
+
+  // First and last elements of each rank
+  std::vector<TYPE> edges(2 * nedge), all_edges(2 * nedge * size);
+  std::copy(vec.begin(), vec.begin() + nedge, edges.begin());
+  std::copy(vec.end() - nedge, vec.end(), edges.begin() + nedge);
+  MPI_Allgather(edges.data(), 2 * nedge, MPI_valueType, all_edges.data(),
+    2 * nedge, MPI_valueType, MPI_COMM_WORLD);
+
+  // Ranges of the ranks, forced to be increasing
+  std::vector<TYPE> splitters(size);
+  for(int i = 1; i < size; ++i) {
+    std::vector<TYPE> around(all_edges.begin() + (2 * i - 1) * nedge,
+      all_edges.begin() + (2 * i + 1) * nedge);
+    std::nth_element(
+      around.begin(), around.begin() + nedge, around.end(), comp);
+    splitters[i] = around[nedge];
+    if(i > 1 && comp(splitters[i], splitters[i - 1]))
+      splitters[i] = splitters[i - 1];
+  } // for
+
+  adaptive_sort(vec, comp);
+
+  // The local data is sorted, each destination is a contiguous block
+  std::vector<int64_t> ends(size + 1, 0);
+  ends[size] = vec.size();
+  for(int i = 1; i < size; ++i)
+    ends[i] = std::lower_bound(vec.begin() + ends[i - 1], vec.end(),
+                splitters[i], comp) -
+              vec.begin();
+
+  char errMsg[] = "32-bit limit for MPI has overflowed";
+  if(static_cast<int64_t>(vec.size()) > INT_MAX)
+    throw std::overflow_error(errMsg);
+  std::vector<int> send_counts(size), send_disps(size, 0);
+  std::vector<int> recv_counts(size), recv_disps(size, 0);
+  for(int i = 0; i < size; ++i) {
+    send_counts[i] = i == rank ? 0 : static_cast<int>(ends[i + 1] - ends[i]);
+    send_disps[i] = static_cast<int>(ends[i]);
+  }
+  MPI_Alltoall(&send_counts[0], 1, MPI_INT, &recv_counts[0], 1, MPI_INT,
+    MPI_COMM_WORLD);
+  std::partial_sum(
+    recv_counts.begin(), recv_counts.end() - 1, recv_disps.begin() + 1);
+  const int64_t nrecv =
+    std::accumulate(recv_counts.begin(), recv_counts.end(), int64_t(0));
+  std::vector<TYPE> recv(nrecv);
+  MPI_Alltoallv(vec.data(), &send_counts[0], &send_disps[0], MPI_valueType,
+    recv.data(), &recv_counts[0], &recv_disps[0], MPI_valueType,
+    MPI_COMM_WORLD);
+  MPI_Type_free(&MPI_valueType);
+
+  // Merge the received elements with the ones kept
+  std::sort(recv.begin(), recv.end(), comp);
+  std::vector<TYPE> merged(ends[rank + 1] - ends[rank] + nrecv);
+  std::merge(vec.begin() + ends[rank], vec.begin() + ends[rank + 1],
+    recv.begin(), recv.end(), merged.begin(), comp);
+  nsent = ends[size] - (ends[rank + 1] - ends[rank]);
+  vec.swap(merged);
+  return true;
+}
 } // namespace psort
\ No newline at end of file
@@ -20,7 +20,8 @@ driver(int, char **) {}
 } // namespace flecsi
 
 TEST(io, write_N_read) {
-  MPI_Init(nullptr, nullptr);
+  int provided;
+  MPI_Init_thread(nullptr, nullptr, MPI_THREAD_MULTIPLE, &provided);
   srand(time(NULL));
   int rank, size;
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
@@ -28,6 +29,11 @@ TEST(io, write_N_read) {
 
   const char * fileprefix = "io_utest";
   const char * filename = "io_utest.h5part";
+  const char * async_fileprefix[2] = {"io_utest_async0", "io_utest_async1"};
+  const char * async_filename[2] = {
+    "io_utest_async0.h5part", "io_utest_async1.h5part"};
+  const char * compressed_fileprefix = "io_utest_compressed";
+  const char * compressed_filename = "io_utest_compressed.h5part";
 
   // Generate particles, write to file, read and compare
   int64_t n = 1000;
@@ -58,7 +64,72 @@ TEST(io, write_N_read) {
   ASSERT_TRUE(localnbodies == n);
   ASSERT_TRUE(totalnbodies == n * size);
 
-  // Remove the created file
+  // Same with the asynchronous output, the bodies can change as soon as the
+  // snapshot is queued
+  param::_out_h5data_async = true;
+  io::outputDataHDF5(bodies, async_fileprefix[0], 1, 0.);
+  for(int64_t i = 0; i < n; ++i)
+    bodies[i].set_mass(2. * mass);
+  io::outputDataHDF5(bodies, async_fileprefix[1], 2, 0.);
+  io::finalizeOutput();
+  param::_out_h5data_async = false;
+
+  for(int step = 1; step < 3; ++step) {
+    io::inputDataHDF5(rbodies, async_fileprefix[step - 1],
+      async_fileprefix[step - 1], totalnbodies, localnbodies, step);
+    ASSERT_TRUE(localnbodies == n);
+    ASSERT_TRUE(totalnbodies == n * size);
+    for(int64_t i = 0; i < n; ++i) {
+      ASSERT_TRUE(rbodies[i].coordinates() == bodies[i].coordinates());
+      ASSERT_TRUE(rbodies[i].mass() == step * mass);
+    }
+  }
+
+  // Selected fields, compressed and chunked datasets
+  strcpy(param::_out_h5data_fields, "m,h,id,alpha");
+  param::_out_h5data_compression = 6;
+  param::_out_h5data_chunk = 100;
+  param::_out_h5data_float32 = true;
+  io::outputDataHDF5(bodies, compressed_fileprefix, 3, 0.);
+  strcpy(param::_out_h5data_fields, "all");
+  param::_out_h5data_compression = 0;
+  param::_out_h5data_chunk = 0;
+  param::_out_h5data_float32 = false;
+
+  io::inputDataHDF5(rbodies, compressed_fileprefix, compressed_fileprefix,
+    totalnbodies, localnbodies, 3);
+  ASSERT_TRUE(localnbodies == n);
+  ASSERT_TRUE(totalnbodies == n * size);
+  for(int64_t i = 0; i < n; ++i) {
+    ASSERT_TRUE(rbodies[i].coordinates() == bodies[i].coordinates());
+    ASSERT_TRUE(rbodies[i].mass() == bodies[i].mass());
+    ASSERT_TRUE(rbodies[i].getDensity() == 0.);
+  }
+
+  // Checkpoint, the bodies come back identical
+  for(int64_t i = 0; i < n; ++i)
+    bodies[i].set_id(rank * n + i);
+  physics::totaltime = 0.5;
+  io::outputCheckpoint(bodies, "io_utest", 4);
+  physics::totaltime = 0.;
+  ASSERT_TRUE(io::inputCheckpoint(
+    rbodies, "io_utest", 4, totalnbodies, localnbodies));
+  ASSERT_TRUE(localnbodies == n);
+  ASSERT_TRUE(totalnbodies == n * size);
+  ASSERT_TRUE(physics::totaltime == 0.5);
+  for(int64_t i = 0; i < n; ++i) {
+    ASSERT_TRUE(rbodies[i].id() == bodies[i].id());
+    ASSERT_TRUE(rbodies[i].coordinates() == bodies[i].coordinates());
+    ASSERT_TRUE(rbodies[i].mass() == bodies[i].mass());
+  }
+  char checkpoint_filename[64];
+  io::checkpointFilename(checkpoint_filename, "io_utest", 4, rank);
+
+  // Remove the created files
+  remove(checkpoint_filename);
   remove(filename);
+  remove(compressed_filename);
+  remove(async_filename[0]);
+  remove(async_filename[1]);
   MPI_Finalize();
 }
@@ -0,0 +1,112 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <iostream>
+#include <log.h>
+#include <mpi.h>
+#include <random>
+#include <vector>
+
+#include "bodies_system.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int, char **) {}
+} // namespace execution
+} // namespace flecsi
+
+// Jittered lattice of n^3 particles in the unit box, the same on all ranks
+void
+lattice(const int n, std::vector<point_t> & pos) {
+  std::mt19937_64 g(42);
+  std::uniform_real_distribution<double> u(-.3, .3);
+  for(int i = 0; i < n; ++i)
+    for(int j = 0; j < n; ++j)
+      for(int k = 0; k < n; ++k) {
+        point_t x;
+        x[0] = (i + .5 + u(g)) / n;
+        x[1] = (j + .5 + u(g)) / n;
+        x[2] = (k + .5 + u(g)) / n;
+        pos.push_back(x);
+      } // for
+}
+
+TEST(body_system, update_smoothinglength) {
+  MPI_Init(nullptr, nullptr);
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  kernels::select();
+
+  const int n = 16;
+  std::vector<point_t> pos;
+  lattice(n, pos);
+  const int64_t np = pos.size();
+  const double mass = 1. / np;
+  const double h0 = param::sph_eta * kernels::kernel_width / n;
+
+  // Initial guesses too small and too large, some beyond the search radius
+  std::vector<body> bodies;
+  for(int64_t i = np * rank / size; i < np * (rank + 1) / size; ++i) {
+    body b;
+    b.set_coordinates(pos[i]);
+    b.set_mass(mass);
+    b.set_radius(i % 2 ? .7 * h0 : 1.5 * h0);
+    b.set_id(i);
+    b.setType(NORMAL);
+    bodies.push_back(b);
+  } // for
+
+  body_system<double, gdimension> bs;
+  bs.setLocalbodies(bodies);
+  bs.update_iteration();
+  bs.update_smoothinglength();
+
+  // h = eta * kernel_width * (m / rho(h))^1/D with rho(h) on all the
+  // particles
+  auto check = [&](const body & b) {
+    const double h = b.radius();
+    double rho = 0.;
+    for(auto & x : pos)
+      rho += mass * kernels::sph_kernel_function(
+                      flecsi::distance(b.coordinates(), x), h);
+    const double h_rho =
+      param::sph_eta * kernels::kernel_width * cbrt(mass / rho);
+    ASSERT_NEAR(h, h_rho, 10. * param::sph_h_tolerance * h);
+  };
+  int64_t nlocal = 0;
+  for(auto & b : bs.getLocalbodies()) {
+    check(b);
+    ++nlocal;
+  } // for
+  MPI_Allreduce(MPI_IN_PLACE, &nlocal, 1, MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+  ASSERT_EQ(nlocal, np);
+
+  // Again from the neighbors cache of a pass on the particles with an even
+  // id, from guesses inside and beyond their radius. The others are kept.
+  for(auto & b : bs.getLocalbodies())
+    b.set_radius(b.id() % 4 == 0 ? .9 * b.radius() : 1.2 * b.radius());
+  bs.update_iteration();
+  std::vector<double> guess;
+  for(auto & b : bs.getLocalbodies())
+    guess.push_back(b.radius());
+  auto even = [](const body & b) { return b.id() % 2 == 0; };
+  bs.set_active_sinks(even);
+  bs.tree()->build_neighbors_cache();
+  bs.update_smoothinglength();
+  bs.set_active_sinks(nullptr);
+  for(size_t i = 0; i < guess.size(); ++i) {
+    const body & b = bs.getLocalbodies()[i];
+    if(even(b))
+      check(b);
+    else
+      ASSERT_EQ(b.radius(), guess[i]);
+  } // for
+
+  MPI_Finalize();
+}
@@ -0,0 +1,67 @@
+#include "gtest/gtest.h"
+
+#include <fstream>
+#include <iostream>
+#include <mpi.h>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "timers.h"
+
+TEST(timers, regions) {
+  MPI_Init(nullptr, nullptr);
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  const char * filename = "timers_utest.csv";
+
+  for(int i = 0; i < 3; ++i) {
+    timers::scope_t outer("outer");
+    {
+      timers::scope_t inner("inner");
+    }
+    timers::registry().add("added", 0.5);
+    // Only the main thread records
+    std::thread([] { timers::scope_t ignored("ignored"); }).join();
+  } // for
+  if(rank == size - 1) {
+    timers::scope_t last("last_rank");
+  }
+
+  const auto & regions = timers::registry().regions();
+  ASSERT_EQ(regions.size(), rank == size - 1 ? 5u : 4u);
+  ASSERT_EQ(regions[1].path, "outer");
+  ASSERT_EQ(regions[2].path, "outer/inner");
+  ASSERT_EQ(regions[3].path, "outer/added");
+  ASSERT_EQ(regions[1].calls, 3);
+  ASSERT_EQ(regions[2].calls, 3);
+  ASSERT_DOUBLE_EQ(regions[3].time, 1.5);
+  ASSERT_GE(regions[1].time, regions[2].time);
+
+  timers::output(filename, 10, true);
+  ASSERT_EQ(timers::registry().regions()[1].calls, 0);
+  timers::output(filename, 20);
+
+  if(rank == 0) {
+    std::ifstream file(filename);
+    std::vector<std::string> lines;
+    std::string line;
+    while(std::getline(file, line))
+      lines.push_back(line);
+    ASSERT_EQ(lines.size(), 1u + 2 * 4);
+    ASSERT_EQ(lines[0], "iteration,region,calls,min,mean,max,imbalance");
+    ASSERT_EQ(lines[1].find("10,outer,3,"), 0u);
+    ASSERT_EQ(lines[3].find("10,outer/added,3,1.500000e+00,1.500000e+00,"
+                            "1.500000e+00,1.0000"),
+      0u);
+    // The region of the last rank is reported for all the ranks
+    ASSERT_EQ(lines[4].find("10,last_rank,1,"), 0u);
+    ASSERT_EQ(lines[5].find("20,outer,0,0.000000e+00"), 0u);
+    remove(filename);
+  }
+
+  MPI_Finalize();
+}